@@ -24,8 +24,45 @@
 /* indent is confused by this file */
 /* *INDENT-OFF* */
 
+#include <unistd.h>
+#include <pthread.h>
+
 #include "rdesktop.h"
 
+/* Upper limit for threads decompressing bitmap updates besides the main
+   thread */
+#define BITMAP_MAX_WORKERS 8
+
+static RD_BOOL g_bitmap_pool_initialized = False;
+static int g_bitmap_workers = 0;
+static pthread_mutex_t g_bitmap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_bitmap_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t g_bitmap_done = PTHREAD_COND_INITIALIZER;
+static BITMAP_JOB *g_bitmap_jobs;
+static int g_bitmap_njobs = 0;
+static int g_bitmap_next = 0;
+
+/* Pixel layout of the UI, if it takes bitmaps in its own format. The
+   lookup tables map each byte of a server pixel to its contribution to
+   the UI pixel and are built for g_bitmap_lut_depth. */
+extern int g_server_depth;
+static PIXEL_FORMAT g_bitmap_format;
+static RD_BOOL g_bitmap_native = False;
+static uint32 g_bitmap_lut[3][256];
+static int g_bitmap_lut_depth = 0;
+
+/* 32 bpp little endian with red at bit 16, the most common X visual */
+static RD_BOOL g_bitmap_xrgb = False;
+
+/* Vectorised translation into g_bitmap_xrgb pixels, per server depth,
+   NULL if the lookup tables are used */
+typedef void (*bitmap_translate_fn) (uint8 * out, uint8 * in, int count);
+
+static bitmap_translate_fn g_bitmap_translate15 = NULL;
+static bitmap_translate_fn g_bitmap_translate16 = NULL;
+static bitmap_translate_fn g_bitmap_translate24 = NULL;
+static bitmap_translate_fn g_bitmap_translate32 = NULL;
+
 #define CVAL(p)   (*(p++))
 #ifdef NEED_ALIGN
 #ifdef L_ENDIAN
@@ -753,139 +790,690 @@ bitmap_decompress3(uint8 * output, int width, int height, uint8 * input, int siz
 	return True;
 }
 
-/* decompress a colour plane */
+/* Split a server pixel into 8 bit colour components */
+static void
+bitmap_split_colour(uint32 colour, int depth, uint32 * red, uint32 * green, uint32 * blue)
+{
+	switch (depth)
+	{
+		case 15:
+			*red = ((colour >> 7) & 0xf8) | ((colour >> 12) & 0x7);
+			*green = ((colour >> 2) & 0xf8) | ((colour >> 8) & 0x7);
+			*blue = ((colour << 3) & 0xf8) | ((colour >> 2) & 0x7);
+			break;
+		case 16:
+			*red = ((colour >> 8) & 0xf8) | ((colour >> 13) & 0x7);
+			*green = ((colour >> 3) & 0xfc) | ((colour >> 9) & 0x3);
+			*blue = ((colour << 3) & 0xf8) | ((colour >> 2) & 0x7);
+			break;
+		default:
+			*red = (colour >> 16) & 0xff;
+			*green = (colour >> 8) & 0xff;
+			*blue = colour & 0xff;
+			break;
+	}
+}
+
+/* Build the lookup tables for server pixels of the given depth. Every
+   bit of a UI pixel comes from a single bit of the server pixel, so the
+   UI pixel is the OR of what each byte of the server pixel maps to. */
+static void
+bitmap_build_lut(int depth)
+{
+	PIXEL_FORMAT *f = &g_bitmap_format;
+	uint32 red, green, blue;
+	int i, j;
+
+	for (i = 0; i < 3; i++)
+	{
+		for (j = 0; j < 256; j++)
+		{
+			bitmap_split_colour((uint32) j << (i * 8), depth, &red, &green, &blue);
+			g_bitmap_lut[i][j] = ((red >> f->red_shift_r) << f->red_shift_l)
+				| ((green >> f->green_shift_r) << f->green_shift_l)
+				| ((blue >> f->blue_shift_r) << f->blue_shift_l);
+		}
+	}
+
+	g_bitmap_lut_depth = depth;
+}
+
+/* Store a pixel in the UI format and advance out */
+static inline void
+bitmap_put_pixel(uint8 ** out, uint32 value)
+{
+	uint8 *o = *out;
+
+	switch (g_bitmap_format.Bpp)
+	{
+		case 2:
+			if (g_bitmap_format.big_endian)
+			{
+				o[0] = value >> 8;
+				o[1] = value;
+			}
+			else
+			{
+				o[0] = value;
+				o[1] = value >> 8;
+			}
+			break;
+		case 3:
+			if (g_bitmap_format.big_endian)
+			{
+				o[0] = value >> 16;
+				o[1] = value >> 8;
+				o[2] = value;
+			}
+			else
+			{
+				o[0] = value;
+				o[1] = value >> 8;
+				o[2] = value >> 16;
+			}
+			break;
+		default:
+			if (g_bitmap_format.big_endian)
+			{
+				o[0] = value >> 24;
+				o[1] = value >> 16;
+				o[2] = value >> 8;
+				o[3] = value;
+			}
+			else
+			{
+				o[0] = value;
+				o[1] = value >> 8;
+				o[2] = value >> 16;
+				o[3] = value >> 24;
+			}
+			break;
+	}
+	*out = o + g_bitmap_format.Bpp;
+}
+
+/* Translate count server pixels with Bpp bytes each using the lookup
+   tables */
+static void
+bitmap_translate_lut(uint8 * output, uint8 * input, int count, int Bpp)
+{
+	uint32 value;
+
+	if (Bpp == 2)
+	{
+		while (count--)
+		{
+			value = g_bitmap_lut[0][input[0]] | g_bitmap_lut[1][input[1]];
+			bitmap_put_pixel(&output, value);
+			input += 2;
+		}
+	}
+	else
+	{
+		while (count--)
+		{
+			value = g_bitmap_lut[0][input[0]] | g_bitmap_lut[1][input[1]]
+				| g_bitmap_lut[2][input[2]];
+			bitmap_put_pixel(&output, value);
+			input += Bpp;
+		}
+	}
+}
+
+/* Decode one RLE colour plane of a 32 bpp bitmap into plane, one byte
+   per pixel with rows in the order they are sent. The first row holds
+   colour values, the following ones the difference to the row before,
+   which is applied by bitmap_planar_compose(). Returns the number of
+   input bytes used or -1 if the input is invalid. */
 static int
-process_plane(uint8 * in, int width, int height, uint8 * out, int size)
+process_plane(uint8 * in, int width, int height, uint8 * plane, int size)
 {
-	UNUSED(size);
 	int indexw;
 	int indexh;
 	int code;
 	int collen;
 	int replen;
 	int color;
-	int x;
 	int revcode;
-	uint8 * last_line;
-	uint8 * this_line;
+	int i;
+	uint8 * end;
 	uint8 * org_in;
-	uint8 * org_out;
+	uint8 * out;
 
 	org_in = in;
-	org_out = out;
-	last_line = 0;
+	end = in + size;
+	out = plane;
 	indexh = 0;
 	while (indexh < height)
 	{
-		out = (org_out + width * height * 4) - ((indexh + 1) * width * 4);
 		color = 0;
-		this_line = out;
 		indexw = 0;
-		if (last_line == 0)
+		while (indexw < width)
 		{
-			while (indexw < width)
+			if (in >= end)
+				return -1;
+			code = CVAL(in);
+			replen = code & 0xf;
+			collen = (code >> 4) & 0xf;
+			revcode = (replen << 4) | collen;
+			if ((revcode <= 47) && (revcode >= 16))
 			{
-				code = CVAL(in);
-				replen = code & 0xf;
-				collen = (code >> 4) & 0xf;
-				revcode = (replen << 4) | collen;
-				if ((revcode <= 47) && (revcode >= 16))
-				{
-					replen = revcode;
-					collen = 0;
-				}
-				while (indexw < width && collen > 0)
-				{
-					color = CVAL(in);
-					*out = color;
-					out += 4;
-					indexw++;
-					collen--;
-				}
-				while (indexw < width && replen > 0)
-				{
-					*out = color;
-					out += 4;
-					indexw++;
-					replen--;
-				}
+				replen = revcode;
+				collen = 0;
 			}
-		}
-		else
-		{
-			while (indexw < width)
+
+			/* colour bytes past the end of the row are read as codes */
+			collen = MIN(collen, width - indexw);
+			if (end - in < collen)
+				return -1;
+			if (collen > 0)
 			{
-				code = CVAL(in);
-				replen = code & 0xf;
-				collen = (code >> 4) & 0xf;
-				revcode = (replen << 4) | collen;
-				if ((revcode <= 47) && (revcode >= 16))
+				if (indexh == 0)
 				{
-					replen = revcode;
-					collen = 0;
+					memcpy(out, in, collen);
 				}
-				while (indexw < width && collen > 0)
-				{
-					x = CVAL(in);
-					if (x & 1)
-					{
-						x = x >> 1;
-						x = x + 1;
-						color = -x;
-					}
-					else
-					{
-						x = x >> 1;
-						color = x;
-					}
-					x = last_line[indexw * 4] + color;
-					*out = x;
-					out += 4;
-					indexw++;
-					collen--;
-				}
-				while (indexw < width && replen > 0)
+				else
 				{
-					x = last_line[indexw * 4] + color;
-					*out = x;
-					out += 4;
-					indexw++;
-					replen--;
+					/* signed difference, low bit is the sign */
+					for (i = 0; i < collen; i++)
+						out[i] = (in[i] >> 1) ^ -(in[i] & 1);
 				}
+				color = out[collen - 1];
+				in += collen;
+				out += collen;
+				indexw += collen;
 			}
+
+			replen = MIN(replen, width - indexw);
+			memset(out, color, replen);
+			out += replen;
+			indexw += replen;
 		}
 		indexh++;
-		last_line = this_line;
 	}
 	return (int) (in - org_in);
 }
 
-/* 4 byte bitmap decompress */
+/* Add the previous row to a row of differences and interleave four
+   planes into 32 bpp pixels, for pixels x to width */
+static void
+bitmap_planar_row_scalar(uint8 * out, uint8 * planes[4], int row, int x, int width)
+{
+	uint8 *b = planes[0] + row * width;
+	uint8 *g = planes[1] + row * width;
+	uint8 *r = planes[2] + row * width;
+	uint8 *a = planes[3] + row * width;
+
+	for (; x < width; x++)
+	{
+		if (row > 0)
+		{
+			b[x] += b[x - width];
+			g[x] += g[x - width];
+			r[x] += r[x - width];
+			a[x] += a[x - width];
+		}
+		out[x * 4 + 0] = b[x];
+		out[x * 4 + 1] = g[x];
+		out[x * 4 + 2] = r[x];
+		out[x * 4 + 3] = a[x];
+	}
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define BITMAP_SIMD
+#include <immintrin.h>
+
+__attribute__ ((target("sse2")))
+static void
+bitmap_planar_row_sse2(uint8 * out, uint8 * planes[4], int row, int x, int width)
+{
+	__m128i v[4], bg, ra;
+	uint8 *p;
+	int i;
+
+	for (; x + 16 <= width; x += 16)
+	{
+		for (i = 0; i < 4; i++)
+		{
+			p = planes[i] + row * width + x;
+			v[i] = _mm_loadu_si128((__m128i *) p);
+			if (row > 0)
+			{
+				v[i] = _mm_add_epi8(v[i], _mm_loadu_si128((__m128i *) (p - width)));
+				_mm_storeu_si128((__m128i *) p, v[i]);
+			}
+		}
+
+		bg = _mm_unpacklo_epi8(v[0], v[1]);
+		ra = _mm_unpacklo_epi8(v[2], v[3]);
+		_mm_storeu_si128((__m128i *) (out + x * 4), _mm_unpacklo_epi16(bg, ra));
+		_mm_storeu_si128((__m128i *) (out + x * 4 + 16), _mm_unpackhi_epi16(bg, ra));
+		bg = _mm_unpackhi_epi8(v[0], v[1]);
+		ra = _mm_unpackhi_epi8(v[2], v[3]);
+		_mm_storeu_si128((__m128i *) (out + x * 4 + 32), _mm_unpacklo_epi16(bg, ra));
+		_mm_storeu_si128((__m128i *) (out + x * 4 + 48), _mm_unpackhi_epi16(bg, ra));
+	}
+
+	bitmap_planar_row_scalar(out, planes, row, x, width);
+}
+
+__attribute__ ((target("avx2")))
+static void
+bitmap_planar_row_avx2(uint8 * out, uint8 * planes[4], int row, int x, int width)
+{
+	__m256i v[4], bg, ra, lo, hi;
+	uint8 *p;
+	int i;
+
+	for (; x + 32 <= width; x += 32)
+	{
+		for (i = 0; i < 4; i++)
+		{
+			p = planes[i] + row * width + x;
+			v[i] = _mm256_loadu_si256((__m256i *) p);
+			if (row > 0)
+			{
+				v[i] = _mm256_add_epi8(v[i],
+						       _mm256_loadu_si256((__m256i *) (p - width)));
+				_mm256_storeu_si256((__m256i *) p, v[i]);
+			}
+		}
+
+		/* unpacking works within 128 bit lanes, pixels 0-7 and
+		   16-23 end up in lo, 8-15 and 24-31 in hi */
+		bg = _mm256_unpacklo_epi8(v[0], v[1]);
+		ra = _mm256_unpacklo_epi8(v[2], v[3]);
+		lo = _mm256_unpacklo_epi16(bg, ra);
+		hi = _mm256_unpackhi_epi16(bg, ra);
+		_mm256_storeu_si256((__m256i *) (out + x * 4), _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i *) (out + x * 4 + 64),
+				    _mm256_permute2x128_si256(lo, hi, 0x31));
+		bg = _mm256_unpackhi_epi8(v[0], v[1]);
+		ra = _mm256_unpackhi_epi8(v[2], v[3]);
+		lo = _mm256_unpacklo_epi16(bg, ra);
+		hi = _mm256_unpackhi_epi16(bg, ra);
+		_mm256_storeu_si256((__m256i *) (out + x * 4 + 32),
+				    _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i *) (out + x * 4 + 96),
+				    _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+
+	bitmap_planar_row_sse2(out, planes, row, x, width);
+}
+
+/* The translate functions below produce g_bitmap_xrgb pixels. 15 and
+   16 bpp pixels are widened to 32 bits and each colour component is
+   shifted into place, with its top bits repeated below it like the
+   lookup tables do. */
+
+#define BITMAP_BITS_SSE2(v, p, mask, shift) \
+	(v) = _mm_or_si128((v), (shift) > 0 ? \
+		_mm_slli_epi32(_mm_and_si128((p), _mm_set1_epi32(mask)), (shift)) : \
+		_mm_srli_epi32(_mm_and_si128((p), _mm_set1_epi32(mask)), -(shift)))
+
+#define BITMAP_BITS_AVX2(v, p, mask, shift) \
+	(v) = _mm256_or_si256((v), (shift) > 0 ? \
+		_mm256_slli_epi32(_mm256_and_si256((p), _mm256_set1_epi32(mask)), (shift)) : \
+		_mm256_srli_epi32(_mm256_and_si256((p), _mm256_set1_epi32(mask)), -(shift)))
+
+__attribute__ ((target("sse2")))
+static inline __m128i
+bitmap_rgb15_sse2(__m128i p)
+{
+	__m128i v = _mm_setzero_si128();
+
+	BITMAP_BITS_SSE2(v, p, 0x7c00, 9);
+	BITMAP_BITS_SSE2(v, p, 0x7000, 4);
+	BITMAP_BITS_SSE2(v, p, 0x03e0, 6);
+	BITMAP_BITS_SSE2(v, p, 0x0700, 0);
+	BITMAP_BITS_SSE2(v, p, 0x001f, 3);
+	BITMAP_BITS_SSE2(v, p, 0x001c, -2);
+	return v;
+}
+
+__attribute__ ((target("sse2")))
+static inline __m128i
+bitmap_rgb16_sse2(__m128i p)
+{
+	__m128i v = _mm_setzero_si128();
+
+	BITMAP_BITS_SSE2(v, p, 0xf800, 8);
+	BITMAP_BITS_SSE2(v, p, 0xe000, 3);
+	BITMAP_BITS_SSE2(v, p, 0x07e0, 5);
+	BITMAP_BITS_SSE2(v, p, 0x0600, -1);
+	BITMAP_BITS_SSE2(v, p, 0x001f, 3);
+	BITMAP_BITS_SSE2(v, p, 0x001c, -2);
+	return v;
+}
+
+__attribute__ ((target("avx2")))
+static inline __m256i
+bitmap_rgb15_avx2(__m256i p)
+{
+	__m256i v = _mm256_setzero_si256();
+
+	BITMAP_BITS_AVX2(v, p, 0x7c00, 9);
+	BITMAP_BITS_AVX2(v, p, 0x7000, 4);
+	BITMAP_BITS_AVX2(v, p, 0x03e0, 6);
+	BITMAP_BITS_AVX2(v, p, 0x0700, 0);
+	BITMAP_BITS_AVX2(v, p, 0x001f, 3);
+	BITMAP_BITS_AVX2(v, p, 0x001c, -2);
+	return v;
+}
+
+__attribute__ ((target("avx2")))
+static inline __m256i
+bitmap_rgb16_avx2(__m256i p)
+{
+	__m256i v = _mm256_setzero_si256();
+
+	BITMAP_BITS_AVX2(v, p, 0xf800, 8);
+	BITMAP_BITS_AVX2(v, p, 0xe000, 3);
+	BITMAP_BITS_AVX2(v, p, 0x07e0, 5);
+	BITMAP_BITS_AVX2(v, p, 0x0600, -1);
+	BITMAP_BITS_AVX2(v, p, 0x001f, 3);
+	BITMAP_BITS_AVX2(v, p, 0x001c, -2);
+	return v;
+}
+
+__attribute__ ((target("sse2")))
+static void
+bitmap_translate15_sse2(uint8 * out, uint8 * in, int count)
+{
+	__m128i p, zero = _mm_setzero_si128();
+
+	for (; count >= 8; count -= 8, in += 16, out += 32)
+	{
+		p = _mm_loadu_si128((__m128i *) in);
+		_mm_storeu_si128((__m128i *) out, bitmap_rgb15_sse2(_mm_unpacklo_epi16(p, zero)));
+		_mm_storeu_si128((__m128i *) (out + 16),
+				 bitmap_rgb15_sse2(_mm_unpackhi_epi16(p, zero)));
+	}
+
+	bitmap_translate_lut(out, in, count, 2);
+}
+
+__attribute__ ((target("sse2")))
+static void
+bitmap_translate16_sse2(uint8 * out, uint8 * in, int count)
+{
+	__m128i p, zero = _mm_setzero_si128();
+
+	for (; count >= 8; count -= 8, in += 16, out += 32)
+	{
+		p = _mm_loadu_si128((__m128i *) in);
+		_mm_storeu_si128((__m128i *) out, bitmap_rgb16_sse2(_mm_unpacklo_epi16(p, zero)));
+		_mm_storeu_si128((__m128i *) (out + 16),
+				 bitmap_rgb16_sse2(_mm_unpackhi_epi16(p, zero)));
+	}
+
+	bitmap_translate_lut(out, in, count, 2);
+}
+
+/* 32 bpp pixels only need their alpha cleared */
+__attribute__ ((target("sse2")))
+static void
+bitmap_translate32_sse2(uint8 * out, uint8 * in, int count)
+{
+	__m128i mask = _mm_set1_epi32(0xffffff);
+
+	for (; count >= 4; count -= 4, in += 16, out += 16)
+		_mm_storeu_si128((__m128i *) out,
+				 _mm_and_si128(_mm_loadu_si128((__m128i *) in), mask));
+
+	bitmap_translate_lut(out, in, count, 4);
+}
+
+/* 24 bpp pixels are spread out with a byte shuffle. 16 bytes are loaded
+   for every 12 that are used, so the last pixels go through the lookup
+   tables. */
+__attribute__ ((target("ssse3")))
+static void
+bitmap_translate24_ssse3(uint8 * out, uint8 * in, int count)
+{
+	__m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+
+	for (; count >= 6; count -= 4, in += 12, out += 16)
+		_mm_storeu_si128((__m128i *) out,
+				 _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) in), shuffle));
+
+	bitmap_translate_lut(out, in, count, 3);
+}
+
+__attribute__ ((target("avx2")))
+static void
+bitmap_translate15_avx2(uint8 * out, uint8 * in, int count)
+{
+	__m256i p;
+
+	for (; count >= 8; count -= 8, in += 16, out += 32)
+	{
+		p = _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i *) in));
+		_mm256_storeu_si256((__m256i *) out, bitmap_rgb15_avx2(p));
+	}
+
+	bitmap_translate_lut(out, in, count, 2);
+}
+
+__attribute__ ((target("avx2")))
+static void
+bitmap_translate16_avx2(uint8 * out, uint8 * in, int count)
+{
+	__m256i p;
+
+	for (; count >= 8; count -= 8, in += 16, out += 32)
+	{
+		p = _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i *) in));
+		_mm256_storeu_si256((__m256i *) out, bitmap_rgb16_avx2(p));
+	}
+
+	bitmap_translate_lut(out, in, count, 2);
+}
+
+/* Two groups of four pixels, one per 128 bit lane */
+__attribute__ ((target("avx2")))
+static void
+bitmap_translate24_avx2(uint8 * out, uint8 * in, int count)
+{
+	__m256i shuffle = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+					   0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	__m256i p;
+
+	for (; count >= 10; count -= 8, in += 24, out += 32)
+	{
+		p = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((__m128i *) in)),
+					    _mm_loadu_si128((__m128i *) (in + 12)), 1);
+		_mm256_storeu_si256((__m256i *) out, _mm256_shuffle_epi8(p, shuffle));
+	}
+
+	bitmap_translate24_ssse3(out, in, count);
+}
+
+__attribute__ ((target("avx2")))
+static void
+bitmap_translate32_avx2(uint8 * out, uint8 * in, int count)
+{
+	__m256i mask = _mm256_set1_epi32(0xffffff);
+
+	for (; count >= 8; count -= 8, in += 32, out += 32)
+		_mm256_storeu_si256((__m256i *) out,
+				    _mm256_and_si256(_mm256_loadu_si256((__m256i *) in), mask));
+
+	bitmap_translate32_sse2(out, in, count);
+}
+#endif
+
+/* Pick vectorised translate functions for the UI format, if the CPU
+   supports them */
+static void
+bitmap_translate_select(void)
+{
+	const char *name = "lookup table";
+
+	g_bitmap_translate15 = NULL;
+	g_bitmap_translate16 = NULL;
+	g_bitmap_translate24 = NULL;
+	g_bitmap_translate32 = NULL;
+
+	if (!g_bitmap_xrgb)
+		return;
+
+#ifdef BITMAP_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		g_bitmap_translate15 = bitmap_translate15_avx2;
+		g_bitmap_translate16 = bitmap_translate16_avx2;
+		g_bitmap_translate24 = bitmap_translate24_avx2;
+		g_bitmap_translate32 = bitmap_translate32_avx2;
+		name = "AVX2";
+	}
+	else if (__builtin_cpu_supports("sse2"))
+	{
+		g_bitmap_translate15 = bitmap_translate15_sse2;
+		g_bitmap_translate16 = bitmap_translate16_sse2;
+		if (__builtin_cpu_supports("ssse3"))
+			g_bitmap_translate24 = bitmap_translate24_ssse3;
+		g_bitmap_translate32 = bitmap_translate32_sse2;
+		name = "SSE2";
+	}
+#endif
+
+	logger(Graphics, Debug, "bitmap_translate_select(), using %s pixel translation", name);
+}
+
+typedef void (*bitmap_planar_row_fn) (uint8 * out, uint8 * planes[4], int row, int x,
+				      int width);
+
+static bitmap_planar_row_fn g_bitmap_planar_row = NULL;
+
+/* Pick the fastest row function the CPU supports */
+static bitmap_planar_row_fn
+bitmap_planar_select(void)
+{
+	bitmap_planar_row_fn fn = bitmap_planar_row_scalar;
+	const char *name = "scalar";
+
+#ifdef BITMAP_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		fn = bitmap_planar_row_avx2;
+		name = "AVX2";
+	}
+	else if (__builtin_cpu_supports("sse2"))
+	{
+		fn = bitmap_planar_row_sse2;
+		name = "SSE2";
+	}
+#endif
+
+	logger(Graphics, Debug, "bitmap_planar_select(), using %s planar decoder", name);
+	return fn;
+}
+
+/* Apply the row differences of the decoded planes and interleave them
+   into bottom up 32 bpp output */
+static void
+bitmap_planar_compose(uint8 * output, uint8 * planes[4], int width, int height)
+{
+	bitmap_planar_row_fn row_fn = __atomic_load_n(&g_bitmap_planar_row, __ATOMIC_RELAXED);
+	int row;
+
+	/* several decompression threads may get here first, they all
+	   come to the same result */
+	if (row_fn == NULL)
+	{
+		row_fn = bitmap_planar_select();
+		__atomic_store_n(&g_bitmap_planar_row, row_fn, __ATOMIC_RELAXED);
+	}
+
+	for (row = 0; row < height; row++)
+		row_fn(output + (height - row - 1) * width * 4, planes, row, 0, width);
+}
+
+/* Compose the planes into bottom up pixels of the UI format. The row
+   functions write 32 bpp little endian pixels with red at bit 16, which
+   is the most common X visual, so they are used directly for that
+   layout. As the UI has no use for alpha it is cleared first. */
+static void
+bitmap_planar_compose_native(uint8 * output, uint8 * planes[4], int width, int height)
+{
+	PIXEL_FORMAT *f = &g_bitmap_format;
+	uint8 *b, *g, *r, *out;
+	uint32 value;
+	int row, x;
+
+	if (g_bitmap_xrgb)
+	{
+		memset(planes[3], 0, width * height);
+		bitmap_planar_compose(output, planes, width, height);
+		return;
+	}
+
+	for (row = 0; row < height; row++)
+	{
+		b = planes[0] + row * width;
+		g = planes[1] + row * width;
+		r = planes[2] + row * width;
+		out = output + (height - row - 1) * width * f->Bpp;
+
+		for (x = 0; x < width; x++)
+		{
+			if (row > 0)
+			{
+				b[x] += b[x - width];
+				g[x] += g[x - width];
+				r[x] += r[x - width];
+			}
+			value = g_bitmap_lut[0][b[x]] | g_bitmap_lut[1][g[x]]
+				| g_bitmap_lut[2][r[x]];
+			bitmap_put_pixel(&out, value);
+		}
+	}
+}
+
+/* 4 byte bitmap decompress, into the UI pixel format if native is set */
 static RD_BOOL
-bitmap_decompress4(uint8 * output, int width, int height, uint8 * input, int size)
+bitmap_decompress4(uint8 * output, int width, int height, uint8 * input, int size,
+		   RD_BOOL native)
 {
+	uint8 buf[64 * 64 * 4];
+	uint8 *data, *planes[4];
 	int code;
 	int bytes_pro;
 	int total_pro;
+	int i;
 
 	code = CVAL(input);
 	if (code != 0x10)
 	{
 		return False;
 	}
+
+	/* planes are sent as alpha, red, green, blue and composed in the
+	   opposite order */
+	data = (width * height <= 64 * 64) ? buf : (uint8 *) xmalloc(width * height * 4);
 	total_pro = 1;
-	bytes_pro = process_plane(input, width, height, output + 3, size - total_pro);
-	total_pro += bytes_pro;
-	input += bytes_pro;
-	bytes_pro = process_plane(input, width, height, output + 2, size - total_pro);
-	total_pro += bytes_pro;
-	input += bytes_pro;
-	bytes_pro = process_plane(input, width, height, output + 1, size - total_pro);
-	total_pro += bytes_pro;
-	input += bytes_pro;
-	bytes_pro = process_plane(input, width, height, output + 0, size - total_pro);
-	total_pro += bytes_pro;
-	return size == total_pro;
+	for (i = 3; i >= 0; i--)
+	{
+		planes[i] = data + i * width * height;
+		bytes_pro = process_plane(input, width, height, planes[i], size - total_pro);
+		if (bytes_pro < 0)
+			break;
+		total_pro += bytes_pro;
+		input += bytes_pro;
+	}
+
+	if (i < 0 && native)
+		bitmap_planar_compose_native(output, planes, width, height);
+	else if (i < 0)
+		bitmap_planar_compose(output, planes, width, height);
+
+	if (data != buf)
+		xfree(data);
+	return i < 0 && size == total_pro;
 }
 
 /* main decompress function */
@@ -906,7 +1494,7 @@ bitmap_decompress(uint8 * output, int width, int height, uint8 * input, int size
 			rv = bitmap_decompress3(output, width, height, input, size);
 			break;
 		case 4:
-			rv = bitmap_decompress4(output, width, height, input, size);
+			rv = bitmap_decompress4(output, width, height, input, size, False);
 			break;
 		default:
 			logger(Core, Debug, "bitmap_decompress(), unhandled BPP %d", Bpp);
@@ -915,4 +1503,240 @@ bitmap_decompress(uint8 * output, int width, int height, uint8 * input, int size
 	return rv;
 }
 
+/* Set the pixel layout of the UI for bitmap_decompress_native() and
+   bitmap_translate(), or NULL if the UI translates bitmaps itself */
+void
+bitmap_set_format(PIXEL_FORMAT * format)
+{
+	PIXEL_FORMAT *f = &g_bitmap_format;
+
+	g_bitmap_native = (format != NULL);
+	if (format != NULL)
+		g_bitmap_format = *format;
+	g_bitmap_lut_depth = 0;
+
+	g_bitmap_xrgb = g_bitmap_native && f->Bpp == 4 && !f->big_endian
+		&& f->red_shift_r == 0 && f->red_shift_l == 16 && f->green_shift_r == 0
+		&& f->green_shift_l == 8 && f->blue_shift_r == 0 && f->blue_shift_l == 0;
+
+	bitmap_translate_select();
+}
+
+/* Returns the bytes per pixel of bitmaps with Bpp bytes per pixel once
+   decoded into the UI format, or 0 if they have to be decoded in server
+   format and translated by the UI. Must not be called while bitmap
+   decompression jobs are running. */
+int
+bitmap_native_Bpp(int Bpp)
+{
+	if (!g_bitmap_native)
+		return 0;
+
+	switch (g_server_depth)
+	{
+		case 15:
+		case 16:
+			if (Bpp != 2)
+				return 0;
+			break;
+		case 24:
+			if (Bpp != 3)
+				return 0;
+			break;
+		case 32:
+			if (Bpp != 4)
+				return 0;
+			break;
+		default:
+			/* palette lookups are left to the UI */
+			return 0;
+	}
+
+	if (g_bitmap_lut_depth != g_server_depth)
+		bitmap_build_lut(g_server_depth);
+
+	return g_bitmap_format.Bpp;
+}
+
+/* Translate count server pixels with Bpp bytes each into the UI format,
+   bitmap_native_Bpp() must have accepted Bpp */
+void
+bitmap_translate(uint8 * output, uint8 * input, int count, int Bpp)
+{
+	bitmap_translate_fn fn;
+
+	switch (g_bitmap_lut_depth)
+	{
+		case 15:
+			fn = g_bitmap_translate15;
+			break;
+		case 16:
+			fn = g_bitmap_translate16;
+			break;
+		case 24:
+			fn = g_bitmap_translate24;
+			break;
+		default:
+			fn = g_bitmap_translate32;
+			break;
+	}
+
+	if (fn != NULL)
+		fn(output, input, count);
+	else
+		bitmap_translate_lut(output, input, count, Bpp);
+}
+
+/* Decompress straight into the UI format, bitmap_native_Bpp() must have
+   accepted Bpp. The interleaved RLE decoders read back the previous
+   output row, so they still work in server format, but only on a tile
+   sized scratch buffer that is translated while it is in the cache. */
+RD_BOOL
+bitmap_decompress_native(uint8 * output, int width, int height, uint8 * input, int size,
+			 int Bpp)
+{
+	uint8 buf[64 * 64 * 3];
+	uint8 *data;
+	RD_BOOL rv;
+
+	if (Bpp == 4)
+		return bitmap_decompress4(output, width, height, input, size, True);
+
+	data = (width * height * Bpp <= (int) sizeof(buf)) ? buf :
+		(uint8 *) xmalloc(width * height * Bpp);
+
+	rv = bitmap_decompress(data, width, height, input, size, Bpp);
+	if (rv)
+		bitmap_translate(output, data, width * height, Bpp);
+
+	if (data != buf)
+		xfree(data);
+	return rv;
+}
+
+/* Decompress the next unclaimed job, called with g_bitmap_lock held.
+   Returns False if all jobs have been claimed. */
+static RD_BOOL
+bitmap_run_job(void)
+{
+	BITMAP_JOB *job;
+
+	/* skip jobs that needed no decompression */
+	while (g_bitmap_next < g_bitmap_njobs && g_bitmap_jobs[g_bitmap_next].done)
+		g_bitmap_next++;
+
+	if (g_bitmap_next >= g_bitmap_njobs)
+		return False;
+
+	job = &g_bitmap_jobs[g_bitmap_next++];
+
+	pthread_mutex_unlock(&g_bitmap_lock);
+	if (job->native)
+		job->ok = bitmap_decompress_native(job->output, job->width, job->height,
+						   job->input, job->size, job->Bpp);
+	else
+		job->ok = bitmap_decompress(job->output, job->width, job->height, job->input,
+					    job->size, job->Bpp);
+	pthread_mutex_lock(&g_bitmap_lock);
+
+	job->done = True;
+	pthread_cond_broadcast(&g_bitmap_done);
+	return True;
+}
+
+static void *
+bitmap_worker(void *arg)
+{
+	UNUSED(arg);
+
+	pthread_mutex_lock(&g_bitmap_lock);
+	while (1)
+	{
+		if (!bitmap_run_job())
+			pthread_cond_wait(&g_bitmap_work, &g_bitmap_lock);
+	}
+
+	return NULL;
+}
+
+/* Start one worker per additional online CPU */
+static void
+bitmap_pool_init(void)
+{
+	pthread_t thread;
+	long cpus;
+
+	g_bitmap_pool_initialized = True;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	while (g_bitmap_workers < MIN(cpus - 1, BITMAP_MAX_WORKERS))
+	{
+		if (pthread_create(&thread, NULL, bitmap_worker, NULL) != 0)
+			break;
+		pthread_detach(thread);
+		g_bitmap_workers++;
+	}
+
+	logger(Graphics, Debug, "bitmap_pool_init(), %d bitmap decompression workers",
+	       g_bitmap_workers);
+}
+
+/* Hand count jobs to the decompression workers. Jobs that are already
+   marked done are skipped, and the workers are only woken up if there
+   is more than one job left to do. The caller must collect every job
+   with bitmap_decompress_wait() and then call bitmap_decompress_end()
+   before starting another batch. */
+void
+bitmap_decompress_start(BITMAP_JOB * jobs, int count)
+{
+	int i, pending = 0;
+
+	for (i = 0; i < count; i++)
+		if (!jobs[i].done)
+			pending++;
+
+	if (pending == 0)
+		return;
+
+	if (!g_bitmap_pool_initialized && pending > 1)
+		bitmap_pool_init();
+
+	pthread_mutex_lock(&g_bitmap_lock);
+	g_bitmap_jobs = jobs;
+	g_bitmap_njobs = count;
+	g_bitmap_next = 0;
+	if (g_bitmap_workers > 0 && pending > 1)
+		pthread_cond_broadcast(&g_bitmap_work);
+	pthread_mutex_unlock(&g_bitmap_lock);
+}
+
+/* Forget a collected batch, so that a worker that wakes up late doesn't
+   look at the jobs while the caller reuses them */
+void
+bitmap_decompress_end(void)
+{
+	pthread_mutex_lock(&g_bitmap_lock);
+	g_bitmap_jobs = NULL;
+	g_bitmap_njobs = 0;
+	g_bitmap_next = 0;
+	pthread_mutex_unlock(&g_bitmap_lock);
+}
+
+/* Wait for a job started with bitmap_decompress_start() to finish,
+   helping with the remaining jobs meanwhile. Returns the result of
+   bitmap_decompress() for the job. */
+RD_BOOL
+bitmap_decompress_wait(BITMAP_JOB * job)
+{
+	pthread_mutex_lock(&g_bitmap_lock);
+	while (!job->done)
+	{
+		if (!bitmap_run_job())
+			pthread_cond_wait(&g_bitmap_done, &g_bitmap_lock);
+	}
+	pthread_mutex_unlock(&g_bitmap_lock);
+
+	return job->ok;
+}
+
 /* *INDENT-ON* */
@@ -0,0 +1,951 @@
+/* -*- c-basic-offset: 8 -*-
+   rdesktop: A Remote Desktop Protocol client.
+   Shared store for persistent bitmap cache content
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+   Bitmaps the server asks us to keep persistently are stored by their
+   HASH_KEY, which the server computes from the bitmap content. The same
+   bitmap therefore has the same key on every server and in every session,
+   and one store per colour depth is shared by all rdesktop processes.
+
+   The store is a single file, mapped into memory:
+
+     header | index of BMPSTORE_SLOTS entries | records
+
+   The index is an open addressing hash table on the key, pointing at
+   records of a bitmap header and the pixel data, which are appended and
+   never modified. Readers don't lock: an index entry is written before
+   its key, and a record found through the index is checked against the
+   key. Writers serialize on a lock on the whole file.
+
+   Pixel data is stored compressed with an LZ77 codec in the LZ4 block
+   format, which decodes at memory speed, unless that doesn't make it
+   smaller. The fixed slot pstcache_<id>_<Bpp> files of earlier versions
+   are imported into the store and removed when it is opened.
+
+   When the index is half full or the records exceed BMPSTORE_MAX_DATA,
+   the least recently used bitmaps are dropped by writing a new file with
+   the rest and renaming it over the old one. The old file is marked as
+   replaced, so that other processes switch to the new file.
+
+   Use is stamped from a clock in the header, which counts puts and
+   touches. Each process using the store notes the clock when it opened
+   the store in a slot of a sessions file, and holds a lock on the slot
+   while it lives. The keys offered to a server are touched, and
+   compaction keeps every bitmap stamped after the oldest live session
+   started, as its server may still refer to it.
+*/
+
+#include "rdesktop.h"
+
+#define BMPSTORE_MAGIC		0x53424452	/* "RDBS" */
+#define BMPSTORE_VERSION	3
+#define BMPSTORE_SLOTS		0x8000
+#define BMPSTORE_MAX_DATA	(64 << 20)
+#define BMPSTORE_KEEP_DATA	(BMPSTORE_MAX_DATA / 4 * 3)	/* after compaction */
+#define BMPSTORE_SESSIONS	64	/* processes using a store at once */
+
+struct bmpstore_header
+{
+	uint32 magic;
+	uint32 version;
+	uint32 slots;
+	uint32 count;
+	uint32 data_end;
+	uint32 replaced;
+	uint32 clock;		/* stamp of the last use */
+	uint32 pad[9];
+};
+
+struct bmpstore_entry
+{
+	HASH_KEY key;
+	uint32 offset;		/* 0 if unused */
+	uint32 stamp;		/* clock at the last use */
+	uint32 stored;		/* bytes of data in the record */
+	uint8 width, height;
+	uint16 pad;
+};
+
+#define CODEC_RAW	0
+#define CODEC_LZ	1
+
+struct bmpstore_record
+{
+	HASH_KEY key;
+	uint8 width, height;
+	uint8 codec;
+	uint8 pad;
+	uint32 length;		/* decoded */
+	uint32 stored;
+};
+
+#define DATA_START	(sizeof(struct bmpstore_header) + BMPSTORE_SLOTS * sizeof(struct bmpstore_entry))
+#define RECORD_SIZE(stored)	((sizeof(struct bmpstore_record) + (stored) + 3) & ~3)
+
+/* Bitmap cache files before the store, with cells at fixed offsets */
+#define OLD_MAX_CELL_SIZE	0x1000	/* pixels */
+
+static int g_bmpstore_fd = -1;
+static int g_bmpstore_Bpp;
+static uint8 *g_bmpstore_map;
+static uint32 g_bmpstore_map_size;
+
+/* slot of this process in the sessions file, and the clock when it started */
+static int g_bmpstore_session_fd = -1;
+static int g_bmpstore_session = -1;
+static uint32 g_bmpstore_session_start;
+
+/* for compressing and decompressing */
+static uint8 *g_bmpstore_buffer;
+static uint32 g_bmpstore_buffer_size;
+
+#define HEADER		((struct bmpstore_header *) g_bmpstore_map)
+#define ENTRIES		((struct bmpstore_entry *) (g_bmpstore_map + sizeof(struct bmpstore_header)))
+
+static void
+bmpstore_filename(char *filename, size_t size, const char *suffix)
+{
+	snprintf(filename, size, "cache/bmpstore_%d%s", g_bmpstore_Bpp, suffix);
+}
+
+static uint32
+bmpstore_hash(uint8 * key)
+{
+	return (key[0] | (key[1] << 8) | (key[2] << 16) | ((uint32) key[3] << 24));
+}
+
+static uint8 *
+bmpstore_get_buffer(uint32 size)
+{
+	if (size > g_bmpstore_buffer_size)
+	{
+		g_bmpstore_buffer = xrealloc(g_bmpstore_buffer, size);
+		g_bmpstore_buffer_size = size;
+	}
+
+	return g_bmpstore_buffer;
+}
+
+#define LZ_HASH_BITS	12
+#define LZ_MIN_MATCH	4
+#define LZ_LAST_LITERALS	5	/* the block format ends with these */
+#define LZ_MATCH_LIMIT	12	/* no match starts this close to the end */
+
+static uint32
+bmpstore_lz_read32(uint8 * p)
+{
+	uint32 v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static int
+bmpstore_lz_length(uint8 * out, int op, int max, int length)
+{
+	for (length -= 15; length >= 255; length -= 255)
+	{
+		if (op >= max)
+			return -1;
+		out[op++] = 255;
+	}
+
+	if (op >= max)
+		return -1;
+	out[op++] = length;
+	return op;
+}
+
+/* Write a sequence of literals followed by a match, offset 0 for the
+   final literals. Returns the new output position, -1 if out is full. */
+static int
+bmpstore_lz_sequence(uint8 * out, int op, int max, uint8 * literals, int num_literals,
+		     int offset, int match)
+{
+	uint8 *token;
+
+	if (op >= max)
+		return -1;
+
+	token = &out[op++];
+	*token = (MIN(num_literals, 15) << 4);
+	if (num_literals >= 15 && (op = bmpstore_lz_length(out, op, max, num_literals)) < 0)
+		return -1;
+
+	if (op + num_literals > max)
+		return -1;
+	memcpy(out + op, literals, num_literals);
+	op += num_literals;
+
+	if (offset == 0)
+		return op;
+
+	if (op + 2 > max)
+		return -1;
+	out[op++] = offset & 0xff;
+	out[op++] = offset >> 8;
+
+	match -= LZ_MIN_MATCH;
+	*token |= MIN(match, 15);
+	if (match >= 15 && (op = bmpstore_lz_length(out, op, max, match)) < 0)
+		return -1;
+
+	return op;
+}
+
+/* Compress into at most max bytes, returns the size or 0 if it doesn't fit */
+int
+bmpstore_lz_compress(uint8 * in, int length, uint8 * out, int max)
+{
+	int table[1 << LZ_HASH_BITS];
+	int ip = 0, anchor = 0, op = 0, ref, match;
+	uint32 seq, hash;
+
+	memset(table, 0xff, sizeof(table));
+
+	while (ip < length - LZ_MATCH_LIMIT)
+	{
+		seq = bmpstore_lz_read32(in + ip);
+		hash = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+		ref = table[hash];
+		table[hash] = ip;
+
+		if (ref < 0 || ip - ref > 0xffff || bmpstore_lz_read32(in + ref) != seq)
+		{
+			ip++;
+			continue;
+		}
+
+		match = LZ_MIN_MATCH;
+		while (ip + match < length - LZ_LAST_LITERALS && in[ref + match] == in[ip + match])
+			match++;
+
+		op = bmpstore_lz_sequence(out, op, max, in + anchor, ip - anchor, ip - ref, match);
+		if (op < 0)
+			return 0;
+
+		ip += match;
+		anchor = ip;
+	}
+
+	op = bmpstore_lz_sequence(out, op, max, in + anchor, length - anchor, 0, 0);
+	return MAX(op, 0);
+}
+
+/* Decompress exactly length bytes, False on corrupt data */
+RD_BOOL
+bmpstore_lz_decompress(uint8 * in, int size, uint8 * out, int length)
+{
+	int ip = 0, op = 0, n, offset;
+	uint8 token, b;
+
+	while (ip < size)
+	{
+		token = in[ip++];
+
+		n = token >> 4;
+		if (n == 15)
+			do
+			{
+				if (ip >= size)
+					return False;
+				b = in[ip++];
+				n += b;
+			}
+			while (b == 255);
+
+		if (ip + n > size || op + n > length)
+			return False;
+		memcpy(out + op, in + ip, n);
+		ip += n;
+		op += n;
+
+		/* the last sequence has no match */
+		if (ip == size)
+			break;
+
+		if (ip + 2 > size)
+			return False;
+		offset = in[ip] | (in[ip + 1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > op)
+			return False;
+
+		n = (token & 15) + LZ_MIN_MATCH;
+		if ((token & 15) == 15)
+			do
+			{
+				if (ip >= size)
+					return False;
+				b = in[ip++];
+				n += b;
+			}
+			while (b == 255);
+
+		if (op + n > length)
+			return False;
+		for (; n > 0; n--, op++)
+			out[op] = out[op - offset];
+	}
+
+	return (op == length);
+}
+
+/* Map the file up to its data end, the records may have grown since */
+static RD_BOOL
+bmpstore_remap(void)
+{
+	uint32 size = HEADER->data_end;
+
+	if (size == g_bmpstore_map_size)
+		return True;
+
+	rd_unmap_file(g_bmpstore_map, g_bmpstore_map_size);
+	g_bmpstore_map = rd_map_file(g_bmpstore_fd, size);
+	g_bmpstore_map_size = g_bmpstore_map ? size : 0;
+	return (g_bmpstore_map != NULL);
+}
+
+static void
+bmpstore_close(void)
+{
+	if (g_bmpstore_map != NULL)
+		rd_unmap_file(g_bmpstore_map, g_bmpstore_map_size);
+	if (g_bmpstore_fd != -1)
+		rd_close_file(g_bmpstore_fd);
+
+	g_bmpstore_map = NULL;
+	g_bmpstore_map_size = 0;
+	g_bmpstore_fd = -1;
+}
+
+/* Open and map a store file, initialising it if it is new. The caller
+   holds no lock, one is taken while the header is checked. */
+static RD_BOOL
+bmpstore_attach(char *filename)
+{
+	struct bmpstore_header *header;
+
+	g_bmpstore_fd = rd_open_file(filename);
+	if (g_bmpstore_fd == -1)
+		return False;
+
+	rd_lock_file_wait(g_bmpstore_fd, 0, 0);
+
+	g_bmpstore_map = rd_map_file(g_bmpstore_fd, DATA_START);
+	if (g_bmpstore_map == NULL)
+	{
+		rd_unlock_file(g_bmpstore_fd, 0, 0);
+		bmpstore_close();
+		return False;
+	}
+	g_bmpstore_map_size = DATA_START;
+
+	header = HEADER;
+	if (header->magic != 0 && (header->magic != BMPSTORE_MAGIC
+				   || header->version != BMPSTORE_VERSION
+				   || header->slots != BMPSTORE_SLOTS
+				   || header->data_end < DATA_START))
+	{
+		/* start over with an empty file, not to keep its size */
+		logger(Core, Warning,
+		       "bmpstore_attach(), unknown bitmap store format in %s, starting over",
+		       filename);
+		rd_remove_file(filename);
+		rd_unlock_file(g_bmpstore_fd, 0, 0);
+		bmpstore_close();
+		return bmpstore_attach(filename);
+	}
+
+	if (header->magic == 0)
+	{
+		memset(g_bmpstore_map, 0, DATA_START);
+		header->magic = BMPSTORE_MAGIC;
+		header->version = BMPSTORE_VERSION;
+		header->slots = BMPSTORE_SLOTS;
+		header->data_end = DATA_START;
+	}
+
+	rd_unlock_file(g_bmpstore_fd, 0, 0);
+
+	if (!bmpstore_remap())
+	{
+		bmpstore_close();
+		return False;
+	}
+
+	return True;
+}
+
+/* Switch to the new file if another process has compacted the store */
+static RD_BOOL
+bmpstore_check_replaced(void)
+{
+	char filename[256];
+
+	if (!HEADER->replaced)
+		return True;
+
+	logger(Core, Debug, "bmpstore_check_replaced(), store was compacted, reopening");
+	bmpstore_close();
+	bmpstore_filename(filename, sizeof(filename), "");
+	return bmpstore_attach(filename);
+}
+
+/* Take the writer lock on the current store file */
+static RD_BOOL
+bmpstore_lock(void)
+{
+	while (True)
+	{
+		rd_lock_file_wait(g_bmpstore_fd, 0, 0);
+		if (!HEADER->replaced)
+			return True;
+
+		rd_unlock_file(g_bmpstore_fd, 0, 0);
+		if (!bmpstore_check_replaced())
+			return False;
+	}
+}
+
+static struct bmpstore_entry *
+bmpstore_find_entry(uint8 * key)
+{
+	struct bmpstore_entry *entry;
+	uint32 slot, n;
+
+	slot = bmpstore_hash(key) & (BMPSTORE_SLOTS - 1);
+	for (n = 0; n < BMPSTORE_SLOTS; n++)
+	{
+		entry = &ENTRIES[slot];
+		if (entry->offset == 0)
+			break;
+		if (memcmp(entry->key, key, sizeof(HASH_KEY)) == 0)
+			return entry;
+		slot = (slot + 1) & (BMPSTORE_SLOTS - 1);
+	}
+
+	return NULL;
+}
+
+/* Add an index entry, the key goes last so readers never match a partial entry */
+static void
+bmpstore_insert_entry(uint8 * key, uint8 width, uint8 height, uint32 stored, uint32 offset,
+		      uint32 stamp)
+{
+	struct bmpstore_entry *entry;
+	uint32 slot;
+
+	slot = bmpstore_hash(key) & (BMPSTORE_SLOTS - 1);
+	while (ENTRIES[slot].offset != 0)
+		slot = (slot + 1) & (BMPSTORE_SLOTS - 1);
+
+	entry = &ENTRIES[slot];
+	entry->width = width;
+	entry->height = height;
+	entry->stored = stored;
+	entry->stamp = stamp;
+	entry->offset = offset;
+	memcpy(entry->key, key, sizeof(HASH_KEY));
+	HEADER->count++;
+}
+
+static int
+bmpstore_cmp_stamp(const void *a, const void *b)
+{
+	const struct bmpstore_entry *ea = a, *eb = b;
+
+	if (ea->stamp == eb->stamp)
+		return 0;
+	return (ea->stamp > eb->stamp) ? -1 : 1;
+}
+
+/* Collect the used index entries, most recently used first */
+static int
+bmpstore_sorted_entries(struct bmpstore_entry **entries)
+{
+	int n, count = 0;
+
+	*entries = xmalloc(MAX(HEADER->count, 1) * sizeof(struct bmpstore_entry));
+	for (n = 0; n < BMPSTORE_SLOTS && count < (int) HEADER->count; n++)
+		if (ENTRIES[n].offset != 0)
+			(*entries)[count++] = ENTRIES[n];
+
+	qsort(*entries, count, sizeof(struct bmpstore_entry), bmpstore_cmp_stamp);
+	return count;
+}
+
+/* Note the clock in a free slot of the sessions file, and keep the slot
+   locked while this process uses the store */
+static void
+bmpstore_begin_session(void)
+{
+	char filename[256];
+	int n;
+
+	g_bmpstore_session_start = HEADER->clock;
+
+	bmpstore_filename(filename, sizeof(filename), ".sessions");
+	g_bmpstore_session_fd = rd_open_file(filename);
+	if (g_bmpstore_session_fd == -1)
+		return;
+
+	for (n = 0; n < BMPSTORE_SESSIONS; n++)
+	{
+		if (!rd_lock_file(g_bmpstore_session_fd, n * sizeof(uint32), sizeof(uint32)))
+			continue;
+
+		rd_lseek_file(g_bmpstore_session_fd, n * sizeof(uint32));
+		if (rd_write_file(g_bmpstore_session_fd, &g_bmpstore_session_start,
+				  sizeof(uint32)) != sizeof(uint32))
+		{
+			rd_unlock_file(g_bmpstore_session_fd, n * sizeof(uint32), sizeof(uint32));
+			break;
+		}
+
+		g_bmpstore_session = n;
+		return;
+	}
+
+	logger(Core, Warning,
+	       "bmpstore_begin_session(), no session slot, other sessions may drop our bitmaps");
+}
+
+static void
+bmpstore_end_session(void)
+{
+	/* closing the file releases the lock on the slot */
+	if (g_bmpstore_session_fd != -1)
+		rd_close_file(g_bmpstore_session_fd);
+
+	g_bmpstore_session_fd = -1;
+	g_bmpstore_session = -1;
+}
+
+/* The clock when the oldest session still using the store started.
+   A slot that can be locked belongs to a process that is gone. */
+static uint32
+bmpstore_live_since(void)
+{
+	uint32 since = g_bmpstore_session_start, start;
+	int n;
+
+	if (g_bmpstore_session_fd == -1)
+		return since;
+
+	for (n = 0; n < BMPSTORE_SESSIONS; n++)
+	{
+		/* locking our own slot again would succeed */
+		if (n == g_bmpstore_session)
+			continue;
+
+		rd_lseek_file(g_bmpstore_session_fd, n * sizeof(uint32));
+		if (rd_read_file(g_bmpstore_session_fd, &start, sizeof(uint32)) != sizeof(uint32))
+			break;
+
+		if (rd_lock_file(g_bmpstore_session_fd, n * sizeof(uint32), sizeof(uint32)))
+		{
+			rd_unlock_file(g_bmpstore_session_fd, n * sizeof(uint32), sizeof(uint32));
+			continue;
+		}
+
+		since = MIN(since, start);
+	}
+
+	return since;
+}
+
+/* Write the most recently used bitmaps to a new file and replace the
+   store with it. Bitmaps stamped after a live session started are always
+   kept. Called with the lock held, returns with the lock on the new file
+   held. Returns False if the store is unchanged. */
+static RD_BOOL
+bmpstore_compact(void)
+{
+	struct bmpstore_entry *entries;
+	char filename[256], newname[256];
+	int n, count, total, fd, old_fd;
+	uint8 *map, *old_map;
+	uint32 data_end, size, old_size, since;
+
+	if (!bmpstore_remap())
+		return False;
+
+	/* size the new file for the bitmaps that are kept */
+	since = bmpstore_live_since();
+	total = bmpstore_sorted_entries(&entries);
+	data_end = DATA_START;
+	for (count = 0; count < total; count++)
+	{
+		size = RECORD_SIZE(entries[count].stored);
+		if (entries[count].stamp <= since
+		    && (count >= BMPSTORE_SLOTS / 4 || data_end + size > BMPSTORE_KEEP_DATA))
+			break;
+		data_end += size;
+	}
+
+	if (count == total)
+	{
+		logger(Core, Debug, "bmpstore_compact(), all %d bitmaps are in use", total);
+		xfree(entries);
+		return False;
+	}
+
+	bmpstore_filename(filename, sizeof(filename), "");
+	bmpstore_filename(newname, sizeof(newname), ".new");
+
+	rd_remove_file(newname);
+	fd = rd_open_file(newname);
+	if (fd == -1)
+	{
+		xfree(entries);
+		return False;
+	}
+	rd_lock_file_wait(fd, 0, 0);
+
+	map = rd_map_file(fd, data_end);
+	if (map == NULL)
+	{
+		rd_close_file(fd);
+		rd_remove_file(newname);
+		xfree(entries);
+		return False;
+	}
+
+	old_fd = g_bmpstore_fd;
+	old_map = g_bmpstore_map;
+	old_size = g_bmpstore_map_size;
+	g_bmpstore_fd = fd;
+	g_bmpstore_map = map;
+	g_bmpstore_map_size = data_end;
+
+	memset(map, 0, DATA_START);
+	HEADER->magic = BMPSTORE_MAGIC;
+	HEADER->version = BMPSTORE_VERSION;
+	HEADER->slots = BMPSTORE_SLOTS;
+	HEADER->data_end = DATA_START;
+	HEADER->clock = ((struct bmpstore_header *) old_map)->clock;
+
+	for (n = 0; n < count; n++)
+	{
+		memcpy(map + HEADER->data_end, old_map + entries[n].offset,
+		       sizeof(struct bmpstore_record) + entries[n].stored);
+		bmpstore_insert_entry(entries[n].key, entries[n].width, entries[n].height,
+				      entries[n].stored, HEADER->data_end, entries[n].stamp);
+		HEADER->data_end += RECORD_SIZE(entries[n].stored);
+	}
+	xfree(entries);
+
+	if (!rd_rename_file(newname, filename))
+	{
+		/* keep using the old file */
+		rd_unmap_file(map, data_end);
+		rd_close_file(fd);
+		rd_remove_file(newname);
+		g_bmpstore_fd = old_fd;
+		g_bmpstore_map = old_map;
+		g_bmpstore_map_size = old_size;
+		return False;
+	}
+
+	/* processes still using the old file pick up the new one */
+	((struct bmpstore_header *) old_map)->replaced = 1;
+	rd_unmap_file(old_map, old_size);
+	rd_close_file(old_fd);
+
+	logger(Core, Debug, "bmpstore_compact(), kept %d of %d bitmaps, %d bytes", count, total,
+	       HEADER->data_end);
+	return True;
+}
+
+/* Import the bitmaps of a fixed slot cache file and remove it */
+static void
+bmpstore_migrate(int id)
+{
+	CELLHEADER cellhdr;
+	char filename[256];
+	uint8 *data;
+	int fd, idx, count = 0;
+	uint32 cell_size;
+
+	snprintf(filename, sizeof(filename), "cache/pstcache_%d_%d", id, g_bmpstore_Bpp);
+	fd = rd_open_file(filename);
+	if (fd == -1)
+		return;
+
+	/* still in use by an older rdesktop */
+	if (!rd_lock_file(fd, 0, 0))
+	{
+		rd_close_file(fd);
+		return;
+	}
+
+	cell_size = g_bmpstore_Bpp * OLD_MAX_CELL_SIZE;
+	data = xmalloc(cell_size);
+	for (idx = 0; idx < BMPCACHE2_NUM_PSTCELLS; idx++)
+	{
+		rd_lseek_file(fd, idx * (cell_size + sizeof(CELLHEADER)));
+		if (rd_read_file(fd, &cellhdr, sizeof(CELLHEADER)) != sizeof(CELLHEADER)
+		    || cellhdr.length > cell_size
+		    || cellhdr.length < cellhdr.width * cellhdr.height * g_bmpstore_Bpp
+		    || rd_read_file(fd, data, cellhdr.length) != cellhdr.length)
+			break;
+
+		/* the cells were filled from the start */
+		if (cellhdr.width == 0 || cellhdr.height == 0)
+			break;
+
+		bmpstore_put(cellhdr.key, cellhdr.width, cellhdr.height, cellhdr.length, data);
+		count++;
+	}
+	xfree(data);
+
+	if (count > 0)
+		logger(Core, Notice, "Moved %d bitmaps from %s to the bitmap store", count,
+		       filename);
+
+	rd_close_file(fd);
+	rd_remove_file(filename);
+}
+
+/* Open the store for the given bytes per pixel */
+RD_BOOL
+bmpstore_open(int Bpp)
+{
+	char filename[256];
+	int id;
+
+	if (g_bmpstore_fd != -1 && g_bmpstore_Bpp == Bpp)
+		return True;
+
+	bmpstore_close();
+	bmpstore_end_session();
+	g_bmpstore_Bpp = Bpp;
+	bmpstore_filename(filename, sizeof(filename), "");
+	logger(Core, Debug, "bmpstore_open(), bitmap store %s", filename);
+
+	if (!bmpstore_attach(filename))
+		return False;
+
+	bmpstore_begin_session();
+
+	for (id = 0; id < BMPCACHE2_MAX_CACHES; id++)
+		bmpstore_migrate(id);
+
+	return True;
+}
+
+/* Look up a bitmap, without touching its data */
+RD_BOOL
+bmpstore_find(uint8 * key, uint8 * width, uint8 * height)
+{
+	struct bmpstore_entry *entry;
+
+	if (g_bmpstore_map == NULL)
+		return False;
+
+	entry = bmpstore_find_entry(key);
+	if (entry == NULL)
+		return False;
+
+	*width = entry->width;
+	*height = entry->height;
+	return True;
+}
+
+/* Get the data of a bitmap, NULL if it is not in the store. The data
+   is only valid until the next call. */
+uint8 *
+bmpstore_get(uint8 * key, uint8 * width, uint8 * height, uint32 * length)
+{
+	struct bmpstore_entry *entry;
+	struct bmpstore_record *record;
+	uint32 offset, stored, size;
+	uint8 *data;
+
+	if (g_bmpstore_map == NULL)
+		return NULL;
+
+	entry = bmpstore_find_entry(key);
+	if (entry == NULL && HEADER->replaced && bmpstore_check_replaced())
+		entry = bmpstore_find_entry(key);
+	if (entry == NULL)
+		return NULL;
+
+	/* remapping moves the index too */
+	offset = entry->offset;
+	stored = entry->stored;
+	size = RECORD_SIZE(stored);
+	if (offset + size > g_bmpstore_map_size && !bmpstore_remap())
+		return NULL;
+	if (offset + size > g_bmpstore_map_size)
+		return NULL;
+
+	record = (struct bmpstore_record *) (g_bmpstore_map + offset);
+	if (memcmp(record->key, key, sizeof(HASH_KEY)) != 0 || record->stored != stored)
+	{
+		logger(Core, Error, "bmpstore_get(), index and record disagree at offset %d",
+		       offset);
+		return NULL;
+	}
+
+	data = (uint8 *) (record + 1);
+	if (record->codec == CODEC_LZ)
+	{
+		if (!bmpstore_lz_decompress(data, record->stored,
+					    bmpstore_get_buffer(record->length), record->length))
+		{
+			logger(Core, Error, "bmpstore_get(), corrupt bitmap at offset %d", offset);
+			return NULL;
+		}
+		data = g_bmpstore_buffer;
+	}
+	else if (record->codec != CODEC_RAW || record->stored != record->length)
+	{
+		return NULL;
+	}
+
+	*width = record->width;
+	*height = record->height;
+	*length = record->length;
+	return data;
+}
+
+/* Add a bitmap to the store, unless some process already did */
+void
+bmpstore_put(uint8 * key, uint8 width, uint8 height, uint32 length, uint8 * data)
+{
+	struct bmpstore_record *record;
+	uint32 offset, stored, size;
+	uint8 *buffer;
+
+	if (g_bmpstore_map == NULL)
+		return;
+
+	/* compress into a buffer that also has the record header and padding */
+	buffer = bmpstore_get_buffer(RECORD_SIZE(length));
+	memset(buffer, 0, RECORD_SIZE(length));
+	record = (struct bmpstore_record *) buffer;
+	memcpy(record->key, key, sizeof(HASH_KEY));
+	record->width = width;
+	record->height = height;
+	record->length = length;
+
+	stored = bmpstore_lz_compress(data, length, (uint8 *) (record + 1), length - 1);
+	if (stored > 0)
+	{
+		record->codec = CODEC_LZ;
+	}
+	else
+	{
+		record->codec = CODEC_RAW;
+		stored = length;
+		memcpy(record + 1, data, length);
+	}
+	record->stored = stored;
+	size = RECORD_SIZE(stored);
+
+	if (!bmpstore_lock())
+		return;
+
+	if (bmpstore_find_entry(key) != NULL)
+	{
+		rd_unlock_file(g_bmpstore_fd, 0, 0);
+		return;
+	}
+
+	if ((HEADER->count >= BMPSTORE_SLOTS / 2 || HEADER->data_end + size > BMPSTORE_MAX_DATA)
+	    && (!bmpstore_compact() || HEADER->count >= BMPSTORE_SLOTS / 2
+		|| HEADER->data_end + size > BMPSTORE_MAX_DATA))
+	{
+		logger(Core, Debug, "bmpstore_put(), store is full");
+		rd_unlock_file(g_bmpstore_fd, 0, 0);
+		return;
+	}
+
+	offset = HEADER->data_end;
+	rd_lseek_file(g_bmpstore_fd, offset);
+	if (rd_write_file(g_bmpstore_fd, buffer, size) != (int) size)
+	{
+		logger(Core, Error, "bmpstore_put(), failed to write bitmap to store");
+		rd_unlock_file(g_bmpstore_fd, 0, 0);
+		return;
+	}
+
+	/* readers that find the entry must be able to map the record */
+	HEADER->data_end = offset + size;
+	bmpstore_insert_entry(key, width, height, stored, offset, ++HEADER->clock);
+
+	rd_unlock_file(g_bmpstore_fd, 0, 0);
+}
+
+/* Get up to max keys of bitmaps with at most max_pixels pixels, most
+   recently used first */
+int
+bmpstore_list(HASH_KEY * keys, int max, int max_pixels)
+{
+	struct bmpstore_entry *entries;
+	int n, count, num = 0;
+
+	if (g_bmpstore_map == NULL)
+		return 0;
+
+	count = bmpstore_sorted_entries(&entries);
+	for (n = 0; n < count && num < max; n++)
+		if (entries[n].width * entries[n].height <= max_pixels)
+			memcpy(keys[num++], entries[n].key, sizeof(HASH_KEY));
+
+	xfree(entries);
+	return num;
+}
+
+/* Mark bitmaps as used now, for the compaction order. Compaction keeps
+   them while this session lasts. Keys of bitmaps that are no longer in
+   the store are cleared, returns the number of bitmaps found. */
+int
+bmpstore_touch(HASH_KEY * keys, int count)
+{
+	struct bmpstore_entry *entry;
+	int n, found = 0;
+	uint32 now;
+
+	if (g_bmpstore_map == NULL || count == 0)
+		return 0;
+
+	if (!bmpstore_lock())
+		return 0;
+
+	now = ++HEADER->clock;
+	for (n = 0; n < count; n++)
+	{
+		entry = bmpstore_find_entry(keys[n]);
+		if (entry != NULL)
+		{
+			entry->stamp = now;
+			found++;
+		}
+		else
+		{
+			memset(keys[n], 0, sizeof(HASH_KEY));
+		}
+	}
+
+	rd_sync_file(g_bmpstore_map, g_bmpstore_map_size);
+	rd_unlock_file(g_bmpstore_fd, 0, 0);
+	return found;
+}
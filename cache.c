@@ -22,191 +22,324 @@
 #include "rdesktop.h"
 
 /* BITMAP CACHE */
-extern int g_pstcache_fd[];
+extern int g_pstcache_id;
+extern int g_bmpcache_num;
+extern uint32 g_bmpcache_cells[];
+extern uint32 g_bmpcache_budget;
+extern int g_server_depth;
 
 #define NUM_ELEMENTS(array) (sizeof(array) / sizeof(array[0]))
-#define IS_PERSISTENT(id) (g_pstcache_fd[id] > 0)
-#define TO_TOP -1
+#define IS_PERSISTENT(id) (g_pstcache_id == (int) (id))
 #define NOT_SET -1
 #define IS_SET(idx) (idx >= 0)
 
 /*
- * TODO: Test for optimal value of BUMP_COUNT. TO_TOP gives lowest CPU utilisation but using
- * a positive value will hopefully result in less frequently used bitmaps having a greater chance
- * of being evicted from the cache, and thereby reducing the need to load bitmaps from disk.
- * (Jeroen)
+ * Each bitmap cache is a segmented LRU. Bitmaps enter the probation segment
+ * and are only moved to the protected segment when they are used again, so
+ * a stream of bitmaps that are drawn once (e.g. scrolling through a document)
+ * pushes out other one-shot bitmaps instead of the working set. Only
+ * persistent caches evict, the server assumes any other cell is still there.
  */
-#define BUMP_COUNT 40
+#define PROBATION 0
+#define PROTECTED 1
+#define PROTECTED_CELLS(cells) ((cells) * 4 / 5)
+#define VOLATILE_IDX 0x7fff
 
 struct bmpcache_entry
 {
 	RD_HBITMAP bitmap;
+	uint32 size;
 	sint16 previous;
 	sint16 next;
+	uint8 segment;
 };
 
-static struct bmpcache_entry g_bmpcache[3][0xa00];
-static RD_HBITMAP g_volatile_bc[3];
+struct bmpcache
+{
+	struct bmpcache_entry *entries;
+	int num_entries;
+	int lru[2];
+	int mru[2];
+	int count[2];
+	uint32 bytes;
+	uint32 hits;
+	uint32 misses;
+	uint32 loads;
+	uint32 evictions;
+};
+
+static struct bmpcache g_bmpcache[BMPCACHE2_MAX_CACHES];
+static RD_HBITMAP g_volatile_bc[BMPCACHE2_MAX_CACHES];
+static uint32 g_bmpcache_bytes;
+
+static void
+cache_reset_bitmap_lists(struct bmpcache *cache)
+{
+	cache->lru[PROBATION] = cache->lru[PROTECTED] = NOT_SET;
+	cache->mru[PROBATION] = cache->mru[PROTECTED] = NOT_SET;
+	cache->count[PROBATION] = cache->count[PROTECTED] = 0;
+}
+
+/* Make sure the entry table of a cache covers idx */
+static void
+cache_grow_bitmaps(uint8 id, uint16 idx)
+{
+	struct bmpcache *cache = &g_bmpcache[id];
+	int n;
+
+	if (idx < cache->num_entries)
+		return;
+
+	if (cache->entries == NULL)
+		cache_reset_bitmap_lists(cache);
+
+	n = MAX(MAX(idx + 1, cache->num_entries * 2), (int) g_bmpcache_cells[id]);
+	n = MIN(n, VOLATILE_IDX);
+
+	cache->entries = xrealloc(cache->entries, n * sizeof(struct bmpcache_entry));
+	memset(&cache->entries[cache->num_entries], 0,
+	       (n - cache->num_entries) * sizeof(struct bmpcache_entry));
+	cache->num_entries = n;
+}
+
+/* Remove a bitmap from its segment */
+static void
+cache_unlink_bitmap(uint8 id, int idx)
+{
+	struct bmpcache *cache = &g_bmpcache[id];
+	struct bmpcache_entry *entry = &cache->entries[idx];
+
+	if (IS_SET(entry->previous))
+		cache->entries[entry->previous].next = entry->next;
+	else
+		cache->lru[entry->segment] = entry->next;
+
+	if (IS_SET(entry->next))
+		cache->entries[entry->next].previous = entry->previous;
+	else
+		cache->mru[entry->segment] = entry->previous;
+
+	cache->count[entry->segment]--;
+}
+
+/* Insert a bitmap at the most recently used end of a segment */
+static void
+cache_link_bitmap(uint8 id, int idx, uint8 segment)
+{
+	struct bmpcache *cache = &g_bmpcache[id];
+	struct bmpcache_entry *entry = &cache->entries[idx];
+
+	entry->segment = segment;
+	entry->previous = cache->mru[segment];
+	entry->next = NOT_SET;
+
+	if (IS_SET(entry->previous))
+		cache->entries[entry->previous].next = idx;
+	else
+		cache->lru[segment] = idx;
+
+	cache->mru[segment] = idx;
+	cache->count[segment]++;
+}
+
+/* Insert a bitmap at the least recently used end of a segment */
+static void
+cache_link_bitmap_lru(uint8 id, int idx, uint8 segment)
+{
+	struct bmpcache *cache = &g_bmpcache[id];
+	struct bmpcache_entry *entry = &cache->entries[idx];
+
+	entry->segment = segment;
+	entry->previous = NOT_SET;
+	entry->next = cache->lru[segment];
+
+	if (IS_SET(entry->next))
+		cache->entries[entry->next].previous = idx;
+	else
+		cache->mru[segment] = idx;
+
+	cache->lru[segment] = idx;
+	cache->count[segment]++;
+}
+
+/* Release the bitmap held by an (unlinked) entry */
+static void
+cache_free_bitmap(uint8 id, int idx)
+{
+	struct bmpcache *cache = &g_bmpcache[id];
+	struct bmpcache_entry *entry = &cache->entries[idx];
+
+	ui_destroy_bitmap(entry->bitmap);
+	cache->bytes -= entry->size;
+	g_bmpcache_bytes -= entry->size;
+	entry->bitmap = NULL;
+	entry->size = 0;
+}
+
+/* Check the cell count and the memory budget, keeping at least one bitmap */
+static RD_BOOL
+cache_bitmaps_over_limit(uint8 id)
+{
+	struct bmpcache *cache = &g_bmpcache[id];
+	int count = cache->count[PROBATION] + cache->count[PROTECTED];
+
+	if (count <= 1)
+		return False;
+
+	if (count > (int) g_bmpcache_cells[id])
+		return True;
+
+	return (g_bmpcache_budget != 0 && g_bmpcache_bytes > g_bmpcache_budget);
+}
+
+/* A cached bitmap was used, move it to the top of the protected segment */
+static void
+cache_touch_bitmap(uint8 id, int idx)
+{
+	struct bmpcache *cache = &g_bmpcache[id];
+	int demote;
+
+	if (cache->mru[PROTECTED] == idx)
+		return;
 
-static int g_bmpcache_lru[3] = { NOT_SET, NOT_SET, NOT_SET };
-static int g_bmpcache_mru[3] = { NOT_SET, NOT_SET, NOT_SET };
+	cache_unlink_bitmap(id, idx);
+	cache_link_bitmap(id, idx, PROTECTED);
 
-static int g_bmpcache_count[3];
+	/* overflow of the protected segment gets a second chance in probation */
+	if (cache->count[PROTECTED] > (int) PROTECTED_CELLS(g_bmpcache_cells[id]))
+	{
+		demote = cache->lru[PROTECTED];
+		cache_unlink_bitmap(id, demote);
+		cache_link_bitmap(id, demote, PROBATION);
+	}
+}
 
 /* Setup the bitmap cache lru/mru linked list */
 void
 cache_rebuild_bmpcache_linked_list(uint8 id, sint16 * idx, int count)
 {
-	int n = count, c = 0;
-	sint16 n_idx;
+	struct bmpcache *cache = &g_bmpcache[id];
+	int n, c = 0, total;
 
-	/* find top, skip evicted bitmaps */
-	while (--n >= 0 && g_bmpcache[id][idx[n]].bitmap == NULL);
-	if (n < 0)
-	{
-		g_bmpcache_mru[id] = g_bmpcache_lru[id] = NOT_SET;
+	if (cache->entries == NULL)
 		return;
-	}
 
-	g_bmpcache_mru[id] = idx[n];
-	g_bmpcache[id][idx[n]].next = NOT_SET;
-	n_idx = idx[n];
-	c++;
+	total = cache->count[PROBATION] + cache->count[PROTECTED];
+	cache_reset_bitmap_lists(cache);
 
-	/* link list */
-	while (n >= 0)
+	/* idx is sorted by stamp, oldest first; skip evicted bitmaps */
+	for (n = 0; n < count; n++)
 	{
-		/* skip evicted bitmaps */
-		while (--n >= 0 && g_bmpcache[id][idx[n]].bitmap == NULL);
-
-		if (n < 0)
-			break;
+		if (idx[n] >= cache->num_entries || cache->entries[idx[n]].bitmap == NULL)
+			continue;
 
-		g_bmpcache[id][n_idx].previous = idx[n];
-		g_bmpcache[id][idx[n]].next = n_idx;
-		n_idx = idx[n];
+		cache_link_bitmap(id, idx[n], PROBATION);
 		c++;
 	}
 
-	g_bmpcache[id][n_idx].previous = NOT_SET;
-	g_bmpcache_lru[id] = n_idx;
-
-	if (c != g_bmpcache_count[id])
+	if (c != total)
 	{
 		logger(Core, Error,
 		       "cache_rebuild_bmpcache_linked_list(), %d in bitmap cache linked list, %d in ui cache...",
-		       c, g_bmpcache_count[id]);
+		       c, total);
 		exit(EX_SOFTWARE);
 	}
 }
 
-/* Move a bitmap to a new position in the linked list. */
+/* Evict the least-recently used bitmap from the cache, probation first */
 void
-cache_bump_bitmap(uint8 id, uint16 idx, int bump)
+cache_evict_bitmap(uint8 id)
 {
-	int p_idx, n_idx, n;
+	struct bmpcache *cache = &g_bmpcache[id];
+	int idx;
+	uint8 segment;
 
 	if (!IS_PERSISTENT(id))
 		return;
 
-	if (g_bmpcache_mru[id] == idx)
+	/* the newest bitmap is the top of probation, never evict that one */
+	segment = (cache->count[PROBATION] > 1 || cache->count[PROTECTED] == 0) ?
+		PROBATION : PROTECTED;
+	idx = cache->lru[segment];
+	if (!IS_SET(idx))
 		return;
 
-	logger(Core, Debug, "cache_bump_bitmap(), id=%d, idx=%d, bump=%d", id, idx, bump);
-
-	n_idx = g_bmpcache[id][idx].next;
-	p_idx = g_bmpcache[id][idx].previous;
-
-	if (IS_SET(n_idx))
-	{
-		/* remove */
-		--g_bmpcache_count[id];
-		if (IS_SET(p_idx))
-			g_bmpcache[id][p_idx].next = n_idx;
-		else
-			g_bmpcache_lru[id] = n_idx;
-		if (IS_SET(n_idx))
-			g_bmpcache[id][n_idx].previous = p_idx;
-		else
-			g_bmpcache_mru[id] = p_idx;
-	}
-	else
-	{
-		p_idx = NOT_SET;
-		n_idx = g_bmpcache_lru[id];
-	}
-
-	if (bump >= 0)
-	{
-		for (n = 0; n < bump && IS_SET(n_idx); n++)
-		{
-			p_idx = n_idx;
-			n_idx = g_bmpcache[id][p_idx].next;
-		}
-	}
-	else
-	{
-		p_idx = g_bmpcache_mru[id];
-		n_idx = NOT_SET;
-	}
+	logger(Core, Debug, "cache_evict_bitmap(), id=%d idx=%d segment=%d bmp=%p", id, idx,
+	       segment, cache->entries[idx].bitmap);
 
-	/* insert */
-	++g_bmpcache_count[id];
-	g_bmpcache[id][idx].previous = p_idx;
-	g_bmpcache[id][idx].next = n_idx;
+	cache_unlink_bitmap(id, idx);
+	cache_free_bitmap(id, idx);
+	cache->evictions++;
 
-	if (p_idx >= 0)
-		g_bmpcache[id][p_idx].next = idx;
-	else
-		g_bmpcache_lru[id] = idx;
-
-	if (n_idx >= 0)
-		g_bmpcache[id][n_idx].previous = idx;
-	else
-		g_bmpcache_mru[id] = idx;
+	pstcache_touch_bitmap(id, idx, 0);
 }
 
-/* Evict the least-recently used bitmap from the cache */
+/* Move a bitmap to the bottom of the probation segment, for bitmaps that
+   are precached in most recently used order */
 void
-cache_evict_bitmap(uint8 id)
+cache_demote_bitmap(uint8 id, uint16 idx)
 {
-	uint16 idx;
-	int n_idx;
+	struct bmpcache *cache = &g_bmpcache[id];
 
-	if (!IS_PERSISTENT(id))
+	if (id >= g_bmpcache_num || idx >= cache->num_entries || cache->entries[idx].bitmap == NULL)
 		return;
 
-	idx = g_bmpcache_lru[id];
-	n_idx = g_bmpcache[id][idx].next;
+	cache_unlink_bitmap(id, idx);
+	cache_link_bitmap_lru(id, idx, PROBATION);
+}
 
-	logger(Core, Debug, "cache_evict_bitmap(), id=%d idx=%d n_idx=%d bmp=%p", id, idx, n_idx,
-	       g_bmpcache[id][idx].bitmap);
+/* Number of cells to advertise for a cache that is not persistent. The
+   configured counts are scaled down so that these caches fit the memory
+   budget even if every cell holds a bitmap of the largest size. */
+uint32
+cache_get_bitmap_cells(uint8 id)
+{
+	uint64 worst = 0;
+	uint32 cells = g_bmpcache_cells[id];
+	int i, Bpp = (g_server_depth + 7) / 8;
 
-	ui_destroy_bitmap(g_bmpcache[id][idx].bitmap);
-	--g_bmpcache_count[id];
-	g_bmpcache[id][idx].bitmap = 0;
+	if (g_bmpcache_budget == 0)
+		return cells;
 
-	g_bmpcache_lru[id] = n_idx;
-	g_bmpcache[id][n_idx].previous = NOT_SET;
+	for (i = 0; i < g_bmpcache_num; i++)
+		if (!IS_PERSISTENT(i))
+			worst += (uint64) g_bmpcache_cells[i] * BMPCACHE2_CELL_PIXELS(i) * Bpp;
 
-	pstcache_touch_bitmap(id, idx, 0);
+	if (worst > g_bmpcache_budget)
+	{
+		cells = MAX(1, (uint64) cells * g_bmpcache_budget / worst);
+		logger(Core, Warning,
+		       "cache_get_bitmap_cells(), bitmap cache %d limited to %u cells by memory budget",
+		       id, cells);
+	}
+
+	return cells;
 }
 
 /* Retrieve a bitmap from the cache */
 RD_HBITMAP
 cache_get_bitmap(uint8 id, uint16 idx)
 {
-	if ((id < NUM_ELEMENTS(g_bmpcache)) && (idx < NUM_ELEMENTS(g_bmpcache[0])))
+	struct bmpcache *cache;
+
+	if ((id < g_bmpcache_num) && (idx < VOLATILE_IDX))
 	{
-		if (g_bmpcache[id][idx].bitmap || pstcache_load_bitmap(id, idx))
+		cache = &g_bmpcache[id];
+		if (idx < cache->num_entries && cache->entries[idx].bitmap != NULL)
 		{
-			if (IS_PERSISTENT(id))
-				cache_bump_bitmap(id, idx, BUMP_COUNT);
+			cache->hits++;
+			cache_touch_bitmap(id, idx);
+			return cache->entries[idx].bitmap;
+		}
 
-			return g_bmpcache[id][idx].bitmap;
+		cache->misses++;
+		if (pstcache_load_bitmap(id, idx))
+		{
+			cache->loads++;
+			return cache->entries[idx].bitmap;
 		}
 	}
-	else if ((id < NUM_ELEMENTS(g_volatile_bc)) && (idx == 0x7fff))
+	else if ((id < NUM_ELEMENTS(g_volatile_bc)) && (idx == VOLATILE_IDX))
 	{
 		return g_volatile_bc[id];
 	}
@@ -216,30 +349,39 @@ cache_get_bitmap(uint8 id, uint16 idx)
 	return NULL;
 }
 
-/* Store a bitmap in the cache */
-void
-cache_put_bitmap(uint8 id, uint16 idx, RD_HBITMAP bitmap)
+/* Store a bitmap in the cache, size is its decoded size in bytes */
+static void
+cache_store_bitmap(uint8 id, uint16 idx, RD_HBITMAP bitmap, uint32 size)
 {
+	struct bmpcache *cache;
+	struct bmpcache_entry *entry;
 	RD_HBITMAP old;
 
-	if ((id < NUM_ELEMENTS(g_bmpcache)) && (idx < NUM_ELEMENTS(g_bmpcache[0])))
+	if ((id < g_bmpcache_num) && (idx < VOLATILE_IDX))
 	{
-		old = g_bmpcache[id][idx].bitmap;
-		if (old != NULL)
-			ui_destroy_bitmap(old);
-		g_bmpcache[id][idx].bitmap = bitmap;
+		cache_grow_bitmaps(id, idx);
+		cache = &g_bmpcache[id];
+		entry = &cache->entries[idx];
 
-		if (IS_PERSISTENT(id))
+		if (entry->bitmap != NULL)
 		{
-			if (old == NULL)
-				g_bmpcache[id][idx].previous = g_bmpcache[id][idx].next = NOT_SET;
-
-			cache_bump_bitmap(id, idx, TO_TOP);
-			if (g_bmpcache_count[id] > BMPCACHE2_C2_CELLS)
-				cache_evict_bitmap(id);
+			cache_unlink_bitmap(id, idx);
+			cache_free_bitmap(id, idx);
 		}
+
+		if (bitmap == NULL)
+			return;
+
+		entry->bitmap = bitmap;
+		entry->size = size;
+		cache->bytes += size;
+		g_bmpcache_bytes += size;
+		cache_link_bitmap(id, idx, PROBATION);
+
+		while (IS_PERSISTENT(id) && cache_bitmaps_over_limit(id))
+			cache_evict_bitmap(id);
 	}
-	else if ((id < NUM_ELEMENTS(g_volatile_bc)) && (idx == 0x7fff))
+	else if ((id < NUM_ELEMENTS(g_volatile_bc)) && (idx == VOLATILE_IDX))
 	{
 		old = g_volatile_bc[id];
 		if (old != NULL)
@@ -252,43 +394,129 @@ cache_put_bitmap(uint8 id, uint16 idx, RD_HBITMAP bitmap)
 	}
 }
 
+/* Store a bitmap sent by the server */
+void
+cache_put_bitmap(uint8 id, uint16 idx, RD_HBITMAP bitmap, uint32 size)
+{
+	pstcache_forget(id, idx);
+	cache_store_bitmap(id, idx, bitmap, size);
+}
+
+/* Store a bitmap loaded from the persistent cache, its cell keeps its key */
+void
+cache_load_bitmap(uint8 id, uint16 idx, RD_HBITMAP bitmap, uint32 size)
+{
+	cache_store_bitmap(id, idx, bitmap, size);
+}
+
 /* Updates the persistent bitmap cache MRU information on exit */
 void
 cache_save_state(void)
 {
 	uint32 id = 0, t = 0;
+	uint8 segment;
 	int idx;
 
-	for (id = 0; id < NUM_ELEMENTS(g_bmpcache); id++)
-		if (IS_PERSISTENT(id))
+	for (id = 0; id < (uint32) g_bmpcache_num; id++)
+		if (IS_PERSISTENT(id) && g_bmpcache[id].entries != NULL)
 		{
 			logger(Core, Debug,
 			       "cache_save_state(), saving cache state for bitmap cache %d", id);
-			idx = g_bmpcache_lru[id];
-			while (idx >= 0)
+			/* protected bitmaps get the newest stamps */
+			for (segment = PROBATION; segment <= PROTECTED; segment++)
 			{
-				pstcache_touch_bitmap(id, idx, ++t);
-				idx = g_bmpcache[id][idx].next;
+				idx = g_bmpcache[id].lru[segment];
+				while (idx >= 0)
+				{
+					pstcache_touch_bitmap(id, idx, ++t);
+					idx = g_bmpcache[id].entries[idx].next;
+				}
 			}
-			logger(Core, Debug, "cache_save_state(), %d stamps written", t);
+			logger(Core, Debug, "cache_save_state(), %d stamps updated", t);
 		}
+
+	pstcache_flush();
 }
 
 
 /* FONT CACHE */
-static FONTGLYPH g_fontcache[12][256];
+extern uint16 g_glyphcache_cells[];
+extern uint32 g_glyphcache_budget;
+
+/* largest glyph in bytes of each glyph cache */
+static const uint16 g_glyphcache_cell_size[GLYPHCACHE_NUM_CACHES] =
+	{ 4, 4, 8, 8, 16, 32, 64, 128, 256, 2048 };
+
+#define GLYPH_SIZE(width, height) ((height) * (((width) + 7) / 8))
+
+struct fontcache
+{
+	FONTGLYPH *glyphs;
+	int num_glyphs;
+	uint32 bytes;
+	uint32 hits;
+	uint32 misses;
+};
+
+static struct fontcache g_fontcache[GLYPHCACHE_NUM_CACHES];
+static uint32 g_fontcache_bytes;
+
+/* Get the largest glyph in bytes of a glyph cache */
+uint16
+cache_get_glyph_cell_size(uint8 font)
+{
+	return g_glyphcache_cell_size[font];
+}
+
+/* Get the cell count to advertise for a glyph cache. Like bitmap caches
+   the glyph caches never evict, so the configured counts are scaled down
+   to fit the memory budget if every cell holds a glyph of the largest
+   size. */
+uint16
+cache_get_glyph_cells(uint8 font)
+{
+	uint32 worst = 0;
+	uint16 cells = g_glyphcache_cells[font];
+	int i;
+
+	if (g_glyphcache_budget == 0)
+		return cells;
+
+	for (i = 0; i < GLYPHCACHE_NUM_CACHES; i++)
+		worst += g_glyphcache_cells[i] * g_glyphcache_cell_size[i];
+
+	if (worst > g_glyphcache_budget)
+	{
+		cells = MAX(1, (uint64) cells * g_glyphcache_budget / worst);
+		logger(Core, Warning,
+		       "cache_get_glyph_cells(), glyph cache %d limited to %u cells by memory budget",
+		       font, cells);
+	}
+
+	return cells;
+}
 
 /* Retrieve a glyph from the font cache */
 FONTGLYPH *
 cache_get_font(uint8 font, uint16 character)
 {
+	struct fontcache *cache;
 	FONTGLYPH *glyph;
 
-	if ((font < NUM_ELEMENTS(g_fontcache)) && (character < NUM_ELEMENTS(g_fontcache[0])))
+	if (font < GLYPHCACHE_NUM_CACHES)
 	{
-		glyph = &g_fontcache[font][character];
-		if (glyph->pixmap != NULL)
-			return glyph;
+		cache = &g_fontcache[font];
+		if (character < cache->num_glyphs)
+		{
+			glyph = &cache->glyphs[character];
+			if (glyph->pixmap != NULL)
+			{
+				cache->hits++;
+				return glyph;
+			}
+		}
+
+		cache->misses++;
 	}
 
 	logger(Core, Debug, "cache_get_font(), font=%d, char=%d", font, character);
@@ -300,19 +528,39 @@ void
 cache_put_font(uint8 font, uint16 character, uint16 offset,
 	       uint16 baseline, uint16 width, uint16 height, RD_HGLYPH pixmap)
 {
+	struct fontcache *cache;
 	FONTGLYPH *glyph;
+	int n;
 
-	if ((font < NUM_ELEMENTS(g_fontcache)) && (character < NUM_ELEMENTS(g_fontcache[0])))
+	/* servers that ignore the advertised cell counts used to get 256 */
+	if ((font < GLYPHCACHE_NUM_CACHES) && (character < 256))
 	{
-		glyph = &g_fontcache[font][character];
+		cache = &g_fontcache[font];
+		if (character >= cache->num_glyphs)
+		{
+			n = MAX(character + 1, g_glyphcache_cells[font]);
+			cache->glyphs = xrealloc(cache->glyphs, n * sizeof(FONTGLYPH));
+			memset(&cache->glyphs[cache->num_glyphs], 0,
+			       (n - cache->num_glyphs) * sizeof(FONTGLYPH));
+			cache->num_glyphs = n;
+		}
+
+		glyph = &cache->glyphs[character];
 		if (glyph->pixmap != NULL)
+		{
 			ui_destroy_glyph(glyph->pixmap);
+			cache->bytes -= GLYPH_SIZE(glyph->width, glyph->height);
+			g_fontcache_bytes -= GLYPH_SIZE(glyph->width, glyph->height);
+		}
 
 		glyph->offset = offset;
 		glyph->baseline = baseline;
 		glyph->width = width;
 		glyph->height = height;
 		glyph->pixmap = pixmap;
+
+		cache->bytes += GLYPH_SIZE(width, height);
+		g_fontcache_bytes += GLYPH_SIZE(width, height);
 	}
 	else
 	{
@@ -475,3 +723,168 @@ cache_put_brush_data(uint8 colour_code, uint8 idx, BRUSHDATA * brush_data)
 		logger(Core, Error, "cache_put_brush_data(), colour=%d, idx=%d", colour_code, idx);
 	}
 }
+
+
+/* BRUSH PIXMAP CACHE */
+/* Stipples and tiles made from brushes, so that repeated pattern fills
+   don't create and free a pixmap each time. Stipples only depend on the
+   pattern bytes, the colours are set on the GC. Tiles are translated from
+   server pixels, so they also depend on the server depth, which is part
+   of the key, and the palette, which flushes the cache. */
+#define BRUSH_PIXMAP_ENTRIES 64
+#define BRUSH_PIXMAP_DATA (8 * 8 * 4)
+
+struct brush_pixmap_entry
+{
+	void *pixmap;
+	uint8 kind;
+	uint8 depth;
+	uint16 size;
+	uint32 hash;
+	uint32 stamp;
+	uint8 data[BRUSH_PIXMAP_DATA];
+};
+
+static struct brush_pixmap_entry g_brush_pixmaps[BRUSH_PIXMAP_ENTRIES];
+static uint32 g_brush_pixmap_stamp;
+static uint32 g_brush_pixmap_hits;
+static uint32 g_brush_pixmap_misses;
+
+static uint32
+cache_brush_pixmap_hash(uint8 kind, uint8 * data, int size)
+{
+	uint32 hash = 2166136261u ^ kind;
+	int i;
+
+	for (i = 0; i < size; i++)
+		hash = (hash ^ data[i]) * 16777619u;
+
+	return hash;
+}
+
+static void
+cache_destroy_brush_pixmap(struct brush_pixmap_entry *entry)
+{
+	if (entry->kind == BRUSH_PIXMAP_TILE)
+		ui_destroy_bitmap((RD_HBITMAP) entry->pixmap);
+	else
+		ui_destroy_glyph((RD_HGLYPH) entry->pixmap);
+
+	entry->pixmap = NULL;
+}
+
+/* Retrieve a brush pixmap made from the given pattern data */
+void *
+cache_get_brush_pixmap(uint8 kind, uint8 * data, int size)
+{
+	struct brush_pixmap_entry *entry;
+	uint32 hash;
+	int i;
+
+	hash = cache_brush_pixmap_hash(kind, data, size);
+	for (i = 0; i < BRUSH_PIXMAP_ENTRIES; i++)
+	{
+		entry = &g_brush_pixmaps[i];
+		if (entry->pixmap != NULL && entry->hash == hash && entry->kind == kind
+		    && entry->depth == g_server_depth && entry->size == size
+		    && memcmp(entry->data, data, size) == 0)
+		{
+			entry->stamp = ++g_brush_pixmap_stamp;
+			g_brush_pixmap_hits++;
+			return entry->pixmap;
+		}
+	}
+
+	g_brush_pixmap_misses++;
+	return NULL;
+}
+
+/* Store a brush pixmap, replacing the least recently used one when full */
+void
+cache_put_brush_pixmap(uint8 kind, uint8 * data, int size, void *pixmap)
+{
+	struct brush_pixmap_entry *entry, *lru;
+	int i;
+
+	if (size > BRUSH_PIXMAP_DATA)
+	{
+		logger(Core, Error, "cache_put_brush_pixmap(), failed, size=%d", size);
+		return;
+	}
+
+	lru = &g_brush_pixmaps[0];
+	for (i = 0; i < BRUSH_PIXMAP_ENTRIES; i++)
+	{
+		entry = &g_brush_pixmaps[i];
+		if (entry->pixmap == NULL)
+		{
+			lru = entry;
+			break;
+		}
+		if (entry->stamp < lru->stamp)
+			lru = entry;
+	}
+
+	if (lru->pixmap != NULL)
+		cache_destroy_brush_pixmap(lru);
+
+	lru->pixmap = pixmap;
+	lru->kind = kind;
+	lru->depth = g_server_depth;
+	lru->size = size;
+	lru->hash = cache_brush_pixmap_hash(kind, data, size);
+	lru->stamp = ++g_brush_pixmap_stamp;
+	memcpy(lru->data, data, size);
+}
+
+/* Drop all brush pixmaps, tiles are translated with the current palette */
+void
+cache_flush_brush_pixmaps(void)
+{
+	int i;
+
+	for (i = 0; i < BRUSH_PIXMAP_ENTRIES; i++)
+		if (g_brush_pixmaps[i].pixmap != NULL)
+			cache_destroy_brush_pixmap(&g_brush_pixmaps[i]);
+}
+
+
+/* Log cache effectiveness on exit */
+void
+cache_log_stats(void)
+{
+	struct bmpcache *cache;
+	struct fontcache *font;
+	uint32 total;
+	int id;
+
+	for (id = 0; id < g_bmpcache_num; id++)
+	{
+		cache = &g_bmpcache[id];
+		total = cache->hits + cache->misses;
+		if (total > 0)
+			logger(Core, Debug,
+			       "cache_log_stats(), bitmap cache %d: %u hits, %u misses (%u loaded from disk), %u evictions, %u%%, %u bytes",
+			       id, cache->hits, cache->misses, cache->loads, cache->evictions,
+			       (uint32) ((uint64) cache->hits * 100 / total), cache->bytes);
+	}
+
+	for (id = 0; id < GLYPHCACHE_NUM_CACHES; id++)
+	{
+		font = &g_fontcache[id];
+		total = font->hits + font->misses;
+		if (total > 0)
+			logger(Core, Debug,
+			       "cache_log_stats(), glyph cache %d: %u hits, %u misses, %u%%, %u bytes",
+			       id, font->hits, font->misses,
+			       (uint32) ((uint64) font->hits * 100 / total), font->bytes);
+	}
+	if (g_fontcache_bytes > 0)
+		logger(Core, Debug, "cache_log_stats(), glyph caches: %u bytes", g_fontcache_bytes);
+
+	total = g_brush_pixmap_hits + g_brush_pixmap_misses;
+	if (total > 0)
+		logger(Core, Debug, "cache_log_stats(), brush pixmaps: %u hits, %u misses, %u%%",
+		       g_brush_pixmap_hits, g_brush_pixmap_misses,
+		       (uint32) ((uint64) g_brush_pixmap_hits * 100 / total));
+}
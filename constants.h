@@ -60,6 +60,22 @@
 
 #define RDESKTOP_FASTPATH_MULTIFRAGMENT_MAX_SIZE 65535
 
+/* [MS-RDPBCGR] 2.2.8.1.2 */
+#define FASTPATH_INPUT_ACTION_FASTPATH	0x0
+#define FASTPATH_INPUT_SECURE_CHECKSUM	(0x1 << 6)
+#define FASTPATH_INPUT_ENCRYPTED	(0x2 << 6)
+
+/* [MS-RDPBCGR] 2.2.8.1.2.2 */
+#define FASTPATH_INPUT_EVENT_SCANCODE	0x0
+#define FASTPATH_INPUT_EVENT_MOUSE	0x1
+#define FASTPATH_INPUT_EVENT_MOUSEX	0x2
+#define FASTPATH_INPUT_EVENT_SYNC	0x3
+#define FASTPATH_INPUT_EVENT_UNICODE	0x4
+
+#define FASTPATH_INPUT_KBDFLAGS_RELEASE		0x01
+#define FASTPATH_INPUT_KBDFLAGS_EXTENDED	0x02
+#define FASTPATH_INPUT_KBDFLAGS_EXTENDED1	0x04
+
 /* ISO PDU codes */
 enum ISO_PDU_CODE
 {
@@ -281,6 +297,7 @@ enum RDP_INPUT_DEVICE
 	RDP_INPUT_CODEPOINT = 1,
 	RDP_INPUT_VIRTKEY = 2,
 	RDP_INPUT_SCANCODE = 4,
+	RDP_INPUT_UNICODE = 5,
 	RDP_INPUT_MOUSE = 0x8001,
 	RDP_INPUT_MOUSEX = 0x8002
 };
@@ -336,6 +353,17 @@ enum RDP_INPUT_DEVICE
 #define BMPCACHE2_C1_CELLS	0x78
 #define BMPCACHE2_C2_CELLS	0x150
 #define BMPCACHE2_NUM_PSTCELLS	0x9f6
+#define BMPCACHE2_MAX_CACHES	5
+/* max cell size for cache 0 is 16x16, 1 = 32x32, 2 = 64x64, etc */
+#define BMPCACHE2_CELL_PIXELS(id)	(0x100 << ((id) * 2))
+
+/* RDP glyph cache constants */
+#define GLYPHCACHE_NUM_CACHES	10
+#define GLYPHCACHE_MAX_CELLS	254
+
+/* Kinds of cached brush pixmaps */
+#define BRUSH_PIXMAP_STIPPLE	0
+#define BRUSH_PIXMAP_TILE	1
 
 #define PDU_FLAG_FIRST		0x01
 #define PDU_FLAG_LAST		0x02
@@ -412,6 +440,7 @@ enum RDP_INPUT_DEVICE
 #define RDP_INFO_COMPRESSION	      0x00000080	/* mppc compression with 8kB history buffer */
 #define RDP_INFO_ENABLEWINDOWSKEY     0x00000100
 #define RDP_INFO_COMPRESSION2	      0x00000200	/* rdp5 mppc compression with 64kB history buffer */
+#define RDP_INFO_COMPRESSION_TYPE_MASK 0x00001e00	/* PACKET_COMPR_TYPE_* << 9 */
 #define RDP_INFO_REMOTE_CONSOLE_AUDIO 0x00002000
 #define RDP_INFO_PASSWORD_IS_SC_PIN   0x00040000
 
@@ -430,6 +459,20 @@ enum RDP_INPUT_DEVICE
 #define RDP_MPPC_RESET		0x40
 #define RDP_MPPC_FLUSH		0x80
 #define RDP_MPPC_DICT_SIZE      65536
+#define RDP_MPPC_TYPE_MASK	0x0f
+
+/* bulk compression types, in the low bits of compressionFlags */
+#define PACKET_COMPR_TYPE_8K	0x0
+#define PACKET_COMPR_TYPE_64K	0x1
+#define PACKET_COMPR_TYPE_RDP6	0x2
+#define PACKET_COMPR_TYPE_RDP61	0x3
+
+/* RDP 6.1 bulk compression, RDP61_COMPRESSED_DATA.Level1ComprFlags */
+#define RDP61_L1_COMPRESSED		0x01
+#define RDP61_L1_NO_COMPRESSION		0x02
+#define RDP61_L1_PACKET_AT_FRONT	0x04
+#define RDP61_L1_INNER_COMPRESSION	0x10
+#define XCRUSH_HISTORY_SIZE	2000000
 
 #define RDP5_COMPRESSED		0x80
 
@@ -805,6 +848,10 @@ enum RDP_DESKTOP_ORIENTATION
 #define GLYPH_SUPPORT_FULL    0x0002
 #define GLYPH_SUPPORT_ENCODE  0x0003
 
+/* [MS-RDPEGDI] 2.2.2.2.1.2.6 */
+#define CG_GLYPH_UNICODE_PRESENT	0x0010
+#define CG_GLYPH_REV2			0x0020
+
 /* [MS-RDPBCGR] 2.2.7.1.11 */
 #define SOUND_BEEPS_FLAG 0x0001
 
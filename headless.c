@@ -0,0 +1,895 @@
+/* -*- c-basic-offset: 8 -*-
+   rdesktop: A Remote Desktop Protocol client.
+   User interface services - headless in-memory framebuffer
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+   This is a replacement for xwin.c that renders into the software
+   framebuffer of swfb.c only and does not need an X server. It
+   is built as the separate rdesktop-headless binary and is meant for
+   profiling the decode and order pipeline, typically together with
+   session replay (-Y).
+
+   Time spent in each drawing primitive is accounted and reported when
+   the UI is deinitialized, together with a checksum of the final
+   framebuffer contents that can be used to compare renderings.
+*/
+
+#include <errno.h>
+#include <time.h>
+#include <sys/select.h>
+
+#include "rdesktop.h"
+
+#define HEADLESS_SCREEN_WIDTH	1920
+#define HEADLESS_SCREEN_HEIGHT	1080
+
+extern RD_BOOL g_exit_mainloop;
+
+/* used by rdp.c and defined by the X11 backend */
+time_t g_wait_for_deactivate_ts = 0;
+RD_BOOL g_dynamic_session_resize = False;
+
+typedef struct
+{
+	int width;
+	int height;
+	int scanline;
+	uint8 *data;		/* 1 bpp, MSB first */
+}
+hl_glyph;
+
+enum HEADLESS_PRIMITIVE
+{
+	HL_PAINT_BITMAP,
+	HL_CREATE_BITMAP,
+	HL_CREATE_GLYPH,
+	HL_DESTBLT,
+	HL_PATBLT,
+	HL_SCREENBLT,
+	HL_MEMBLT,
+	HL_TRIBLT,
+	HL_LINE,
+	HL_RECT,
+	HL_POLYGON,
+	HL_POLYLINE,
+	HL_ELLIPSE,
+	HL_DRAW_GLYPH,
+	HL_DRAW_TEXT,
+	HL_DESKTOP_SAVE,
+	HL_DESKTOP_RESTORE,
+	HL_PRIMITIVE_COUNT
+};
+
+static const char *hl_primitive_names[HL_PRIMITIVE_COUNT] = {
+	"paint_bitmap",
+	"create_bitmap",
+	"create_glyph",
+	"destblt",
+	"patblt",
+	"screenblt",
+	"memblt",
+	"triblt",
+	"line",
+	"rect",
+	"polygon",
+	"polyline",
+	"ellipse",
+	"draw_glyph",
+	"draw_text",
+	"desktop_save",
+	"desktop_restore"
+};
+
+static struct
+{
+	uint32 calls;
+	uint64 ns;
+}
+hl_stats[HL_PRIMITIVE_COUNT];
+
+static uint32 g_fb_checksum = 0;
+static int g_null_cursor;
+
+#define HL_TIMER_START(ts)	clock_gettime(CLOCK_MONOTONIC, &ts)
+#define HL_TIMER_STOP(prim, ts)	hl_account(prim, &ts)
+
+static void
+hl_account(int primitive, struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	hl_stats[primitive].calls++;
+	hl_stats[primitive].ns += (uint64) (now.tv_sec - start->tv_sec) * 1000000000 +
+		(now.tv_nsec - start->tv_nsec);
+}
+
+/* Draw a glyph, transparent draws only the set pixels */
+static void
+hl_draw_glyph(hl_glyph * glyph, int x, int y, uint32 fgcolour, uint32 bgcolour,
+	      RD_BOOL transparent)
+{
+	swfb_draw_glyph(glyph->data, glyph->scanline, glyph->width, glyph->height, x, y,
+			fgcolour, bgcolour, transparent);
+}
+
+RD_BOOL
+ui_init(void)
+{
+	/* 0x00RRGGBB, the framebuffer format of swfb.c */
+	PIXEL_FORMAT format = { 4, False, 0, 16, 0, 8, 0, 0 };
+
+	memset(hl_stats, 0, sizeof(hl_stats));
+	bitmap_set_format(&format);
+	logger(GUI, Verbose, "ui_init(), using headless in-memory framebuffer");
+	return True;
+}
+
+void
+ui_get_screen_size(uint32 * width, uint32 * height)
+{
+	*width = HEADLESS_SCREEN_WIDTH;
+	*height = HEADLESS_SCREEN_HEIGHT;
+}
+
+void
+ui_get_screen_size_from_percentage(uint32 pw, uint32 ph, uint32 * width, uint32 * height)
+{
+	*width = HEADLESS_SCREEN_WIDTH * pw / 100;
+	*height = HEADLESS_SCREEN_HEIGHT * ph / 100;
+}
+
+void
+ui_get_workarea_size(uint32 * width, uint32 * height)
+{
+	ui_get_screen_size(width, height);
+}
+
+void
+ui_deinit(void)
+{
+	uint64 total_ns = 0;
+	uint32 total_calls = 0;
+	int i;
+
+	logger(GUI, Notice, "Headless rendering statistics:");
+	for (i = 0; i < HL_PRIMITIVE_COUNT; i++)
+	{
+		if (hl_stats[i].calls == 0)
+			continue;
+
+		logger(GUI, Notice, "  %-16s %10u calls %12.3f ms %10.1f ns/call",
+		       hl_primitive_names[i], hl_stats[i].calls, hl_stats[i].ns / 1000000.0,
+		       (double) hl_stats[i].ns / hl_stats[i].calls);
+		total_calls += hl_stats[i].calls;
+		total_ns += hl_stats[i].ns;
+	}
+	logger(GUI, Notice, "  %-16s %10u calls %12.3f ms", "total", total_calls,
+	       total_ns / 1000000.0);
+
+	if (swfb_screen() != NULL)
+		g_fb_checksum = swfb_checksum();
+	logger(GUI, Notice, "  framebuffer checksum 0x%08x", g_fb_checksum);
+
+	swfb_set_colourmap(NULL);
+}
+
+RD_BOOL
+ui_create_window(uint32 width, uint32 height)
+{
+	swfb_create(width, height);
+	return True;
+}
+
+void
+ui_resize_window(uint32 width, uint32 height)
+{
+	swfb_resize(width, height);
+}
+
+void
+ui_destroy_window(void)
+{
+	g_fb_checksum = swfb_checksum();
+	swfb_destroy();
+}
+
+void
+ui_update_window_sizehints(uint32 width, uint32 height)
+{
+	UNUSED(width);
+	UNUSED(height);
+}
+
+RD_BOOL
+ui_have_window(void)
+{
+	return swfb_screen() != NULL;
+}
+
+/* Wait for data on rdp_socket, serving the other channels meanwhile,
+   see the X11 version of this function */
+void
+ui_select(int rdp_socket)
+{
+	int n, ret;
+	fd_set rfds, wfds;
+	struct timeval tv;
+	RD_BOOL s_timeout;
+
+	while (g_exit_mainloop == False)
+	{
+		n = rdp_socket;
+		s_timeout = False;
+
+		FD_ZERO(&rfds);
+		FD_ZERO(&wfds);
+		FD_SET(rdp_socket, &rfds);
+
+		tv.tv_sec = 60;
+		tv.tv_usec = 0;
+
+		/* load persistent cache bitmaps a few at a time while idle */
+		if (pstcache_precache())
+			tv.tv_sec = 0;
+
+#ifdef WITH_RDPSND
+		rdpsnd_add_fds(&n, &rfds, &wfds, &tv);
+#endif
+		rdpdr_add_fds(&n, &rfds, &wfds, &tv, &s_timeout);
+		seamless_select_timeout(&tv);
+		ctrl_add_fds(&n, &rfds);
+
+		n++;
+
+		ret = select(n, &rfds, &wfds, NULL, &tv);
+		if (ret <= 0)
+		{
+			if (ret == -1 && errno != EINTR)
+				logger(GUI, Error, "ui_select(), select failed: %s",
+				       strerror(errno));
+#ifdef WITH_RDPSND
+			rdpsnd_check_fds(&rfds, &wfds);
+#endif
+			if (s_timeout)
+				rdpdr_check_fds(&rfds, &wfds, (RD_BOOL) True);
+			continue;
+		}
+
+#ifdef WITH_RDPSND
+		rdpsnd_check_fds(&rfds, &wfds);
+#endif
+		rdpdr_check_fds(&rfds, &wfds, (RD_BOOL) False);
+		ctrl_check_fds(&rfds, &wfds);
+
+		if (FD_ISSET(rdp_socket, &rfds))
+			return;
+	}
+}
+
+void
+ui_move_pointer(int x, int y)
+{
+	UNUSED(x);
+	UNUSED(y);
+}
+
+RD_HBITMAP
+ui_create_bitmap(int width, int height, uint8 * data)
+{
+	struct timespec ts;
+	SWFB_SURFACE *bmp;
+
+	HL_TIMER_START(ts);
+	bmp = swfb_create_surface(width, height, data, False);
+	HL_TIMER_STOP(HL_CREATE_BITMAP, ts);
+	return (RD_HBITMAP) bmp;
+}
+
+void
+ui_paint_bitmap(int x, int y, int cx, int cy, int width, int height, uint8 * data)
+{
+	struct timespec ts;
+
+	HL_TIMER_START(ts);
+	swfb_paint(x, y, cx, cy, width, height, data, False);
+	HL_TIMER_STOP(HL_PAINT_BITMAP, ts);
+}
+
+RD_HBITMAP
+ui_create_bitmap_native(int width, int height, uint8 * data)
+{
+	struct timespec ts;
+	SWFB_SURFACE *bmp;
+
+	HL_TIMER_START(ts);
+	bmp = swfb_create_surface(width, height, data, True);
+	HL_TIMER_STOP(HL_CREATE_BITMAP, ts);
+	return (RD_HBITMAP) bmp;
+}
+
+void
+ui_paint_bitmap_native(int x, int y, int cx, int cy, int width, int height, uint8 * data)
+{
+	struct timespec ts;
+
+	HL_TIMER_START(ts);
+	swfb_paint(x, y, cx, cy, width, height, data, True);
+	HL_TIMER_STOP(HL_PAINT_BITMAP, ts);
+}
+
+void
+ui_destroy_bitmap(RD_HBITMAP bmp)
+{
+	swfb_destroy_surface((SWFB_SURFACE *) bmp);
+}
+
+RD_HGLYPH
+ui_create_glyph(int width, int height, uint8 * data)
+{
+	struct timespec ts;
+	hl_glyph *glyph;
+
+	HL_TIMER_START(ts);
+
+	glyph = (hl_glyph *) xmalloc(sizeof(hl_glyph));
+	glyph->width = width;
+	glyph->height = height;
+	glyph->scanline = (width + 7) / 8;
+	glyph->data = (uint8 *) xmalloc(glyph->scanline * height);
+	memcpy(glyph->data, data, glyph->scanline * height);
+
+	HL_TIMER_STOP(HL_CREATE_GLYPH, ts);
+	return (RD_HGLYPH) glyph;
+}
+
+void
+ui_destroy_glyph(RD_HGLYPH glyph)
+{
+	hl_glyph *g = (hl_glyph *) glyph;
+
+	xfree(g->data);
+	xfree(g);
+}
+
+RD_HCURSOR
+ui_create_cursor(unsigned int x, unsigned int y, uint32 width, uint32 height,
+		 uint8 * andmask, uint8 * xormask, int bpp)
+{
+	UNUSED(x);
+	UNUSED(y);
+	UNUSED(width);
+	UNUSED(height);
+	UNUSED(andmask);
+	UNUSED(xormask);
+	UNUSED(bpp);
+
+	return (RD_HCURSOR) & g_null_cursor;
+}
+
+void
+ui_set_cursor(RD_HCURSOR cursor)
+{
+	UNUSED(cursor);
+}
+
+void
+ui_destroy_cursor(RD_HCURSOR cursor)
+{
+	UNUSED(cursor);
+}
+
+void
+ui_set_null_cursor(void)
+{
+}
+
+void
+ui_set_standard_cursor(void)
+{
+}
+
+RD_HCOLOURMAP
+ui_create_colourmap(COLOURMAP * colours)
+{
+	return swfb_create_colourmap(colours);
+}
+
+void
+ui_destroy_colourmap(RD_HCOLOURMAP map)
+{
+	xfree(map);
+}
+
+void
+ui_set_colourmap(RD_HCOLOURMAP map)
+{
+	swfb_set_colourmap(map);
+}
+
+void
+ui_set_clip(int x, int y, int cx, int cy)
+{
+	swfb_set_clip(x, y, cx, cy);
+}
+
+void
+ui_reset_clip(void)
+{
+	SWFB_SURFACE *fb = swfb_screen();
+
+	if (fb != NULL)
+		swfb_set_clip(0, 0, fb->width, fb->height);
+}
+
+void
+ui_bell(void)
+{
+}
+
+void
+ui_destblt(uint8 opcode,
+	   /* dest */ int x, int y, int cx, int cy)
+{
+	struct timespec ts;
+
+	HL_TIMER_START(ts);
+	swfb_fill(opcode, x, y, cx, cy, 0);
+	HL_TIMER_STOP(HL_DESTBLT, ts);
+}
+
+void
+ui_patblt(uint8 opcode,
+	  /* dest */ int x, int y, int cx, int cy,
+	  /* brush */ BRUSH * brush, uint32 bgcolour, uint32 fgcolour)
+{
+	struct timespec ts;
+
+	HL_TIMER_START(ts);
+	swfb_patblt(opcode, x, y, cx, cy, brush, bgcolour, fgcolour);
+	HL_TIMER_STOP(HL_PATBLT, ts);
+}
+
+void
+ui_screenblt(uint8 opcode,
+	     /* dest */ int x, int y, int cx, int cy,
+	     /* src */ int srcx, int srcy)
+{
+	struct timespec ts;
+
+	HL_TIMER_START(ts);
+	swfb_blit(opcode, x, y, cx, cy, swfb_screen(), srcx, srcy);
+	HL_TIMER_STOP(HL_SCREENBLT, ts);
+}
+
+void
+ui_memblt(uint8 opcode,
+	  /* dest */ int x, int y, int cx, int cy,
+	  /* src */ RD_HBITMAP src, int srcx, int srcy)
+{
+	struct timespec ts;
+
+	HL_TIMER_START(ts);
+	swfb_blit(opcode, x, y, cx, cy, (SWFB_SURFACE *) src, srcx, srcy);
+	HL_TIMER_STOP(HL_MEMBLT, ts);
+}
+
+void
+ui_triblt(uint8 opcode,
+	  /* dest */ int x, int y, int cx, int cy,
+	  /* src */ RD_HBITMAP src, int srcx, int srcy,
+	  /* brush */ BRUSH * brush, uint32 bgcolour, uint32 fgcolour)
+{
+	struct timespec ts;
+
+	HL_TIMER_START(ts);
+
+	swfb_triblt(opcode, x, y, cx, cy, (SWFB_SURFACE *) src, srcx, srcy, brush, bgcolour,
+		    fgcolour);
+
+	HL_TIMER_STOP(HL_TRIBLT, ts);
+}
+
+void
+ui_line(uint8 opcode,
+	/* dest */ int startx, int starty, int endx, int endy,
+	/* pen */ PEN * pen)
+{
+	struct timespec ts;
+
+	HL_TIMER_START(ts);
+	swfb_line(opcode, startx, starty, endx, endy, pen->colour);
+	HL_TIMER_STOP(HL_LINE, ts);
+}
+
+void
+ui_rect(
+	       /* dest */ int x, int y, int cx, int cy,
+	       /* brush */ uint32 colour)
+{
+	struct timespec ts;
+
+	HL_TIMER_START(ts);
+	swfb_fill(ROP2_COPY, x, y, cx, cy, colour);
+	HL_TIMER_STOP(HL_RECT, ts);
+}
+
+void
+ui_polygon(uint8 opcode,
+	   /* mode */ uint8 fillmode,
+	   /* dest */ RD_POINT * point, int npoints,
+	   /* brush */ BRUSH * brush, uint32 bgcolour, uint32 fgcolour)
+{
+	struct timespec ts;
+
+	HL_TIMER_START(ts);
+
+	if (fillmode != ALTERNATE && fillmode != WINDING)
+		logger(GUI, Warning, "Unimplemented fill mode %d", fillmode);
+
+	swfb_polygon(opcode, fillmode, point, npoints, brush, bgcolour, fgcolour);
+
+	HL_TIMER_STOP(HL_POLYGON, ts);
+}
+
+void
+ui_polyline(uint8 opcode,
+	    /* dest */ RD_POINT * points, int npoints,
+	    /* pen */ PEN * pen)
+{
+	struct timespec ts;
+
+	HL_TIMER_START(ts);
+	swfb_polyline(opcode, points, npoints, pen->colour);
+
+	HL_TIMER_STOP(HL_POLYLINE, ts);
+}
+
+void
+ui_ellipse(uint8 opcode,
+	   /* mode */ uint8 fillmode,
+	   /* dest */ int x, int y, int cx, int cy,
+	   /* brush */ BRUSH * brush, uint32 bgcolour, uint32 fgcolour)
+{
+	struct timespec ts;
+
+	HL_TIMER_START(ts);
+	swfb_ellipse(opcode, fillmode, x, y, cx, cy, brush, bgcolour, fgcolour);
+
+	HL_TIMER_STOP(HL_ELLIPSE, ts);
+}
+
+void
+ui_draw_glyph(int mixmode,
+	      /* dest */ int x, int y, int cx, int cy,
+	      /* src */ RD_HGLYPH glyph, int srcx, int srcy,
+	      uint32 bgcolour, uint32 fgcolour)
+{
+	struct timespec ts;
+
+	UNUSED(cx);
+	UNUSED(cy);
+	UNUSED(srcx);
+	UNUSED(srcy);
+
+	HL_TIMER_START(ts);
+	hl_draw_glyph((hl_glyph *) glyph, x, y, fgcolour, bgcolour, mixmode == MIX_TRANSPARENT);
+	HL_TIMER_STOP(HL_DRAW_GLYPH, ts);
+}
+
+#define DO_GLYPH(ttext,idx) \
+{\
+  glyph = cache_get_font (font, ttext[idx]);\
+  if (!(flags & TEXT2_IMPLICIT_X))\
+  {\
+    xyoffset = ttext[++idx];\
+    if ((xyoffset & 0x80))\
+    {\
+      if (flags & TEXT2_VERTICAL)\
+        y += ttext[idx+1] | (ttext[idx+2] << 8);\
+      else\
+        x += ttext[idx+1] | (ttext[idx+2] << 8);\
+      idx += 2;\
+    }\
+    else\
+    {\
+      if (flags & TEXT2_VERTICAL)\
+        y += xyoffset;\
+      else\
+        x += xyoffset;\
+    }\
+  }\
+  if (glyph != NULL)\
+  {\
+    x1 = x + glyph->offset;\
+    y1 = y + glyph->baseline;\
+    hl_draw_glyph((hl_glyph *) glyph->pixmap, x1, y1, fgcolour, fgcolour, True);\
+    if (flags & TEXT2_IMPLICIT_X)\
+      x += glyph->width;\
+  }\
+}
+
+void
+ui_draw_text(uint8 font, uint8 flags, uint8 opcode, int mixmode, int x, int y,
+	     int clipx, int clipy, int clipcx, int clipcy,
+	     int boxx, int boxy, int boxcx, int boxcy, BRUSH * brush,
+	     uint32 bgcolour, uint32 fgcolour, uint8 * text, uint8 length)
+{
+	struct timespec ts;
+	SWFB_SURFACE *fb;
+	FONTGLYPH *glyph;
+	int i, j, xyoffset, x1, y1;
+	DATABLOB *entry;
+
+	UNUSED(opcode);
+	UNUSED(brush);
+
+	HL_TIMER_START(ts);
+
+	fb = swfb_screen();
+	if (fb != NULL && boxx + boxcx > fb->width)
+		boxcx = fb->width - boxx;
+
+	if (boxcx > 1)
+		swfb_fill(ROP2_COPY, boxx, boxy, boxcx, boxcy, bgcolour);
+	else if (mixmode == MIX_OPAQUE)
+		swfb_fill(ROP2_COPY, clipx, clipy, clipcx, clipcy, bgcolour);
+
+	/* Paint text, character by character */
+	for (i = 0; i < length;)
+	{
+		switch (text[i])
+		{
+			case 0xff:
+				/* At least two bytes needs to follow */
+				if (i + 3 > length)
+				{
+					logger(GUI, Warning,
+					       "ui_draw_text(), skipping short 0xff command");
+					i = length = 0;
+					break;
+				}
+				cache_put_text(text[i + 1], text, text[i + 2]);
+				i += 3;
+				length -= i;
+				/* this will move pointer from start to first character after FF command */
+				text = &(text[i]);
+				i = 0;
+				break;
+
+			case 0xfe:
+				/* At least one byte needs to follow */
+				if (i + 2 > length)
+				{
+					logger(GUI, Warning,
+					       "ui_draw_text(), skipping short 0xfe command");
+					i = length = 0;
+					break;
+				}
+				entry = cache_get_text(text[i + 1]);
+				if (entry->data != NULL)
+				{
+					if ((((uint8 *) (entry->data))[1] == 0)
+					    && (!(flags & TEXT2_IMPLICIT_X)) && (i + 2 < length))
+					{
+						if (flags & TEXT2_VERTICAL)
+							y += text[i + 2];
+						else
+							x += text[i + 2];
+					}
+					for (j = 0; j < entry->size; j++)
+						DO_GLYPH(((uint8 *) (entry->data)), j);
+				}
+				if (i + 2 < length)
+					i += 3;
+				else
+					i += 2;
+				length -= i;
+				/* this will move pointer from start to first character after FE command */
+				text = &(text[i]);
+				i = 0;
+				break;
+
+			default:
+				DO_GLYPH(text, i);
+				i++;
+				break;
+		}
+	}
+
+	HL_TIMER_STOP(HL_DRAW_TEXT, ts);
+}
+
+void
+ui_desktop_save(uint32 offset, int x, int y, int cx, int cy)
+{
+	struct timespec ts;
+
+	HL_TIMER_START(ts);
+	swfb_desktop_save(offset, x, y, cx, cy);
+	HL_TIMER_STOP(HL_DESKTOP_SAVE, ts);
+}
+
+void
+ui_desktop_restore(uint32 offset, int x, int y, int cx, int cy)
+{
+	struct timespec ts;
+
+	HL_TIMER_START(ts);
+	swfb_desktop_restore(offset, x, y, cx, cy);
+	HL_TIMER_STOP(HL_DESKTOP_RESTORE, ts);
+}
+
+void
+ui_begin_update(void)
+{
+}
+
+void
+ui_end_update(void)
+{
+}
+
+/* Seamless windows need a window system, these are never reached as
+   seamless_init() is not called by this backend */
+void
+ui_seamless_begin(RD_BOOL hidden)
+{
+	UNUSED(hidden);
+}
+
+void
+ui_seamless_end()
+{
+}
+
+void
+ui_seamless_hide_desktop(void)
+{
+}
+
+void
+ui_seamless_unhide_desktop(void)
+{
+}
+
+void
+ui_seamless_toggle(void)
+{
+}
+
+void
+ui_seamless_create_window(unsigned long id, unsigned long group, unsigned long parent,
+			  unsigned long flags)
+{
+	UNUSED(id);
+	UNUSED(group);
+	UNUSED(parent);
+	UNUSED(flags);
+}
+
+void
+ui_seamless_destroy_window(unsigned long id, unsigned long flags)
+{
+	UNUSED(id);
+	UNUSED(flags);
+}
+
+void
+ui_seamless_destroy_group(unsigned long id, unsigned long flags)
+{
+	UNUSED(id);
+	UNUSED(flags);
+}
+
+void
+ui_seamless_seticon(unsigned long id, const char *format, int width, int height, int chunk,
+		    const char *data, size_t chunk_len)
+{
+	UNUSED(id);
+	UNUSED(format);
+	UNUSED(width);
+	UNUSED(height);
+	UNUSED(chunk);
+	UNUSED(data);
+	UNUSED(chunk_len);
+}
+
+void
+ui_seamless_delicon(unsigned long id, const char *format, int width, int height)
+{
+	UNUSED(id);
+	UNUSED(format);
+	UNUSED(width);
+	UNUSED(height);
+}
+
+void
+ui_seamless_move_window(unsigned long id, int x, int y, int width, int height,
+			unsigned long flags)
+{
+	UNUSED(id);
+	UNUSED(x);
+	UNUSED(y);
+	UNUSED(width);
+	UNUSED(height);
+	UNUSED(flags);
+}
+
+void
+ui_seamless_restack_window(unsigned long id, unsigned long behind, unsigned long flags)
+{
+	UNUSED(id);
+	UNUSED(behind);
+	UNUSED(flags);
+}
+
+void
+ui_seamless_settitle(unsigned long id, const char *title, unsigned long flags)
+{
+	UNUSED(id);
+	UNUSED(title);
+	UNUSED(flags);
+}
+
+void
+ui_seamless_setstate(unsigned long id, unsigned int state, unsigned long flags)
+{
+	UNUSED(id);
+	UNUSED(state);
+	UNUSED(flags);
+}
+
+void
+ui_seamless_syncbegin(unsigned long flags)
+{
+	UNUSED(flags);
+}
+
+void
+ui_seamless_ack(unsigned int serial)
+{
+	UNUSED(serial);
+}
+
+/* Keyboard and clipboard, provided by xkeymap.c and cliprdr.c in the
+   X11 build */
+RD_BOOL
+xkeymap_from_locale(const char *locale)
+{
+	UNUSED(locale);
+	return False;
+}
+
+unsigned int
+read_keyboard_state(void)
+{
+	return 0;
+}
+
+uint16
+ui_get_numlock_state(unsigned int state)
+{
+	UNUSED(state);
+	return 0;
+}
+
+void
+cliprdr_set_mode(const char *optarg)
+{
+	UNUSED(optarg);
+}
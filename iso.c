@@ -158,6 +158,72 @@ iso_recv_msg(uint8 * code, RD_BOOL * is_fastpath, uint8 * fastpath_hdr)
 	return s;
 }
 
+/* Length of the slow or fast path frame starting at data, as given by
+   its header, zero if more than the available bytes are needed to tell.
+   Lengths shorter than the header read by iso_recv_msg() are reported
+   as that header, which it then rejects. */
+uint32
+iso_frame_length(uint8 * data, uint32 available)
+{
+	uint32 length;
+
+	if (available < 2)
+		return 0;
+
+	if (data[0] == T123_HEADER_VERSION)
+	{
+		if (available < 4)
+			return 0;
+		length = (data[2] << 8) | data[3];
+	}
+	else if (data[1] & 0x80)
+	{
+		if (available < 3)
+			return 0;
+		length = ((data[1] & ~0x80) << 8) | data[2];
+	}
+	else
+	{
+		length = data[1];
+	}
+
+	return MAX(length, 4);
+}
+
+/* Skip the headers of a complete frame the way iso_recv() does, for
+   the receive pipeline. Returns False if it is not a data frame. */
+RD_BOOL
+iso_parse_frame(STREAM s, RD_BOOL * is_fastpath, uint8 * fastpath_hdr)
+{
+	uint8 version, length, code;
+
+	if (!s_check_rem(s, 2))
+		return False;
+
+	in_uint8(s, version);
+	*is_fastpath = (version != T123_HEADER_VERSION);
+	*fastpath_hdr = *is_fastpath ? version : 0;
+
+	if (*is_fastpath)
+	{
+		in_uint8(s, length);	/* length1 */
+		if (length & 0x80)
+			in_uint8s(s, 1);	/* length2 */
+		return s_check(s);
+	}
+
+	/* rest of the TPKT header and the X.224 data header */
+	if (!s_check_rem(s, 5))
+		return False;
+	in_uint8s(s, 3);	/* reserved, length */
+	in_uint8s(s, 1);	/* hdrlen */
+	in_uint8(s, code);
+	if (code != ISO_PDU_DT || !s_check_rem(s, 1))
+		return False;
+	in_uint8s(s, 1);	/* eot */
+	return True;
+}
+
 /* Initialise ISO transport data packet */
 STREAM
 iso_init(int length)
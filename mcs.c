@@ -363,6 +363,34 @@ mcs_recv(uint16 * channel, RD_BOOL * is_fastpath, uint8 * fastpath_hdr)
 	return s;
 }
 
+/* Skip the headers of a complete frame the way mcs_recv() does, for the
+   receive pipeline. Returns False if it carries no channel data. */
+RD_BOOL
+mcs_parse_frame(STREAM s, uint16 * channel, RD_BOOL * is_fastpath, uint8 * fastpath_hdr)
+{
+	uint8 opcode, length;
+
+	if (!iso_parse_frame(s, is_fastpath, fastpath_hdr))
+		return False;
+
+	if (*is_fastpath == True)
+		return True;
+
+	if (!s_check_rem(s, 7))
+		return False;
+
+	in_uint8(s, opcode);
+	if ((opcode >> 2) != MCS_SDIN)
+		return False;
+	in_uint8s(s, 2);	/* userid */
+	in_uint16_be(s, *channel);
+	in_uint8s(s, 1);	/* flags */
+	in_uint8(s, length);
+	if (length & 0x80)
+		in_uint8s(s, 1);	/* second byte of length */
+	return s_check(s);
+}
+
 RD_BOOL
 mcs_connect_start(char *server, char *username, char *domain, char *password,
 		  RD_BOOL reconnect, uint32 * selected_protocol)
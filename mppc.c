@@ -19,6 +19,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #include "rdesktop.h"
 
@@ -53,9 +54,10 @@
 
 
 RDPCOMP g_mppc_dict;
+static MPPC_STATS g_mppc_stats;
 
-int
-mppc_expand(uint8 * data, uint32 clen, uint8 ctype, uint32 * roff, uint32 * rlen)
+static int
+mppc_expand_hist(uint8 * data, uint32 clen, uint8 ctype, uint32 * roff, uint32 * rlen)
 {
 	int k, walker_len = 0, walker;
 	uint32 i = 0;
@@ -377,3 +379,403 @@ mppc_expand(uint8 * data, uint32 clen, uint8 ctype, uint32 * roff, uint32 * rlen
 
 	return 0;
 }
+
+/* Expand clen bytes of data into the history buffer, the result is at
+   g_mppc_dict.hist + roff and is rlen bytes long */
+int
+mppc_expand(uint8 * data, uint32 clen, uint8 ctype, uint32 * roff, uint32 * rlen)
+{
+	/* the RDP 6.1 level 2 stage arrives here as 64K, anything else
+	   would be misread as MPPC */
+	if ((ctype & RDP_MPPC_COMPRESSED) && (ctype & RDP_MPPC_TYPE_MASK) > PACKET_COMPR_TYPE_64K)
+	{
+		logger(Protocol, Error, "mppc_expand(), unsupported compression type %d",
+		       ctype & RDP_MPPC_TYPE_MASK);
+		return -1;
+	}
+
+	return mppc_expand_hist(data, clen, ctype, roff, rlen);
+}
+
+/* Set up s as a read-only view of expanded data in the history buffer,
+   so that it can be parsed without copying it out. The view is valid
+   until the next call to mppc_expand(). */
+RD_BOOL
+mppc_get_stream(STREAM s, uint32 roff, uint32 rlen)
+{
+	if (roff > RDP_MPPC_DICT_SIZE || rlen > RDP_MPPC_DICT_SIZE - roff)
+	{
+		logger(Protocol, Error, "mppc_get_stream(), expanded data %u+%u outside history",
+		       roff, rlen);
+		return False;
+	}
+
+	memset(s, 0, sizeof(struct stream));
+	s->data = s->p = g_mppc_dict.hist + roff;
+	s->size = rlen;
+	s->end = s->data + rlen;
+	s->rdp_hdr = s->p;
+
+	return True;
+}
+
+/* RDP 6.0 bulk decompression (NCRUSH), see MS-RDPEGDI 3.1.8.1.4.
+
+   The data is a stream of Huffman codes, read from the least
+   significant bit of each byte on. The literal/EOS/copy-offset (LEC)
+   alphabet has the 256 literals, an end of stream marker, 32 copy
+   offset classes and 4 indexes into a cache of the last copy offsets.
+   Each copy is followed by its length in the length-of-match (LOM)
+   alphabet. Both are canonical codes, given by their code lengths. */
+
+#define NCRUSH_EOS		256
+#define NCRUSH_COPY_OFFSET	257
+#define NCRUSH_OFFSET_CACHE	289
+#define NCRUSH_LEC_SYMBOLS	294
+#define NCRUSH_LOM_SYMBOLS	32
+#define NCRUSH_LOM_CLASSES	30	/* LOM symbols with a match length */
+#define NCRUSH_LEC_BITS		13	/* longest code of each alphabet */
+#define NCRUSH_LOM_BITS		9
+
+/* Code lengths of the LEC alphabet (HuffLengthLEC). Not yet checked
+   against the table of the specification. */
+static const uint8 ncrush_lec_lengths[NCRUSH_LEC_SYMBOLS] = {
+	6, 6, 6, 7, 7, 7, 7, 7, 7, 7, 7, 8, 8, 8, 8, 8,	/* 0 - 15 */
+	8, 8, 9, 8, 9, 9, 9, 9, 8, 8, 9, 9, 9, 9, 9, 9,	/* 16 - 31 */
+	8, 9, 9, 10, 9, 9, 9, 9, 9, 9, 9, 10, 9, 10, 10, 10,	/* 32 - 47 */
+	9, 9, 10, 9, 10, 9, 10, 9, 9, 9, 10, 10, 9, 10, 9, 9,	/* 48 - 63 */
+	8, 9, 9, 9, 9, 10, 10, 10, 9, 9, 10, 10, 10, 10, 10, 10,	/* 64 - 79 */
+	9, 9, 10, 10, 10, 10, 10, 10, 10, 9, 10, 10, 10, 10, 10, 10,	/* 80 - 95 */
+	9, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10,	/* 96 - 111 */
+	10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 9,	/* 112 - 127 */
+	7, 9, 9, 10, 9, 6, 10, 10, 9, 10, 10, 10, 7, 10, 10, 10,	/* 128 - 143 */
+	9, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10,	/* 144 - 159 */
+	11, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10, 10,	/* 160 - 175 */
+	9, 10, 10, 10, 10, 10, 10, 10, 10, 11, 10, 11, 10, 10, 12, 10,	/* 176 - 191 */
+	9, 10, 10, 10, 10, 10, 10, 10, 9, 10, 10, 10, 10, 10, 10, 10,	/* 192 - 207 */
+	9, 10, 10, 10, 10, 10, 10, 10, 9, 10, 10, 10, 10, 10, 10, 10,	/* 208 - 223 */
+	9, 10, 10, 10, 10, 10, 10, 10, 9, 10, 10, 10, 10, 10, 10, 10,	/* 224 - 239 */
+	9, 10, 10, 10, 9, 10, 10, 10, 9, 10, 10, 10, 9, 10, 9, 7,	/* 240 - 255 */
+	13, 9, 8, 8, 7, 7, 7, 7, 6, 6, 6, 5, 6, 6, 6, 5,	/* 256 - 271 */
+	6, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,	/* 272 - 287 */
+	6, 5, 7, 8, 8, 13	/* 288 - 293 */
+};
+
+/* Code lengths of the LOM alphabet (HuffLengthLOM) */
+static const uint8 ncrush_lom_lengths[NCRUSH_LOM_SYMBOLS] = {
+	4, 2, 3, 4, 3, 4, 4, 5, 4, 5, 5, 6, 6, 7, 7, 8,
+	7, 8, 8, 9, 9, 8, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9
+};
+
+/* Copy offset and match length classes, the value is the base of the
+   class plus as many extra bits as given for it */
+static const uint8 ncrush_copy_offset_bits[32] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13, 14, 14
+};
+
+static const uint32 ncrush_copy_offset_base[32] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+	32769, 49153
+};
+
+static const uint8 ncrush_lom_bits[NCRUSH_LOM_CLASSES] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 6, 6, 8, 8, 14, 14
+};
+
+static const uint16 ncrush_lom_base[NCRUSH_LOM_CLASSES] = {
+	2, 3, 4, 5, 6, 7, 8, 9, 10, 12, 14, 16, 18, 22, 26, 30,
+	34, 42, 50, 58, 66, 82, 98, 114, 130, 194, 258, 514, 2, 2
+};
+
+/* Lookup tables indexed by the next bits of the stream, an entry is a
+   symbol with its code length in the top 4 bits */
+static uint16 g_ncrush_lec[1 << NCRUSH_LEC_BITS];
+static uint16 g_ncrush_lom[1 << NCRUSH_LOM_BITS];
+static RD_BOOL g_ncrush_tables = False;
+
+static uint8 g_ncrush_hist[RDP_MPPC_DICT_SIZE];
+static uint32 g_ncrush_offset = 0;
+static uint32 g_ncrush_offset_cache[4];
+
+struct ncrush_bits
+{
+	uint8 *p, *end;
+	uint32 bits;		/* the next nbits bits of the stream */
+	int nbits;
+};
+
+/* Fill a lookup table from the code lengths of a canonical code, False
+   if they don't make a complete prefix code */
+static RD_BOOL
+ncrush_build_table(uint16 * table, int bits, const uint8 * lengths, int count)
+{
+	int len, sym, code, rev, i, space;
+
+	code = 0;
+	space = 1 << bits;
+	for (len = 1; len <= bits; len++)
+	{
+		for (sym = 0; sym < count; sym++)
+		{
+			if (lengths[sym] != len)
+				continue;
+			if (code >= (1 << len))
+				return False;
+
+			/* codes are sent most significant bit first */
+			rev = 0;
+			for (i = 0; i < len; i++)
+				rev |= ((code >> i) & 1) << (len - 1 - i);
+			for (i = rev; i < (1 << bits); i += 1 << len)
+				table[i] = sym | (len << 12);
+
+			code++;
+			space -= 1 << (bits - len);
+		}
+		code <<= 1;
+	}
+
+	return space == 0;
+}
+
+static void
+ncrush_fill(struct ncrush_bits *b)
+{
+	while (b->nbits <= 24 && b->p < b->end)
+	{
+		b->bits |= (uint32) * (b->p++) << b->nbits;
+		b->nbits += 8;
+	}
+}
+
+/* Decode the next symbol, -1 if the data ends within its code */
+static int
+ncrush_decode(struct ncrush_bits *b, uint16 * table, int bits)
+{
+	uint16 entry;
+	int len;
+
+	ncrush_fill(b);
+	entry = table[b->bits & ((1 << bits) - 1)];
+	len = entry >> 12;
+	if (len > b->nbits)
+		return -1;
+
+	b->bits >>= len;
+	b->nbits -= len;
+	return entry & 0xfff;
+}
+
+/* Read count extra bits, -1 if the data ends */
+static int
+ncrush_read(struct ncrush_bits *b, int count)
+{
+	int value;
+
+	ncrush_fill(b);
+	if (count > b->nbits)
+		return -1;
+
+	value = b->bits & ((1 << count) - 1);
+	b->bits >>= count;
+	b->nbits -= count;
+	return value;
+}
+
+/* Expand an RDP 6.0 compressed packet into the history, s is set up as
+   a read-only view of the result and is valid until the next call */
+RD_BOOL
+ncrush_expand(STREAM s, uint8 * data, uint32 clen, uint8 ctype)
+{
+	struct ncrush_bits b;
+	uint32 start, offset, copy_offset, length, src;
+	int sym, extra;
+
+	if (!g_ncrush_tables)
+	{
+		if (!ncrush_build_table(g_ncrush_lec, NCRUSH_LEC_BITS, ncrush_lec_lengths,
+					NCRUSH_LEC_SYMBOLS)
+		    || !ncrush_build_table(g_ncrush_lom, NCRUSH_LOM_BITS, ncrush_lom_lengths,
+					   NCRUSH_LOM_SYMBOLS))
+		{
+			logger(Protocol, Error, "ncrush_expand(), invalid code tables");
+			return False;
+		}
+		g_ncrush_tables = True;
+	}
+
+	/* keep the last 32K of history at the front */
+	if (ctype & RDP_MPPC_RESET)
+	{
+		if (g_ncrush_offset < RDP_MPPC_DICT_SIZE / 2)
+			goto error;
+		memmove(g_ncrush_hist, g_ncrush_hist + g_ncrush_offset - RDP_MPPC_DICT_SIZE / 2,
+			RDP_MPPC_DICT_SIZE / 2);
+		memset(g_ncrush_hist + RDP_MPPC_DICT_SIZE / 2, 0, RDP_MPPC_DICT_SIZE / 2);
+		g_ncrush_offset = RDP_MPPC_DICT_SIZE / 2;
+	}
+
+	if (ctype & RDP_MPPC_FLUSH)
+	{
+		memset(g_ncrush_hist, 0, sizeof(g_ncrush_hist));
+		memset(g_ncrush_offset_cache, 0, sizeof(g_ncrush_offset_cache));
+		g_ncrush_offset = 0;
+	}
+
+	memset(s, 0, sizeof(struct stream));
+	if ((ctype & RDP_MPPC_COMPRESSED) == 0)
+	{
+		s->data = s->p = data;
+		s->size = clen;
+		s->end = data + clen;
+		s->rdp_hdr = s->p;
+		return True;
+	}
+
+	b.p = data;
+	b.end = data + clen;
+	b.bits = 0;
+	b.nbits = 0;
+
+	start = offset = g_ncrush_offset;
+	while (1)
+	{
+		sym = ncrush_decode(&b, g_ncrush_lec, NCRUSH_LEC_BITS);
+		if (sym < 0)
+			goto error;
+
+		if (sym < NCRUSH_EOS)
+		{
+			if (offset >= RDP_MPPC_DICT_SIZE)
+				goto error;
+			g_ncrush_hist[offset++] = sym;
+			continue;
+		}
+
+		if (sym == NCRUSH_EOS)
+			break;
+
+		if (sym < NCRUSH_OFFSET_CACHE)
+		{
+			/* a new offset goes in front of the cache */
+			sym -= NCRUSH_COPY_OFFSET;
+			extra = ncrush_read(&b, ncrush_copy_offset_bits[sym]);
+			if (extra < 0)
+				goto error;
+			copy_offset = ncrush_copy_offset_base[sym] + extra;
+			memmove(g_ncrush_offset_cache + 1, g_ncrush_offset_cache,
+				3 * sizeof(g_ncrush_offset_cache[0]));
+			g_ncrush_offset_cache[0] = copy_offset;
+		}
+		else
+		{
+			/* a cached offset is swapped with the front one */
+			sym -= NCRUSH_OFFSET_CACHE;
+			if (sym >= 4)
+				goto error;
+			copy_offset = g_ncrush_offset_cache[sym];
+			g_ncrush_offset_cache[sym] = g_ncrush_offset_cache[0];
+			g_ncrush_offset_cache[0] = copy_offset;
+		}
+
+		sym = ncrush_decode(&b, g_ncrush_lom, NCRUSH_LOM_BITS);
+		if (sym < 0 || sym >= NCRUSH_LOM_CLASSES)
+			goto error;
+		extra = ncrush_read(&b, ncrush_lom_bits[sym]);
+		if (extra < 0)
+			goto error;
+		length = ncrush_lom_base[sym] + extra;
+
+		if (length > RDP_MPPC_DICT_SIZE - offset)
+			goto error;
+
+		/* like MPPC, offsets reaching back past the start of the
+		   history wrap around */
+		src = (offset - copy_offset) & (RDP_MPPC_DICT_SIZE - 1);
+		if (src < offset && length <= offset - src)
+		{
+			memcpy(g_ncrush_hist + offset, g_ncrush_hist + src, length);
+			offset += length;
+			continue;
+		}
+
+		/* the bytes just written are repeated */
+		while (length--)
+		{
+			g_ncrush_hist[offset++] = g_ncrush_hist[src];
+			src = (src + 1) & (RDP_MPPC_DICT_SIZE - 1);
+		}
+	}
+
+	g_ncrush_offset = offset;
+
+	s->data = s->p = g_ncrush_hist + start;
+	s->size = offset - start;
+	s->end = g_ncrush_hist + offset;
+	s->rdp_hdr = s->p;
+
+	return True;
+
+      error:
+	logger(Protocol, Error, "ncrush_expand(), invalid compressed data, flags 0x%x", ctype);
+	return False;
+}
+
+/* Expand a bulk compressed packet with the engine given by the
+   compression type in ctype, s is set up as a read-only view of the
+   result in the history of that engine */
+RD_BOOL
+bulk_expand(STREAM s, uint8 * data, uint32 clen, uint8 ctype)
+{
+	struct timespec start, end;
+	uint32 roff, rlen;
+	RD_BOOL ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	switch (ctype & RDP_MPPC_TYPE_MASK)
+	{
+		case PACKET_COMPR_TYPE_8K:
+		case PACKET_COMPR_TYPE_64K:
+			ret = mppc_expand(data, clen, ctype, &roff, &rlen) == 0
+				&& mppc_get_stream(s, roff, rlen);
+			break;
+
+		case PACKET_COMPR_TYPE_RDP61:
+			ret = xcrush_expand(s, data, clen);
+			break;
+
+		case PACKET_COMPR_TYPE_RDP6:
+			ret = ncrush_expand(s, data, clen, ctype);
+			break;
+
+		default:
+			logger(Protocol, Error, "bulk_expand(), unsupported compression type %d",
+			       ctype & RDP_MPPC_TYPE_MASK);
+			ret = False;
+			break;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	g_mppc_stats.packets++;
+	g_mppc_stats.bytes_in += clen;
+	g_mppc_stats.ns += (uint64) (end.tv_sec - start.tv_sec) * 1000000000 +
+		(end.tv_nsec - start.tv_nsec);
+	if (ret)
+		g_mppc_stats.bytes_out += s->end - s->p;
+	else
+		g_mppc_stats.errors++;
+
+	return ret;
+}
+
+/* Get bulk decompression statistics */
+void
+mppc_get_stats(MPPC_STATS * stats)
+{
+	*stats = g_mppc_stats;
+}
@@ -87,6 +87,42 @@ parse_delta(uint8 * buffer, int *offset)
 	return value;
 }
 
+/* Read a 1 or 2 byte value with a sign bit [MS-RDPEGDI 2.2.2.2.1.2.1.3] */
+static int
+rdp_in_two_byte_signed(STREAM s)
+{
+	uint8 first, second;
+	int value;
+
+	in_uint8(s, first);
+	value = first & 0x3f;
+	if (first & 0x80)
+	{
+		in_uint8(s, second);
+		value = (value << 8) | second;
+	}
+
+	return (first & 0x40) ? -value : value;
+}
+
+/* Read a 1 or 2 byte unsigned value [MS-RDPEGDI 2.2.2.2.1.2.1.2] */
+static int
+rdp_in_two_byte_unsigned(STREAM s)
+{
+	uint8 first, second;
+	int value;
+
+	in_uint8(s, first);
+	value = first & 0x7f;
+	if (first & 0x80)
+	{
+		in_uint8(s, second);
+		value = (value << 8) | second;
+	}
+
+	return value;
+}
+
 /* Read a colour entry */
 static void
 rdp_in_colour(STREAM s, uint32 * colour)
@@ -908,7 +944,7 @@ process_raw_bmpcache(STREAM s)
 	uint16 cache_idx, bufsize;
 	uint8 cache_id, width, height, bpp, Bpp;
 	uint8 *data, *inverted;
-	int y;
+	int y, native_Bpp;
 
 	in_uint8(s, cache_id);
 	in_uint8s(s, 1);	/* pad */
@@ -922,16 +958,24 @@ process_raw_bmpcache(STREAM s)
 
 	logger(Graphics, Debug, "process_raw_bpmcache(), cx=%d, cy=%d, id=%d, idx=%d", width,
 	       height, cache_id, cache_idx);
-	inverted = (uint8 *) xmalloc(width * height * Bpp);
+	native_Bpp = bitmap_native_Bpp(Bpp);
+	inverted = (uint8 *) xmalloc(width * height * (native_Bpp ? native_Bpp : Bpp));
 	for (y = 0; y < height; y++)
 	{
-		memcpy(&inverted[(height - y - 1) * (width * Bpp)], &data[y * (width * Bpp)],
-		       width * Bpp);
+		if (native_Bpp)
+			bitmap_translate(&inverted[(height - y - 1) * (width * native_Bpp)],
+					 &data[y * (width * Bpp)], width, Bpp);
+		else
+			memcpy(&inverted[(height - y - 1) * (width * Bpp)],
+			       &data[y * (width * Bpp)], width * Bpp);
 	}
 
-	bitmap = ui_create_bitmap(width, height, inverted);
+	if (native_Bpp)
+		bitmap = ui_create_bitmap_native(width, height, inverted);
+	else
+		bitmap = ui_create_bitmap(width, height, inverted);
 	xfree(inverted);
-	cache_put_bitmap(cache_id, cache_idx, bitmap);
+	cache_put_bitmap(cache_id, cache_idx, bitmap, width * height * Bpp);
 }
 
 /* Process a bitmap cache order */
@@ -944,6 +988,7 @@ process_bmpcache(STREAM s)
 	uint8 *data, *bmpdata;
 	uint16 bufsize, pad2, row_size, final_size;
 	uint8 pad1;
+	int native_Bpp;
 
 	pad2 = row_size = final_size = 0xffff;	/* Shut the compiler up */
 
@@ -977,12 +1022,18 @@ process_bmpcache(STREAM s)
 	       width, height, cache_id, cache_idx, bpp, size, pad1, bufsize, pad2, row_size,
 	       final_size);
 
-	bmpdata = (uint8 *) xmalloc(width * height * Bpp);
+	native_Bpp = bitmap_native_Bpp(Bpp);
+	bmpdata = (uint8 *) xmalloc(width * height * (native_Bpp ? native_Bpp : Bpp));
 
-	if (bitmap_decompress(bmpdata, width, height, data, size, Bpp))
+	if (native_Bpp && bitmap_decompress_native(bmpdata, width, height, data, size, Bpp))
+	{
+		bitmap = ui_create_bitmap_native(width, height, bmpdata);
+		cache_put_bitmap(cache_id, cache_idx, bitmap, width * height * Bpp);
+	}
+	else if (!native_Bpp && bitmap_decompress(bmpdata, width, height, data, size, Bpp))
 	{
 		bitmap = ui_create_bitmap(width, height, bmpdata);
-		cache_put_bitmap(cache_id, cache_idx, bitmap);
+		cache_put_bitmap(cache_id, cache_idx, bitmap, width * height * Bpp);
 	}
 	else
 	{
@@ -1001,6 +1052,7 @@ process_bmpcache2(STREAM s, uint16 flags, RD_BOOL compressed)
 	uint8 cache_id, cache_idx_low, width, height, Bpp;
 	uint16 cache_idx, bufsize;
 	uint8 *data, *bmpdata, *bitmap_id;
+	int native_Bpp;
 
 	bitmap_id = NULL;	/* prevent compiler warning */
 	cache_id = flags & ID_MASK;
@@ -1038,9 +1090,21 @@ process_bmpcache2(STREAM s, uint16 flags, RD_BOOL compressed)
 	       "process_bmpcache2(), compr=%d, flags=%x, cx=%d, cy=%d, id=%d, idx=%d, Bpp=%d, bs=%d",
 	       compressed, flags, width, height, cache_id, cache_idx, Bpp, bufsize);
 
-	bmpdata = (uint8 *) xmalloc(width * height * Bpp);
+	/* the persistent cache keeps bitmaps in server format */
+	native_Bpp = (flags & PERSIST) ? 0 : bitmap_native_Bpp(Bpp);
+	bmpdata = (uint8 *) xmalloc(width * height * (native_Bpp ? native_Bpp : Bpp));
 
-	if (compressed)
+	if (compressed && native_Bpp)
+	{
+		if (!bitmap_decompress_native(bmpdata, width, height, data, bufsize, Bpp))
+		{
+			logger(Graphics, Error,
+			       "process_bmpcache2(), failed to decompress bitmap data");
+			xfree(bmpdata);
+			return;
+		}
+	}
+	else if (compressed)
 	{
 		if (!bitmap_decompress(bmpdata, width, height, data, bufsize, Bpp))
 		{
@@ -1050,6 +1114,12 @@ process_bmpcache2(STREAM s, uint16 flags, RD_BOOL compressed)
 			return;
 		}
 	}
+	else if (native_Bpp)
+	{
+		for (y = 0; y < height; y++)
+			bitmap_translate(&bmpdata[(height - y - 1) * (width * native_Bpp)],
+					 &data[y * (width * Bpp)], width, Bpp);
+	}
 	else
 	{
 		for (y = 0; y < height; y++)
@@ -1057,11 +1127,14 @@ process_bmpcache2(STREAM s, uint16 flags, RD_BOOL compressed)
 			       &data[y * (width * Bpp)], width * Bpp);
 	}
 
-	bitmap = ui_create_bitmap(width, height, bmpdata);
+	if (native_Bpp)
+		bitmap = ui_create_bitmap_native(width, height, bmpdata);
+	else
+		bitmap = ui_create_bitmap(width, height, bmpdata);
 
 	if (bitmap)
 	{
-		cache_put_bitmap(cache_id, cache_idx, bitmap);
+		cache_put_bitmap(cache_id, cache_idx, bitmap, width * height * Bpp);
 		if (flags & PERSIST)
 			pstcache_save_bitmap(cache_id, cache_idx, bitmap_id, width, height,
 					     width * height * Bpp, bmpdata);
@@ -1139,6 +1212,71 @@ process_fontcache(STREAM s)
 	}
 }
 
+/* Process a revision 2 font cache order, which has the font and glyph
+   count in the order flags and variable length glyph fields */
+static void
+process_fontcache2(STREAM s, uint16 flags)
+{
+	RD_HGLYPH bitmap;
+	uint8 font, nglyphs, character;
+	sint16 offset, baseline;
+	uint16 width, height;
+	int i, n, field, datasize;
+	uint8 *data;
+
+	font = flags & 0x0f;
+	nglyphs = flags >> 8;
+
+	logger(Graphics, Debug, "process_fontcache2(), font=%d, n=%d", font, nglyphs);
+
+	if (font >= GLYPHCACHE_NUM_CACHES)
+	{
+		logger(Graphics, Error, "process_fontcache2(), invalid font %d", font);
+		return;
+	}
+
+	for (i = 0; i < nglyphs; i++)
+	{
+		/* the character, then four fields of one or two bytes */
+		for (n = 1, field = 0; field < 4 && s_check_rem(s, n + 1); field++)
+			n += (s->p[n] & 0x80) ? 2 : 1;
+		if (field < 4 || !s_check_rem(s, n))
+		{
+			logger(Graphics, Error, "process_fontcache2(), glyph overruns order");
+			return;
+		}
+
+		in_uint8(s, character);
+		offset = rdp_in_two_byte_signed(s);
+		baseline = rdp_in_two_byte_signed(s);
+		width = rdp_in_two_byte_unsigned(s);
+		height = rdp_in_two_byte_unsigned(s);
+
+		/* the sizes can be up to 32767, larger than any cell */
+		if (height * ((width + 7) / 8) > cache_get_glyph_cell_size(font))
+		{
+			logger(Graphics, Error,
+			       "process_fontcache2(), glyph of %dx%d too large for font %d", width,
+			       height, font);
+			return;
+		}
+
+		datasize = (height * ((width + 7) / 8) + 3) & ~3;
+		if (!s_check_rem(s, datasize))
+		{
+			logger(Graphics, Error, "process_fontcache2(), glyph data overruns order");
+			return;
+		}
+		in_uint8p(s, data, datasize);
+
+		bitmap = ui_create_glyph(width, height, data);
+		cache_put_font(font, character, offset, baseline, width, height, bitmap);
+	}
+
+	/* the unicode characters of the glyphs (CG_GLYPH_UNICODE_PRESENT) are
+	   only useful for accessibility */
+}
+
 static void
 process_compressed_8x8_brush_data(uint8 * in, uint8 * out, int Bpp)
 {
@@ -1262,7 +1400,7 @@ process_secondary_order(STREAM s)
 	struct stream packet = *s;
 
 	in_uint16_le(s, length);
-	in_uint16_le(s, flags);	/* used by bmpcache2 */
+	in_uint16_le(s, flags);	/* used by bmpcache2, brushcache and fontcache2 */
 	in_uint8(s, type);
 
 	length += 13;  /* MS-RDPEGDI is ridiculous and says that you need to add 13 to this
@@ -1292,7 +1430,10 @@ process_secondary_order(STREAM s)
 			break;
 
 		case RDP_ORDER_FONTCACHE:
-			process_fontcache(s);
+			if (flags & CG_GLYPH_REV2)
+				process_fontcache2(s, flags);
+			else
+				process_fontcache(s);
 			break;
 
 		case RDP_ORDER_RAW_BMPCACHE2:
@@ -27,13 +27,25 @@ extern "C" {
 #define UNUSED(param) ((void)param)
 /* bitmap.c */
 RD_BOOL bitmap_decompress(uint8 * output, int width, int height, uint8 * input, int size, int Bpp);
+void bitmap_decompress_start(BITMAP_JOB * jobs, int count);
+RD_BOOL bitmap_decompress_wait(BITMAP_JOB * job);
+void bitmap_decompress_end(void);
+void bitmap_set_format(PIXEL_FORMAT * format);
+int bitmap_native_Bpp(int Bpp);
+void bitmap_translate(uint8 * output, uint8 * input, int count, int Bpp);
+RD_BOOL bitmap_decompress_native(uint8 * output, int width, int height, uint8 * input, int size,
+				 int Bpp);
 /* cache.c */
 void cache_rebuild_bmpcache_linked_list(uint8 id, sint16 * idx, int count);
-void cache_bump_bitmap(uint8 id, uint16 idx, int bump);
 void cache_evict_bitmap(uint8 id);
+void cache_demote_bitmap(uint8 id, uint16 idx);
+uint32 cache_get_bitmap_cells(uint8 id);
 RD_HBITMAP cache_get_bitmap(uint8 id, uint16 idx);
-void cache_put_bitmap(uint8 id, uint16 idx, RD_HBITMAP bitmap);
+void cache_put_bitmap(uint8 id, uint16 idx, RD_HBITMAP bitmap, uint32 size);
+void cache_load_bitmap(uint8 id, uint16 idx, RD_HBITMAP bitmap, uint32 size);
 void cache_save_state(void);
+uint16 cache_get_glyph_cell_size(uint8 font);
+uint16 cache_get_glyph_cells(uint8 font);
 FONTGLYPH *cache_get_font(uint8 font, uint16 character);
 void cache_put_font(uint8 font, uint16 character, uint16 offset, uint16 baseline, uint16 width,
 		    uint16 height, RD_HGLYPH pixmap);
@@ -46,6 +58,10 @@ RD_HCURSOR cache_get_cursor(uint16 cache_idx);
 void cache_put_cursor(uint16 cache_idx, RD_HCURSOR cursor);
 BRUSHDATA *cache_get_brush_data(uint8 colour_code, uint8 idx);
 void cache_put_brush_data(uint8 colour_code, uint8 idx, BRUSHDATA * brush_data);
+void *cache_get_brush_pixmap(uint8 kind, uint8 * data, int size);
+void cache_put_brush_pixmap(uint8 kind, uint8 * data, int size, void *pixmap);
+void cache_flush_brush_pixmaps(void);
+void cache_log_stats(void);
 /* channels.c */
 VCHANNEL *channel_register(char *name, uint32 flags, void (*callback) (STREAM));
 STREAM channel_init(VCHANNEL * channel, uint32 length);
@@ -76,6 +92,13 @@ RD_NTSTATUS disk_query_volume_information(RD_NTHANDLE handle, uint32 info_class,
 RD_NTSTATUS disk_query_directory(RD_NTHANDLE handle, uint32 info_class, char *pattern, STREAM out);
 /* mppc.c */
 int mppc_expand(uint8 * data, uint32 clen, uint8 ctype, uint32 * roff, uint32 * rlen);
+RD_BOOL mppc_get_stream(STREAM s, uint32 roff, uint32 rlen);
+RD_BOOL ncrush_expand(STREAM s, uint8 * data, uint32 clen, uint8 ctype);
+void mppc_get_stats(MPPC_STATS * stats);
+RD_BOOL bulk_expand(STREAM s, uint8 * data, uint32 clen, uint8 ctype);
+/* xcrush.c */
+RD_BOOL xcrush_expand(STREAM s, uint8 * data, uint32 clen);
+void xcrush_reset(void);
 /* ewmhints.c */
 int get_current_workarea(uint32 * x, uint32 * y, uint32 * width, uint32 * height);
 void ewmh_init(void);
@@ -83,6 +106,8 @@ void ewmh_init(void);
 STREAM iso_init(int length);
 void iso_send(STREAM s);
 STREAM iso_recv(RD_BOOL * is_fastpath, uint8 * fastpath_hdr);
+uint32 iso_frame_length(uint8 * data, uint32 available);
+RD_BOOL iso_parse_frame(STREAM s, RD_BOOL * is_fastpath, uint8 * fastpath_hdr);
 RD_BOOL iso_connect(char *server, char *username, char *domain, char *password, RD_BOOL reconnect,
 		    uint32 * selected_protocol);
 void iso_disconnect(void);
@@ -96,6 +121,7 @@ STREAM mcs_init(int length);
 void mcs_send_to_channel(STREAM s, uint16 channel);
 void mcs_send(STREAM s);
 STREAM mcs_recv(uint16 * channel, RD_BOOL * is_fastpath, uint8 * fastpath_hdr);
+RD_BOOL mcs_parse_frame(STREAM s, uint16 * channel, RD_BOOL * is_fastpath, uint8 * fastpath_hdr);
 RD_BOOL mcs_connect_start(char *server, char *username, char *domain, char *password,
 			  RD_BOOL reconnect, uint32 * selected_protocol);
 RD_BOOL mcs_connect_finalize(STREAM s);
@@ -111,12 +137,25 @@ int printer_enum_devices(uint32 * id, char *optarg);
 /* printercache.c */
 int printercache_load_blob(char *printer_name, uint8 ** data);
 void printercache_process(STREAM s);
+/* bmpstore.c */
+RD_BOOL bmpstore_open(int Bpp);
+RD_BOOL bmpstore_find(uint8 * key, uint8 * width, uint8 * height);
+uint8 *bmpstore_get(uint8 * key, uint8 * width, uint8 * height, uint32 * length);
+void bmpstore_put(uint8 * key, uint8 width, uint8 height, uint32 length, uint8 * data);
+int bmpstore_list(HASH_KEY * keys, int max, int max_pixels);
+int bmpstore_touch(HASH_KEY * keys, int count);
+int bmpstore_lz_compress(uint8 * in, int length, uint8 * out, int max);
+RD_BOOL bmpstore_lz_decompress(uint8 * in, int size, uint8 * out, int length);
 /* pstcache.c */
+void pstcache_set_server(char *server);
 void pstcache_touch_bitmap(uint8 cache_id, uint16 cache_idx, uint32 stamp);
 RD_BOOL pstcache_load_bitmap(uint8 cache_id, uint16 cache_idx);
+void pstcache_forget(uint8 cache_id, uint16 cache_idx);
 RD_BOOL pstcache_save_bitmap(uint8 cache_id, uint16 cache_idx, uint8 * key, uint8 width,
-			     uint8 height, uint16 length, uint8 * data);
+			     uint8 height, uint32 length, uint8 * data);
 int pstcache_enumerate(uint8 id, HASH_KEY * keylist);
+RD_BOOL pstcache_precache(void);
+void pstcache_flush(void);
 RD_BOOL pstcache_init(uint8 cache_id);
 /* rdesktop.c */
 int main(int argc, char *argv[]);
@@ -145,12 +184,29 @@ int rd_read_file(int fd, void *ptr, int len);
 int rd_write_file(int fd, void *ptr, int len);
 int rd_lseek_file(int fd, int offset);
 RD_BOOL rd_lock_file(int fd, int start, int len);
+RD_BOOL rd_lock_file_wait(int fd, int start, int len);
+void rd_unlock_file(int fd, int start, int len);
+RD_BOOL rd_rename_file(char *oldname, char *newname);
+void rd_remove_file(char *filename);
+void *rd_map_file(int fd, int length);
+void rd_unmap_file(void *map, int length);
+void rd_sync_file(void *map, int length);
 /* rdp5.c */
 void process_ts_fp_updates(STREAM s);
+void expand_ts_fp_updates(STREAM s, RDP_EXPANDED *** tail);
+/* queue.c */
+RD_BOOL queue_init(RD_QUEUE * q, uint32 size);
+void queue_destroy(RD_QUEUE * q);
+RD_BOOL queue_push(RD_QUEUE * q, void *item);
+void *queue_pop(RD_QUEUE * q);
+int queue_fd(RD_QUEUE * q);
+RD_BOOL queue_wait_space(RD_QUEUE * q, int cancel_fd);
 /* rdp.c */
 void rdp_in_unistr(STREAM s, int in_len, char **string, uint32 * str_size);
 void rdp_send_input(uint32 time, uint16 message_type, uint16 device_flags, uint16 param1,
 		    uint16 param2);
+void rdp_begin_input_batch(void);
+void rdp_end_input_batch(void);
 void rdp_send_suppress_output_pdu(enum RDP_SUPPRESS_STATUS allowupdates);
 void process_colour_pointer_pdu(STREAM s);
 void process_new_pointer_pdu(STREAM s);
@@ -159,6 +215,10 @@ void process_system_pointer_pdu(STREAM s);
 void set_system_pointer(uint32 ptr);
 void process_bitmap_updates(STREAM s);
 void process_palette(STREAM s);
+RD_BOOL rdp_expand(STREAM ns, STREAM s, uint32 clen, uint8 ctype);
+void rdp_expand_ahead(STREAM s, uint32 clen, uint8 ctype, RDP_EXPANDED *** tail);
+RDP_EXPANDED *rdp_expand_frame(STREAM s);
+RD_BOOL process_data_pdu(STREAM s, uint32 * ext_disc_reason);
 void rdp_main_loop(RD_BOOL * deactivated, uint32 * ext_disc_reason);
 RD_BOOL rdp_loop(RD_BOOL * deactivated, uint32 * ext_disc_reason);
 RD_BOOL rdp_connect(char *server, uint32 flags, char *domain, char *password, char *command,
@@ -166,6 +226,14 @@ RD_BOOL rdp_connect(char *server, uint32 flags, char *domain, char *password, ch
 void rdp_reset_state(void);
 void rdp_disconnect(void);
 void rdp_protocol_error(const char *message, STREAM s);
+/* replay.c */
+RD_BOOL replay_record_open(const char *filename);
+void replay_record_close(void);
+void replay_record_session(void);
+void replay_record_fp_update(uint8 hdr, uint8 * data, uint16 length);
+void replay_record_fp_end(void);
+void replay_record_data_pdu(uint8 data_pdu_type, uint8 * data, uint32 length);
+int replay_run(const char *filename, RD_BOOL paced);
 /* rdpdr.c */
 int get_device_index(RD_NTHANDLE handle);
 void convert_to_unix_filename(char *filename);
@@ -197,9 +265,12 @@ void buf_out_uint32(uint8 * buffer, uint32 value);
 void sec_sign(uint8 * signature, int siglen, uint8 * session_key, int keylen, uint8 * data,
 	      int datalen);
 void sec_decrypt(uint8 * data, int length);
+RD_BOOL sec_parse_frame(STREAM s, RD_BOOL decrypt, uint16 * channel, RD_BOOL * is_fastpath);
 STREAM sec_init(uint32 flags, int maxlen);
 void sec_send_to_channel(STREAM s, uint32 flags, uint16 channel);
 void sec_send(STREAM s, uint32 flags);
+STREAM sec_fastpath_init(uint32 flags, int maxlen);
+void sec_fastpath_send(STREAM s, uint32 flags, uint8 num_events);
 void sec_process_mcs_data(STREAM s);
 STREAM sec_recv(RD_BOOL * is_fastpath);
 RD_BOOL sec_connect(char *server, char *username, char *domain, char *password, RD_BOOL reconnect);
@@ -210,6 +281,35 @@ int serial_enum_devices(uint32 * id, char *optarg);
 RD_BOOL serial_get_event(RD_NTHANDLE handle, uint32 * result);
 RD_BOOL serial_get_timeout(RD_NTHANDLE handle, uint32 length, uint32 * timeout,
 			   uint32 * itv_timeout);
+/* swfb.c */
+RD_BOOL swfb_get_damage(int *x, int *y, int *cx, int *cy);
+void swfb_fill(uint8 opcode, int x, int y, int cx, int cy, uint32 colour);
+void swfb_patblt(uint8 opcode, int x, int y, int cx, int cy, BRUSH * brush, uint32 bgcolour,
+		 uint32 fgcolour);
+void swfb_blit(uint8 opcode, int x, int y, int cx, int cy, SWFB_SURFACE * src, int srcx, int srcy);
+void swfb_triblt(uint8 rop3, int x, int y, int cx, int cy, SWFB_SURFACE * src, int srcx, int srcy,
+		 BRUSH * brush, uint32 bgcolour, uint32 fgcolour);
+void swfb_line(uint8 opcode, int startx, int starty, int endx, int endy, uint32 colour);
+void swfb_polyline(uint8 opcode, RD_POINT * points, int npoints, uint32 colour);
+void swfb_polygon(uint8 opcode, uint8 fillmode, RD_POINT * point, int npoints, BRUSH * brush,
+		  uint32 bgcolour, uint32 fgcolour);
+void swfb_ellipse(uint8 opcode, uint8 fillmode, int x, int y, int cx, int cy, BRUSH * brush,
+		  uint32 bgcolour, uint32 fgcolour);
+void swfb_draw_glyph(uint8 * bits, int scanline, int width, int height, int x, int y,
+		     uint32 fgcolour, uint32 bgcolour, RD_BOOL transparent);
+SWFB_SURFACE *swfb_create_surface(int width, int height, uint8 * data, RD_BOOL native);
+void swfb_destroy_surface(SWFB_SURFACE * surface);
+void swfb_paint(int x, int y, int cx, int cy, int width, int height, uint8 * data, RD_BOOL native);
+RD_HCOLOURMAP swfb_create_colourmap(COLOURMAP * colours);
+void swfb_set_colourmap(RD_HCOLOURMAP map);
+void swfb_desktop_save(uint32 offset, int x, int y, int cx, int cy);
+void swfb_desktop_restore(uint32 offset, int x, int y, int cx, int cy);
+void swfb_set_clip(int x, int y, int cx, int cy);
+void swfb_create(int width, int height);
+void swfb_resize(int width, int height);
+void swfb_destroy(void);
+SWFB_SURFACE *swfb_screen(void);
+uint32 swfb_checksum(void);
 /* tcp.c */
 STREAM tcp_init(uint32 maxlen);
 void tcp_send(STREAM s);
@@ -222,6 +322,9 @@ void tcp_reset_state(void);
 RD_BOOL tcp_tls_connect(void);
 RD_BOOL tcp_tls_get_server_pubkey(STREAM s);
 void tcp_run_ui(RD_BOOL run);
+void tcp_get_recv_stats(TCP_RECV_STATS * stats);
+RD_BOOL tcp_recv_decoded(void);
+RDP_EXPANDED *tcp_recv_expanded(void);
 
 /* asn.c */
 RD_BOOL ber_in_header(STREAM s, int *tagval, int *length);
@@ -273,6 +376,8 @@ void ui_select(int rdp_socket);
 void ui_move_pointer(int x, int y);
 RD_HBITMAP ui_create_bitmap(int width, int height, uint8 * data);
 void ui_paint_bitmap(int x, int y, int cx, int cy, int width, int height, uint8 * data);
+RD_HBITMAP ui_create_bitmap_native(int width, int height, uint8 * data);
+void ui_paint_bitmap_native(int x, int y, int cx, int cy, int width, int height, uint8 * data);
 void ui_destroy_bitmap(RD_HBITMAP bmp);
 RD_HGLYPH ui_create_glyph(int width, int height, uint8 * data);
 void ui_destroy_glyph(RD_HGLYPH glyph);
@@ -19,43 +19,90 @@
 
 #include "rdesktop.h"
 
-#define MAX_CELL_SIZE		0x1000	/* pixels */
+/*
+   The persistent cache keeps the keys of the bitmaps in its cells, the
+   bitmaps themselves are in the shared store of bmpstore.c. The keys of
+   the cells are saved per server when the session ends, and offered to
+   the same server first on the next connect, followed by the most
+   recently used bitmaps of the store from other servers and sessions.
+*/
+
+#define PRECACHE_BATCH		16	/* bitmaps loaded per idle round */
+#define KEY_SET_SIZE		0x2000	/* for finding duplicate keys */
 
-#define IS_PERSISTENT(id) (id < 8 && g_pstcache_fd[id] > 0)
+#define IS_PERSISTENT(id) (g_pstcache_id >= 0 && (id) == g_pstcache_id)
 
 extern int g_server_depth;
 extern RD_BOOL g_bitmap_cache;
 extern RD_BOOL g_bitmap_cache_persist_enable;
 extern RD_BOOL g_bitmap_cache_precache;
+extern uint32 g_bmpcache_cells[];
+
+struct pstcache_cell
+{
+	HASH_KEY key;
+	uint32 stamp;		/* MRU order, set by cache_save_state() */
+	RD_BOOL queued;		/* waiting to be precached */
+};
 
-int g_pstcache_fd[8];
+/* Entry of the per server key list file */
+struct pstcache_key
+{
+	HASH_KEY key;
+	uint32 stamp;
+};
+
+int g_pstcache_id = -1;
 int g_pstcache_Bpp;
 RD_BOOL g_pstcache_enumerated = False;
 uint8 zero_key[] = { 0, 0, 0, 0, 0, 0, 0, 0 };
 
+static struct pstcache_cell *g_pstcache_cells;
+static char g_pstcache_server[64] = "";
+
+/* Cells to precache, most recently used first */
+static uint16 *g_pstcache_queue;
+static int g_pstcache_queue_len;
+static int g_pstcache_queue_pos;
+
+static void
+pstcache_keys_filename(char *filename, size_t size, const char *suffix)
+{
+	snprintf(filename, size, "cache/keys_%s_%d%s",
+		 g_pstcache_server[0] ? g_pstcache_server : "unknown", g_pstcache_Bpp, suffix);
+}
+
+/* Remember the server name, its key list is kept separately */
+void
+pstcache_set_server(char *server)
+{
+	char *p;
+
+	STRNCPY(g_pstcache_server, server, sizeof(g_pstcache_server));
+	for (p = g_pstcache_server; *p != '\0'; p++)
+		if (*p == '/')
+			*p = '_';
+}
 
 /* Update mru stamp/index for a bitmap */
 void
 pstcache_touch_bitmap(uint8 cache_id, uint16 cache_idx, uint32 stamp)
 {
-	int fd;
-
 	if (!IS_PERSISTENT(cache_id) || cache_idx >= BMPCACHE2_NUM_PSTCELLS)
 		return;
 
-	fd = g_pstcache_fd[cache_id];
-	rd_lseek_file(fd, 12 + cache_idx * (g_pstcache_Bpp * MAX_CELL_SIZE + sizeof(CELLHEADER)));
-	rd_write_file(fd, &stamp, sizeof(stamp));
+	g_pstcache_cells[cache_idx].stamp = stamp;
 }
 
 /* Load a bitmap from the persistent cache */
 RD_BOOL
 pstcache_load_bitmap(uint8 cache_id, uint16 cache_idx)
 {
-	uint8 *celldata;
-	int fd;
-	CELLHEADER cellhdr;
+	struct pstcache_cell *cell;
 	RD_HBITMAP bitmap;
+	uint8 width, height;
+	uint32 length;
+	uint8 *data;
 
 	if (!g_bitmap_cache_persist_enable)
 		return False;
@@ -63,55 +110,141 @@ pstcache_load_bitmap(uint8 cache_id, uint16 cache_idx)
 	if (!IS_PERSISTENT(cache_id) || cache_idx >= BMPCACHE2_NUM_PSTCELLS)
 		return False;
 
-	fd = g_pstcache_fd[cache_id];
-	rd_lseek_file(fd, cache_idx * (g_pstcache_Bpp * MAX_CELL_SIZE + sizeof(CELLHEADER)));
-	rd_read_file(fd, &cellhdr, sizeof(CELLHEADER));
-	celldata = (uint8 *) xmalloc(cellhdr.length);
-	rd_read_file(fd, celldata, cellhdr.length);
+	cell = &g_pstcache_cells[cache_idx];
+	cell->queued = False;
+
+	if (memcmp(cell->key, zero_key, sizeof(HASH_KEY)) == 0)
+		return False;
+
+	data = bmpstore_get(cell->key, &width, &height, &length);
+	if (data == NULL)
+	{
+		logger(Core, Debug, "pstcache_load_bitmap(), not in store: id=%d, idx=%d",
+		       cache_id, cache_idx);
+		return False;
+	}
+
+	if (length < (uint32) width * height * g_pstcache_Bpp)
+	{
+		logger(Core, Error, "pstcache_load_bitmap(), bad cell: id=%d, idx=%d, length=%d",
+		       cache_id, cache_idx, length);
+		return False;
+	}
 
-	bitmap = ui_create_bitmap(cellhdr.width, cellhdr.height, celldata);
+	bitmap = ui_create_bitmap(width, height, data);
 	logger(Core, Debug, "pstcache_load_bitmap(), load bitmap from disk: id=%d, idx=%d, bmp=%p)",
 	       cache_id, cache_idx, bitmap);
-	cache_put_bitmap(cache_id, cache_idx, bitmap);
+	cache_load_bitmap(cache_id, cache_idx, bitmap, length);
 
-	xfree(celldata);
 	return True;
 }
 
+/* The server put a bitmap of its own in a cell, so the key of the cell is
+   stale. Forget it, so that it is neither precached over the new bitmap
+   nor saved in the key list. pstcache_save_bitmap() sets the key again if
+   the server sent it to be persisted. */
+void
+pstcache_forget(uint8 cache_id, uint16 cache_idx)
+{
+	if (!IS_PERSISTENT(cache_id) || cache_idx >= BMPCACHE2_NUM_PSTCELLS)
+		return;
+
+	memset(&g_pstcache_cells[cache_idx], 0, sizeof(struct pstcache_cell));
+}
+
 /* Store a bitmap in the persistent cache */
 RD_BOOL
 pstcache_save_bitmap(uint8 cache_id, uint16 cache_idx, uint8 * key,
-		     uint8 width, uint8 height, uint16 length, uint8 * data)
+		     uint8 width, uint8 height, uint32 length, uint8 * data)
 {
-	int fd;
-	CELLHEADER cellhdr;
+	struct pstcache_cell *cell;
 
 	if (!IS_PERSISTENT(cache_id) || cache_idx >= BMPCACHE2_NUM_PSTCELLS)
 		return False;
 
-	memcpy(cellhdr.key, key, sizeof(HASH_KEY));
-	cellhdr.width = width;
-	cellhdr.height = height;
-	cellhdr.length = length;
-	cellhdr.stamp = 0;
+	cell = &g_pstcache_cells[cache_idx];
+	memcpy(cell->key, key, sizeof(HASH_KEY));
+	cell->stamp = 0;
+	cell->queued = False;
 
-	fd = g_pstcache_fd[cache_id];
-	rd_lseek_file(fd, cache_idx * (g_pstcache_Bpp * MAX_CELL_SIZE + sizeof(CELLHEADER)));
-	rd_write_file(fd, &cellhdr, sizeof(CELLHEADER));
-	rd_write_file(fd, data, length);
+	bmpstore_put(key, width, height, length, data);
+	return True;
+}
+
+/* Add a key to the next free cell, unless a cell has it already. The
+   set holds the indexes of the filled cells, hashed by key. */
+static RD_BOOL
+pstcache_add_key(uint8 * key, uint32 stamp, int *count, sint16 * set)
+{
+	uint32 slot;
 
+	slot = (key[0] | (key[1] << 8)) & (KEY_SET_SIZE - 1);
+	while (set[slot] >= 0)
+	{
+		if (memcmp(g_pstcache_cells[set[slot]].key, key, sizeof(HASH_KEY)) == 0)
+			return False;
+		slot = (slot + 1) & (KEY_SET_SIZE - 1);
+	}
+
+	set[slot] = *count;
+	memcpy(g_pstcache_cells[*count].key, key, sizeof(HASH_KEY));
+	g_pstcache_cells[*count].stamp = stamp;
+	(*count)++;
 	return True;
 }
 
-/* List the bitmap keys from the persistent cache file */
+/* Fill the cells from the key list of this server, then from the store */
+static int
+pstcache_fill_cells(uint8 id)
+{
+	struct pstcache_key keys[256];
+	HASH_KEY *mru;
+	sint16 *set;
+	char filename[256];
+	uint8 width, height;
+	int fd, n, len, num, count = 0;
+
+	set = xmalloc(KEY_SET_SIZE * sizeof(sint16));
+	memset(set, 0xff, KEY_SET_SIZE * sizeof(sint16));
+
+	pstcache_keys_filename(filename, sizeof(filename), "");
+	fd = rd_open_file(filename);
+	if (fd != -1)
+	{
+		while (count < BMPCACHE2_NUM_PSTCELLS
+		       && (len = rd_read_file(fd, keys, sizeof(keys))) > 0)
+		{
+			num = len / sizeof(struct pstcache_key);
+			for (n = 0; n < num && count < BMPCACHE2_NUM_PSTCELLS; n++)
+			{
+				if (!bmpstore_find(keys[n].key, &width, &height)
+				    || width * height > BMPCACHE2_CELL_PIXELS(id))
+					continue;
+				pstcache_add_key(keys[n].key, keys[n].stamp, &count, set);
+			}
+		}
+		rd_close_file(fd);
+	}
+
+	logger(Core, Debug, "pstcache_fill_cells(), %d keys from the list of %s", count,
+	       filename);
+
+	mru = xmalloc(BMPCACHE2_NUM_PSTCELLS * sizeof(HASH_KEY));
+	num = bmpstore_list(mru, BMPCACHE2_NUM_PSTCELLS, BMPCACHE2_CELL_PIXELS(id));
+	for (n = 0; n < num && count < BMPCACHE2_NUM_PSTCELLS; n++)
+		pstcache_add_key(mru[n], 0, &count, set);
+
+	xfree(mru);
+	xfree(set);
+	return count;
+}
+
+/* List the bitmap keys of the persistent cache */
 int
 pstcache_enumerate(uint8 id, HASH_KEY * keylist)
 {
-	int fd, n;
-	uint16 idx;
-	sint16 mru_idx[0xa00];
-	uint32 mru_stamp[0xa00];
-	CELLHEADER cellhdr;
+	int n, num, count;
+	sint16 mru_idx[BMPCACHE2_NUM_PSTCELLS];
 
 	if (!(g_bitmap_cache && g_bitmap_cache_persist_enable && IS_PERSISTENT(id)))
 		return 0;
@@ -121,55 +254,164 @@ pstcache_enumerate(uint8 id, HASH_KEY * keylist)
 		return 0;
 
 	logger(Core, Debug, "pstcache_enumerate(), start enumeration");
-	for (idx = 0; idx < BMPCACHE2_NUM_PSTCELLS; idx++)
+	num = pstcache_fill_cells(id);
+	for (n = 0; n < num; n++)
+		memcpy(keylist[n], g_pstcache_cells[n].key, sizeof(HASH_KEY));
+
+	/* keep the bitmaps offered to the server in the store while the session
+	   lasts, and leave out any that another process has dropped since */
+	bmpstore_touch(keylist, num);
+	count = 0;
+	for (n = 0; n < num; n++)
 	{
-		fd = g_pstcache_fd[id];
-		rd_lseek_file(fd, idx * (g_pstcache_Bpp * MAX_CELL_SIZE + sizeof(CELLHEADER)));
-		if (rd_read_file(fd, &cellhdr, sizeof(CELLHEADER)) <= 0)
-			break;
+		if (memcmp(keylist[n], zero_key, sizeof(HASH_KEY)) == 0)
+			continue;
+		memcpy(keylist[count], keylist[n], sizeof(HASH_KEY));
+		g_pstcache_cells[count++] = g_pstcache_cells[n];
+	}
+	memset(&g_pstcache_cells[count], 0, (num - count) * sizeof(struct pstcache_cell));
+
+	for (n = 0; n < count; n++)
+		mru_idx[count - n - 1] = n;
 
-		if (memcmp(cellhdr.key, zero_key, sizeof(HASH_KEY)) != 0)
+	logger(Core, Debug, "pstcache_enumerate(), %d cached bitmaps", count);
+
+	/* Pre-cache (not possible for 8-bit colour depth cause it needs a colourmap)
+	   from ui_select(), the bitmaps that were in memory at the end of the last
+	   session with this server, as many as fit in memory */
+	if (g_bitmap_cache_precache && g_server_depth > 8)
+	{
+		g_pstcache_queue = xmalloc(MAX(count, 1) * sizeof(uint16));
+		g_pstcache_queue_len = g_pstcache_queue_pos = 0;
+		for (n = 0; n < count && g_pstcache_cells[n].stamp != 0; n++)
 		{
-			memcpy(keylist[idx], cellhdr.key, sizeof(HASH_KEY));
+			if (g_pstcache_queue_len == (int) g_bmpcache_cells[id])
+				break;
+			g_pstcache_queue[g_pstcache_queue_len++] = n;
+			g_pstcache_cells[n].queued = True;
+		}
+		logger(Core, Debug, "pstcache_enumerate(), %d bitmaps queued for precaching",
+		       g_pstcache_queue_len);
+	}
 
-			/* Pre-cache (not possible for 8-bit colour depth cause it needs a colourmap) */
-			if (g_bitmap_cache_precache && cellhdr.stamp && g_server_depth > 8)
-				pstcache_load_bitmap(id, idx);
+	cache_rebuild_bmpcache_linked_list(id, mru_idx, count);
+	g_pstcache_enumerated = True;
+	return count;
+}
 
-			/* Sort by stamp */
-			for (n = idx; n > 0 && cellhdr.stamp < mru_stamp[n - 1]; n--)
-			{
-				mru_idx[n] = mru_idx[n - 1];
-				mru_stamp[n] = mru_stamp[n - 1];
-			}
+static void
+pstcache_drop_queue(void)
+{
+	xfree(g_pstcache_queue);
+	g_pstcache_queue = NULL;
+	g_pstcache_queue_len = g_pstcache_queue_pos = 0;
+}
 
-			mru_idx[n] = idx;
-			mru_stamp[n] = cellhdr.stamp;
-		}
+/* Load a few of the queued bitmaps, called when the client is idle.
+   Cells the server uses before they get here are loaded on demand by
+   cache_get_bitmap(). Returns True while there are more to load. */
+RD_BOOL
+pstcache_precache(void)
+{
+	uint16 idx;
+	int n = 0;
+
+	if (g_pstcache_queue == NULL)
+		return False;
+
+	while (g_pstcache_queue_pos < g_pstcache_queue_len && n < PRECACHE_BATCH)
+	{
+		idx = g_pstcache_queue[g_pstcache_queue_pos++];
+
+		/* already loaded on demand or replaced by the server */
+		if (!g_pstcache_cells[idx].queued)
+			continue;
+
+		/* older than anything loaded so far */
+		if (pstcache_load_bitmap(g_pstcache_id, idx))
+			cache_demote_bitmap(g_pstcache_id, idx);
+		n++;
+	}
+
+	if (g_pstcache_queue_pos < g_pstcache_queue_len)
+		return True;
+
+	logger(Core, Debug, "pstcache_precache(), done");
+	pstcache_drop_queue();
+	return False;
+}
+
+static int
+pstcache_cmp_stamp(const void *a, const void *b)
+{
+	const struct pstcache_key *ka = a, *kb = b;
+
+	if (ka->stamp == kb->stamp)
+		return 0;
+	return (ka->stamp > kb->stamp) ? -1 : 1;
+}
+
+/* Save the key list of this server, most recently used first, and mark
+   the bitmaps that were in memory as used in the store */
+void
+pstcache_flush(void)
+{
+	struct pstcache_key *keys;
+	HASH_KEY *used;
+	char filename[256], newname[256];
+	int fd, n, count = 0, num_used = 0, length;
+
+	if (g_pstcache_cells == NULL || !g_pstcache_enumerated)
+		return;
+
+	keys = xmalloc(BMPCACHE2_NUM_PSTCELLS * sizeof(struct pstcache_key));
+	used = xmalloc(BMPCACHE2_NUM_PSTCELLS * sizeof(HASH_KEY));
+	for (n = 0; n < BMPCACHE2_NUM_PSTCELLS; n++)
+	{
+		if (memcmp(g_pstcache_cells[n].key, zero_key, sizeof(HASH_KEY)) == 0)
+			continue;
+
+		memcpy(keys[count].key, g_pstcache_cells[n].key, sizeof(HASH_KEY));
+		keys[count].stamp = g_pstcache_cells[n].stamp;
+		count++;
+
+		if (g_pstcache_cells[n].stamp != 0)
+			memcpy(used[num_used++], g_pstcache_cells[n].key, sizeof(HASH_KEY));
+	}
+
+	qsort(keys, count, sizeof(struct pstcache_key), pstcache_cmp_stamp);
+
+	/* write to a new file and rename it, sessions to the same server may end together */
+	pstcache_keys_filename(filename, sizeof(filename), "");
+	pstcache_keys_filename(newname, sizeof(newname), ".new");
+	rd_remove_file(newname);
+	fd = rd_open_file(newname);
+	if (fd != -1)
+	{
+		length = count * sizeof(struct pstcache_key);
+		if (rd_write_file(fd, keys, length) == length)
+			rd_rename_file(newname, filename);
 		else
-		{
-			break;
-		}
+			rd_remove_file(newname);
+		rd_close_file(fd);
 	}
 
-	logger(Core, Debug, "pstcache_enumerate(), %d cached bitmaps", idx);
+	bmpstore_touch(used, num_used);
+	logger(Core, Debug, "pstcache_flush(), %d keys saved, %d in memory", count, num_used);
 
-	cache_rebuild_bmpcache_linked_list(id, mru_idx, idx);
-	g_pstcache_enumerated = True;
-	return idx;
+	xfree(used);
+	xfree(keys);
 }
 
 /* initialise the persistent bitmap cache */
 RD_BOOL
 pstcache_init(uint8 cache_id)
 {
-	int fd;
-	char filename[256];
-
 	if (g_pstcache_enumerated)
 		return True;
 
-	g_pstcache_fd[cache_id] = 0;
+	g_pstcache_id = -1;
+	pstcache_drop_queue();
 
 	if (!(g_bitmap_cache && g_bitmap_cache_persist_enable))
 		return False;
@@ -182,21 +424,16 @@ pstcache_init(uint8 cache_id)
 	}
 
 	g_pstcache_Bpp = (g_server_depth + 7) / 8;
-	sprintf(filename, "cache/pstcache_%d_%d", cache_id, g_pstcache_Bpp);
-	logger(Core, Debug, "pstcache_init(), bitmap cache file %s", filename);
-
-	fd = rd_open_file(filename);
-	if (fd == -1)
-		return False;
-
-	if (!rd_lock_file(fd, 0, 0))
+	if (!bmpstore_open(g_pstcache_Bpp))
 	{
-		logger(Core, Error,
-		       "pstcache_init(), failed to lock persistent cache file, disabling feature");
-		rd_close_file(fd);
+		logger(Core, Error, "pstcache_init(), failed to open bitmap store, disabling feature");
 		return False;
 	}
 
-	g_pstcache_fd[cache_id] = fd;
+	if (g_pstcache_cells == NULL)
+		g_pstcache_cells = xmalloc(BMPCACHE2_NUM_PSTCELLS * sizeof(struct pstcache_cell));
+	memset(g_pstcache_cells, 0, BMPCACHE2_NUM_PSTCELLS * sizeof(struct pstcache_cell));
+
+	g_pstcache_id = cache_id;
 	return True;
 }
@@ -0,0 +1,188 @@
+/* -*- c-basic-offset: 8 -*-
+   rdesktop: A Remote Desktop Protocol client.
+   Bounded single producer, single consumer queue
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+   Items are passed between exactly one producer thread and one consumer
+   thread without locking: the producer only writes tail, the consumer
+   only writes head. A side waits on a pipe when the queue is empty or
+   full, so that the consumer can include it in the select() of the main
+   loop. The other side only writes to the pipe when it has just made
+   the queue non-empty or non-full, and the waiting side re-checks the
+   queue after draining the pipe, so a wakeup cannot be lost.
+*/
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#ifdef HAVE_SYS_SELECT_H
+#include <sys/select.h>
+#endif
+
+#include "rdesktop.h"
+
+#define QUEUE_LOAD(v)		__atomic_load_n(&(v), __ATOMIC_SEQ_CST)
+#define QUEUE_STORE(v, x)	__atomic_store_n(&(v), (x), __ATOMIC_SEQ_CST)
+
+static RD_BOOL
+queue_pipe(int fds[2])
+{
+	if (pipe(fds) != 0)
+		return False;
+
+	fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+	fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+	return True;
+}
+
+static void
+queue_signal(int fd)
+{
+	uint8 c = 0;
+
+	/* a full pipe already holds a pending wakeup */
+	if (write(fd, &c, 1) < 0 && errno != EAGAIN)
+		logger(Core, Warning, "queue_signal(), write failed: %s", strerror(errno));
+}
+
+static void
+queue_drain(int fd)
+{
+	uint8 buf[64];
+
+	while (read(fd, buf, sizeof(buf)) > 0);
+}
+
+/* Initialise a queue with room for size items, size must be a power
+   of two */
+RD_BOOL
+queue_init(RD_QUEUE * q, uint32 size)
+{
+	memset(q, 0, sizeof(RD_QUEUE));
+
+	if (!queue_pipe(q->readable))
+	{
+		logger(Core, Error, "queue_init(), pipe() failed: %s", strerror(errno));
+		return False;
+	}
+
+	if (!queue_pipe(q->writable))
+	{
+		logger(Core, Error, "queue_init(), pipe() failed: %s", strerror(errno));
+		close(q->readable[0]);
+		close(q->readable[1]);
+		return False;
+	}
+
+	q->items = (void **) xmalloc(size * sizeof(void *));
+	q->size = size;
+	return True;
+}
+
+void
+queue_destroy(RD_QUEUE * q)
+{
+	close(q->readable[0]);
+	close(q->readable[1]);
+	close(q->writable[0]);
+	close(q->writable[1]);
+	xfree(q->items);
+	memset(q, 0, sizeof(RD_QUEUE));
+}
+
+/* Add an item, producer side. Returns False if the queue is full. */
+RD_BOOL
+queue_push(RD_QUEUE * q, void *item)
+{
+	uint32 tail = q->tail;
+
+	if (tail - QUEUE_LOAD(q->head) == q->size)
+		return False;
+
+	q->items[tail & (q->size - 1)] = item;
+	QUEUE_STORE(q->tail, tail + 1);
+
+	/* the consumer may have seen an empty queue and gone to sleep */
+	if (QUEUE_LOAD(q->head) == tail)
+		queue_signal(q->readable[1]);
+
+	return True;
+}
+
+/* Remove an item, consumer side. Returns NULL if the queue is empty. */
+void *
+queue_pop(RD_QUEUE * q)
+{
+	uint32 head = q->head;
+	void *item;
+
+	if (QUEUE_LOAD(q->tail) == head)
+	{
+		queue_drain(q->readable[0]);
+		if (QUEUE_LOAD(q->tail) == head)
+			return NULL;
+	}
+
+	item = q->items[head & (q->size - 1)];
+	QUEUE_STORE(q->head, head + 1);
+
+	/* the producer may have seen a full queue and gone to sleep */
+	if (QUEUE_LOAD(q->tail) - head == q->size)
+		queue_signal(q->writable[1]);
+
+	return item;
+}
+
+/* File descriptor that becomes readable when items may be available,
+   for use in select() by the consumer */
+int
+queue_fd(RD_QUEUE * q)
+{
+	return q->readable[0];
+}
+
+/* Wait until the queue is not full, producer side. Returns False if
+   cancel_fd became readable first. */
+RD_BOOL
+queue_wait_space(RD_QUEUE * q, int cancel_fd)
+{
+	fd_set rfds;
+	int n;
+
+	while (1)
+	{
+		queue_drain(q->writable[0]);
+		if (q->tail - QUEUE_LOAD(q->head) < q->size)
+			return True;
+
+		FD_ZERO(&rfds);
+		FD_SET(q->writable[0], &rfds);
+		FD_SET(cancel_fd, &rfds);
+		n = select(MAX(q->writable[0], cancel_fd) + 1, &rfds, NULL, NULL, NULL);
+		if (n < 0 && errno != EINTR)
+		{
+			logger(Core, Error, "queue_wait_space(), select() failed: %s",
+			       strerror(errno));
+			return False;
+		}
+
+		if (n > 0 && FD_ISSET(cancel_fd, &rfds))
+			return False;
+	}
+}
@@ -25,6 +25,7 @@
 #include <pwd.h>		/* getpwuid */
 #include <termios.h>		/* tcgetattr tcsetattr */
 #include <sys/stat.h>		/* stat */
+#include <sys/mman.h>		/* mmap munmap msync */
 #include <sys/time.h>		/* gettimeofday */
 #include <sys/times.h>		/* times */
 #include <ctype.h>		/* toupper */
@@ -92,6 +93,13 @@ RD_BOOL g_sendmotion = True;
 RD_BOOL g_bitmap_cache = True;
 RD_BOOL g_bitmap_cache_persist_enable = False;
 RD_BOOL g_bitmap_cache_precache = True;
+int g_bmpcache_num = 3;		/* bitmap caches advertised, the last may be persistent */
+uint32 g_bmpcache_cells[BMPCACHE2_MAX_CACHES] =
+	{ BMPCACHE2_C0_CELLS, BMPCACHE2_C1_CELLS, BMPCACHE2_C2_CELLS };
+uint32 g_bmpcache_budget = 0;	/* bytes of decoded bitmaps, 0 is unlimited */
+uint16 g_glyphcache_cells[GLYPHCACHE_NUM_CACHES] =
+	{ 254, 254, 254, 254, 254, 254, 254, 254, 254, 64 };
+uint32 g_glyphcache_budget = 0;	/* bytes of glyph data, 0 is unlimited */
 RD_BOOL g_use_ctrl = True;
 RD_BOOL g_encryption = True;
 RD_BOOL g_encryption_initial = True;
@@ -109,6 +117,7 @@ RD_BOOL g_numlock_sync = False;
 RD_BOOL g_lspci_enabled = False;
 RD_BOOL g_owncolmap = False;
 RD_BOOL g_ownbackstore = True;	/* We can't rely on external BackingStore */
+RD_BOOL g_swfb = False;		/* Render in a client side framebuffer */
 RD_BOOL g_seamless_rdp = False;
 RD_BOOL g_use_password_as_pin = False;
 char g_seamless_shell[512];
@@ -188,6 +197,7 @@ usage(char *program)
 	fprintf(stderr, "   -A: path to SeamlessRDP shell, this enables SeamlessRDP mode\n");
 	fprintf(stderr, "   -V: tls version (1.0, 1.1, 1.2, defaults to 1.0)\n");
 	fprintf(stderr, "   -B: use BackingStore of X-server (if available)\n");
+	fprintf(stderr, "   -F: render in a client side framebuffer (32 bpp displays)\n");
 	fprintf(stderr, "   -e: disable encryption (French TS)\n");
 	fprintf(stderr, "   -E: disable encryption from client to server\n");
 	fprintf(stderr, "   -m: do not send motion events\n");
@@ -202,8 +212,14 @@ usage(char *program)
 	fprintf(stderr, "   -X: embed into another window with a given id.\n");
 	fprintf(stderr, "   -a: connection colour depth\n");
 	fprintf(stderr, "   -z: enable rdp compression\n");
+	fprintf(stderr, "   -Z: compression history memory in kB (default 2018 for RDP 6.1, 64 for RDP 6.0)\n");
 	fprintf(stderr, "   -x: RDP5 experience (m[odem 28.8], b[roadband], l[an] or hex nr.)\n");
 	fprintf(stderr, "   -P: use persistent bitmap caching\n");
+	fprintf(stderr, "   -q: bitmap caches: CELLS[,CELLS...][:MB] (default: 120,120,336)\n");
+	fprintf(stderr, "   -G: glyph caches: CELLS[,CELLS...][:KB] (default: 254,...,254,64)\n");
+	fprintf(stderr, "   -R: record session to file\n");
+	fprintf(stderr, "   -Y: replay recorded session from file instead of connecting\n");
+	fprintf(stderr, "   -y: replay at the original pace instead of as fast as possible\n");
 	fprintf(stderr, "   -r: enable specified device redirection (this flag can be repeated)\n");
 	fprintf(stderr,
 		"         '-r comport:COM1=/dev/ttyS0': enable serial redirection of /dev/ttyS0 to COM1\n");
@@ -741,6 +757,125 @@ parse_geometry_string(const char *optarg)
 	return 0;
 }
 
+// CELLS[,CELLS...][:MB]
+static int
+parse_bmpcache_string(const char *optarg)
+{
+	sint32 value;
+	const char *ps;
+	char *pe;
+	int num = 0;
+
+	ps = optarg;
+	while (*ps != ':' && *ps != '\0')
+	{
+		if (num == BMPCACHE2_MAX_CACHES)
+		{
+			logger(Core, Error, "invalid bitmap cache, at most %d caches",
+			       BMPCACHE2_MAX_CACHES);
+			return -1;
+		}
+
+		value = strtol(ps, &pe, 10);
+		if (ps == pe || value <= 0 || value >= 0x7fff)
+		{
+			logger(Core, Error,
+			       "invalid bitmap cache, expected cell count between 1 and 32766");
+			return -1;
+		}
+
+		g_bmpcache_cells[num++] = value;
+		ps = pe;
+
+		if (*ps == ',')
+			ps++;
+		else if (*ps != ':' && *ps != '\0')
+		{
+			logger(Core, Error, "invalid bitmap cache, expected ',' or ':' after cells");
+			return -1;
+		}
+	}
+
+	if (num > 0)
+		g_bmpcache_num = num;
+
+	/* parse optional memory budget */
+	if (*ps == ':')
+	{
+		ps++;
+		value = strtol(ps, &pe, 10);
+		if (ps == pe || value < 0 || value > 4095 || *pe != '\0')
+		{
+			logger(Core, Error,
+			       "invalid bitmap cache, expected megabytes between 0 and 4095");
+			return -1;
+		}
+
+		g_bmpcache_budget = (uint32) value << 20;
+	}
+
+	return 0;
+}
+
+/* Parses glyph cache configuration of the form CELLS[,CELLS...][:KB], caches
+   that aren't listed keep their defaults */
+static int
+parse_glyphcache_string(const char *optarg)
+{
+	sint32 value;
+	const char *ps;
+	char *pe;
+	int num = 0;
+
+	ps = optarg;
+	while (*ps != ':' && *ps != '\0')
+	{
+		if (num == GLYPHCACHE_NUM_CACHES)
+		{
+			logger(Core, Error, "invalid glyph cache, at most %d caches",
+			       GLYPHCACHE_NUM_CACHES);
+			return -1;
+		}
+
+		value = strtol(ps, &pe, 10);
+		if (ps == pe || value <= 0 || value > GLYPHCACHE_MAX_CELLS)
+		{
+			logger(Core, Error,
+			       "invalid glyph cache, expected cell count between 1 and %d",
+			       GLYPHCACHE_MAX_CELLS);
+			return -1;
+		}
+
+		g_glyphcache_cells[num++] = value;
+		ps = pe;
+
+		if (*ps == ',')
+			ps++;
+		else if (*ps != ':' && *ps != '\0')
+		{
+			logger(Core, Error, "invalid glyph cache, expected ',' or ':' after cells");
+			return -1;
+		}
+	}
+
+	/* parse optional memory budget */
+	if (*ps == ':')
+	{
+		ps++;
+		value = strtol(ps, &pe, 10);
+		if (ps == pe || value < 0 || value > 65535 || *pe != '\0')
+		{
+			logger(Core, Error,
+			       "invalid glyph cache, expected kilobytes between 0 and 65535");
+			return -1;
+		}
+
+		g_glyphcache_budget = (uint32) value << 10;
+	}
+
+	return 0;
+}
+
 static void
 setup_user_requested_session_size()
 {
@@ -781,10 +916,14 @@ main(int argc, char *argv[])
 	struct passwd *pw;
 	uint32 flags, ext_disc_reason = 0;
 	char *p;
-	int c;
+	int c, ret;
 	char *locale = NULL;
 	int username_option = 0;
 	RD_BOOL geometry_option = False;
+	char *record_file = NULL;
+	char *replay_file = NULL;
+	RD_BOOL replay_paced = False;
+	uint32 compression_history = XCRUSH_HISTORY_SIZE + RDP_MPPC_DICT_SIZE;
 #ifdef WITH_RDPSND
 	char *rdpsnd_optarg = NULL;
 #endif
@@ -820,7 +959,7 @@ main(int argc, char *argv[])
 	g_num_devices = 0;
 
 	while ((c = getopt(argc, argv,
-			   "A:V:u:L:d:s:c:p:n:k:g:o:fbBeEitmMzCDKS:T:NX:a:x:Pr:045vh?")) != -1)
+			   "A:V:u:L:d:s:c:p:n:k:g:o:fbBFeEitmMzZ:CDKS:T:NX:a:x:Pq:G:R:Y:yr:045vh?")) != -1)
 	{
 		switch (c)
 		{
@@ -909,6 +1048,10 @@ main(int argc, char *argv[])
 				g_ownbackstore = False;
 				break;
 
+			case 'F':
+				g_swfb = True;
+				break;
+
 			case 'e':
 				g_encryption_initial = g_encryption = False;
 				break;
@@ -978,7 +1121,17 @@ main(int argc, char *argv[])
 
 			case 'z':
 				logger(Core, Debug, "rdp compression enabled");
-				flags |= (RDP_INFO_COMPRESSION | RDP_INFO_COMPRESSION2);
+				flags |= RDP_INFO_COMPRESSION;
+				break;
+
+			case 'Z':
+				compression_history = strtoul(optarg, &p, 10) * 1024;
+				if (*p || *optarg == '-' || compression_history == 0)
+				{
+					logger(Core, Error, "invalid compression history size '%s'",
+					       optarg);
+					return EX_USAGE;
+				}
 				break;
 
 			case 'x':
@@ -1009,6 +1162,32 @@ main(int argc, char *argv[])
 				g_bitmap_cache_persist_enable = True;
 				break;
 
+			case 'q':
+				if (parse_bmpcache_string(optarg) != 0)
+				{
+					return EX_USAGE;
+				}
+				break;
+
+			case 'G':
+				if (parse_glyphcache_string(optarg) != 0)
+				{
+					return EX_USAGE;
+				}
+				break;
+
+			case 'R':
+				record_file = optarg;
+				break;
+
+			case 'Y':
+				replay_file = optarg;
+				break;
+
+			case 'y':
+				replay_paced = True;
+				break;
+
 			case 'r':
 
 				if (str_startswith(optarg, "sound"))
@@ -1169,11 +1348,27 @@ main(int argc, char *argv[])
 		}
 	}
 
-	if (argc - optind != 1)
+	if (argc - optind != (replay_file ? 0 : 1))
 	{
 		usage(argv[0]);
 		return EX_USAGE;
 	}
+
+	/* offer the compression type with the largest history that fits
+	   in the memory allowed for it, RDP 6.0 needs the same 64K as RDP5.
+	   The RDP 6.1 history is only allocated once the server uses it. */
+	if (flags & RDP_INFO_COMPRESSION)
+	{
+		if (compression_history >= XCRUSH_HISTORY_SIZE + RDP_MPPC_DICT_SIZE)
+			flags |= PACKET_COMPR_TYPE_RDP61 << 9;
+		else if (compression_history >= RDP_MPPC_DICT_SIZE)
+			flags |= PACKET_COMPR_TYPE_RDP6 << 9;
+		else
+			flags |= PACKET_COMPR_TYPE_8K << 9;
+		logger(Core, Debug, "rdp compression type %d",
+		       (flags & RDP_INFO_COMPRESSION_TYPE_MASK) >> 9);
+	}
+
 	if (g_local_cursor)
 	{
 		/* there is no point wasting bandwidth on cursor shadows
@@ -1181,8 +1376,15 @@ main(int argc, char *argv[])
 		g_rdp5_performanceflags |= PERF_DISABLE_CURSOR_SHADOW;
 	}
 
-	STRNCPY(server, argv[optind], sizeof(server));
-	parse_server_and_port(server);
+	if (replay_file)
+	{
+		STRNCPY(server, replay_file, sizeof(server));
+	}
+	else
+	{
+		STRNCPY(server, argv[optind], sizeof(server));
+		parse_server_and_port(server);
+	}
 
 	if (g_seamless_rdp)
 	{
@@ -1285,7 +1487,7 @@ main(int argc, char *argv[])
 		xfree(locale);
 
 	/* If no password provided at this point, prompt for password / pin */
-	if (!g_password[0] && password_provided == False)
+	if (!g_password[0] && password_provided == False && replay_file == NULL)
 	{
 		if (read_password(g_password, sizeof(g_password)))
 		{
@@ -1344,6 +1546,17 @@ main(int argc, char *argv[])
 
 	setup_user_requested_session_size();
 
+	if (replay_file)
+	{
+		ret = replay_run(replay_file, replay_paced);
+		ui_destroy_window();
+		ui_deinit();
+		return ret;
+	}
+
+	if (record_file && !replay_record_open(record_file))
+		return EX_CANTCREAT;
+
 	g_reconnect_loop = False;
 	while (1)
 	{
@@ -1491,6 +1704,8 @@ main(int argc, char *argv[])
 	ui_destroy_window();
 
 	cache_save_state();
+	cache_log_stats();
+	replay_record_close();
 	ui_deinit();
 
 	if (g_user_quit)
@@ -2163,3 +2378,107 @@ rd_lock_file(int fd, int start, int len)
 		return False;
 	return True;
 }
+
+/* do a write lock on a file, waiting for other holders */
+RD_BOOL
+rd_lock_file_wait(int fd, int start, int len)
+{
+	struct flock lock;
+
+	lock.l_type = F_WRLCK;
+	lock.l_whence = SEEK_SET;
+	lock.l_start = start;
+	lock.l_len = len;
+	while (fcntl(fd, F_SETLKW, &lock) == -1)
+		if (errno != EINTR)
+			return False;
+	return True;
+}
+
+/* release a lock on a file */
+void
+rd_unlock_file(int fd, int start, int len)
+{
+	struct flock lock;
+
+	lock.l_type = F_UNLCK;
+	lock.l_whence = SEEK_SET;
+	lock.l_start = start;
+	lock.l_len = len;
+	fcntl(fd, F_SETLK, &lock);
+}
+
+/* rename a file in the .rdesktop directory, replacing the target */
+RD_BOOL
+rd_rename_file(char *oldname, char *newname)
+{
+	char *home;
+	char from[256], to[256];
+
+	home = getenv("HOME");
+	if (home == NULL)
+		return False;
+	snprintf(from, sizeof(from), "%s/.rdesktop/%s", home, oldname);
+	snprintf(to, sizeof(to), "%s/.rdesktop/%s", home, newname);
+	if (rename(from, to) == -1)
+	{
+		logger(Core, Error, "rd_rename_file(), rename() failed: %s", strerror(errno));
+		return False;
+	}
+
+	return True;
+}
+
+/* remove a file from the .rdesktop directory */
+void
+rd_remove_file(char *filename)
+{
+	char *home;
+	char fn[256];
+
+	home = getenv("HOME");
+	if (home == NULL)
+		return;
+	snprintf(fn, sizeof(fn), "%s/.rdesktop/%s", home, filename);
+	unlink(fn);
+}
+
+/* map a file shared into memory, growing it to length bytes if needed */
+void *
+rd_map_file(int fd, int length)
+{
+	struct stat st;
+	void *map;
+
+	if (fstat(fd, &st) == -1)
+		return NULL;
+
+	if (st.st_size < length && ftruncate(fd, length) == -1)
+	{
+		logger(Core, Error, "rd_map_file(), ftruncate() failed: %s", strerror(errno));
+		return NULL;
+	}
+
+	map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+	{
+		logger(Core, Error, "rd_map_file(), mmap() failed: %s", strerror(errno));
+		return NULL;
+	}
+
+	return map;
+}
+
+/* unmap a file mapped with rd_map_file() */
+void
+rd_unmap_file(void *map, int length)
+{
+	munmap(map, length);
+}
+
+/* start writing back the changed pages of a mapped file */
+void
+rd_sync_file(void *map, int length)
+{
+	msync(map, length, MS_ASYNC);
+}
@@ -48,6 +48,7 @@ extern uint32 g_requested_session_width;
 extern uint32 g_requested_session_height;
 extern RD_BOOL g_bitmap_cache;
 extern RD_BOOL g_bitmap_cache_persist_enable;
+extern int g_bmpcache_num;
 extern RD_BOOL g_numlock_sync;
 extern RD_BOOL g_pending_resize;
 extern RD_BOOL g_pending_resize_defer;
@@ -96,6 +97,39 @@ extern RD_BOOL g_fullscreen;
 uint16 g_session_width;
 uint16 g_session_height;
 
+/* Input events are collected while processing a round of X events
+   and sent in a single PDU */
+#define RDP_INPUT_QUEUE_SIZE 64
+
+typedef struct _RDP_INPUT_EVENT
+{
+	uint32 time;
+	uint16 message_type;
+	uint16 device_flags;
+	uint16 param1;
+	uint16 param2;
+}
+RDP_INPUT_EVENT;
+
+static RDP_INPUT_EVENT g_input_queue[RDP_INPUT_QUEUE_SIZE];
+static int g_input_queue_len = 0;
+static RD_BOOL g_input_batching = False;
+
+/* Server accepts fast-path input PDUs */
+static RD_BOOL g_fastpath_input = False;
+
+/* Destination of a rectangle in a bitmap update */
+typedef struct _BITMAP_UPDATE_RECT
+{
+	uint16 left;
+	uint16 top;
+	uint16 cx;
+	uint16 cy;
+	RD_BOOL compressed;
+	int Bpp;		/* of the decompressed data */
+}
+BITMAP_UPDATE_RECT;
+
 static void rdp_out_unistr(STREAM s, char *string, int len);
 
 /* reads a TS_SHARECONTROLHEADER from stream, returns True of there is
@@ -570,27 +604,140 @@ rdp_send_synchronise(void)
 	rdp_send_data(s, RDP_DATA_PDU_SYNCHRONISE);
 }
 
-/* Send a single input event */
+/* Send queued input events, either as a fast-path input PDU or as a
+   slow-path TS_INPUT_PDU, both of which may carry several events */
+static void
+rdp_flush_input(void)
+{
+	STREAM s;
+	RDP_INPUT_EVENT *ev;
+	uint8 code, flags;
+	uint32 secflags;
+	int i;
+
+	if (g_input_queue_len == 0)
+		return;
+
+	logger(Protocol, Debug, "%s(), sending %d events", __func__, g_input_queue_len);
+
+	if (g_fastpath_input)
+	{
+		secflags = g_encryption ? SEC_ENCRYPT : 0;
+		s = sec_fastpath_init(secflags, 1 + g_input_queue_len * 7);
+
+		if (g_input_queue_len >= 16)
+			out_uint8(s, g_input_queue_len);	/* numEvents */
+
+		for (i = 0; i < g_input_queue_len; i++)
+		{
+			ev = &g_input_queue[i];
+			switch (ev->message_type)
+			{
+				case RDP_INPUT_SCANCODE:
+					flags = 0;
+					if (ev->device_flags & KBD_FLAG_UP)
+						flags |= FASTPATH_INPUT_KBDFLAGS_RELEASE;
+					if (ev->device_flags & KBD_FLAG_EXT)
+						flags |= FASTPATH_INPUT_KBDFLAGS_EXTENDED;
+					if (ev->device_flags & KBD_FLAG_EXT1)
+						flags |= FASTPATH_INPUT_KBDFLAGS_EXTENDED1;
+					out_uint8(s, (FASTPATH_INPUT_EVENT_SCANCODE << 5) | flags);
+					out_uint8(s, ev->param1);	/* keyCode */
+					break;
+
+				case RDP_INPUT_UNICODE:
+					flags = (ev->device_flags & KBD_FLAG_UP) ?
+						FASTPATH_INPUT_KBDFLAGS_RELEASE : 0;
+					out_uint8(s, (FASTPATH_INPUT_EVENT_UNICODE << 5) | flags);
+					out_uint16_le(s, ev->param1);	/* unicodeCode */
+					break;
+
+				case RDP_INPUT_MOUSE:
+				case RDP_INPUT_MOUSEX:
+					code = (ev->message_type == RDP_INPUT_MOUSE) ?
+						FASTPATH_INPUT_EVENT_MOUSE : FASTPATH_INPUT_EVENT_MOUSEX;
+					out_uint8(s, code << 5);
+					out_uint16_le(s, ev->device_flags);	/* pointerFlags */
+					out_uint16_le(s, ev->param1);	/* xPos */
+					out_uint16_le(s, ev->param2);	/* yPos */
+					break;
+
+				case RDP_INPUT_SYNCHRONIZE:
+					/* eventFlags carries the toggle states */
+					out_uint8(s, (FASTPATH_INPUT_EVENT_SYNC << 5) | (ev->param1 & 0x1f));
+					break;
+
+				default:
+					logger(Protocol, Warning,
+					       "rdp_flush_input(), unhandled input event type 0x%x",
+					       ev->message_type);
+					break;
+			}
+		}
+
+		s_mark_end(s);
+		sec_fastpath_send(s, secflags, g_input_queue_len);
+	}
+	else
+	{
+		s = rdp_init_data(4 + g_input_queue_len * 12);
+
+		out_uint16_le(s, g_input_queue_len);	/* number of events */
+		out_uint16(s, 0);	/* pad */
+
+		for (i = 0; i < g_input_queue_len; i++)
+		{
+			ev = &g_input_queue[i];
+			out_uint32_le(s, ev->time);
+			out_uint16_le(s, ev->message_type);
+			out_uint16_le(s, ev->device_flags);
+			out_uint16_le(s, ev->param1);
+			out_uint16_le(s, ev->param2);
+		}
+
+		s_mark_end(s);
+		rdp_send_data(s, RDP_DATA_PDU_INPUT);
+	}
+
+	g_input_queue_len = 0;
+}
+
+/* Start collecting input events, they are sent together by
+   rdp_end_input_batch() instead of one PDU per event */
+void
+rdp_begin_input_batch(void)
+{
+	g_input_batching = True;
+}
+
+/* Send all input events collected since rdp_begin_input_batch() */
+void
+rdp_end_input_batch(void)
+{
+	g_input_batching = False;
+	rdp_flush_input();
+}
+
+/* Send an input event, or queue it if a batch is being collected */
 void
 rdp_send_input(uint32 time, uint16 message_type, uint16 device_flags, uint16 param1, uint16 param2)
 {
-	STREAM s;
+	RDP_INPUT_EVENT *ev;
 
 	logger(Protocol, Debug, "%s()", __func__);
 
-	s = rdp_init_data(16);
-
-	out_uint16_le(s, 1);	/* number of events */
-	out_uint16(s, 0);	/* pad */
+	if (g_input_queue_len == RDP_INPUT_QUEUE_SIZE)
+		rdp_flush_input();
 
-	out_uint32_le(s, time);
-	out_uint16_le(s, message_type);
-	out_uint16_le(s, device_flags);
-	out_uint16_le(s, param1);
-	out_uint16_le(s, param2);
+	ev = &g_input_queue[g_input_queue_len++];
+	ev->time = time;
+	ev->message_type = message_type;
+	ev->device_flags = device_flags;
+	ev->param1 = param1;
+	ev->param2 = param2;
 
-	s_mark_end(s);
-	rdp_send_data(s, RDP_DATA_PDU_INPUT);
+	if (!g_input_batching)
+		rdp_flush_input();
 }
 
 /* Send a Suppress Output PDU */
@@ -635,11 +782,13 @@ rdp_enum_bmpcache2(void)
 	STREAM s;
 	HASH_KEY keylist[BMPCACHE2_NUM_PSTCELLS];
 	uint32 num_keys, offset, count, flags;
+	int id, pst_id;
 
 	logger(Protocol, Debug, "%s()", __func__);
 
 	offset = 0;
-	num_keys = pstcache_enumerate(2, keylist);
+	pst_id = g_bmpcache_num - 1;
+	num_keys = pstcache_enumerate(pst_id, keylist);
 
 	while (offset < num_keys)
 	{
@@ -653,15 +802,11 @@ rdp_enum_bmpcache2(void)
 		if (num_keys - offset <= 169)
 			flags |= PDU_FLAG_LAST;
 
-		/* header */
-		out_uint32_le(s, 0);
-		out_uint16_le(s, count);
-		out_uint16_le(s, 0);
-		out_uint16_le(s, 0);
-		out_uint16_le(s, 0);
-		out_uint16_le(s, 0);
-		out_uint16_le(s, num_keys);
-		out_uint32_le(s, 0);
+		/* header, the keys only belong to the persistent cache */
+		for (id = 0; id < BMPCACHE2_MAX_CACHES; id++)
+			out_uint16_le(s, id == pst_id ? count : 0);	/* numEntriesCache */
+		for (id = 0; id < BMPCACHE2_MAX_CACHES; id++)
+			out_uint16_le(s, id == pst_id ? num_keys : 0);	/* totalEntriesCache */
 		out_uint32_le(s, flags);
 
 		/* list */
@@ -828,25 +973,31 @@ rdp_out_bmpcache_caps(STREAM s)
 static void
 rdp_out_bmpcache2_caps(STREAM s)
 {
+	RD_BOOL persist;
+	int id;
+
 	out_uint16_le(s, RDP_CAPSET_BMPCACHE2);
 	out_uint16_le(s, RDP_CAPLEN_BMPCACHE2);
 
 	out_uint16_le(s, g_bitmap_cache_persist_enable ? 2 : 0);	/* version */
 
-	out_uint16_be(s, 3);	/* number of caches in this set */
+	out_uint16_be(s, g_bmpcache_num);	/* number of caches in this set */
 
-	/* max cell size for cache 0 is 16x16, 1 = 32x32, 2 = 64x64, etc */
-	out_uint32_le(s, BMPCACHE2_C0_CELLS);
-	out_uint32_le(s, BMPCACHE2_C1_CELLS);
-	if (pstcache_init(2))
-	{
-		out_uint32_le(s, BMPCACHE2_NUM_PSTCELLS | BMPCACHE2_FLAG_PERSIST);
-	}
-	else
+	/* the largest cache is the persistent one */
+	persist = pstcache_init(g_bmpcache_num - 1);
+	for (id = 0; id < g_bmpcache_num; id++)
 	{
-		out_uint32_le(s, BMPCACHE2_C2_CELLS);
+		if (persist && id == g_bmpcache_num - 1)
+		{
+			out_uint32_le(s, BMPCACHE2_NUM_PSTCELLS | BMPCACHE2_FLAG_PERSIST);
+		}
+		else
+		{
+			out_uint32_le(s, cache_get_bitmap_cells(id));
+		}
 	}
-	out_uint8s(s, 20);	/* other bitmap caches not used */
+	out_uint8s(s, 4 * (BMPCACHE2_MAX_CACHES - g_bmpcache_num));	/* unused caches */
+	out_uint8s(s, 12);	/* pad */
 }
 
 /* Output control capability set */
@@ -957,6 +1108,8 @@ rdp_out_ts_input_capabilityset(STREAM s)
 {
 	uint16 inputflags = 0;
 	inputflags |= INPUT_FLAG_SCANCODES;
+	if (g_rdp_version >= RDP_V5)
+		inputflags |= INPUT_FLAG_FASTPATH_INPUT | INPUT_FLAG_FASTPATH_INPUT2;
 
 	out_uint16_le(s, RDP_CAPSET_INPUT);
 	out_uint16_le(s, RDP_CAPLEN_INPUT);
@@ -1007,22 +1160,18 @@ rdp_out_ts_cache_definition(STREAM s, uint16 entries, uint16 maxcellsize)
 static void
 rdp_out_ts_glyphcache_capabilityset(STREAM s)
 {
-	uint16 supportlvl = GLYPH_SUPPORT_FULL;
+	/* encode allows the more compact revision 2 cache glyph order */
+	uint16 supportlvl = GLYPH_SUPPORT_ENCODE;
 	uint32 fragcache = 0x01000100;
+	uint8 id;
+
 	out_uint16_le(s, RDP_CAPSET_GLYPHCACHE);
 	out_uint16_le(s, RDP_CAPLEN_GLYPHCACHE);
 
 	/* GlyphCache - 10 TS_CACHE_DEFINITION structures */
-	rdp_out_ts_cache_definition(s, 254, 4);
-	rdp_out_ts_cache_definition(s, 254, 4);
-	rdp_out_ts_cache_definition(s, 254, 8);
-	rdp_out_ts_cache_definition(s, 254, 8);
-	rdp_out_ts_cache_definition(s, 254, 16);
-	rdp_out_ts_cache_definition(s, 254, 32);
-	rdp_out_ts_cache_definition(s, 254, 64);
-	rdp_out_ts_cache_definition(s, 254, 128);
-	rdp_out_ts_cache_definition(s, 254, 256);
-	rdp_out_ts_cache_definition(s, 64, 2048);
+	for (id = 0; id < GLYPHCACHE_NUM_CACHES; id++)
+		rdp_out_ts_cache_definition(s, cache_get_glyph_cells(id),
+					    cache_get_glyph_cell_size(id));
 
 	out_uint32_le(s, fragcache);	/* FragCache */
 	out_uint16_le(s, supportlvl);	/* GlyphSupportLevel */
@@ -1205,6 +1354,21 @@ rdp_process_bitmap_caps(STREAM s)
 	ui_resize_window(g_session_width, g_session_height);
 }
 
+/* Process an input capability set */
+static void
+rdp_process_input_caps(STREAM s)
+{
+	uint16 inputflags;
+
+	in_uint16_le(s, inputflags);
+
+	g_fastpath_input = (g_rdp_version >= RDP_V5) &&
+		(inputflags & (INPUT_FLAG_FASTPATH_INPUT | INPUT_FLAG_FASTPATH_INPUT2));
+
+	logger(Protocol, Debug, "rdp_process_input_caps(), fast-path input %s",
+	       g_fastpath_input ? "enabled" : "disabled");
+}
+
 /* Process server capabilities */
 static void
 rdp_process_server_caps(STREAM s, uint16 length)
@@ -1217,6 +1381,9 @@ rdp_process_server_caps(STREAM s, uint16 length)
 
 	start = s->p;
 
+	/* fast-path input is only used if the server says so */
+	g_fastpath_input = False;
+
 	in_uint16_le(s, ncapsets);
 	in_uint8s(s, 2);	/* pad */
 
@@ -1239,6 +1406,11 @@ rdp_process_server_caps(STREAM s, uint16 length)
 			case RDP_CAPSET_BITMAP:
 				rdp_process_bitmap_caps(s);
 				break;
+
+			case RDP_CAPSET_INPUT:
+				rdp_process_input_caps(s);
+				break;
+
 			case RDP_CAPSET_VC:
 				/* Parse only if we got VCChunkSize */
 				if (capset_length > 8) {
@@ -1275,6 +1447,7 @@ process_demand_active(STREAM s)
 	logger(Protocol, Debug, "process_demand_active(), shareid=0x%x", g_rdp_shareid);
 
 	rdp_process_server_caps(s, len_combined_caps);
+	replay_record_session();
 
 	rdp_send_confirm_active();
 	rdp_send_synchronise();
@@ -1442,13 +1615,14 @@ process_pointer_pdu(STREAM s)
 	}
 }
 
-/* Process TS_BITMAP_DATA */
+/* Parse TS_BITMAP_DATA into rect and job, the bitmap is decompressed
+   later by process_bitmap_updates() */
 static void
-process_bitmap_data(STREAM s)
+process_bitmap_data(STREAM s, BITMAP_UPDATE_RECT * rect, BITMAP_JOB * job)
 {
 	uint16 left, top, right, bottom, width, height;
-	uint16 cx, cy, bpp, Bpp, flags, bufsize, size;
-	uint8 *data, *bmpdata;
+	uint16 bpp, Bpp, flags, bufsize;
+	uint32 size;
 	
 	logger(Protocol, Debug, "%s()", __func__);
 
@@ -1465,8 +1639,10 @@ process_bitmap_data(STREAM s)
 	in_uint16_le(s, flags); /* flags */
 	in_uint16_le(s, bufsize); /* bitmapLength */
 
-	cx = right - left + 1;
-	cy = bottom - top + 1;
+	rect->left = left;
+	rect->top = top;
+	rect->cx = right - left + 1;
+	rect->cy = bottom - top + 1;
 
 	/* FIXME: There are a assumtion that we do not consider in
 		this code. The value of bpp is not passed to
@@ -1489,19 +1665,22 @@ process_bitmap_data(STREAM s)
 				left, top, right, bottom, width, height, bpp, flags);
 		rdp_protocol_error("TS_BITMAP_DATA, unsafe size of bitmap data received from server", &packet);
 	}
+
+	job->width = width;
+	job->height = height;
+	job->Bpp = Bpp;
+	job->done = False;
  
 	if (flags == 0)
 	{
-		/* read uncompressed bitmap data */
-		int y;
-		bmpdata = (uint8 *) xmalloc(width * height * Bpp);
-		for (y = 0; y < height; y++)
+		/* uncompressed bitmap data, copied by process_bitmap_updates() */
+		size = width * height * Bpp;
+		if (!s_check_rem(s, size))
 		{
-			in_uint8a(s, &bmpdata[(height - y - 1) * (width * Bpp)], width * Bpp);
+			rdp_protocol_error("process_bitmap_data(), consume of bitmap data from stream would overrun", &packet);
 		}
-		
-		ui_paint_bitmap(left, top, cx, cy, width, height, bmpdata);
-		xfree(bmpdata);
+		in_uint8p(s, job->input, size);
+		rect->compressed = False;
 		return;
 	}
 
@@ -1523,33 +1702,108 @@ process_bitmap_data(STREAM s)
 	{
 		rdp_protocol_error("process_bitmap_data(), consume of bitmap data from stream would overrun", &packet);
 	}
-	in_uint8p(s, data, size);
-	bmpdata = (uint8 *) xmalloc(width * height * Bpp);
-	if (bitmap_decompress(bmpdata, width, height, data, size, Bpp))
-	{
-		ui_paint_bitmap(left, top, cx, cy, width, height, bmpdata);
-	}
-	else
-	{
-		logger(Protocol, Warning, "%s(), failed to decompress bitmap", __func__);
-	}
-
-	xfree(bmpdata);
+	in_uint8p(s, job->input, size);
+	job->size = size;
+	rect->compressed = True;
 }
 
-/* Process TS_UPDATE_BITMAP_DATA */
+/* Process TS_UPDATE_BITMAP_DATA
+
+   The rectangles are independent of each other, so they are all parsed
+   first and decompressed in parallel, then painted in protocol order as
+   soon as each one is ready. */
 void
 process_bitmap_updates(STREAM s)
 {
-	int i;
+	static BITMAP_UPDATE_RECT *rects = NULL;
+	static BITMAP_JOB *jobs = NULL;
+	static int size = 0;
+	static uint8 *pixels = NULL;
+	static size_t pixels_size = 0;
+	BITMAP_UPDATE_RECT *rect;
+	BITMAP_JOB *job;
+	size_t total;
+	int i, y, line, Bpp;
 	uint16 num_updates;
 	
 	in_uint16_le(s, num_updates);   /* rectangles */
 
+	if (num_updates > size)
+	{
+		size = num_updates;
+		rects = (BITMAP_UPDATE_RECT *) xrealloc(rects, size * sizeof(BITMAP_UPDATE_RECT));
+		jobs = (BITMAP_JOB *) xrealloc(jobs, size * sizeof(BITMAP_JOB));
+	}
+
+	/* when the UI can take them, bitmaps are decoded straight into
+	   its pixel format instead of being translated afterwards */
+	total = 0;
 	for (i = 0; i < num_updates; i++)
 	{
-		process_bitmap_data(s);
+		process_bitmap_data(s, &rects[i], &jobs[i]);
+		Bpp = bitmap_native_Bpp(jobs[i].Bpp);
+		rects[i].Bpp = Bpp ? Bpp : jobs[i].Bpp;
+		jobs[i].native = (Bpp != 0);
+		total += jobs[i].width * jobs[i].height * rects[i].Bpp;
+	}
+
+	/* decompress into one buffer that is kept between updates */
+	if (total > pixels_size)
+	{
+		pixels_size = total;
+		pixels = (uint8 *) xrealloc(pixels, pixels_size);
 	}
+
+	total = 0;
+	for (i = 0; i < num_updates; i++)
+	{
+		job = &jobs[i];
+		job->output = pixels + total;
+		total += job->width * job->height * rects[i].Bpp;
+
+		if (rects[i].compressed)
+			continue;
+
+		/* uncompressed bitmaps are stored bottom up */
+		line = job->width * job->Bpp;
+		for (y = 0; y < job->height; y++)
+		{
+			if (job->native)
+				bitmap_translate(&job->output[(job->height - y - 1) * job->width *
+							      rects[i].Bpp], &job->input[y * line],
+						 job->width, job->Bpp);
+			else
+				memcpy(&job->output[(job->height - y - 1) * line],
+				       &job->input[y * line], line);
+		}
+
+		job->ok = True;
+		job->done = True;
+	}
+
+	bitmap_decompress_start(jobs, num_updates);
+
+	for (i = 0; i < num_updates; i++)
+	{
+		rect = &rects[i];
+		job = &jobs[i];
+		if (bitmap_decompress_wait(job) && job->native)
+		{
+			ui_paint_bitmap_native(rect->left, rect->top, rect->cx, rect->cy,
+					       job->width, job->height, job->output);
+		}
+		else if (job->ok)
+		{
+			ui_paint_bitmap(rect->left, rect->top, rect->cx, rect->cy, job->width,
+					job->height, job->output);
+		}
+		else
+		{
+			logger(Protocol, Warning, "%s(), failed to decompress bitmap", __func__);
+		}
+	}
+
+	bitmap_decompress_end();
 }
 
 /* Process a palette update */
@@ -1579,6 +1833,7 @@ process_palette(STREAM s)
 
 	hmap = ui_create_colourmap(&map);
 	ui_set_colourmap(hmap);
+	cache_flush_brush_pixmaps();
 
 	xfree(map.colours);
 }
@@ -1709,8 +1964,124 @@ process_ts_set_error_info_pdu(STREAM s, uint32 * ext_disc_reason)
 	       *ext_disc_reason);
 }
 
+/* Expand the clen bytes of bulk compressed data at s->p of the frame
+   being received into ns. While the receive pipeline runs its decode
+   stage has already done so, and the result is only looked up. */
+RD_BOOL
+rdp_expand(STREAM ns, STREAM s, uint32 clen, uint8 ctype)
+{
+	RDP_EXPANDED *e;
+	uint32 offset;
+
+	if (!tcp_recv_decoded())
+		return bulk_expand(ns, s->p, clen, ctype);
+
+	offset = s->p - s->data;
+	for (e = tcp_recv_expanded(); e != NULL; e = e->next)
+	{
+		if (e->offset != offset || e->clen != clen || e->ctype != ctype)
+			continue;
+
+		if (!e->ok)
+			return False;
+
+		*ns = e->s;
+		return True;
+	}
+
+	logger(Protocol, Error, "rdp_expand(), no data expanded at offset %u of the frame",
+	       offset);
+	return False;
+}
+
+/* Expand bulk compressed data at s->p for the decode stage of the
+   receive pipeline. The data is copied out of the history, as the next
+   packet overwrites it before the main thread gets to parse it. */
+void
+rdp_expand_ahead(STREAM s, uint32 clen, uint8 ctype, RDP_EXPANDED *** tail)
+{
+	RDP_EXPANDED *e;
+	struct stream ns;
+	uint32 length;
+
+	e = (RDP_EXPANDED *) xmalloc(sizeof(RDP_EXPANDED));
+	memset(e, 0, sizeof(RDP_EXPANDED));
+	e->offset = s->p - s->data;
+	e->clen = clen;
+	e->ctype = ctype;
+	e->ok = s_check_rem(s, clen) && bulk_expand(&ns, s->p, clen, ctype);
+
+	if (e->ok)
+	{
+		length = ns.end - ns.p;
+		s_realloc(&e->s, MAX(length, 1));
+		s_reset(&e->s);
+		out_uint8p(&e->s, ns.p, length);
+		s_mark_end(&e->s);
+		e->s.p = e->s.rdp_hdr = e->s.data;
+	}
+
+	**tail = e;
+	*tail = &e->next;
+}
+
+/* Decode stage of the receive pipeline: expand the bulk compressed PDUs
+   of a received frame, walking it the way rdp_recv() does. s is the
+   frame after RC4 decryption. Returns the list of expanded data. */
+RDP_EXPANDED *
+rdp_expand_frame(STREAM s)
+{
+	RDP_EXPANDED *list = NULL, **tail = &list;
+	RD_BOOL is_fastpath;
+	uint16 channel, length, pdu_type, clen;
+	uint8 ctype, *next;
+
+	if (!sec_parse_frame(s, False, &channel, &is_fastpath) || channel != MCS_GLOBAL_CHANNEL)
+		return NULL;
+
+	if (is_fastpath == True)
+	{
+		expand_ts_fp_updates(s, &tail);
+		return list;
+	}
+
+	while (s_check_rem(s, 2))
+	{
+		/* TS_SHARECONTROLHEADER */
+		next = s->p;
+		in_uint16_le(s, length);	/* totalLength */
+		if (length == 0x8000)
+			length = 8;	/* a flow PDU */
+		else if (length < 6 || !s_check_rem(s, 4))
+			break;
+		else
+		{
+			in_uint16_le(s, pdu_type);	/* pduType */
+			in_uint8s(s, 2);	/* pduSource */
+
+			/* TS_SHAREDATAHEADER, as in process_data_pdu() */
+			if ((pdu_type & 0xf) == RDP_PDU_DATA && s_check_rem(s, 12))
+			{
+				in_uint8s(s, 9);	/* shareid, pad, streamid, len, type */
+				in_uint8(s, ctype);
+				in_uint16_le(s, clen);
+				clen -= 18;
+
+				if (ctype & RDP_MPPC_COMPRESSED)
+					rdp_expand_ahead(s, clen, ctype, &tail);
+			}
+		}
+
+		if (length > s->end - next)
+			break;
+		s->p = next + length;
+	}
+
+	return list;
+}
+
 /* Process data PDU */
-static RD_BOOL
+RD_BOOL
 process_data_pdu(STREAM s, uint32 * ext_disc_reason)
 {
 	uint8 data_pdu_type;
@@ -1718,8 +2089,6 @@ process_data_pdu(STREAM s, uint32 * ext_disc_reason)
 	uint16 clen;
 	uint32 len;
 
-	uint32 roff, rlen;
-
 	struct stream *ns = &(g_mppc_dict.ns);
 
 	in_uint8s(s, 6);	/* shareid, pad, streamid */
@@ -1734,25 +2103,19 @@ process_data_pdu(STREAM s, uint32 * ext_disc_reason)
 		if (len > RDP_MPPC_DICT_SIZE)
 			logger(Protocol, Error,
 			       "process_data_pdu(), error decompressed packet size exceeds max");
-		if (mppc_expand(s->p, clen, ctype, &roff, &rlen) == -1)
+		/* parse the uncompressed data in place in the history buffer */
+		if (!rdp_expand(ns, s, clen, ctype))
+		{
 			logger(Protocol, Error,
 			       "process_data_pdu(), error while decompressing packet");
-
-		/* len -= 18; */
-
-		/* allocate memory and copy the uncompressed data into the temporary stream */
-		ns->data = (uint8 *) xrealloc(ns->data, rlen);
-
-		memcpy((ns->data), (unsigned char *) (g_mppc_dict.hist + roff), rlen);
-
-		ns->size = rlen;
-		ns->end = (ns->data + ns->size);
-		ns->p = ns->data;
-		ns->rdp_hdr = ns->p;
+			return False;
+		}
 
 		s = ns;
 	}
 
+	replay_record_data_pdu(data_pdu_type, s->p, s->end - s->p);
+
 	switch (data_pdu_type)
 	{
 		case RDP_DATA_PDU_UPDATE:
@@ -2061,6 +2424,8 @@ rdp_connect(char *server, uint32 flags, char *domain, char *password,
 	RD_BOOL deactivated = False;
 	uint32 ext_disc_reason = 0;
 
+	pstcache_set_server(server);
+
 	if (!sec_connect(server, g_username, domain, password, reconnect))
 		return False;
 
@@ -2090,6 +2455,8 @@ rdp_reset_state(void)
 	g_rdp_shareid = 0;
 	g_exit_mainloop = False;
 	g_first_bitmap_caps = True;
+	g_fastpath_input = False;
+	g_input_queue_len = 0;
 	sec_reset_state();
 }
 
@@ -2097,7 +2464,19 @@ rdp_reset_state(void)
 void
 rdp_disconnect(void)
 {
+	MPPC_STATS stats;
+
 	logger(Protocol, Debug, "%s()", __func__);
+
+	mppc_get_stats(&stats);
+	if (stats.packets > 0)
+		logger(Protocol, Debug,
+		       "%s(), expanded %u packets, %lu -> %lu bytes at %.1f MB/s, %u errors",
+		       __func__, stats.packets, (unsigned long) stats.bytes_in,
+		       (unsigned long) stats.bytes_out,
+		       stats.ns ? stats.bytes_out * 1000.0 / stats.ns : 0.0, stats.errors);
+	xcrush_reset();
+
 	sec_disconnect();
 }
 
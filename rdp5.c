@@ -81,7 +81,6 @@ process_ts_fp_updates(STREAM s)
 	uint8 hdr, code, frag, comp, ctype = 0;
 	uint8 *next;
 
-	uint32 roff, rlen;
 	struct stream *ns = &(g_mppc_dict.ns);
 	struct stream *ts;
 
@@ -96,6 +95,7 @@ process_ts_fp_updates(STREAM s)
 		frag = hdr & 0x30;	/*  |- fragmentation */
 		comp = hdr & 0xC0;	/*  `- compression */
 
+		ctype = 0;
 		if (comp & FASTPATH_OUTPUT_COMPRESSION_USED)
 			in_uint8(s, ctype);	/* compressionFlags */
 
@@ -105,26 +105,23 @@ process_ts_fp_updates(STREAM s)
 
 		if (ctype & RDP_MPPC_COMPRESSED)
 		{
-			if (mppc_expand(s->p, length, ctype, &roff, &rlen) == -1)
+			/* parse the uncompressed data in place in the history buffer */
+			if (!rdp_expand(ns, s, length, ctype))
+			{
 				logger(Protocol, Error,
 				       "process_ts_fp_update_pdu(), error while decompressing packet");
+				s->p = next;
+				continue;
+			}
 
-			/* allocate memory and copy the uncompressed data into the temporary stream */
-			ns->data = (uint8 *) xrealloc(ns->data, rlen);
-
-			memcpy((ns->data), (unsigned char *) (g_mppc_dict.hist + roff), rlen);
-
-			ns->size = rlen;
-			ns->end = (ns->data + ns->size);
-			ns->p = ns->data;
-			ns->rdp_hdr = ns->p;
-
-			length = rlen;
+			length = s_length(ns);
 			ts = ns;
 		}
 		else
 			ts = s;
 
+		replay_record_fp_update(code | frag, ts->p, length);
+
 		if (frag == FASTPATH_FRAGMENT_SINGLE)
 		{
 			process_ts_fp_update_by_code(ts, code);
@@ -157,5 +154,36 @@ process_ts_fp_updates(STREAM s)
 
 		s->p = next;
 	}
+	replay_record_fp_end();
 	ui_end_update();
 }
+
+/* Expand the compressed TS_FP_UPDATE structures of a fast-path output
+   PDU ahead of process_ts_fp_updates(), for the decode stage of the
+   receive pipeline */
+void
+expand_ts_fp_updates(STREAM s, RDP_EXPANDED *** tail)
+{
+	uint16 length;
+	uint8 hdr, ctype;
+
+	while (s_check_rem(s, 3))
+	{
+		in_uint8(s, hdr);	/* updateHeader */
+
+		ctype = 0;
+		if (hdr & FASTPATH_OUTPUT_COMPRESSION_USED)
+			in_uint8(s, ctype);	/* compressionFlags */
+
+		if (!s_check_rem(s, 2))
+			break;
+		in_uint16_le(s, length);	/* length */
+
+		if (ctype & RDP_MPPC_COMPRESSED)
+			rdp_expand_ahead(s, length, ctype, tail);
+
+		if (!s_check_rem(s, length))
+			break;
+		in_uint8s(s, length);
+	}
+}
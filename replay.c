@@ -0,0 +1,363 @@
+/* -*- c-basic-offset: 8 -*-
+   rdesktop: A Remote Desktop Protocol client.
+   Session recording and offline replay
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+   A recording holds the server display PDUs after decryption and bulk
+   decompression, so that it can be fed back through the regular update
+   processing without a server, a network or any compression state.
+
+   File layout, all integers little endian:
+
+     header:  "RDRECORD" (8 bytes), uint32 version
+     record:  uint8 type, uint8 pad, uint16 channel,
+              uint32 timestamp (ms since recording started),
+              uint32 length, length bytes of payload
+
+   Record types:
+
+     REPLAY_RECORD_SESSION   uint16 width, uint16 height, uint16 depth,
+                             written on each capability exchange
+     REPLAY_RECORD_FASTPATH  uncompressed TS_FP_UPDATE structures of one
+                             fast-path output PDU
+     REPLAY_RECORD_DATA_PDU  uncompressed share data PDU, starting at
+                             the shareId field of TS_SHAREDATAHEADER
+
+   Note that a recording made with persistent bitmap caching enabled
+   refers to bitmaps that are not part of the recording.
+*/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#include "rdesktop.h"
+
+#define REPLAY_MAGIC		"RDRECORD"
+#define REPLAY_VERSION		1
+#define REPLAY_HEADER_SIZE	12
+#define REPLAY_RECORD_HEADER_SIZE	12
+
+enum REPLAY_RECORD_TYPE
+{
+	REPLAY_RECORD_SESSION = 1,
+	REPLAY_RECORD_FASTPATH = 2,
+	REPLAY_RECORD_DATA_PDU = 3
+};
+
+extern int g_server_depth;
+extern uint16 g_session_width;
+extern uint16 g_session_height;
+extern uint32 g_requested_session_width;
+extern uint32 g_requested_session_height;
+
+static FILE *g_record_fp = NULL;
+static struct timeval g_record_start;
+static struct stream g_record_pdu;
+
+static uint32
+replay_elapsed_ms(struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_usec - start->tv_usec) / 1000;
+}
+
+static void
+replay_write_record(uint8 type, uint16 channel, uint8 * data, uint32 length)
+{
+	uint8 buf[REPLAY_RECORD_HEADER_SIZE];
+	struct stream hdr;
+
+	if (g_record_fp == NULL)
+		return;
+
+	hdr.data = hdr.p = buf;
+	hdr.size = sizeof(buf);
+
+	out_uint8(&hdr, type);
+	out_uint8(&hdr, 0);	/* pad */
+	out_uint16_le(&hdr, channel);
+	out_uint32_le(&hdr, replay_elapsed_ms(&g_record_start));
+	out_uint32_le(&hdr, length);
+
+	if (fwrite(buf, sizeof(buf), 1, g_record_fp) != 1 ||
+	    (length > 0 && fwrite(data, length, 1, g_record_fp) != 1))
+	{
+		logger(Core, Error, "replay_write_record(), write failed: %s, recording stopped",
+		       strerror(errno));
+		replay_record_close();
+	}
+}
+
+/* Start recording the session to filename */
+RD_BOOL
+replay_record_open(const char *filename)
+{
+	uint8 buf[REPLAY_HEADER_SIZE];
+	struct stream hdr;
+
+	g_record_fp = fopen(filename, "wb");
+	if (g_record_fp == NULL)
+	{
+		logger(Core, Error, "replay_record_open(), failed to open '%s': %s", filename,
+		       strerror(errno));
+		return False;
+	}
+
+	hdr.data = hdr.p = buf;
+	hdr.size = sizeof(buf);
+	out_uint8p(&hdr, REPLAY_MAGIC, 8);
+	out_uint32_le(&hdr, REPLAY_VERSION);
+	fwrite(buf, sizeof(buf), 1, g_record_fp);
+
+	gettimeofday(&g_record_start, NULL);
+
+	logger(Core, Verbose, "Recording session to '%s'", filename);
+	return True;
+}
+
+void
+replay_record_close(void)
+{
+	if (g_record_fp == NULL)
+		return;
+
+	fclose(g_record_fp);
+	g_record_fp = NULL;
+
+	xfree(g_record_pdu.data);
+	memset(&g_record_pdu, 0, sizeof(g_record_pdu));
+}
+
+/* Record the negotiated session size and depth */
+void
+replay_record_session(void)
+{
+	uint8 buf[6];
+	struct stream s;
+
+	if (g_record_fp == NULL)
+		return;
+
+	s.data = s.p = buf;
+	s.size = sizeof(buf);
+	out_uint16_le(&s, g_session_width);
+	out_uint16_le(&s, g_session_height);
+	out_uint16_le(&s, g_server_depth);
+
+	replay_write_record(REPLAY_RECORD_SESSION, MCS_GLOBAL_CHANNEL, buf, sizeof(buf));
+}
+
+/* Collect one uncompressed TS_FP_UPDATE for the fast-path PDU being
+   processed, the PDU is written by replay_record_fp_end() */
+void
+replay_record_fp_update(uint8 hdr, uint8 * data, uint16 length)
+{
+	if (g_record_fp == NULL)
+		return;
+
+	s_realloc(&g_record_pdu, (g_record_pdu.p - g_record_pdu.data) + 3 + length);
+
+	out_uint8(&g_record_pdu, hdr);	/* updateHeader, without compression */
+	out_uint16_le(&g_record_pdu, length);
+	out_uint8p(&g_record_pdu, data, length);
+}
+
+void
+replay_record_fp_end(void)
+{
+	if (g_record_fp == NULL)
+		return;
+
+	s_mark_end(&g_record_pdu);
+	replay_write_record(REPLAY_RECORD_FASTPATH, 0, g_record_pdu.data,
+			    s_length(&g_record_pdu));
+	s_reset(&g_record_pdu);
+}
+
+/* Record an uncompressed share data PDU */
+void
+replay_record_data_pdu(uint8 data_pdu_type, uint8 * data, uint32 length)
+{
+	uint8 *buf;
+	struct stream s;
+
+	if (g_record_fp == NULL)
+		return;
+
+	/* TS_SHAREDATAHEADER without the share control header, lengths
+	   include it */
+	buf = xmalloc(12 + length);
+	s.data = s.p = buf;
+	s.size = 12 + length;
+
+	out_uint32_le(&s, 0);	/* shareId */
+	out_uint8(&s, 0);	/* pad1 */
+	out_uint8(&s, 0);	/* streamId */
+	out_uint16_le(&s, 18 + length);	/* uncompressedLength */
+	out_uint8(&s, data_pdu_type);	/* pduType2 */
+	out_uint8(&s, 0);	/* compressedType */
+	out_uint16_le(&s, 18 + length);	/* compressedLength */
+	out_uint8p(&s, data, length);
+
+	replay_write_record(REPLAY_RECORD_DATA_PDU, MCS_GLOBAL_CHANNEL, buf, s.p - buf);
+	xfree(buf);
+}
+
+static void
+replay_process_session(STREAM s)
+{
+	uint16 width, height, depth;
+
+	in_uint16_le(s, width);
+	in_uint16_le(s, height);
+	in_uint16_le(s, depth);
+
+	g_server_depth = depth;
+	g_session_width = width;
+	g_session_height = height;
+
+	if (!ui_have_window())
+	{
+		g_requested_session_width = width;
+		g_requested_session_height = height;
+		rd_create_ui();
+	}
+	else
+	{
+		ui_resize_window(width, height);
+		ui_reset_clip();
+	}
+
+	reset_order_state();
+}
+
+/* Wait until the original time of a record has passed */
+static void
+replay_wait(struct timeval *start, uint32 timestamp)
+{
+	uint32 now;
+
+	now = replay_elapsed_ms(start);
+	if (now < timestamp)
+		usleep((timestamp - now) * 1000);
+}
+
+/* Replay a recording, as fast as possible or at the original pace */
+int
+replay_run(const char *filename, RD_BOOL paced)
+{
+	FILE *fp;
+	uint8 hdr[REPLAY_RECORD_HEADER_SIZE];
+	struct stream s, h;
+	struct timeval start;
+	uint8 type;
+	uint16 channel;
+	uint32 timestamp, length, version, elapsed;
+	uint32 ext_disc_reason = 0;
+	uint32 frames = 0;
+	uint64 bytes = 0;
+
+	fp = fopen(filename, "rb");
+	if (fp == NULL)
+	{
+		logger(Core, Error, "replay_run(), failed to open '%s': %s", filename,
+		       strerror(errno));
+		return EX_NOINPUT;
+	}
+
+	memset(&s, 0, sizeof(s));
+	h.data = h.p = hdr;
+	h.size = sizeof(hdr);
+
+	if (fread(hdr, REPLAY_HEADER_SIZE, 1, fp) != 1
+	    || memcmp(hdr, REPLAY_MAGIC, 8) != 0)
+	{
+		logger(Core, Error, "replay_run(), '%s' is not a session recording", filename);
+		fclose(fp);
+		return EX_DATAERR;
+	}
+
+	in_uint8s(&h, 8);
+	in_uint32_le(&h, version);
+	if (version != REPLAY_VERSION)
+	{
+		logger(Core, Error, "replay_run(), unsupported recording version %d", version);
+		fclose(fp);
+		return EX_DATAERR;
+	}
+
+	gettimeofday(&start, NULL);
+
+	while (fread(hdr, sizeof(hdr), 1, fp) == 1)
+	{
+		h.p = hdr;
+		in_uint8(&h, type);
+		in_uint8s(&h, 1);	/* pad */
+		in_uint16_le(&h, channel);
+		in_uint32_le(&h, timestamp);
+		in_uint32_le(&h, length);
+
+		s_realloc(&s, length);
+		s_reset(&s);
+		if (length > 0 && fread(s.data, length, 1, fp) != 1)
+		{
+			logger(Core, Warning, "replay_run(), truncated record, stopping");
+			break;
+		}
+		s.end = s.data + length;
+
+		if (paced)
+			replay_wait(&start, timestamp);
+
+		switch (type)
+		{
+			case REPLAY_RECORD_SESSION:
+				replay_process_session(&s);
+				break;
+
+			case REPLAY_RECORD_FASTPATH:
+				process_ts_fp_updates(&s);
+				frames++;
+				break;
+
+			case REPLAY_RECORD_DATA_PDU:
+				process_data_pdu(&s, &ext_disc_reason);
+				frames++;
+				break;
+
+			default:
+				logger(Core, Debug,
+				       "replay_run(), skipping record type %d on channel %d", type,
+				       channel);
+		}
+
+		bytes += length;
+	}
+
+	elapsed = replay_elapsed_ms(&start);
+	logger(Core, Notice, "Replayed %u PDUs (%lu bytes) in %u.%03u seconds, %.1f PDUs/s",
+	       frames, (unsigned long) bytes, elapsed / 1000, elapsed % 1000,
+	       elapsed ? frames * 1000.0 / elapsed : 0.0);
+
+	xfree(s.data);
+	fclose(fp);
+	return EX_OK;
+}
@@ -310,6 +310,87 @@ sec_decrypt(uint8 * data, int length)
 	g_sec_decrypt_use_count++;
 }
 
+/* Decrypt received data, unless the receive thread already has */
+static void
+sec_recv_decrypt(STREAM s)
+{
+	if (!tcp_recv_decoded())
+		sec_decrypt(s->p, s->end - s->p);
+}
+
+/* Skip the headers of a complete frame the way sec_recv() does, for the
+   stages of the receive pipeline. With decrypt set the data is RC4
+   decrypted in place; the receive thread does this for every frame
+   while it runs, so sec_recv() must not. Returns False if the frame
+   carries no RDP or channel data, such as licensing and redirection
+   packets, otherwise s->p is left at the data of *channel. */
+RD_BOOL
+sec_parse_frame(STREAM s, RD_BOOL decrypt, uint16 * channel, RD_BOOL * is_fastpath)
+{
+	uint8 fastpath_hdr;
+	uint16 sec_flags;
+
+	*channel = MCS_GLOBAL_CHANNEL;
+	if (!mcs_parse_frame(s, channel, is_fastpath, &fastpath_hdr))
+		return False;
+
+	if (*is_fastpath == True)
+	{
+		if (((fastpath_hdr & 0xC0) >> 6) & FASTPATH_OUTPUT_ENCRYPTED)
+		{
+			if (!s_check_rem(s, 8))
+				return False;
+			in_uint8s(s, 8);	/* signature */
+			if (decrypt)
+				sec_decrypt(s->p, s->end - s->p);
+		}
+		return True;
+	}
+
+	if (g_encryption)
+	{
+		if (!s_check_rem(s, 4))
+			return False;
+		in_uint16_le(s, sec_flags);
+		in_uint8s(s, 2);	/* skip sec_flags_hi */
+
+		if (sec_flags & SEC_ENCRYPT)
+		{
+			if (!s_check_rem(s, 8))
+				return False;
+			in_uint8s(s, 8);	/* signature */
+			if (decrypt)
+				sec_decrypt(s->p, s->end - s->p);
+		}
+
+		if (sec_flags & SEC_LICENSE_PKT)
+			return False;
+
+		if (sec_flags & SEC_REDIRECTION_PKT)
+		{
+			if (!s_check_rem(s, 8))
+				return False;
+			in_uint8s(s, 8);	/* signature */
+			if (decrypt)
+				sec_decrypt(s->p, s->end - s->p);
+			return False;
+		}
+
+		return True;
+	}
+
+	/* Without encryption only licensing packets have a security
+	   header. Licensing is over before the server sends anything
+	   compressed, so the decode stage never looks at this while
+	   the main thread is still changing it. */
+	if (!__atomic_load_n(&g_licence_issued, __ATOMIC_ACQUIRE)
+	    && !__atomic_load_n(&g_licence_error_result, __ATOMIC_ACQUIRE)
+	    && s_check_rem(s, 2) && ((s->p[0] | (s->p[1] << 8)) & SEC_LICENSE_PKT))
+		return False;
+
+	return True;
+}
+
 /* Perform an RSA public key encryption operation */
 static void
 sec_rsa_encrypt(uint8 * out, uint8 * in, int len, uint32 modulus_size, uint8 * modulus,
@@ -372,6 +453,60 @@ sec_send(STREAM s, uint32 flags)
 	sec_send_to_channel(s, flags, MCS_GLOBAL_CHANNEL);
 }
 
+/* Initialise fast-path input packet, which bypasses the MCS and ISO
+   layers altogether */
+STREAM
+sec_fastpath_init(uint32 flags, int maxlen)
+{
+	int hdrlen;
+	STREAM s;
+
+	/* fpInputHeader, two byte length and optional dataSignature */
+	hdrlen = (flags & SEC_ENCRYPT) ? 11 : 3;
+	s = tcp_init(maxlen + hdrlen);
+	s_push_layer(s, sec_hdr, hdrlen);
+
+	return s;
+}
+
+/* Transmit fast-path input packet (2.2.8.1.2 MS-RDPBCGR) */
+void
+sec_fastpath_send(STREAM s, uint32 flags, uint8 num_events)
+{
+	uint8 hdr;
+	int datalen;
+
+#ifdef WITH_SCARD
+	scard_lock(SCARD_LOCK_SEC);
+#endif
+
+	s_pop_layer(s, sec_hdr);
+
+	/* numEvents in the header only holds 15 events, beyond that
+	   it is zero and the optional numEvents field is used */
+	hdr = FASTPATH_INPUT_ACTION_FASTPATH;
+	if (num_events < 16)
+		hdr |= num_events << 2;
+	if (flags & SEC_ENCRYPT)
+		hdr |= FASTPATH_INPUT_ENCRYPTED;
+
+	out_uint8(s, hdr);	/* fpInputHeader */
+	out_uint16_be(s, (s->end - s->data) | 0x8000);	/* length1, length2 */
+
+	if (flags & SEC_ENCRYPT)
+	{
+		datalen = s->end - s->p - 8;
+		sec_sign(s->p, 8, g_sec_sign_key, g_rc4_key_len, s->p + 8, datalen);
+		sec_encrypt(s->p + 8, datalen);
+	}
+
+	tcp_send(s);
+
+#ifdef WITH_SCARD
+	scard_unlock(SCARD_LOCK_SEC);
+#endif
+}
+
 
 /* Transfer the client random to the server */
 static void
@@ -873,7 +1008,7 @@ sec_recv(RD_BOOL * is_fastpath)
 				}
 
 				in_uint8s(s, 8);	/* signature */
-				sec_decrypt(s->p, s->end - s->p);
+				sec_recv_decrypt(s);
 			}
 			return s;
 		}
@@ -893,7 +1028,7 @@ sec_recv(RD_BOOL * is_fastpath)
 					}
 
 					in_uint8s(s, 8);	/* signature */
-					sec_decrypt(s->p, s->end - s->p);
+					sec_recv_decrypt(s);
 				}
 
 				if (sec_flags & SEC_LICENSE_PKT)
@@ -911,7 +1046,7 @@ sec_recv(RD_BOOL * is_fastpath)
 					}
 
 					in_uint8s(s, 8);	/* signature */
-					sec_decrypt(s->p, s->end - s->p);
+					sec_recv_decrypt(s);
 
 					/* Check for a redirect packet, starts with 00 04 */
 					if (s->p[0] == 0 && s->p[1] == 4)
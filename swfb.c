@@ -0,0 +1,1143 @@
+/* -*- c-basic-offset: 8 -*-
+   rdesktop: A Remote Desktop Protocol client.
+   Software framebuffer, client side rendering of drawing orders
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+   Drawing orders are rendered into a 32 bit 0x00RRGGBB framebuffer in
+   memory. This is the whole display of rdesktop-headless, and of the X11
+   version when started with -F, which then only sends the parts of the
+   framebuffer that changed to the X server, see swfb_get_damage().
+
+   Raster operations are evaluated as ROP3 on pattern, source and
+   destination, one span at a time. The ROP2 opcodes of most orders
+   combine one operand with the destination and are turned into the ROP3
+   that takes that operand as the pattern.
+*/
+
+#include "rdesktop.h"
+
+extern int g_server_depth;
+
+static SWFB_SURFACE g_swfb;
+static int g_clip_x, g_clip_y, g_clip_cx, g_clip_cy;
+static uint32 *g_colmap = NULL;
+
+/* Span sized scratch buffers, for patterns and overlapping copies */
+static uint32 *g_swfb_pat = NULL;
+static uint32 *g_swfb_row = NULL;
+static int g_swfb_span_size = 0;
+
+/* Changed areas, merged when they are close or the list is full */
+#define SWFB_DAMAGE_RECTS	16
+static struct
+{
+	int x1, y1, x2, y2;
+}
+g_swfb_damage[SWFB_DAMAGE_RECTS];
+static int g_swfb_ndamage = 0;
+
+static uint8 hatch_patterns[] = {
+	0x00, 0x00, 0x00, 0xff, 0x00, 0x00, 0x00, 0x00,	/* 0 - bsHorizontal */
+	0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08,	/* 1 - bsVertical */
+	0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,	/* 2 - bsFDiagonal */
+	0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80,	/* 3 - bsBDiagonal */
+	0x08, 0x08, 0x08, 0xff, 0x08, 0x08, 0x08, 0x08,	/* 4 - bsCross */
+	0x81, 0x42, 0x24, 0x18, 0x18, 0x24, 0x42, 0x81	/* 5 - bsDiagCross */
+};
+
+/* Colour handling */
+
+static uint32
+swfb_rgb15(uint16 colour)
+{
+	uint32 r, g, b;
+
+	r = ((colour >> 7) & 0xf8) | ((colour >> 12) & 0x7);
+	g = ((colour >> 2) & 0xf8) | ((colour >> 8) & 0x7);
+	b = ((colour << 3) & 0xf8) | ((colour >> 2) & 0x7);
+	return (r << 16) | (g << 8) | b;
+}
+
+static uint32
+swfb_rgb16(uint16 colour)
+{
+	uint32 r, g, b;
+
+	r = ((colour >> 8) & 0xf8) | ((colour >> 13) & 0x7);
+	g = ((colour >> 3) & 0xfc) | ((colour >> 9) & 0x3);
+	b = ((colour << 3) & 0xf8) | ((colour >> 2) & 0x7);
+	return (r << 16) | (g << 8) | b;
+}
+
+/* Translate a colour from an order */
+static uint32
+swfb_colour(uint32 colour)
+{
+	switch (g_server_depth)
+	{
+		case 8:
+			return g_colmap ? g_colmap[colour & 0xff] : 0;
+		case 15:
+			return swfb_rgb15(colour);
+		case 16:
+			return swfb_rgb16(colour);
+		default:
+			return ((colour & 0xff) << 16) | (colour & 0xff00) | ((colour >> 16) & 0xff);
+	}
+}
+
+/* Translate count pixels of bitmap data in server format */
+static void
+swfb_translate(uint32 * out, const uint8 * data, int count)
+{
+	int i;
+
+	switch (g_server_depth)
+	{
+		case 8:
+			for (i = 0; i < count; i++)
+				out[i] = g_colmap ? g_colmap[data[i]] : 0;
+			break;
+		case 15:
+			for (i = 0; i < count; i++, data += 2)
+				out[i] = swfb_rgb15(data[0] | (data[1] << 8));
+			break;
+		case 16:
+			for (i = 0; i < count; i++, data += 2)
+				out[i] = swfb_rgb16(data[0] | (data[1] << 8));
+			break;
+		case 24:
+			for (i = 0; i < count; i++, data += 3)
+				out[i] = (data[2] << 16) | (data[1] << 8) | data[0];
+			break;
+		default:
+			for (i = 0; i < count; i++, data += 4)
+				out[i] = (data[2] << 16) | (data[1] << 8) | data[0];
+			break;
+	}
+}
+
+/* Raster operations */
+
+/* Bit n of a ROP3 is the result for pattern, source and destination
+   bits p, s, d where n = p << 2 | s << 1 | d. The result is built as a
+   select on p of selects on s of functions of d. */
+#define ROP3_BIT(rop, n)	(-(uint32) (((rop) >> (n)) & 1))
+
+static inline uint32
+swfb_rop3(uint8 rop, uint32 p, uint32 s, uint32 d)
+{
+	uint32 g0, g1, g2, g3, lo, hi;
+
+	g0 = (d & ROP3_BIT(rop, 1)) | (~d & ROP3_BIT(rop, 0));
+	g1 = (d & ROP3_BIT(rop, 3)) | (~d & ROP3_BIT(rop, 2));
+	g2 = (d & ROP3_BIT(rop, 5)) | (~d & ROP3_BIT(rop, 4));
+	g3 = (d & ROP3_BIT(rop, 7)) | (~d & ROP3_BIT(rop, 6));
+	lo = (s & g1) | (~s & g0);
+	hi = (s & g3) | (~s & g2);
+	return ((p & hi) | (~p & lo)) & 0xffffff;
+}
+
+/* The ROP3 that applies a ROP2 to the pattern and destination */
+static uint8
+swfb_rop2_to_rop3(uint8 opcode)
+{
+	uint8 rop3 = 0;
+	int i;
+
+	for (i = 0; i < 8; i++)
+		if ((opcode >> (((i >> 2) << 1) | (i & 1))) & 1)
+			rop3 |= 1 << i;
+
+	return rop3;
+}
+
+typedef void (*swfb_span_fn) (uint32 * d, const uint32 * s, const uint32 * p, int n, uint8 rop);
+
+static void
+swfb_span_scalar(uint32 * d, const uint32 * s, const uint32 * p, int n, uint8 rop)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		d[i] = swfb_rop3(rop, p[i], s[i], d[i]);
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SWFB_SIMD
+#include <immintrin.h>
+
+#define SWFB_MASK_SSE2(rop, n)	_mm_set1_epi32(ROP3_BIT(rop, n))
+#define SWFB_MASK_AVX2(rop, n)	_mm256_set1_epi32(ROP3_BIT(rop, n))
+
+__attribute__ ((target("sse2")))
+static void
+swfb_span_sse2(uint32 * d, const uint32 * s, const uint32 * p, int n, uint8 rop)
+{
+	__m128i m[8], vd, vs, vp, g0, g1, g2, g3, lo, hi, rgb;
+	int i;
+
+	for (i = 0; i < 8; i++)
+		m[i] = SWFB_MASK_SSE2(rop, i);
+	rgb = _mm_set1_epi32(0xffffff);
+
+	for (i = 0; i + 4 <= n; i += 4)
+	{
+		vd = _mm_loadu_si128((__m128i *) (d + i));
+		vs = _mm_loadu_si128((__m128i *) (s + i));
+		vp = _mm_loadu_si128((__m128i *) (p + i));
+
+		g0 = _mm_or_si128(_mm_and_si128(vd, m[1]), _mm_andnot_si128(vd, m[0]));
+		g1 = _mm_or_si128(_mm_and_si128(vd, m[3]), _mm_andnot_si128(vd, m[2]));
+		g2 = _mm_or_si128(_mm_and_si128(vd, m[5]), _mm_andnot_si128(vd, m[4]));
+		g3 = _mm_or_si128(_mm_and_si128(vd, m[7]), _mm_andnot_si128(vd, m[6]));
+		lo = _mm_or_si128(_mm_and_si128(vs, g1), _mm_andnot_si128(vs, g0));
+		hi = _mm_or_si128(_mm_and_si128(vs, g3), _mm_andnot_si128(vs, g2));
+		vd = _mm_or_si128(_mm_and_si128(vp, hi), _mm_andnot_si128(vp, lo));
+		_mm_storeu_si128((__m128i *) (d + i), _mm_and_si128(vd, rgb));
+	}
+
+	swfb_span_scalar(d + i, s + i, p + i, n - i, rop);
+}
+
+__attribute__ ((target("avx2")))
+static void
+swfb_span_avx2(uint32 * d, const uint32 * s, const uint32 * p, int n, uint8 rop)
+{
+	__m256i m[8], vd, vs, vp, g0, g1, g2, g3, lo, hi, rgb;
+	int i;
+
+	for (i = 0; i < 8; i++)
+		m[i] = SWFB_MASK_AVX2(rop, i);
+	rgb = _mm256_set1_epi32(0xffffff);
+
+	for (i = 0; i + 8 <= n; i += 8)
+	{
+		vd = _mm256_loadu_si256((__m256i *) (d + i));
+		vs = _mm256_loadu_si256((__m256i *) (s + i));
+		vp = _mm256_loadu_si256((__m256i *) (p + i));
+
+		g0 = _mm256_or_si256(_mm256_and_si256(vd, m[1]), _mm256_andnot_si256(vd, m[0]));
+		g1 = _mm256_or_si256(_mm256_and_si256(vd, m[3]), _mm256_andnot_si256(vd, m[2]));
+		g2 = _mm256_or_si256(_mm256_and_si256(vd, m[5]), _mm256_andnot_si256(vd, m[4]));
+		g3 = _mm256_or_si256(_mm256_and_si256(vd, m[7]), _mm256_andnot_si256(vd, m[6]));
+		lo = _mm256_or_si256(_mm256_and_si256(vs, g1), _mm256_andnot_si256(vs, g0));
+		hi = _mm256_or_si256(_mm256_and_si256(vs, g3), _mm256_andnot_si256(vs, g2));
+		vd = _mm256_or_si256(_mm256_and_si256(vp, hi), _mm256_andnot_si256(vp, lo));
+		_mm256_storeu_si256((__m256i *) (d + i), _mm256_and_si256(vd, rgb));
+	}
+
+	swfb_span_scalar(d + i, s + i, p + i, n - i, rop);
+}
+#endif
+
+static swfb_span_fn g_swfb_span = NULL;
+
+/* Pick the fastest span function the CPU supports */
+static void
+swfb_span_select(void)
+{
+	const char *name = "scalar";
+
+	g_swfb_span = swfb_span_scalar;
+
+#ifdef SWFB_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		g_swfb_span = swfb_span_avx2;
+		name = "AVX2";
+	}
+	else if (__builtin_cpu_supports("sse2"))
+	{
+		g_swfb_span = swfb_span_sse2;
+		name = "SSE2";
+	}
+#endif
+
+	logger(GUI, Debug, "swfb_span_select(), using %s raster operations", name);
+}
+
+/* Apply a ROP3 to n pixels, s is only read if the operation uses it */
+static void
+swfb_span(uint32 * d, const uint32 * s, const uint32 * p, int n, uint8 rop)
+{
+	switch (rop)
+	{
+		case 0xaa:	/* D */
+			break;
+		case 0xcc:	/* S */
+			memmove(d, s, n * sizeof(uint32));
+			break;
+		case 0xf0:	/* P */
+			memcpy(d, p, n * sizeof(uint32));
+			break;
+		default:
+			if ((rop >> 2 & 0x33) == (rop & 0x33))
+				s = p;	/* independent of the source */
+			g_swfb_span(d, s, p, n, rop);
+			break;
+	}
+}
+
+static void
+swfb_span_buffers(int n)
+{
+	if (n <= g_swfb_span_size)
+		return;
+
+	g_swfb_span_size = n;
+	g_swfb_pat = (uint32 *) xrealloc(g_swfb_pat, n * sizeof(uint32));
+	g_swfb_row = (uint32 *) xrealloc(g_swfb_row, n * sizeof(uint32));
+}
+
+/* Clipping and damage */
+
+/* Clip a destination rectangle against the clip rectangle and the
+   framebuffer, returns False if nothing is left. The amount the
+   origin moved is added to srcx and srcy if given. */
+static RD_BOOL
+swfb_clip(int *x, int *y, int *cx, int *cy, int *srcx, int *srcy)
+{
+	int x1, y1, x2, y2;
+
+	x1 = MAX(MAX(*x, g_clip_x), 0);
+	y1 = MAX(MAX(*y, g_clip_y), 0);
+	x2 = MIN(MIN(*x + *cx, g_clip_x + g_clip_cx), g_swfb.width);
+	y2 = MIN(MIN(*y + *cy, g_clip_y + g_clip_cy), g_swfb.height);
+
+	if (x1 >= x2 || y1 >= y2)
+		return False;
+
+	if (srcx != NULL)
+		*srcx += x1 - *x;
+	if (srcy != NULL)
+		*srcy += y1 - *y;
+
+	*x = x1;
+	*y = y1;
+	*cx = x2 - x1;
+	*cy = y2 - y1;
+	return True;
+}
+
+static int
+swfb_area(int x1, int y1, int x2, int y2)
+{
+	return (x2 - x1) * (y2 - y1);
+}
+
+/* Record that a rectangle may have changed */
+static void
+swfb_damage(int x, int y, int cx, int cy)
+{
+	int i, best, cost, best_cost, x1, y1, x2, y2;
+
+	if (!swfb_clip(&x, &y, &cx, &cy, NULL, NULL))
+		return;
+
+	/* merge with a rectangle if that adds little that didn't change */
+	best = 0;
+	best_cost = INT_MAX;
+	for (i = 0; i < g_swfb_ndamage; i++)
+	{
+		x1 = MIN(x, g_swfb_damage[i].x1);
+		y1 = MIN(y, g_swfb_damage[i].y1);
+		x2 = MAX(x + cx, g_swfb_damage[i].x2);
+		y2 = MAX(y + cy, g_swfb_damage[i].y2);
+		cost = swfb_area(x1, y1, x2, y2) - cx * cy -
+			swfb_area(g_swfb_damage[i].x1, g_swfb_damage[i].y1,
+				  g_swfb_damage[i].x2, g_swfb_damage[i].y2);
+		if (cost < best_cost)
+		{
+			best = i;
+			best_cost = cost;
+		}
+	}
+
+	if (best_cost > 64 * 64 && g_swfb_ndamage < SWFB_DAMAGE_RECTS)
+	{
+		i = g_swfb_ndamage++;
+		g_swfb_damage[i].x1 = x;
+		g_swfb_damage[i].y1 = y;
+		g_swfb_damage[i].x2 = x + cx;
+		g_swfb_damage[i].y2 = y + cy;
+		return;
+	}
+
+	g_swfb_damage[best].x1 = MIN(x, g_swfb_damage[best].x1);
+	g_swfb_damage[best].y1 = MIN(y, g_swfb_damage[best].y1);
+	g_swfb_damage[best].x2 = MAX(x + cx, g_swfb_damage[best].x2);
+	g_swfb_damage[best].y2 = MAX(y + cy, g_swfb_damage[best].y2);
+}
+
+/* Take one changed rectangle, returns False when there are none left */
+RD_BOOL
+swfb_get_damage(int *x, int *y, int *cx, int *cy)
+{
+	if (g_swfb_ndamage == 0)
+		return False;
+
+	g_swfb_ndamage--;
+	*x = g_swfb_damage[g_swfb_ndamage].x1;
+	*y = g_swfb_damage[g_swfb_ndamage].y1;
+	*cx = g_swfb_damage[g_swfb_ndamage].x2 - *x;
+	*cy = g_swfb_damage[g_swfb_ndamage].y2 - *y;
+	return True;
+}
+
+/* Rasterisation */
+
+/* Expand a brush into an 8x8 pattern of framebuffer colours, in the
+   same way xwin.c sets up its stipples and tiles */
+static RD_BOOL
+swfb_brush_pattern(BRUSH * brush, uint32 bgcolour, uint32 fgcolour, uint32 * pattern)
+{
+	uint8 bits[8];
+	uint32 set, unset;
+	int i, j;
+
+	switch (brush ? brush->style : 0)
+	{
+		case 0:	/* Solid */
+			for (i = 0; i < 64; i++)
+				pattern[i] = swfb_colour(fgcolour);
+			return True;
+
+		case 2:	/* Hatch */
+			memcpy(bits, hatch_patterns + brush->pattern[0] * 8, 8);
+			set = swfb_colour(fgcolour);
+			unset = swfb_colour(bgcolour);
+			break;
+
+		case 3:	/* Pattern */
+			if (brush->bd == 0)	/* rdp4 brush */
+			{
+				for (i = 0; i != 8; i++)
+					bits[7 - i] = brush->pattern[i];
+			}
+			else if (brush->bd->colour_code > 1)	/* > 1 bpp */
+			{
+				swfb_translate(pattern, brush->bd->data, 64);
+				return True;
+			}
+			else
+			{
+				memcpy(bits, brush->bd->data, 8);
+			}
+			set = swfb_colour(bgcolour);
+			unset = swfb_colour(fgcolour);
+			break;
+
+		default:
+			logger(GUI, Warning, "Unimplemented support for brush type %d",
+			       brush->style);
+			return False;
+	}
+
+	for (i = 0; i < 8; i++)
+		for (j = 0; j < 8; j++)
+			pattern[i * 8 + j] = (bits[i] & (0x80 >> j)) ? set : unset;
+
+	return True;
+}
+
+/* Expand row y of a pattern anchored at xorg, yorg over [x, x + n) */
+static void
+swfb_pattern_span(const uint32 * pattern, int x, int y, int n, int xorg, int yorg)
+{
+	const uint32 *row;
+	int i;
+
+	row = pattern + ((y - yorg) & 7) * 8;
+	for (i = 0; i < n && i < 8; i++)
+		g_swfb_pat[i] = row[(x + i - xorg) & 7];
+	for (; i < n; i++)
+		g_swfb_pat[i] = g_swfb_pat[i - 8];
+}
+
+/* Fill a horizontal span [x1, x2) with a pattern anchored at xorg, yorg */
+static void
+swfb_fill_span(uint8 rop, int x1, int x2, int y, const uint32 * pattern, int xorg, int yorg)
+{
+	uint32 *d;
+
+	if (y < MAX(g_clip_y, 0) || y >= MIN(g_clip_y + g_clip_cy, g_swfb.height))
+		return;
+
+	x1 = MAX(MAX(x1, g_clip_x), 0);
+	x2 = MIN(MIN(x2, g_clip_x + g_clip_cx), g_swfb.width);
+	if (x1 >= x2)
+		return;
+
+	swfb_span_buffers(x2 - x1);
+	swfb_pattern_span(pattern, x1, y, x2 - x1, xorg, yorg);
+
+	d = g_swfb.data + y * g_swfb.width + x1;
+	swfb_span(d, g_swfb_pat, g_swfb_pat, x2 - x1, rop);
+}
+
+static inline void
+swfb_set_pixel(uint8 rop, int x, int y, uint32 colour)
+{
+	uint32 *p;
+
+	if (x < g_clip_x || x >= g_clip_x + g_clip_cx || y < g_clip_y || y >= g_clip_y + g_clip_cy)
+		return;
+	if (x < 0 || x >= g_swfb.width || y < 0 || y >= g_swfb.height)
+		return;
+
+	p = g_swfb.data + y * g_swfb.width + x;
+	*p = rop == 0xf0 ? colour : swfb_rop3(rop, colour, colour, *p);
+}
+
+/* Fill a rectangle with a solid colour from an order */
+void
+swfb_fill(uint8 opcode, int x, int y, int cx, int cy, uint32 colour)
+{
+	uint32 *d;
+	uint8 rop;
+	int i, j;
+
+	if (!swfb_clip(&x, &y, &cx, &cy, NULL, NULL))
+		return;
+
+	rop = swfb_rop2_to_rop3(opcode);
+	colour = swfb_colour(colour);
+	swfb_span_buffers(cx);
+	for (j = 0; j < cx; j++)
+		g_swfb_pat[j] = colour;
+
+	for (i = 0; i < cy; i++)
+	{
+		d = g_swfb.data + (y + i) * g_swfb.width + x;
+		swfb_span(d, g_swfb_pat, g_swfb_pat, cx, rop);
+	}
+
+	swfb_damage(x, y, cx, cy);
+}
+
+void
+swfb_patblt(uint8 opcode, int x, int y, int cx, int cy, BRUSH * brush, uint32 bgcolour,
+	    uint32 fgcolour)
+{
+	uint32 pattern[64];
+	uint8 rop;
+	int i;
+
+	if (brush->style == 0)
+	{
+		swfb_fill(opcode, x, y, cx, cy, fgcolour);
+		return;
+	}
+
+	if (!swfb_brush_pattern(brush, bgcolour, fgcolour, pattern))
+		return;
+
+	rop = swfb_rop2_to_rop3(opcode);
+	for (i = 0; i < cy; i++)
+		swfb_fill_span(rop, x, x + cx, y + i, pattern, brush->xorigin, brush->yorigin);
+
+	swfb_damage(x, y, cx, cy);
+}
+
+/* Combine pattern, source and destination with a ROP3. The source may
+   be the framebuffer itself, brush may be NULL if the operation doesn't
+   use the pattern. */
+static void
+swfb_rop3_blit(uint8 rop, int x, int y, int cx, int cy, SWFB_SURFACE * src, int srcx, int srcy,
+	       const uint32 * pattern, int xorg, int yorg)
+{
+	uint32 *s, *d;
+	int i, row, step;
+
+	/* source outside of its surface is left untouched, as X does */
+	if (srcx < 0)
+	{
+		x -= srcx;
+		cx += srcx;
+		srcx = 0;
+	}
+	if (srcy < 0)
+	{
+		y -= srcy;
+		cy += srcy;
+		srcy = 0;
+	}
+	cx = MIN(cx, src->width - srcx);
+	cy = MIN(cy, src->height - srcy);
+
+	if (cx <= 0 || cy <= 0 || !swfb_clip(&x, &y, &cx, &cy, &srcx, &srcy))
+		return;
+
+	/* a copy with the source as pattern can move rows in place */
+	if (pattern == NULL && rop == 0xf0)
+		rop = 0xcc;
+
+	swfb_span_buffers(cx);
+
+	/* copy within the framebuffer in the direction that doesn't
+	   overwrite rows that are still to be read */
+	row = 0;
+	step = 1;
+	if (src == &g_swfb && srcy < y)
+	{
+		row = cy - 1;
+		step = -1;
+	}
+
+	for (i = 0; i < cy; i++, row += step)
+	{
+		s = src->data + (srcy + row) * src->width + srcx;
+		d = g_swfb.data + (y + row) * g_swfb.width + x;
+		if (src == &g_swfb && rop != 0xcc)
+		{
+			memcpy(g_swfb_row, s, cx * sizeof(uint32));
+			s = g_swfb_row;
+		}
+
+		if (pattern != NULL)
+		{
+			swfb_pattern_span(pattern, x, y + row, cx, xorg, yorg);
+			swfb_span(d, s, g_swfb_pat, cx, rop);
+		}
+		else
+		{
+			/* the source takes the place of the pattern */
+			swfb_span(d, s, s, cx, rop);
+		}
+	}
+
+	swfb_damage(x, y, cx, cy);
+}
+
+/* Copy from a surface with a ROP2, src may be the framebuffer itself */
+void
+swfb_blit(uint8 opcode, int x, int y, int cx, int cy, SWFB_SURFACE * src, int srcx, int srcy)
+{
+	if (src == NULL)
+		return;
+
+	swfb_rop3_blit(swfb_rop2_to_rop3(opcode), x, y, cx, cy, src, srcx, srcy, NULL, 0, 0);
+}
+
+/* Combine a bitmap, a brush and the framebuffer with any ROP3 */
+void
+swfb_triblt(uint8 rop3, int x, int y, int cx, int cy, SWFB_SURFACE * src, int srcx, int srcy,
+	    BRUSH * brush, uint32 bgcolour, uint32 fgcolour)
+{
+	uint32 pattern[64];
+
+	if (src == NULL)
+		return;
+
+	if (!swfb_brush_pattern(brush, bgcolour, fgcolour, pattern))
+		return;
+
+	swfb_rop3_blit(rop3, x, y, cx, cy, src, srcx, srcy, pattern,
+		       brush ? brush->xorigin : 0, brush ? brush->yorigin : 0);
+}
+
+/* Draw a line with a colour from an order, including both end points */
+void
+swfb_line(uint8 opcode, int startx, int starty, int endx, int endy, uint32 colour)
+{
+	int dx, dy, sx, sy, err, e2;
+	uint8 rop;
+
+	rop = swfb_rop2_to_rop3(opcode);
+	colour = swfb_colour(colour);
+	swfb_damage(MIN(startx, endx), MIN(starty, endy), abs(endx - startx) + 1,
+		    abs(endy - starty) + 1);
+
+	dx = abs(endx - startx);
+	dy = -abs(endy - starty);
+	sx = startx < endx ? 1 : -1;
+	sy = starty < endy ? 1 : -1;
+	err = dx + dy;
+
+	while (1)
+	{
+		swfb_set_pixel(rop, startx, starty, colour);
+		if (startx == endx && starty == endy)
+			break;
+		e2 = 2 * err;
+		if (e2 >= dy)
+		{
+			err += dy;
+			startx += sx;
+		}
+		if (e2 <= dx)
+		{
+			err += dx;
+			starty += sy;
+		}
+	}
+}
+
+/* Draw connected lines, points are relative to the previous one */
+void
+swfb_polyline(uint8 opcode, RD_POINT * points, int npoints, uint32 colour)
+{
+	int i, x, y;
+
+	x = points[0].x;
+	y = points[0].y;
+	for (i = 1; i < npoints; i++)
+	{
+		swfb_line(opcode, x, y, x + points[i].x, y + points[i].y, colour);
+		x += points[i].x;
+		y += points[i].y;
+	}
+}
+
+static int
+swfb_compare_int(const void *a, const void *b)
+{
+	return *(const int *) a - *(const int *) b;
+}
+
+/* Scanline polygon fill sampling pixel centres, points are relative to
+   the previous one */
+void
+swfb_polygon(uint8 opcode, uint8 fillmode, RD_POINT * point, int npoints, BRUSH * brush,
+	     uint32 bgcolour, uint32 fgcolour)
+{
+	uint32 pattern[64];
+	int *px, *py, *xs, *dirs;
+	int i, j, y, minx, maxx, miny, maxy, n, x0, y0, x1, y1, winding, start, xorg, yorg;
+	uint8 rop;
+
+	if (npoints < 3)
+		return;
+
+	if (!swfb_brush_pattern(brush, bgcolour, fgcolour, pattern))
+		return;
+
+	rop = swfb_rop2_to_rop3(opcode);
+	xorg = brush ? brush->xorigin : 0;
+	yorg = brush ? brush->yorigin : 0;
+
+	px = (int *) xmalloc(npoints * sizeof(int));
+	py = (int *) xmalloc(npoints * sizeof(int));
+	xs = (int *) xmalloc(npoints * sizeof(int));
+	dirs = (int *) xmalloc(npoints * sizeof(int));
+
+	px[0] = point[0].x;
+	py[0] = point[0].y;
+	for (i = 1; i < npoints; i++)
+	{
+		px[i] = px[i - 1] + point[i].x;
+		py[i] = py[i - 1] + point[i].y;
+	}
+
+	minx = maxx = px[0];
+	miny = maxy = py[0];
+	for (i = 1; i < npoints; i++)
+	{
+		minx = MIN(minx, px[i]);
+		maxx = MAX(maxx, px[i]);
+		miny = MIN(miny, py[i]);
+		maxy = MAX(maxy, py[i]);
+	}
+	swfb_damage(minx, miny, maxx - minx + 1, maxy - miny + 1);
+
+	miny = MAX(miny, MAX(g_clip_y, 0));
+	maxy = MIN(maxy, MIN(g_clip_y + g_clip_cy, g_swfb.height));
+
+	for (y = miny; y < maxy; y++)
+	{
+		/* collect crossings of the scanline centre */
+		n = 0;
+		for (i = 0; i < npoints; i++)
+		{
+			j = (i + 1) % npoints;
+			x0 = px[i];
+			y0 = py[i];
+			x1 = px[j];
+			y1 = py[j];
+
+			if (y0 == y1)
+				continue;
+			if ((2 * y + 1 < 2 * MIN(y0, y1)) || (2 * y + 1 >= 2 * MAX(y0, y1)))
+				continue;
+
+			xs[n] = x0 + ((2 * y + 1 - 2 * y0) * (x1 - x0) + (y1 - y0)) / (2 * (y1 - y0));
+			dirs[n] = y1 > y0 ? 1 : -1;
+			n++;
+		}
+
+		if (fillmode == WINDING)
+		{
+			/* sort crossings together with their direction */
+			for (i = 1; i < n; i++)
+			{
+				for (j = i; j > 0 && xs[j - 1] > xs[j]; j--)
+				{
+					x0 = xs[j];
+					xs[j] = xs[j - 1];
+					xs[j - 1] = x0;
+					x0 = dirs[j];
+					dirs[j] = dirs[j - 1];
+					dirs[j - 1] = x0;
+				}
+			}
+
+			winding = 0;
+			start = 0;
+			for (i = 0; i < n; i++)
+			{
+				if (winding == 0)
+					start = xs[i];
+				winding += dirs[i];
+				if (winding == 0)
+					swfb_fill_span(rop, start, xs[i], y, pattern, xorg, yorg);
+			}
+		}
+		else
+		{
+			qsort(xs, n, sizeof(int), swfb_compare_int);
+			for (i = 0; i + 1 < n; i += 2)
+				swfb_fill_span(rop, xs[i], xs[i + 1], y, pattern, xorg, yorg);
+		}
+	}
+
+	xfree(px);
+	xfree(py);
+	xfree(xs);
+	xfree(dirs);
+}
+
+/* Test if the pixel centre (x, y) is inside the ellipse inscribed in
+   the box at the origin, all values are doubled to stay integral */
+static RD_BOOL
+swfb_in_ellipse(int x, int y, int cx, int cy)
+{
+	sint64 dx, dy, rx, ry;
+
+	if (x < 0 || y < 0 || x >= cx || y >= cy)
+		return False;
+
+	dx = 2 * x + 1 - cx;
+	dy = 2 * y + 1 - cy;
+	rx = cx;
+	ry = cy;
+
+	return dx * dx * ry * ry + dy * dy * rx * rx <= rx * rx * ry * ry;
+}
+
+void
+swfb_ellipse(uint8 opcode, uint8 fillmode, int x, int y, int cx, int cy, BRUSH * brush,
+	     uint32 bgcolour, uint32 fgcolour)
+{
+	uint32 pattern[64];
+	int i, j, start, xorg, yorg;
+	uint8 rop;
+
+	if (!swfb_brush_pattern(brush, bgcolour, fgcolour, pattern))
+		return;
+
+	rop = swfb_rop2_to_rop3(opcode);
+	xorg = brush ? brush->xorigin : 0;
+	yorg = brush ? brush->yorigin : 0;
+
+	for (j = 0; j < cy; j++)
+	{
+		if (fillmode)
+		{
+			start = -1;
+			for (i = 0; i <= cx; i++)
+			{
+				if (swfb_in_ellipse(i, j, cx, cy))
+				{
+					if (start < 0)
+						start = i;
+				}
+				else if (start >= 0)
+				{
+					swfb_fill_span(rop, x + start, x + i, y + j, pattern, xorg,
+						       yorg);
+					break;
+				}
+			}
+		}
+		else
+		{
+			/* outline, inside pixels with a neighbour outside */
+			for (i = 0; i < cx; i++)
+			{
+				if (swfb_in_ellipse(i, j, cx, cy)
+				    && (!swfb_in_ellipse(i - 1, j, cx, cy)
+					|| !swfb_in_ellipse(i + 1, j, cx, cy)
+					|| !swfb_in_ellipse(i, j - 1, cx, cy)
+					|| !swfb_in_ellipse(i, j + 1, cx, cy)))
+					swfb_fill_span(rop, x + i, x + i + 1, y + j, pattern, xorg,
+						       yorg);
+			}
+		}
+	}
+
+	swfb_damage(x, y, cx, cy);
+}
+
+/* Draw a 1 bpp glyph with MSB first rows of scanline bytes, transparent
+   draws only the set pixels */
+void
+swfb_draw_glyph(uint8 * bits, int scanline, int width, int height, int x, int y,
+		uint32 fgcolour, uint32 bgcolour, RD_BOOL transparent)
+{
+	int i, j, x1, y1, x2, y2;
+	uint32 fg, bg, *d;
+	uint8 *row;
+
+	x1 = MAX(MAX(x, g_clip_x), 0);
+	y1 = MAX(MAX(y, g_clip_y), 0);
+	x2 = MIN(MIN(x + width, g_clip_x + g_clip_cx), g_swfb.width);
+	y2 = MIN(MIN(y + height, g_clip_y + g_clip_cy), g_swfb.height);
+	if (x1 >= x2 || y1 >= y2)
+		return;
+
+	fg = swfb_colour(fgcolour);
+	bg = swfb_colour(bgcolour);
+
+	for (j = y1; j < y2; j++)
+	{
+		row = bits + (j - y) * scanline;
+		d = g_swfb.data + j * g_swfb.width;
+		for (i = x1; i < x2; i++)
+		{
+			if (row[(i - x) >> 3] & (0x80 >> ((i - x) & 7)))
+				d[i] = fg;
+			else if (!transparent)
+				d[i] = bg;
+		}
+	}
+
+	swfb_damage(x1, y1, x2 - x1, y2 - y1);
+}
+
+/* Surfaces, bitmaps in framebuffer format */
+
+/* Create a surface from bitmap data in server format, or in framebuffer
+   format if native is set */
+SWFB_SURFACE *
+swfb_create_surface(int width, int height, uint8 * data, RD_BOOL native)
+{
+	SWFB_SURFACE *surface;
+
+	surface = (SWFB_SURFACE *) xmalloc(sizeof(SWFB_SURFACE));
+	surface->width = width;
+	surface->height = height;
+	surface->data = (uint32 *) xmalloc(width * height * sizeof(uint32));
+	if (native)
+		memcpy(surface->data, data, width * height * sizeof(uint32));
+	else
+		swfb_translate(surface->data, data, width * height);
+
+	return surface;
+}
+
+void
+swfb_destroy_surface(SWFB_SURFACE * surface)
+{
+	if (surface == NULL)
+		return;
+
+	xfree(surface->data);
+	xfree(surface);
+}
+
+/* Copy bitmap data to the framebuffer without keeping it */
+void
+swfb_paint(int x, int y, int cx, int cy, int width, int height, uint8 * data, RD_BOOL native)
+{
+	SWFB_SURFACE bmp;
+
+	bmp.width = width;
+	bmp.height = height;
+	if (native)
+	{
+		bmp.data = (uint32 *) data;
+	}
+	else
+	{
+		bmp.data = (uint32 *) xmalloc(width * height * sizeof(uint32));
+		swfb_translate(bmp.data, data, width * height);
+	}
+
+	swfb_blit(ROP2_COPY, x, y, cx, cy, &bmp, 0, 0);
+
+	if (!native)
+		xfree(bmp.data);
+}
+
+/* Colour maps, used for 8 bpp sessions */
+
+RD_HCOLOURMAP
+swfb_create_colourmap(COLOURMAP * colours)
+{
+	COLOURENTRY *entry;
+	uint32 *map;
+	int i;
+
+	map = (uint32 *) xmalloc(256 * sizeof(uint32));
+	memset(map, 0, 256 * sizeof(uint32));
+	for (i = 0; i < MIN(colours->ncolours, 256); i++)
+	{
+		entry = &colours->colours[i];
+		map[i] = (entry->red << 16) | (entry->green << 8) | entry->blue;
+	}
+
+	return map;
+}
+
+/* Make map the current colour map, the framebuffer takes ownership.
+   NULL releases the current one. */
+void
+swfb_set_colourmap(RD_HCOLOURMAP map)
+{
+	if (g_colmap)
+		xfree(g_colmap);
+
+	g_colmap = (uint32 *) map;
+}
+
+/* Desktop save, the cache holds framebuffer pixels */
+
+void
+swfb_desktop_save(uint32 offset, int x, int y, int cx, int cy)
+{
+	if (x < 0 || y < 0 || cx <= 0 || cy <= 0 || x + cx > g_swfb.width
+	    || y + cy > g_swfb.height)
+	{
+		logger(GUI, Warning, "swfb_desktop_save(), area %dx%d+%d+%d outside of framebuffer",
+		       cx, cy, x, y);
+		return;
+	}
+
+	cache_put_desktop(offset * 4, cx, cy, g_swfb.width * 4, 4,
+			  (uint8 *) (g_swfb.data + y * g_swfb.width + x));
+}
+
+void
+swfb_desktop_restore(uint32 offset, int x, int y, int cx, int cy)
+{
+	SWFB_SURFACE saved;
+
+	saved.data = (uint32 *) cache_get_desktop(offset * 4, cx, cy, 4);
+	if (saved.data == NULL)
+		return;
+
+	saved.width = cx;
+	saved.height = cy;
+	swfb_blit(ROP2_COPY, x, y, cx, cy, &saved, 0, 0);
+}
+
+/* Framebuffer */
+
+void
+swfb_set_clip(int x, int y, int cx, int cy)
+{
+	g_clip_x = x;
+	g_clip_y = y;
+	g_clip_cx = cx;
+	g_clip_cy = cy;
+}
+
+void
+swfb_create(int width, int height)
+{
+	if (g_swfb_span == NULL)
+		swfb_span_select();
+
+	g_swfb.width = width;
+	g_swfb.height = height;
+	g_swfb.data = (uint32 *) xmalloc(width * height * sizeof(uint32));
+	memset(g_swfb.data, 0, width * height * sizeof(uint32));
+
+	g_swfb_ndamage = 0;
+	swfb_set_clip(0, 0, width, height);
+	swfb_damage(0, 0, width, height);
+}
+
+/* Change the framebuffer size, keeping the contents that still fit */
+void
+swfb_resize(int width, int height)
+{
+	uint32 *data;
+	int y;
+
+	if (g_swfb.width == width && g_swfb.height == height)
+		return;
+
+	logger(GUI, Debug, "swfb_resize(), changing framebuffer %dx%d to %dx%d",
+	       g_swfb.width, g_swfb.height, width, height);
+
+	data = (uint32 *) xmalloc(width * height * sizeof(uint32));
+	memset(data, 0, width * height * sizeof(uint32));
+	for (y = 0; y < MIN(g_swfb.height, height); y++)
+		memcpy(data + y * width, g_swfb.data + y * g_swfb.width,
+		       MIN(g_swfb.width, width) * sizeof(uint32));
+
+	xfree(g_swfb.data);
+	g_swfb.data = data;
+	g_swfb.width = width;
+	g_swfb.height = height;
+
+	g_swfb_ndamage = 0;
+	swfb_set_clip(0, 0, width, height);
+	swfb_damage(0, 0, width, height);
+}
+
+void
+swfb_destroy(void)
+{
+	xfree(g_swfb.data);
+	memset(&g_swfb, 0, sizeof(g_swfb));
+	g_swfb_ndamage = 0;
+
+	xfree(g_swfb_pat);
+	xfree(g_swfb_row);
+	g_swfb_pat = g_swfb_row = NULL;
+	g_swfb_span_size = 0;
+}
+
+/* The framebuffer, NULL when there is none. Its contents may be read,
+   drawing into it is left to the functions above. */
+SWFB_SURFACE *
+swfb_screen(void)
+{
+	return g_swfb.data != NULL ? &g_swfb : NULL;
+}
+
+/* FNV-1a hash of the RGB bytes of the framebuffer, for comparing
+   renderings */
+uint32
+swfb_checksum(void)
+{
+	uint32 hash = 0x811c9dc5;
+	int i;
+
+	for (i = 0; i < g_swfb.width * g_swfb.height; i++)
+	{
+		hash = (hash ^ (g_swfb.data[i] & 0xff)) * 0x01000193;
+		hash = (hash ^ ((g_swfb.data[i] >> 8) & 0xff)) * 0x01000193;
+		hash = (hash ^ ((g_swfb.data[i] >> 16) & 0xff)) * 0x01000193;
+	}
+
+	return hash;
+}
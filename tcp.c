@@ -30,8 +30,11 @@
 #include <netinet/tcp.h>	/* TCP_NODELAY */
 #include <arpa/inet.h>		/* inet_addr */
 #include <errno.h>		/* errno */
+#include <fcntl.h>		/* fcntl */
 #include <assert.h>
+#include <pthread.h>
 #endif
+#include <time.h>
 
 #include <gnutls/gnutls.h>
 #include <gnutls/x509.h>
@@ -58,6 +61,32 @@
 #define INADDR_NONE ((unsigned long) -1)
 #endif
 
+/* Initial size of the receive read-ahead buffer, grown on demand if a
+   single frame does not fit */
+#define TCP_READAHEAD_SIZE (64 * 1024)
+
+/* The receive thread reads up to TCP_CHUNK_SIZE bytes at a time and
+   queues them as whole frames, at most TCP_RECV_QUEUE_SIZE of them. The
+   decode thread passes them on to the main thread through a queue of
+   TCP_DECODE_QUEUE_SIZE frames. */
+#define TCP_CHUNK_SIZE (16 * 1024)
+#define TCP_RECV_QUEUE_SIZE 64
+#define TCP_DECODE_QUEUE_SIZE 32
+
+#define TCP_RECV_CLOSED -1
+#define TCP_RECV_ERROR -2
+
+typedef struct _TCP_FRAME
+{
+	int length;		/* frame length or TCP_RECV_CLOSED / TCP_RECV_ERROR */
+	int offset;		/* bytes already handed to the read-ahead buffer */
+	RDP_EXPANDED *expanded;	/* compressed data expanded by the decode thread */
+	struct timespec received;
+	struct timespec decoded;
+	uint8 data[];
+}
+TCP_FRAME;
+
 #ifdef WITH_SCARD
 #define STREAM_COUNT 8
 #else
@@ -75,6 +104,16 @@ static RD_BOOL g_ssl_initialized = False;
 static int g_sock;
 static RD_BOOL g_run_ui = False;
 static struct stream g_in;
+static struct stream g_readahead;
+static TCP_RECV_STATS g_recv_stats;
+static RD_BOOL g_recv_thread_running = False;
+static pthread_t g_recv_thread;
+static pthread_t g_decode_thread;
+static RD_QUEUE g_recv_queue;
+static RD_QUEUE g_decode_queue;
+static struct stream g_recv_buffer;
+static TCP_FRAME *g_recv_frame = NULL;
+static int g_recv_stop[2];
 static struct stream g_out[STREAM_COUNT];
 int g_tcp_port_rdp = TCP_PORT_RDP;
 
@@ -186,100 +225,682 @@ tcp_send(STREAM s)
 #endif
 }
 
-/* Receive a message on the TCP layer */
-STREAM
-tcp_recv(STREAM s, uint32 length)
+/* Make room for at least length more bytes after the frame being
+   assembled in g_in. Data before the current frame has already been
+   handed out and is reclaimed by moving the frame to the start of the
+   read-ahead buffer, which is only grown if the frame itself does not
+   fit. */
+static void
+tcp_readahead_reserve(uint32 length)
 {
-	uint32 new_length, end_offset, p_offset;
-	int rcvd = 0;
+	uint8 *olddata;
+	uint32 frame_offset, p_offset, end_offset, needed, size, room;
 
-	if (g_network_error == True)
-		return NULL;
+	room = g_readahead.data + g_readahead.size - g_readahead.end;
+	if (room >= length && (room >= TCP_READAHEAD_SIZE / 4 || g_in.data == g_readahead.data))
+		return;
 
-	if (s == NULL)
+	frame_offset = g_in.data - g_readahead.data;
+	p_offset = g_in.p - g_in.data;
+	end_offset = g_in.end - g_in.data;
+
+	if (frame_offset > 0)
 	{
-		/* read into "new" stream */
-		if (length > g_in.size)
+		memmove(g_readahead.data, g_in.data, g_readahead.end - g_in.data);
+		g_readahead.end -= frame_offset;
+	}
+
+	needed = (g_readahead.end - g_readahead.data) + length;
+	if (needed > g_readahead.size)
+	{
+		size = g_readahead.size;
+		while (size < needed)
+			size *= 2;
+
+		olddata = g_readahead.data;
+		g_readahead.data = (uint8 *) xrealloc(g_readahead.data, size);
+		g_readahead.size = size;
+		g_readahead.end = g_readahead.data + (g_readahead.end - olddata);
+	}
+
+	g_in.data = g_readahead.data;
+	g_in.p = g_in.data + p_offset;
+	g_in.end = g_in.data + end_offset;
+}
+
+/* Receive whatever is available into buf, returns number of bytes
+   read, zero if nothing was read, TCP_RECV_CLOSED if the peer closed
+   the connection and TCP_RECV_ERROR on failure */
+static int
+tcp_read(uint8 * buf, uint32 room)
+{
+	int rcvd;
+
+	if (g_ssl_initialized)
+	{
+		rcvd = gnutls_record_recv(g_tls_session, buf, room);
+
+		if (rcvd < 0)
 		{
-			g_in.data = (uint8 *) xrealloc(g_in.data, length);
-			g_in.size = length;
+			if (gnutls_error_is_fatal(rcvd))
+			{
+				logger(Core, Error, "tcp_recv(), gnutls_record_recv() failed with %d: %s\n", rcvd, gnutls_strerror(rcvd));
+				return TCP_RECV_ERROR;
+			}
+			else
+			{
+				rcvd = 0;
+			}
+		}
+		else if (rcvd == 0)
+		{
+			logger(Core, Error, "tcp_recv(), connection closed by peer");
+			return TCP_RECV_CLOSED;
 		}
-		g_in.end = g_in.p = g_in.data;
-		s = &g_in;
 	}
 	else
 	{
-		/* append to existing stream */
-		new_length = (s->end - s->data) + length;
-		if (new_length > s->size)
+		rcvd = recv(g_sock, buf, room, 0);
+		if (rcvd < 0)
 		{
-			p_offset = s->p - s->data;
-			end_offset = s->end - s->data;
-			s->data = (uint8 *) xrealloc(s->data, new_length);
-			s->size = new_length;
-			s->p = s->data + p_offset;
-			s->end = s->data + end_offset;
+			if (rcvd == -1 && TCP_BLOCKS)
+			{
+				rcvd = 0;
+			}
+			else
+			{
+				logger(Core, Error, "tcp_recv(), recv() failed: %s",
+				       TCP_STRERROR);
+				return TCP_RECV_ERROR;
+			}
+		}
+		else if (rcvd == 0)
+		{
+			logger(Core, Error, "rcp_recv(), connection closed by peer");
+			return TCP_RECV_CLOSED;
+		}
+	}
+
+	return rcvd;
+}
+
+static uint64
+tcp_ns_since(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64) (now.tv_sec - start->tv_sec) * 1000000000 + (now.tv_nsec -
+								      start->tv_nsec);
+}
+
+static TCP_FRAME *
+tcp_frame_new(uint32 length)
+{
+	TCP_FRAME *frame;
+
+	frame = (TCP_FRAME *) xmalloc(sizeof(TCP_FRAME) + length);
+	memset(frame, 0, sizeof(TCP_FRAME));
+	frame->length = length;
+	return frame;
+}
+
+static void
+tcp_frame_free(TCP_FRAME * frame)
+{
+	RDP_EXPANDED *e;
+
+	if (frame == NULL)
+		return;
+
+	while ((e = frame->expanded) != NULL)
+	{
+		frame->expanded = e->next;
+		xfree(e->s.data);
+		xfree(e);
+	}
+	xfree(frame);
+}
+
+/* Queue a frame for the next stage, waiting while the queue is full so
+   that the stages before it are held up. Returns False, with the frame
+   freed, if the pipeline is stopped while waiting. */
+static RD_BOOL
+tcp_queue_frame(RD_QUEUE * q, TCP_FRAME * frame, uint32 * stalls, uint64 * stall_ns)
+{
+	struct timespec start;
+
+	if (queue_push(q, frame))
+		return True;
+
+	(*stalls)++;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (!queue_wait_space(q, g_recv_stop[0]))
+	{
+		tcp_frame_free(frame);
+		return False;
+	}
+	*stall_ns += tcp_ns_since(&start);
+	queue_push(q, frame);
+	return True;
+}
+
+/* Take the next frame from a queue, waiting for one. Returns NULL if
+   the pipeline is stopped while waiting. */
+static TCP_FRAME *
+tcp_dequeue_frame(RD_QUEUE * q)
+{
+	TCP_FRAME *frame;
+	fd_set rfds;
+	int n;
+
+	while ((frame = (TCP_FRAME *) queue_pop(q)) == NULL)
+	{
+		FD_ZERO(&rfds);
+		FD_SET(queue_fd(q), &rfds);
+		FD_SET(g_recv_stop[0], &rfds);
+		n = select(MAX(queue_fd(q), g_recv_stop[0]) + 1, &rfds, NULL, NULL, NULL);
+		if (n > 0 && FD_ISSET(g_recv_stop[0], &rfds))
+			return NULL;
+	}
+
+	return frame;
+}
+
+/* Queue the complete frames at the front of g_recv_buffer, RC4
+   decrypting each on the way. Returns False if the pipeline is stopped
+   while waiting for room in the queue. */
+static RD_BOOL
+tcp_recv_thread_frames(struct timespec *received)
+{
+	TCP_FRAME *frame;
+	struct stream s;
+	struct timespec start;
+	uint32 available, length;
+	uint16 channel;
+	RD_BOOL is_fastpath;
+
+	while (1)
+	{
+		available = g_recv_buffer.end - g_recv_buffer.p;
+		length = iso_frame_length(g_recv_buffer.p, available);
+		if (length == 0 || length > available)
+			return True;
+
+		frame = tcp_frame_new(length);
+		memcpy(frame->data, g_recv_buffer.p, length);
+		frame->received = *received;
+		g_recv_buffer.p += length;
+
+		memset(&s, 0, sizeof(s));
+		s.data = s.p = frame->data;
+		s.end = s.data + length;
+		s.size = length;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		sec_parse_frame(&s, True, &channel, &is_fastpath);
+		g_recv_stats.decrypt_ns += tcp_ns_since(&start);
+
+		if (!tcp_queue_frame(&g_recv_queue, frame, &g_recv_stats.stalls,
+				     &g_recv_stats.stall_ns))
+			return False;
+	}
+}
+
+/* Receive thread, reads and TLS decrypts data from the socket, splits it
+   into frames and takes over the RC4 decryption of sec_recv(). The
+   frames go to the decode thread through g_recv_queue. When the queue
+   is full the thread stops reading, so that the server is throttled by
+   the TCP window instead of data piling up in the client. */
+static void *
+tcp_recv_thread(void *arg)
+{
+	TCP_FRAME *frame;
+	struct timespec start, received;
+	fd_set rfds;
+	uint32 pending;
+	int rcvd, n;
+
+	UNUSED(arg);
+
+	/* data read ahead by the main thread comes first */
+	clock_gettime(CLOCK_MONOTONIC, &received);
+	if (!tcp_recv_thread_frames(&received))
+		return NULL;
+
+	while (1)
+	{
+		if (!g_ssl_initialized || (gnutls_record_check_pending(g_tls_session) <= 0))
+		{
+			FD_ZERO(&rfds);
+			FD_SET(g_sock, &rfds);
+			FD_SET(g_recv_stop[0], &rfds);
+			n = select(MAX(g_sock, g_recv_stop[0]) + 1, &rfds, NULL, NULL, NULL);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n > 0 && FD_ISSET(g_recv_stop[0], &rfds))
+				break;
 		}
+
+		/* move a partial frame to the front and make room to read */
+		pending = g_recv_buffer.end - g_recv_buffer.p;
+		memmove(g_recv_buffer.data, g_recv_buffer.p, pending);
+		g_recv_buffer.p = g_recv_buffer.data;
+		g_recv_buffer.end = g_recv_buffer.data + pending;
+		if (g_recv_buffer.size - pending < TCP_CHUNK_SIZE)
+		{
+			s_realloc(&g_recv_buffer, pending + TCP_CHUNK_SIZE);
+			g_recv_buffer.end = g_recv_buffer.data + pending;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		rcvd = tcp_read(g_recv_buffer.end, TCP_CHUNK_SIZE);
+		g_recv_stats.read_ns += tcp_ns_since(&start);
+		g_recv_stats.reads++;
+
+		if (rcvd == 0)
+			continue;
+
+		if (rcvd < 0)
+		{
+			/* the main thread reports the failure when it gets here */
+			frame = tcp_frame_new(0);
+			frame->length = rcvd;
+			clock_gettime(CLOCK_MONOTONIC, &frame->received);
+			tcp_queue_frame(&g_recv_queue, frame, &g_recv_stats.stalls,
+					&g_recv_stats.stall_ns);
+			break;
+		}
+
+		g_recv_buffer.end += rcvd;
+		clock_gettime(CLOCK_MONOTONIC, &received);
+		if (!tcp_recv_thread_frames(&received))
+			break;
+	}
+
+	return NULL;
+}
+
+/* Decode thread, expands the bulk compressed data of the frames from
+   g_recv_queue ahead of the main thread and passes them on through
+   g_decode_queue. A full decode queue holds it up, and in turn the
+   receive thread. */
+static void *
+tcp_decode_thread(void *arg)
+{
+	TCP_FRAME *frame;
+	struct stream s;
+	struct timespec start;
+	uint64 wait;
+
+	UNUSED(arg);
+
+	while ((frame = tcp_dequeue_frame(&g_recv_queue)) != NULL)
+	{
+		wait = tcp_ns_since(&frame->received);
+		g_recv_stats.queued++;
+		g_recv_stats.queue_ns += wait;
+		g_recv_stats.queue_max_ns = MAX(g_recv_stats.queue_max_ns, wait);
+
+		if (frame->length > 0)
+		{
+			memset(&s, 0, sizeof(s));
+			s.data = s.p = frame->data;
+			s.end = s.data + frame->length;
+			s.size = frame->length;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			frame->expanded = rdp_expand_frame(&s);
+			g_recv_stats.decode_ns += tcp_ns_since(&start);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &frame->decoded);
+		if (frame->length < 0)
+		{
+			tcp_queue_frame(&g_decode_queue, frame, &g_recv_stats.decode_stalls,
+					&g_recv_stats.decode_stall_ns);
+			break;
+		}
+
+		if (!tcp_queue_frame(&g_decode_queue, frame, &g_recv_stats.decode_stalls,
+				     &g_recv_stats.decode_stall_ns))
+			break;
+	}
+
+	return NULL;
+}
+
+/* Hand out the next decoded frame, waiting for one in ui_select() if
+   there is none yet. The previous frame is kept until then, as the
+   upper layers use its expanded data while they parse it. */
+static TCP_FRAME *
+tcp_recv_thread_frame(void)
+{
+	TCP_FRAME *frame;
+	uint64 wait;
+
+	if (g_recv_frame != NULL && g_recv_frame->offset < g_recv_frame->length)
+		return g_recv_frame;
+
+	while ((frame = (TCP_FRAME *) queue_pop(&g_decode_queue)) == NULL)
+	{
+		g_recv_stats.selects++;
+		ui_select(queue_fd(&g_decode_queue));
+
+		/* break out of recv, if request of exiting
+		   main loop has been done */
+		if (g_exit_mainloop == True)
+			return NULL;
 	}
 
-	while (length > 0)
+	wait = tcp_ns_since(&frame->decoded);
+	g_recv_stats.decoded++;
+	g_recv_stats.decode_queue_ns += wait;
+	g_recv_stats.decode_queue_max_ns = MAX(g_recv_stats.decode_queue_max_ns, wait);
+
+	tcp_frame_free(g_recv_frame);
+	g_recv_frame = frame;
+	return frame;
+}
+
+/* Read whatever is available from the socket into the read-ahead
+   buffer, returns number of bytes read, zero if nothing was read and
+   -1 on failure */
+static int
+tcp_readahead_fill(void)
+{
+	TCP_FRAME *frame;
+	int rcvd;
+	uint32 room;
+
+	room = g_readahead.data + g_readahead.size - g_readahead.end;
+
+	if (g_recv_thread_running)
 	{
+		frame = tcp_recv_thread_frame();
+		if (frame == NULL)
+			return -1;
 
-		if ((!g_ssl_initialized || (gnutls_record_check_pending(g_tls_session) <= 0)) && g_run_ui)
+		if (frame->length < 0)
 		{
+			if (frame->length == TCP_RECV_ERROR)
+				g_network_error = True;
+			return -1;
+		}
+
+		/* the frame may be larger than the room left, keep the rest
+		   for the next call */
+		rcvd = MIN(room, (uint32) (frame->length - frame->offset));
+		memcpy(g_readahead.end, frame->data + frame->offset, rcvd);
+		frame->offset += rcvd;
+	}
+	else
+	{
+		if ((!g_ssl_initialized || (gnutls_record_check_pending(g_tls_session) <= 0))
+		    && g_run_ui)
+		{
+			g_recv_stats.selects++;
 			ui_select(g_sock);
 
 			/* break out of recv, if request of exiting
 			   main loop has been done */
 			if (g_exit_mainloop == True)
-				return NULL;
+				return -1;
 		}
 
-		if (g_ssl_initialized) {
-			rcvd = gnutls_record_recv(g_tls_session, s->end, length);
+		g_recv_stats.reads++;
+		rcvd = tcp_read(g_readahead.end, room);
+		if (rcvd < 0)
+		{
+			if (rcvd == TCP_RECV_ERROR)
+				g_network_error = True;
+			return -1;
+		}
+	}
 
-			if (rcvd < 0) {
-				if (gnutls_error_is_fatal(rcvd)) {
-					logger(Core, Error, "tcp_recv(), gnutls_record_recv() failed with %d: %s\n", rcvd, gnutls_strerror(rcvd));
-					g_network_error = True;
-					return NULL;
-				} else {
-					rcvd = 0;
-				}
-			}
+	g_readahead.end += rcvd;
+	g_recv_stats.bytes += rcvd;
+	return rcvd;
+}
+
+/* Switch the socket between blocking and non-blocking mode */
+static void
+tcp_set_blocking(RD_BOOL blocking)
+{
+	int flags;
+
+	flags = fcntl(g_sock, F_GETFL);
+	if (flags == -1)
+		return;
+
+	if (blocking)
+		flags &= ~O_NONBLOCK;
+	else
+		flags |= O_NONBLOCK;
+
+	if (fcntl(g_sock, F_SETFL, flags) == -1)
+		logger(Core, Warning, "tcp_set_blocking(), fcntl() failed: %s", TCP_STRERROR);
+}
+
+/* Start the receive pipeline: a receive thread and a decode thread. The
+   socket is non-blocking while it runs, so that the receive thread
+   never waits in recv() or for the rest of a TLS record, but always in
+   select() where it sees the stop pipe. */
+static void
+tcp_recv_thread_start(void)
+{
+	uint32 pending;
+	uint8 c = 0;
+
+	if (g_recv_thread_running)
+		return;
+
+	if (!queue_init(&g_recv_queue, TCP_RECV_QUEUE_SIZE))
+		return;
+
+	if (!queue_init(&g_decode_queue, TCP_DECODE_QUEUE_SIZE))
+	{
+		queue_destroy(&g_recv_queue);
+		return;
+	}
+
+	if (pipe(g_recv_stop) != 0)
+	{
+		logger(Core, Warning, "tcp_recv_thread_start(), pipe() failed: %s",
+		       TCP_STRERROR);
+		queue_destroy(&g_recv_queue);
+		queue_destroy(&g_decode_queue);
+		return;
+	}
+
+	/* frames read ahead but not yet parsed still have to be decrypted
+	   in order, so they go through the pipeline first */
+	pending = g_readahead.end - g_readahead.p;
+	memset(&g_recv_buffer, 0, sizeof(g_recv_buffer));
+	s_realloc(&g_recv_buffer, pending + TCP_CHUNK_SIZE);
+	s_reset(&g_recv_buffer);
+	if (pending > 0)
+		memcpy(g_recv_buffer.data, g_readahead.p, pending);
+	g_recv_buffer.end = g_recv_buffer.data + pending;
+	g_readahead.end = g_readahead.p;
+
+	tcp_set_blocking(False);
+
+	if (pthread_create(&g_decode_thread, NULL, tcp_decode_thread, NULL) != 0)
+	{
+		logger(Core, Warning,
+		       "tcp_recv_thread_start(), failed to create decode thread, receiving on the main thread");
+		goto fail;
+	}
+
+	if (pthread_create(&g_recv_thread, NULL, tcp_recv_thread, NULL) != 0)
+	{
+		logger(Core, Warning,
+		       "tcp_recv_thread_start(), failed to create receive thread, receiving on the main thread");
+		if (write(g_recv_stop[1], &c, 1) != 1)
+			logger(Core, Warning, "tcp_recv_thread_start(), write failed: %s",
+			       TCP_STRERROR);
+		pthread_join(g_decode_thread, NULL);
+		goto fail;
+	}
+
+	g_recv_thread_running = True;
+	return;
+
+      fail:
+	tcp_set_blocking(True);
+	close(g_recv_stop[0]);
+	close(g_recv_stop[1]);
+	queue_destroy(&g_recv_queue);
+	queue_destroy(&g_decode_queue);
+
+	/* nothing has been decrypted, the main thread takes over */
+	if (pending > 0)
+	{
+		tcp_readahead_reserve(pending);
+		memcpy(g_readahead.end, g_recv_buffer.data, pending);
+		g_readahead.end += pending;
+	}
+	xfree(g_recv_buffer.data);
+	memset(&g_recv_buffer, 0, sizeof(g_recv_buffer));
+}
+
+/* Stop the receive pipeline. Frames still on their way are dropped: the
+   pipeline only stops when the session ends, and they are already
+   decrypted, so they could not be parsed on the main thread anyway. */
+static void
+tcp_recv_thread_stop(void)
+{
+	TCP_FRAME *frame;
+	uint8 c = 0;
+
+	if (!g_recv_thread_running)
+		return;
+
+	if (write(g_recv_stop[1], &c, 1) != 1)
+		logger(Core, Warning, "tcp_recv_thread_stop(), write failed: %s", TCP_STRERROR);
+	pthread_join(g_recv_thread, NULL);
+	pthread_join(g_decode_thread, NULL);
+	g_recv_thread_running = False;
+	tcp_set_blocking(True);
+
+	while ((frame = queue_pop(&g_recv_queue)) != NULL)
+		tcp_frame_free(frame);
+	while ((frame = queue_pop(&g_decode_queue)) != NULL)
+		tcp_frame_free(frame);
+	tcp_frame_free(g_recv_frame);
+	g_recv_frame = NULL;
+
+	g_readahead.end = g_readahead.p;
+	xfree(g_recv_buffer.data);
+	memset(&g_recv_buffer, 0, sizeof(g_recv_buffer));
+
+	close(g_recv_stop[0]);
+	close(g_recv_stop[1]);
+	queue_destroy(&g_recv_queue);
+	queue_destroy(&g_decode_queue);
+}
+
+/* Receive a message on the TCP layer
+
+   Data is read from the socket in chunks as large as the read-ahead
+   buffer allows. The returned stream is a view into that buffer and
+   stays valid until the next call to tcp_recv() with s == NULL, which
+   starts a new frame. Passing the stream returned by the previous call
+   extends the frame with length more bytes. */
+STREAM
+tcp_recv(STREAM s, uint32 length)
+{
+	uint32 available, new_length, end_offset, p_offset;
+
+	if (g_network_error == True)
+		return NULL;
 
+	if (s == NULL)
+	{
+		/* everything up to the end of the previous frame has been
+		   consumed, start a new frame view after it */
+		if (g_in.end == g_readahead.end)
+			g_in.end = g_readahead.end = g_readahead.data;
+		g_in.data = g_in.p = g_in.end;
+		g_in.size = 0;
+		g_readahead.p = g_in.data;
+		g_recv_stats.frames++;
+		s = &g_in;
+	}
+	else if (s != &g_in)
+	{
+		/* append to a stream owned by the caller */
+		new_length = (s->end - s->data) + length;
+		if (new_length > s->size)
+		{
+			p_offset = s->p - s->data;
+			end_offset = s->end - s->data;
+			s->data = (uint8 *) xrealloc(s->data, new_length);
+			s->size = new_length;
+			s->p = s->data + p_offset;
+			s->end = s->data + end_offset;
 		}
-		else
+
+		while (length > 0)
 		{
-			rcvd = recv(g_sock, s->end, length, 0);
-			if (rcvd < 0)
+			available = g_readahead.end - g_readahead.p;
+			if (available == 0)
 			{
-				if (rcvd == -1 && TCP_BLOCKS)
-				{
-					rcvd = 0;
-				}
-				else
-				{
-					logger(Core, Error, "tcp_recv(), recv() failed: %s",
-							TCP_STRERROR);
-					g_network_error = True;
+				g_in.data = g_in.p = g_in.end = g_readahead.p = g_readahead.data;
+				g_readahead.end = g_readahead.data;
+				if (tcp_readahead_fill() < 0)
 					return NULL;
-				}
-			}
-			else if (rcvd == 0)
-			{
-				logger(Core, Error, "rcp_recv(), connection closed by peer");
-				return NULL;
+				continue;
 			}
+
+			available = MIN(available, length);
+			memcpy(s->end, g_readahead.p, available);
+			g_readahead.p += available;
+			g_in.data = g_in.p = g_in.end = g_readahead.p;
+			s->end += available;
+			length -= available;
 		}
 
-		s->end += rcvd;
-		length -= rcvd;
+		return s;
 	}
 
+	while ((uint32) (g_readahead.end - g_in.end) < length)
+	{
+		tcp_readahead_reserve(length - (g_readahead.end - g_in.end));
+		if (tcp_readahead_fill() < 0)
+			return NULL;
+	}
+
+	g_in.end += length;
+	g_in.size = g_in.end - g_in.data;
+	g_readahead.p = g_in.end;
+
 	return s;
 }
 
+/* Get receive statistics, useful for measuring how many syscalls are
+   spent per received PDU */
+void
+tcp_get_recv_stats(TCP_RECV_STATS * stats)
+{
+	*stats = g_recv_stats;
+}
+
+/* True if the frame being received came through the receive pipeline,
+   which has RC4 decrypted it and expanded its compressed data */
+RD_BOOL
+tcp_recv_decoded(void)
+{
+	return g_recv_thread_running;
+}
+
+/* Compressed data of the frame being received that the decode thread
+   has expanded, in the order found in the frame */
+RDP_EXPANDED *
+tcp_recv_expanded(void)
+{
+	return g_recv_frame ? g_recv_frame->expanded : NULL;
+}
+
 /*
  * Callback during handshake to verify peer certificate
  */
@@ -354,6 +975,12 @@ tcp_tls_connect(void)
 	gnutls_datum_t out;
 	gnutls_certificate_credentials_t xcred;
 
+	/* The handshake reads straight from the socket, anything left
+	   in the read-ahead buffer would be lost */
+	if (g_readahead.end != g_in.end)
+		logger(Core, Warning, "%s(), discarding %d bytes of unread data", __func__,
+		       (int) (g_readahead.end - g_in.end));
+
 	/* Initialize TLS session */
 	if (!g_ssl_initialized)
 	{
@@ -678,8 +1305,12 @@ tcp_connect(char *server)
 		}
 	}
 
-	g_in.size = 4096;
-	g_in.data = (uint8 *) xmalloc(g_in.size);
+	g_readahead.size = TCP_READAHEAD_SIZE;
+	g_readahead.data = (uint8 *) xmalloc(g_readahead.size);
+	g_readahead.p = g_readahead.end = g_readahead.data;
+	g_in.data = g_in.p = g_in.end = g_readahead.data;
+	g_in.size = 0;
+	memset(&g_recv_stats, 0, sizeof(g_recv_stats));
 
 	for (i = 0; i < STREAM_COUNT; i++)
 	{
@@ -700,6 +1331,8 @@ tcp_disconnect(void)
 {
 	int i;
 
+	tcp_recv_thread_stop();
+
 	if (g_ssl_initialized) {
 		(void)gnutls_bye(g_tls_session, GNUTLS_SHUT_WR);
 		gnutls_deinit(g_tls_session);
@@ -712,9 +1345,37 @@ tcp_disconnect(void)
 	TCP_CLOSE(g_sock);
 	g_sock = -1;
 
-	g_in.size = 0;
-	xfree(g_in.data);
-	g_in.data = NULL;
+	if (g_recv_stats.frames > 0)
+		logger(Core, Debug,
+		       "tcp_disconnect(), received %u frames using %u reads and %u selects",
+		       g_recv_stats.frames, g_recv_stats.reads, g_recv_stats.selects);
+	if (g_recv_stats.queued > 0)
+	{
+		logger(Core, Debug,
+		       "tcp_disconnect(), receive thread: %.1f ms receiving, %.1f ms RC4 decrypting, "
+		       "%.1f ms stalled %u times on a full receive queue",
+		       g_recv_stats.read_ns / 1e6, g_recv_stats.decrypt_ns / 1e6,
+		       g_recv_stats.stall_ns / 1e6, g_recv_stats.stalls);
+		logger(Core, Debug,
+		       "tcp_disconnect(), decode thread: %u frames, %.1f ms expanding, "
+		       "%.1f ms stalled %u times on a full decode queue, "
+		       "%.3f ms average and %.3f ms maximum receive queue latency",
+		       g_recv_stats.queued, g_recv_stats.decode_ns / 1e6,
+		       g_recv_stats.decode_stall_ns / 1e6, g_recv_stats.decode_stalls,
+		       g_recv_stats.queue_ns / 1e6 / g_recv_stats.queued,
+		       g_recv_stats.queue_max_ns / 1e6);
+	}
+	if (g_recv_stats.decoded > 0)
+		logger(Core, Debug,
+		       "tcp_disconnect(), main thread: %u frames, %.3f ms average and "
+		       "%.3f ms maximum decode queue latency",
+		       g_recv_stats.decoded,
+		       g_recv_stats.decode_queue_ns / 1e6 / g_recv_stats.decoded,
+		       g_recv_stats.decode_queue_max_ns / 1e6);
+
+	xfree(g_readahead.data);
+	memset(&g_readahead, 0, sizeof(g_readahead));
+	memset(&g_in, 0, sizeof(g_in));
 
 	for (i = 0; i < STREAM_COUNT; i++)
 	{
@@ -757,8 +1418,10 @@ tcp_reset_state(void)
 {
 	int i;
 
-	/* Clear the incoming stream */
-	s_reset(&g_in);
+	/* Clear the incoming stream and any read-ahead data */
+	g_readahead.p = g_readahead.end = g_readahead.data;
+	g_in.data = g_in.p = g_in.end = g_readahead.data;
+	g_in.size = 0;
 
 	/* Clear the outgoing stream(s) */
 	for (i = 0; i < STREAM_COUNT; i++)
@@ -771,4 +1434,9 @@ void
 tcp_run_ui(RD_BOOL run)
 {
 	g_run_ui = run;
+
+	if (run)
+		tcp_recv_thread_start();
+	else
+		tcp_recv_thread_stop();
 }
@@ -5,3 +5,39 @@ RD_BOOL bitmap_decompress(uint8 * output, int width, int height, uint8 * input,
 {
   return mock(output, width, height, input, size, Bpp);
 };
+
+void bitmap_decompress_start(BITMAP_JOB * jobs, int count)
+{
+  mock(jobs, count);
+}
+
+RD_BOOL bitmap_decompress_wait(BITMAP_JOB * job)
+{
+  return mock(job);
+}
+
+void bitmap_decompress_end(void)
+{
+  mock();
+}
+
+void bitmap_set_format(PIXEL_FORMAT * format)
+{
+  mock(format);
+}
+
+int bitmap_native_Bpp(int Bpp)
+{
+  return mock(Bpp);
+}
+
+void bitmap_translate(uint8 * output, uint8 * input, int count, int Bpp)
+{
+  mock(output, input, count, Bpp);
+}
+
+RD_BOOL bitmap_decompress_native(uint8 * output, int width, int height, uint8 * input, int size,
+				 int Bpp)
+{
+  return mock(output, width, height, input, size, Bpp);
+}
@@ -0,0 +1,236 @@
+#include <cgreen/cgreen.h>
+#include <cgreen/mocks.h>
+#include "../rdesktop.h"
+
+/* Boilerplate */
+Describe(Bitmap);
+BeforeEach(Bitmap) {}
+AfterEach(Bitmap) { bitmap_set_format(NULL); }
+
+int g_server_depth;
+
+/* malloc; exit if out of memory */
+void *
+xmalloc(int size)
+{
+	void *mem = malloc(size);
+	if (mem == NULL)
+	{
+		logger(Core, Error, "xmalloc, failed to allocate %d bytes", size);
+		exit(EX_UNAVAILABLE);
+	}
+	return mem;
+}
+
+/* free */
+void
+xfree(void *mem)
+{
+	free(mem);
+}
+
+#define WIDTH 40
+
+/* Encode a plane of two rows, the first with the values base + x as
+   literals, the second one larger by means of repeated differences */
+static int
+encode_plane(uint8 * out, int base)
+{
+	int n = 0, x, i;
+
+	for (x = 0; x < WIDTH; x += 15)
+	{
+		out[n++] = MIN(15, WIDTH - x) << 4;
+		for (i = x; i < MIN(x + 15, WIDTH); i++)
+			out[n++] = base + i;
+	}
+
+	/* difference +1, sent as 2, then 15, 15 and 7 repeats */
+	out[n++] = 0x1f;
+	out[n++] = 2;
+	out[n++] = 0x1f;
+	out[n++] = 2;
+	out[n++] = 0x17;
+	out[n++] = 2;
+
+	return n;
+}
+
+Ensure(Bitmap, decompresses_32bpp_planes_into_bottom_up_pixels)
+{
+	uint8 input[1 + 4 * 64], output[WIDTH * 2 * 4];
+	int size, i, x;
+
+	/* planes are sent as alpha, red, green, blue */
+	input[0] = 0x10;
+	size = 1;
+	for (i = 3; i >= 0; i--)
+		size += encode_plane(input + size, i * 50);
+
+	assert_that(bitmap_decompress(output, WIDTH, 2, input, size, 4), is_true);
+
+	for (x = 0; x < WIDTH; x++)
+	{
+		for (i = 0; i < 4; i++)
+		{
+			/* the second row comes first in the output */
+			assert_that(output[x * 4 + i], is_equal_to(i * 50 + x + 1));
+			assert_that(output[(WIDTH + x) * 4 + i], is_equal_to(i * 50 + x));
+		}
+	}
+}
+
+Ensure(Bitmap, refuses_truncated_32bpp_planes)
+{
+	uint8 input[1 + 4 * 64], output[WIDTH * 2 * 4];
+	int size, i;
+
+	input[0] = 0x10;
+	size = 1;
+	for (i = 3; i >= 0; i--)
+		size += encode_plane(input + size, i * 50);
+
+	assert_that(bitmap_decompress(output, WIDTH, 2, input, size - 1, 4), is_false);
+}
+
+Ensure(Bitmap, translates_16bpp_pixels_into_ui_format)
+{
+	/* 32 bpp big endian, red at bit 16 */
+	PIXEL_FORMAT format = { 4, True, 0, 16, 0, 8, 0, 0 };
+	uint8 input[] = { 0x00, 0xf8, 0xe0, 0x07, 0x1f, 0x00 };
+	uint8 expected[] = { 0, 0xff, 0, 0, 0, 0, 0xff, 0, 0, 0, 0, 0xff };
+	uint8 output[12];
+	int i;
+
+	g_server_depth = 16;
+	bitmap_set_format(&format);
+	assert_that(bitmap_native_Bpp(2), is_equal_to(4));
+	assert_that(bitmap_native_Bpp(3), is_equal_to(0));
+
+	bitmap_translate(output, input, 3, 2);
+
+	for (i = 0; i < 12; i++)
+		assert_that(output[i], is_equal_to(expected[i]));
+}
+
+Ensure(Bitmap, decompresses_32bpp_planes_into_ui_format)
+{
+	/* R5G6B5 little endian */
+	PIXEL_FORMAT format = { 2, False, 3, 11, 2, 5, 3, 0 };
+	uint8 input[1 + 4 * 64], output[WIDTH * 2 * 2];
+	uint16 pixel;
+	int size, i, x;
+
+	input[0] = 0x10;
+	size = 1;
+	for (i = 3; i >= 0; i--)
+		size += encode_plane(input + size, i * 50);
+
+	g_server_depth = 32;
+	bitmap_set_format(&format);
+	assert_that(bitmap_native_Bpp(4), is_equal_to(2));
+	assert_that(bitmap_decompress_native(output, WIDTH, 2, input, size, 4), is_true);
+
+	for (x = 0; x < WIDTH; x++)
+	{
+		/* blue is the first plane, alpha is dropped */
+		pixel = output[(WIDTH + x) * 2] | (output[(WIDTH + x) * 2 + 1] << 8);
+		assert_that(pixel, is_equal_to((((100 + x) >> 3) << 11) | (((50 + x) >> 2) << 5)
+					       | (x >> 3)));
+	}
+}
+
+Ensure(Bitmap, translates_runs_of_pixels_like_single_pixels)
+{
+	/* the common X visual, which has vectorised translate functions */
+	PIXEL_FORMAT format = { 4, False, 0, 16, 0, 8, 0, 0 };
+	int depths[] = { 15, 16, 24, 32 };
+	uint8 input[37 * 4], run[37 * 4], single[37 * 4];
+	int i, d, Bpp;
+
+	for (i = 0; i < (int) sizeof(input); i++)
+		input[i] = i * 73 + 11;
+
+	bitmap_set_format(&format);
+	for (d = 0; d < 4; d++)
+	{
+		g_server_depth = depths[d];
+		Bpp = (depths[d] + 7) / 8;
+		assert_that(bitmap_native_Bpp(Bpp), is_equal_to(4));
+
+		bitmap_translate(run, input, 37, Bpp);
+		for (i = 0; i < 37; i++)
+			bitmap_translate(single + i * 4, input + i * Bpp, 1, Bpp);
+
+		for (i = 0; i < 37 * 4; i++)
+			assert_that(run[i], is_equal_to(single[i]));
+	}
+}
+
+#define JOBS 64
+#define ROUNDS 200
+
+Ensure(Bitmap, decompresses_many_rectangles_on_the_workers)
+{
+	/* R5G6B5 little endian */
+	PIXEL_FORMAT format = { 2, False, 3, 11, 2, 5, 3, 0 };
+	static uint8 input[JOBS][1 + 4 * 64];
+	static uint8 output[JOBS][WIDTH * 2 * 4];
+	static uint8 expected[2][JOBS][WIDTH * 2 * 4];
+	BITMAP_JOB jobs[JOBS];
+	int size[JOBS], round, i, p;
+	RD_BOOL truncated;
+
+	g_server_depth = 32;
+	bitmap_set_format(&format);
+
+	for (i = 0; i < JOBS; i++)
+	{
+		input[i][0] = 0x10;
+		size[i] = 1;
+		for (p = 3; p >= 0; p--)
+			size[i] += encode_plane(input[i] + size[i], p * 50 + i);
+
+		assert_that(bitmap_decompress(expected[0][i], WIDTH, 2, input[i], size[i], 4),
+			    is_true);
+		assert_that(bitmap_decompress_native(expected[1][i], WIDTH, 2, input[i], size[i],
+						     4), is_true);
+	}
+
+	for (round = 0; round < ROUNDS; round++)
+	{
+		memset(jobs, 0, sizeof(jobs));
+		memset(output, 0, sizeof(output));
+		for (i = 0; i < JOBS; i++)
+		{
+			truncated = (i + round) % 13 == 0;
+			jobs[i].output = output[i];
+			jobs[i].input = input[i];
+			jobs[i].size = size[i] - (truncated ? 1 : 0);
+			jobs[i].width = WIDTH;
+			jobs[i].height = 2;
+			jobs[i].Bpp = 4;
+			jobs[i].native = (i + round) % 2;
+
+			/* rectangles that need no decompression */
+			if ((i + round) % 11 == 0)
+				jobs[i].ok = jobs[i].done = True;
+		}
+
+		bitmap_decompress_start(jobs, JOBS);
+
+		/* collect the last job first, so that the caller has to help
+		   with the others while it waits */
+		for (i = JOBS - 1; i >= 0; i--)
+		{
+			truncated = (i + round) % 13 == 0 && (i + round) % 11 != 0;
+			assert_that(bitmap_decompress_wait(&jobs[i]), is_equal_to(!truncated));
+			if (jobs[i].ok && (i + round) % 11 != 0)
+				assert_that(output[i],
+					    is_equal_to_contents_of(expected[jobs[i].native][i],
+								    WIDTH * 2 * (jobs[i].native ? 2 : 4)));
+		}
+
+		bitmap_decompress_end();
+	}
+}
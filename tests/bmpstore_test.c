@@ -0,0 +1,449 @@
+#include <cgreen/cgreen.h>
+#include <cgreen/mocks.h>
+#include "../rdesktop.h"
+
+/* Boilerplate */
+Describe(BmpStore);
+BeforeEach(BmpStore) {}
+AfterEach(BmpStore) {}
+
+/* malloc; exit if out of memory */
+void *
+xmalloc(int size)
+{
+	void *mem = malloc(size);
+	if (mem == NULL)
+	{
+		logger(Core, Error, "xmalloc, failed to allocate %d bytes", size);
+		exit(EX_UNAVAILABLE);
+	}
+	return mem;
+}
+
+/* realloc; exit if out of memory */
+void *
+xrealloc(void *oldmem, size_t size)
+{
+	void *mem = realloc(oldmem, MAX(size, 1));
+	if (mem == NULL)
+	{
+		logger(Core, Error, "xrealloc, failed to allocate %d bytes", (int) size);
+		exit(EX_UNAVAILABLE);
+	}
+	return mem;
+}
+
+/* free */
+void
+xfree(void *mem)
+{
+	free(mem);
+}
+
+/* Files in memory, standing in for the .rdesktop directory. Slot locks
+   held by other processes are set by the tests. */
+#define FAKE_FILES	16
+#define FAKE_SIZE	(4 << 20)
+#define OTHER_PROCESS	-2
+
+struct fake_file
+{
+	char name[64];
+	uint8 *data;
+	int size;
+	RD_BOOL linked;
+};
+
+static struct fake_file g_files[FAKE_FILES];
+static struct fake_file *g_fd_file[FAKE_FILES];
+static int g_fd_pos[FAKE_FILES];
+static int g_slot_owner[64];
+
+static struct fake_file *
+fake_find(char *filename)
+{
+	int n;
+
+	for (n = 0; n < FAKE_FILES; n++)
+		if (g_files[n].linked && strcmp(g_files[n].name, filename) == 0)
+			return &g_files[n];
+	return NULL;
+}
+
+/* a file that was removed and isn't open any more */
+static RD_BOOL
+fake_unused(struct fake_file *file)
+{
+	int fd;
+
+	if (file->linked)
+		return False;
+	for (fd = 0; fd < FAKE_FILES; fd++)
+		if (g_fd_file[fd] == file)
+			return False;
+	return True;
+}
+
+int
+rd_open_file(char *filename)
+{
+	struct fake_file *file;
+	int n, fd;
+
+	file = fake_find(filename);
+	for (n = 0; file == NULL && n < FAKE_FILES; n++)
+		if (fake_unused(&g_files[n]))
+		{
+			file = &g_files[n];
+			if (file->data == NULL)
+				file->data = calloc(1, FAKE_SIZE);
+			memset(file->data, 0, file->size);
+			file->size = 0;
+			STRNCPY(file->name, filename, sizeof(file->name));
+			file->linked = True;
+		}
+
+	for (fd = 0; fd < FAKE_FILES; fd++)
+		if (g_fd_file[fd] == NULL)
+		{
+			g_fd_file[fd] = file;
+			g_fd_pos[fd] = 0;
+			return fd;
+		}
+	return -1;
+}
+
+void
+rd_close_file(int fd)
+{
+	int n;
+
+	for (n = 0; n < 64; n++)
+		if (g_slot_owner[n] == fd + 1)
+			g_slot_owner[n] = 0;
+	g_fd_file[fd] = NULL;
+}
+
+int
+rd_read_file(int fd, void *ptr, int len)
+{
+	struct fake_file *file = g_fd_file[fd];
+
+	len = MAX(MIN(len, file->size - g_fd_pos[fd]), 0);
+	memcpy(ptr, file->data + g_fd_pos[fd], len);
+	g_fd_pos[fd] += len;
+	return len;
+}
+
+int
+rd_write_file(int fd, void *ptr, int len)
+{
+	struct fake_file *file = g_fd_file[fd];
+
+	if (g_fd_pos[fd] + len > FAKE_SIZE)
+		return -1;
+	memcpy(file->data + g_fd_pos[fd], ptr, len);
+	g_fd_pos[fd] += len;
+	file->size = MAX(file->size, g_fd_pos[fd]);
+	return len;
+}
+
+int
+rd_lseek_file(int fd, int offset)
+{
+	g_fd_pos[fd] = offset;
+	return offset;
+}
+
+/* only the session slots are locked in parts */
+RD_BOOL
+rd_lock_file(int fd, int start, int len)
+{
+	if (len == 0)
+		return True;
+	if (g_slot_owner[start / len] == OTHER_PROCESS)
+		return False;
+	g_slot_owner[start / len] = fd + 1;
+	return True;
+}
+
+RD_BOOL
+rd_lock_file_wait(int fd, int start, int len)
+{
+	return rd_lock_file(fd, start, len);
+}
+
+void
+rd_unlock_file(int fd, int start, int len)
+{
+	UNUSED(fd);
+	if (len != 0)
+		g_slot_owner[start / len] = 0;
+}
+
+RD_BOOL
+rd_rename_file(char *oldname, char *newname)
+{
+	struct fake_file *file = fake_find(oldname);
+
+	rd_remove_file(newname);
+	STRNCPY(file->name, newname, sizeof(file->name));
+	return True;
+}
+
+void
+rd_remove_file(char *filename)
+{
+	struct fake_file *file = fake_find(filename);
+
+	if (file != NULL)
+		file->linked = False;
+}
+
+void *
+rd_map_file(int fd, int length)
+{
+	struct fake_file *file = g_fd_file[fd];
+
+	if (length > FAKE_SIZE)
+		return NULL;
+	file->size = MAX(file->size, length);
+	return file->data;
+}
+
+void
+rd_unmap_file(void *map, int length)
+{
+	UNUSED(map);
+	UNUSED(length);
+}
+
+void
+rd_sync_file(void *map, int length)
+{
+	UNUSED(map);
+	UNUSED(length);
+}
+
+#define LENGTH (64 * 64 * 4)
+
+/* A bitmap with runs of a few colours, like most screen content */
+static void
+make_bitmap(uint8 * data)
+{
+	int i;
+
+	for (i = 0; i < LENGTH; i++)
+		data[i] = ((i / 4) % 64 < 40) ? (i & 3) * 20 : (i / 256) + (i & 3);
+}
+
+Ensure(BmpStore, compresses_and_restores_bitmaps)
+{
+	static uint8 data[LENGTH], packed[LENGTH], output[LENGTH + 4];
+	int size;
+
+	make_bitmap(data);
+	size = bmpstore_lz_compress(data, LENGTH, packed, LENGTH - 1);
+	assert_that(size, is_greater_than(0));
+	assert_that(size, is_less_than(LENGTH / 4));
+
+	/* nothing is written past the bitmap */
+	memset(output, 0xa5, sizeof(output));
+	assert_that(bmpstore_lz_decompress(packed, size, output, LENGTH), is_true);
+	assert_that(memcmp(output, data, LENGTH), is_equal_to(0));
+	assert_that(output[LENGTH], is_equal_to(0xa5));
+}
+
+Ensure(BmpStore, gives_up_on_data_that_does_not_shrink)
+{
+	static uint8 data[LENGTH], packed[LENGTH], output[LENGTH];
+	unsigned int seed = 1;
+	int i, size;
+
+	for (i = 0; i < LENGTH; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		data[i] = seed >> 16;
+	}
+
+	assert_that(bmpstore_lz_compress(data, LENGTH, packed, LENGTH - 1), is_equal_to(0));
+
+	/* still correct with enough room */
+	size = bmpstore_lz_compress(data, LENGTH, packed, sizeof(packed));
+	if (size > 0)
+	{
+		assert_that(bmpstore_lz_decompress(packed, size, output, LENGTH), is_true);
+		assert_that(memcmp(output, data, LENGTH), is_equal_to(0));
+	}
+}
+
+Ensure(BmpStore, handles_bitmaps_too_short_to_compress)
+{
+	uint8 data[] = { 1, 2, 3 }, packed[16], output[3];
+	int size;
+
+	size = bmpstore_lz_compress(data, sizeof(data), packed, sizeof(packed));
+	assert_that(size, is_greater_than(0));
+	assert_that(bmpstore_lz_decompress(packed, size, output, sizeof(output)), is_true);
+	assert_that(memcmp(output, data, sizeof(data)), is_equal_to(0));
+
+	assert_that(bmpstore_lz_compress(data, 0, packed, -1), is_equal_to(0));
+}
+
+Ensure(BmpStore, refuses_truncated_data)
+{
+	static uint8 data[LENGTH], packed[LENGTH], output[LENGTH];
+	int size, n;
+
+	make_bitmap(data);
+	size = bmpstore_lz_compress(data, LENGTH, packed, LENGTH - 1);
+
+	for (n = 0; n < size; n++)
+		assert_that(bmpstore_lz_decompress(packed, n, output, LENGTH), is_false);
+}
+
+Ensure(BmpStore, refuses_corrupt_data_without_overrunning)
+{
+	static uint8 data[LENGTH], packed[LENGTH], output[LENGTH + 64];
+	int size, i, n;
+
+	make_bitmap(data);
+	size = bmpstore_lz_compress(data, LENGTH, packed, LENGTH - 1);
+
+	/* a match before the start of the output */
+	packed[0] = 0x0f;
+	packed[1] = 0x01;
+	packed[2] = 0x00;
+	assert_that(bmpstore_lz_decompress(packed, size, output, LENGTH), is_false);
+
+	/* garbage may decode, but never beyond the expected length */
+	for (n = 0; n < 100; n++)
+	{
+		make_bitmap(data);
+		size = bmpstore_lz_compress(data, LENGTH, packed, LENGTH - 1);
+		for (i = 0; i < 4; i++)
+			packed[(n * 131 + i * 977) % size] ^= 1 << ((n + i) & 7);
+
+		memset(output + LENGTH, 0xa5, 64);
+		bmpstore_lz_decompress(packed, size, output, LENGTH);
+		for (i = LENGTH; i < LENGTH + 64; i++)
+			assert_that(output[i], is_equal_to(0xa5));
+	}
+}
+
+#define STORE_FULL	0x4000	/* bitmaps that make the next put compact */
+#define STORE_KEPT	0x2000	/* most recently used bitmaps kept */
+
+static void
+make_key(int n, uint8 * key)
+{
+	memset(key, 0x5a, sizeof(HASH_KEY));
+	key[0] = n;
+	key[1] = n >> 8;
+	key[2] = n >> 16;
+}
+
+/* Put bitmaps first to first + count - 1 */
+static void
+put_bitmaps(int first, int count)
+{
+	HASH_KEY key;
+	uint8 data[16];
+	int n;
+
+	for (n = first; n < first + count; n++)
+	{
+		make_key(n, key);
+		memset(data, n, sizeof(data));
+		bmpstore_put(key, 2, 2, sizeof(data), data);
+	}
+}
+
+static RD_BOOL
+has_bitmap(int n)
+{
+	HASH_KEY key;
+	uint8 width, height;
+
+	make_key(n, key);
+	return bmpstore_find(key, &width, &height);
+}
+
+/* Start over on a store, as the next run of rdesktop would */
+static void
+new_session(int Bpp)
+{
+	bmpstore_open(Bpp + 1);
+	bmpstore_open(Bpp);
+}
+
+Ensure(BmpStore, clears_keys_that_are_not_in_the_store_when_touching)
+{
+	HASH_KEY keys[3], key, zero;
+
+	always_expect(logger);
+	assert_that(bmpstore_open(1), is_true);
+	put_bitmaps(0, 2);
+
+	make_key(0, keys[0]);
+	make_key(7, keys[1]);
+	make_key(1, keys[2]);
+	assert_that(bmpstore_touch(keys, 3), is_equal_to(2));
+
+	memset(zero, 0, sizeof(zero));
+	make_key(0, key);
+	assert_that(keys[0], is_equal_to_contents_of(key, sizeof(HASH_KEY)));
+	assert_that(keys[1], is_equal_to_contents_of(zero, sizeof(HASH_KEY)));
+	make_key(1, key);
+	assert_that(keys[2], is_equal_to_contents_of(key, sizeof(HASH_KEY)));
+}
+
+Ensure(BmpStore, keeps_all_bitmaps_touched_in_this_session_when_compacting)
+{
+	static HASH_KEY keys[STORE_KEPT + 10];
+	int n;
+
+	always_expect(logger);
+	assert_that(bmpstore_open(3), is_true);
+	put_bitmaps(0, STORE_FULL);
+
+	/* the oldest bitmaps, offered to the server, more than are kept */
+	new_session(3);
+	for (n = 0; n < STORE_KEPT + 10; n++)
+		make_key(n, keys[n]);
+	assert_that(bmpstore_touch(keys, STORE_KEPT + 10), is_equal_to(STORE_KEPT + 10));
+
+	put_bitmaps(STORE_FULL, 1);
+	assert_that(has_bitmap(0), is_true);
+	assert_that(has_bitmap(STORE_KEPT + 9), is_true);
+	assert_that(has_bitmap(STORE_KEPT + 10), is_false);
+	assert_that(has_bitmap(STORE_FULL - 1), is_false);
+	assert_that(has_bitmap(STORE_FULL), is_true);
+}
+
+Ensure(BmpStore, keeps_bitmaps_of_other_live_sessions_when_compacting)
+{
+	int fd;
+	uint32 start;
+
+	always_expect(logger);
+	assert_that(bmpstore_open(5), is_true);
+	put_bitmaps(0, STORE_FULL);
+	new_session(5);
+
+	/* a session that started after the first 0x1000 bitmaps, and one
+	   whose process has gone */
+	fd = rd_open_file("cache/bmpstore_5.sessions");
+	start = 0x1000;
+	rd_lseek_file(fd, 5 * sizeof(uint32));
+	rd_write_file(fd, &start, sizeof(start));
+	start = 1;
+	rd_write_file(fd, &start, sizeof(start));
+	rd_close_file(fd);
+	g_slot_owner[5] = OTHER_PROCESS;
+
+	put_bitmaps(STORE_FULL, 1);
+	assert_that(has_bitmap(0x0fff), is_false);
+	assert_that(has_bitmap(0x1000), is_true);
+	assert_that(has_bitmap(STORE_FULL), is_true);
+}
@@ -45,8 +45,81 @@ cache_put_desktop(uint32 offset, int cx, int cy, int scanline,
   mock(offset, cx, cy, scanline, bytes_per_pixel, data);
 }
 
+uint32
+cache_get_bitmap_cells(uint8 id)
+{
+  return (uint32) mock(id);
+}
+
+uint16
+cache_get_glyph_cell_size(uint8 font)
+{
+  return (uint16) mock(font);
+}
+
+uint16
+cache_get_glyph_cells(uint8 font)
+{
+  return (uint16) mock(font);
+}
+
 void
 cache_save_state()
 {
   mock();
 }
+
+void *
+cache_get_brush_pixmap(uint8 kind, uint8 * data, int size)
+{
+  return (void *) mock(kind, data, size);
+}
+
+void
+cache_put_brush_pixmap(uint8 kind, uint8 * data, int size, void *pixmap)
+{
+  mock(kind, data, size, pixmap);
+}
+
+void
+cache_flush_brush_pixmaps(void)
+{
+  mock();
+}
+
+void
+cache_log_stats(void)
+{
+  mock();
+}
+
+RD_HBITMAP
+cache_get_bitmap(uint8 id, uint16 idx)
+{
+  return (RD_HBITMAP) mock(id, idx);
+}
+
+void
+cache_put_bitmap(uint8 id, uint16 idx, RD_HBITMAP bitmap, uint32 size)
+{
+  mock(id, idx, bitmap, size);
+}
+
+void
+cache_put_font(uint8 font, uint16 character, uint16 offset, uint16 baseline, uint16 width,
+	       uint16 height, RD_HGLYPH pixmap)
+{
+  mock(font, character, offset, baseline, width, height, pixmap);
+}
+
+BRUSHDATA *
+cache_get_brush_data(uint8 colour_code, uint8 idx)
+{
+  return (BRUSHDATA *) mock(colour_code, idx);
+}
+
+void
+cache_put_brush_data(uint8 colour_code, uint8 idx, BRUSHDATA * brush_data)
+{
+  mock(colour_code, idx, brush_data);
+}
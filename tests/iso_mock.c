@@ -35,3 +35,9 @@ STREAM iso_init(int length)
 {
   return (STREAM)mock(length);
 }
+
+RD_BOOL
+iso_parse_frame(STREAM s, RD_BOOL * is_fastpath, uint8 * fastpath_hdr)
+{
+  return (RD_BOOL) mock(s, is_fastpath, fastpath_hdr);
+}
@@ -49,3 +49,9 @@ mcs_reset_state(void)
 {
   mock();
 }
+
+RD_BOOL
+mcs_parse_frame(STREAM s, uint16 * channel, RD_BOOL * is_fastpath, uint8 * fastpath_hdr)
+{
+  return (RD_BOOL) mock(s, channel, is_fastpath, fastpath_hdr);
+}
@@ -0,0 +1,307 @@
+/* -*- c-basic-offset: 8 -*-
+   rdesktop: A Remote Desktop Protocol client.
+   Decode throughput of the RDP 6.0 (NCRUSH) bulk decompressor
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Build with "make mppc_bench" and run as "./mppc_bench [rounds]".
+
+   The decompressor is compiled in so that its code tables can be used
+   to compress the input. Each packet is a synthetic screen update of
+   runs, repeated rows and noise, compressed by a greedy matcher that
+   also uses the offset cache, and sent with a flushed history. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../mppc.c"
+
+#define PACKET_SIZE	16384
+#define PACKETS		64
+#define MAX_MATCH	769	/* ncrush_lom_base[27] + 255 */
+
+struct bench_writer
+{
+	uint8 *p;
+	uint32 bits;
+	int nbits;
+};
+
+static uint16 g_lec_codes[NCRUSH_LEC_SYMBOLS];
+static uint16 g_lom_codes[NCRUSH_LOM_SYMBOLS];
+
+void
+logger(log_subject_t subject, log_level_t level, char *format, ...)
+{
+	UNUSED(subject);
+	UNUSED(level);
+	UNUSED(format);
+}
+
+void *
+xmalloc(int size)
+{
+	void *mem = malloc(size);
+	if (mem == NULL)
+		abort();
+	return mem;
+}
+
+void
+xfree(void *mem)
+{
+	free(mem);
+}
+
+static void
+bench_codes(uint16 * codes, const uint8 * lengths, int count, int bits)
+{
+	int len, sym, code;
+
+	code = 0;
+	for (len = 1; len <= bits; len++)
+	{
+		for (sym = 0; sym < count; sym++)
+			if (lengths[sym] == len)
+				codes[sym] = code++;
+		code <<= 1;
+	}
+}
+
+static void
+bench_bits(struct bench_writer *w, uint32 value, int count)
+{
+	w->bits |= value << w->nbits;
+	w->nbits += count;
+	while (w->nbits >= 8)
+	{
+		*(w->p++) = w->bits;
+		w->bits >>= 8;
+		w->nbits -= 8;
+	}
+}
+
+/* codes go most significant bit first */
+static void
+bench_code(struct bench_writer *w, uint16 code, int len)
+{
+	while (len--)
+		bench_bits(w, (code >> len) & 1, 1);
+}
+
+static void
+bench_symbol(struct bench_writer *w, int sym)
+{
+	bench_code(w, g_lec_codes[sym], ncrush_lec_lengths[sym]);
+}
+
+static void
+bench_length(struct bench_writer *w, uint32 length)
+{
+	int i;
+
+	for (i = NCRUSH_LOM_CLASSES - 3; i > 0; i--)
+		if (ncrush_lom_base[i] <= length)
+			break;
+
+	bench_code(w, g_lom_codes[i], ncrush_lom_lengths[i]);
+	bench_bits(w, length - ncrush_lom_base[i], ncrush_lom_bits[i]);
+}
+
+static uint32
+bench_match(uint8 * in, uint32 pos, uint32 len, uint32 distance)
+{
+	uint32 n = 0;
+
+	if (distance == 0 || distance > pos)
+		return 0;
+	while (pos + n < len && n < MAX_MATCH && in[pos + n] == in[pos + n - distance])
+		n++;
+	return n;
+}
+
+/* Greedy compression, returns the length of the output */
+static uint32
+bench_compress(uint8 * in, uint32 len, uint8 * out)
+{
+	static uint32 last[1 << 16];
+	struct bench_writer w;
+	uint32 cache[4] = { 0, 0, 0, 0 };
+	uint32 pos, n, best, distance, hash, tmp;
+	int i, slot;
+
+	memset(last, 0, sizeof(last));
+	w.p = out;
+	w.bits = 0;
+	w.nbits = 0;
+
+	pos = 0;
+	while (pos < len)
+	{
+		best = 0;
+		distance = 0;
+		slot = -1;
+		for (i = 0; i < 4; i++)
+		{
+			n = bench_match(in, pos, len, cache[i]);
+			if (n > best)
+			{
+				best = n;
+				slot = i;
+			}
+		}
+
+		if (pos + 2 < len)
+		{
+			hash = (in[pos] << 8 | in[pos + 1]) ^ (in[pos + 2] << 4);
+			if (last[hash] != 0)
+			{
+				n = bench_match(in, pos, len, pos + 1 - last[hash]);
+				if (n > best + 1)
+				{
+					best = n;
+					distance = pos + 1 - last[hash];
+					slot = -1;
+				}
+			}
+			last[hash] = pos + 1;
+		}
+
+		if (best < 3)
+		{
+			bench_symbol(&w, in[pos++]);
+			continue;
+		}
+
+		if (slot >= 0)
+		{
+			bench_symbol(&w, NCRUSH_OFFSET_CACHE + slot);
+			tmp = cache[slot];
+			cache[slot] = cache[0];
+			cache[0] = tmp;
+		}
+		else
+		{
+			for (i = 31; i > 0; i--)
+				if (ncrush_copy_offset_base[i] <= distance)
+					break;
+			bench_symbol(&w, NCRUSH_COPY_OFFSET + i);
+			bench_bits(&w, distance - ncrush_copy_offset_base[i],
+				   ncrush_copy_offset_bits[i]);
+			memmove(cache + 1, cache, 3 * sizeof(cache[0]));
+			cache[0] = distance;
+		}
+
+		bench_length(&w, best);
+		pos += best;
+	}
+
+	bench_symbol(&w, NCRUSH_EOS);
+	if (w.nbits)
+		*(w.p++) = w.bits;
+
+	return w.p - out;
+}
+
+/* Rows of 64 pixels of 32 bits, mostly solid runs and copies of the
+   row above, with a little noise */
+static void
+bench_fill(uint8 * buf, uint32 len, unsigned int seed)
+{
+	uint32 pos, run;
+	uint8 value;
+
+	srand(seed);
+	pos = 0;
+	while (pos < len)
+	{
+		run = 4 + rand() % 64;
+		if (run > len - pos)
+			run = len - pos;
+
+		switch (rand() % 4)
+		{
+			case 0:
+				for (value = rand(); run--; pos++)
+					buf[pos] = value;
+				break;
+			case 1:
+			case 2:
+				for (; run--; pos++)
+					buf[pos] = pos >= 256 ? buf[pos - 256] : 0;
+				break;
+			default:
+				for (; run--; pos++)
+					buf[pos] = rand();
+				break;
+		}
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	static uint8 in[PACKET_SIZE];
+	static uint8 packets[PACKETS][PACKET_SIZE * 2];
+	uint32 lengths[PACKETS];
+	struct timespec start, end;
+	struct stream s;
+	uint64 clen, bytes, ns;
+	int rounds, round, i;
+
+	rounds = argc > 1 ? atoi(argv[1]) : 200;
+
+	bench_codes(g_lec_codes, ncrush_lec_lengths, NCRUSH_LEC_SYMBOLS, NCRUSH_LEC_BITS);
+	bench_codes(g_lom_codes, ncrush_lom_lengths, NCRUSH_LOM_SYMBOLS, NCRUSH_LOM_BITS);
+
+	clen = 0;
+	for (i = 0; i < PACKETS; i++)
+	{
+		bench_fill(in, sizeof(in), i);
+		lengths[i] = bench_compress(in, sizeof(in), packets[i]);
+		clen += lengths[i];
+
+		if (!ncrush_expand(&s, packets[i], lengths[i],
+				   RDP_MPPC_COMPRESSED | RDP_MPPC_FLUSH | PACKET_COMPR_TYPE_RDP6)
+		    || s.end - s.p != sizeof(in) || memcmp(s.p, in, sizeof(in)) != 0)
+		{
+			fprintf(stderr, "packet %d does not round-trip\n", i);
+			return 1;
+		}
+	}
+
+	bytes = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (round = 0; round < rounds; round++)
+	{
+		for (i = 0; i < PACKETS; i++)
+		{
+			ncrush_expand(&s, packets[i], lengths[i],
+				      RDP_MPPC_COMPRESSED | RDP_MPPC_FLUSH |
+				      PACKET_COMPR_TYPE_RDP6);
+			bytes += s.end - s.p;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	ns = (uint64) (end.tv_sec - start.tv_sec) * 1000000000 + end.tv_nsec - start.tv_nsec;
+	printf("%d packets of %d bytes, compressed to %.1f%%\n", PACKETS, PACKET_SIZE,
+	       100.0 * clen / (PACKETS * PACKET_SIZE));
+	printf("decoded %llu bytes in %.3f s, %.1f MB/s\n", (unsigned long long) bytes,
+	       ns / 1e9, ns ? bytes * 1e3 / ns : 0.0);
+
+	return 0;
+}
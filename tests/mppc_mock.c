@@ -6,3 +6,21 @@ mppc_expand(uint8 * data, uint32 clen, uint8 ctype, uint32 * roff, uint32 * rlen
 {
   return mock(data, clen, ctype, roff, rlen);
 }
+
+RD_BOOL
+mppc_get_stream(STREAM s, uint32 roff, uint32 rlen)
+{
+  return mock(s, roff, rlen);
+}
+
+void
+mppc_get_stats(MPPC_STATS * stats)
+{
+  mock(stats);
+}
+
+RD_BOOL
+bulk_expand(STREAM s, uint8 * data, uint32 clen, uint8 ctype)
+{
+  return mock(s, data, clen, ctype);
+}
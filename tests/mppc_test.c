@@ -0,0 +1,193 @@
+#include <cgreen/cgreen.h>
+#include <cgreen/mocks.h>
+#include "../rdesktop.h"
+
+extern RDPCOMP g_mppc_dict;
+
+/* Boilerplate */
+Describe(MPPC);
+BeforeEach(MPPC) {}
+AfterEach(MPPC) {}
+
+/* malloc; exit if out of memory */
+void *
+xmalloc(int size)
+{
+	void *mem = malloc(size);
+	if (mem == NULL)
+	{
+		logger(Core, Error, "xmalloc, failed to allocate %d bytes", size);
+		exit(EX_UNAVAILABLE);
+	}
+	return mem;
+}
+
+/* free */
+void
+xfree(void *mem)
+{
+	free(mem);
+}
+
+/* Encode data as MPPC literals only */
+static uint32
+encode_literals(uint8 * data, uint32 length, uint8 * out)
+{
+	uint32 acc = 0, i, n = 0;
+	int bits = 0;
+
+	for (i = 0; i < length; i++)
+	{
+		if (data[i] < 0x80)
+		{
+			acc = (acc << 8) | data[i];
+			bits += 8;
+		}
+		else
+		{
+			acc = (acc << 9) | 0x100 | (data[i] & 0x7f);
+			bits += 9;
+		}
+
+		while (bits >= 8)
+		{
+			out[n++] = acc >> (bits - 8);
+			bits -= 8;
+		}
+	}
+
+	if (bits > 0)
+		out[n++] = acc << (8 - bits);
+
+	return n;
+}
+
+Ensure(MPPC, expands_literals_into_history)
+{
+	uint8 data[1000], compressed[1200];
+	uint32 i, clen, roff, rlen;
+	struct stream s;
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = i * 7;
+
+	clen = encode_literals(data, sizeof(data), compressed);
+
+	never_expect(logger);
+	assert_that(mppc_expand(compressed, clen,
+				RDP_MPPC_COMPRESSED | RDP_MPPC_RESET | PACKET_COMPR_TYPE_64K,
+				&roff, &rlen), is_equal_to(0));
+	assert_that(roff, is_equal_to(0));
+	assert_that(rlen, is_equal_to(sizeof(data)));
+
+	assert_that(mppc_get_stream(&s, roff, rlen), is_true);
+	assert_that(s.p, is_equal_to(g_mppc_dict.hist));
+	assert_that(s.end - s.p, is_equal_to(sizeof(data)));
+	assert_that(s.p, is_equal_to_contents_of(data, sizeof(data)));
+}
+
+Ensure(MPPC, refuses_stream_outside_of_history)
+{
+	struct stream s;
+
+	expect(logger);
+	assert_that(mppc_get_stream(&s, RDP_MPPC_DICT_SIZE - 10, 11), is_false);
+}
+
+Ensure(MPPC, rejects_unsupported_compression_types)
+{
+	uint8 compressed[4] = { 0 };
+	uint32 roff, rlen;
+
+	expect(logger);
+	assert_that(mppc_expand(compressed, sizeof(compressed),
+				RDP_MPPC_COMPRESSED | PACKET_COMPR_TYPE_RDP6, &roff, &rlen),
+		    is_equal_to(-1));
+}
+
+Ensure(MPPC, expands_rdp61_matches_from_history)
+{
+	/* level 1 literals "abcdef", then a packet made of "xy", a match of
+	   4 bytes at history offset 1 and the literal "z" */
+	uint8 first[] = { RDP61_L1_PACKET_AT_FRONT, 0, 'a', 'b', 'c', 'd', 'e', 'f' };
+	uint8 second[] = { RDP61_L1_COMPRESSED, 0,
+		1, 0,		/* MatchCount */
+		4, 0, 2, 0, 1, 0, 0, 0,	/* MatchLength, MatchOutputOffset, MatchHistoryOffset */
+		'x', 'y', 'z'
+	};
+	struct stream s;
+
+	never_expect(logger);
+	assert_that(bulk_expand(&s, first, sizeof(first),
+				RDP_MPPC_COMPRESSED | PACKET_COMPR_TYPE_RDP61), is_true);
+	assert_that(s.end - s.p, is_equal_to(6));
+	assert_that(s.p, is_equal_to_contents_of("abcdef", 6));
+
+	assert_that(bulk_expand(&s, second, sizeof(second),
+				RDP_MPPC_COMPRESSED | PACKET_COMPR_TYPE_RDP61), is_true);
+	assert_that(s.end - s.p, is_equal_to(7));
+	assert_that(s.p, is_equal_to_contents_of("xybcdez", 7));
+}
+
+Ensure(MPPC, rejects_rdp61_match_outside_of_history)
+{
+	uint8 data[] = { RDP61_L1_COMPRESSED | RDP61_L1_PACKET_AT_FRONT, 0,
+		1, 0,
+		16, 0, 0, 0, 0x78, 0x84, 0x1e, 0	/* 16 bytes at 1999992 */
+	};
+	struct stream s;
+
+	expect(logger);
+	assert_that(xcrush_expand(&s, data, sizeof(data)), is_false);
+}
+
+/* "abc", a copy of 6 bytes at offset 3, a copy of 3 bytes at the
+   cached offset, "d" and the end of stream */
+static uint8 rdp6_first[] = { 0x7b, 0xee, 0xb5, 0x77, 0xab, 0x31, 0xfb, 0xfc, 0x3f };
+
+/* "x", a copy of 4 bytes at offset 14 (copy offset class 7 with extra
+   bits 1), a copy of 2 bytes at the second cached offset (3) and the
+   end of stream */
+static uint8 rdp6_second[] = { 0x27, 0x30, 0xa9, 0x1c, 0xff, 0x0f };
+
+Ensure(MPPC, expands_rdp6_literals_copies_and_cached_offsets)
+{
+	struct stream s;
+
+	never_expect(logger);
+	assert_that(bulk_expand(&s, rdp6_first, sizeof(rdp6_first),
+				RDP_MPPC_COMPRESSED | RDP_MPPC_FLUSH | PACKET_COMPR_TYPE_RDP6),
+		    is_true);
+	assert_that(s.end - s.p, is_equal_to(13));
+	assert_that(s.p, is_equal_to_contents_of("abcabcabcabcd", 13));
+
+	assert_that(bulk_expand(&s, rdp6_second, sizeof(rdp6_second),
+				RDP_MPPC_COMPRESSED | PACKET_COMPR_TYPE_RDP6), is_true);
+	assert_that(s.end - s.p, is_equal_to(7));
+	assert_that(s.p, is_equal_to_contents_of("xabcabc", 7));
+}
+
+Ensure(MPPC, rejects_truncated_rdp6_data)
+{
+	struct stream s;
+
+	expect(logger);
+	assert_that(ncrush_expand(&s, rdp6_first, sizeof(rdp6_first) - 1,
+				  RDP_MPPC_COMPRESSED | RDP_MPPC_FLUSH | PACKET_COMPR_TYPE_RDP6),
+		    is_false);
+}
+
+Ensure(MPPC, rejects_rdp6_history_moved_to_front_before_it_is_half_full)
+{
+	struct stream s;
+
+	never_expect(logger);
+	assert_that(ncrush_expand(&s, rdp6_first, sizeof(rdp6_first),
+				  RDP_MPPC_COMPRESSED | RDP_MPPC_FLUSH | PACKET_COMPR_TYPE_RDP6),
+		    is_true);
+
+	expect(logger);
+	assert_that(ncrush_expand(&s, rdp6_second, sizeof(rdp6_second),
+				  RDP_MPPC_COMPRESSED | RDP_MPPC_RESET | PACKET_COMPR_TYPE_RDP6),
+		    is_false);
+}
@@ -0,0 +1,179 @@
+#include <cgreen/cgreen.h>
+#include <cgreen/mocks.h>
+#include "../rdesktop.h"
+#include "../proto.h"
+
+/* Boilerplate */
+Describe(Orders);
+BeforeEach(Orders) {};
+AfterEach(Orders) {};
+
+/* Global Variables.. :( */
+RDP_VERSION g_rdp_version;
+
+#include "../orders.c"
+
+/* malloc; exit if out of memory */
+void *
+xmalloc(int size)
+{
+	void *mem = malloc(size);
+	if (mem == NULL)
+	{
+		logger(Core, Error, "xmalloc, failed to allocate %d bytes", size);
+		exit(EX_UNAVAILABLE);
+	}
+	return mem;
+}
+
+/* free */
+void
+xfree(void *mem)
+{
+	free(mem);
+}
+
+#define FONT		3
+#define CELL_SIZE	32	/* bytes of the cells of FONT */
+#define GLYPHS(n)	((n) << 8 | FONT)
+
+/* A stream of exactly the given bytes, so that reading past them is
+   caught by memory checkers */
+static STREAM
+make_stream(const uint8 * bytes, size_t length)
+{
+	STREAM s = xmalloc(sizeof(struct stream));
+
+	memset(s, 0, sizeof(struct stream));
+	s->data = s->p = (uint8 *) xmalloc(MAX(length, 1));
+	memcpy(s->data, bytes, length);
+	s->end = s->data + length;
+	s->size = length;
+	return s;
+}
+
+static void
+free_stream(STREAM s)
+{
+	xfree(s->data);
+	xfree(s);
+}
+
+Ensure(Orders, reads_one_and_two_byte_unsigned_values)
+{
+	uint8 bytes[] = { 0x05, 0x7f, 0x80, 0x80, 0x81, 0x23, 0xff, 0xff };
+	STREAM s = make_stream(bytes, sizeof(bytes));
+
+	assert_that(rdp_in_two_byte_unsigned(s), is_equal_to(0x05));
+	assert_that(rdp_in_two_byte_unsigned(s), is_equal_to(0x7f));
+	assert_that(rdp_in_two_byte_unsigned(s), is_equal_to(0x80));
+	assert_that(rdp_in_two_byte_unsigned(s), is_equal_to(0x123));
+	assert_that(rdp_in_two_byte_unsigned(s), is_equal_to(0x7fff));
+	assert_that(s->p, is_equal_to(s->end));
+
+	free_stream(s);
+}
+
+Ensure(Orders, reads_one_and_two_byte_signed_values)
+{
+	uint8 bytes[] = { 0x05, 0x45, 0x3f, 0x7f, 0x40, 0x81, 0x23, 0xc1, 0x23, 0xbf, 0xff,
+		0xff, 0xff
+	};
+	STREAM s = make_stream(bytes, sizeof(bytes));
+
+	assert_that(rdp_in_two_byte_signed(s), is_equal_to(5));
+	assert_that(rdp_in_two_byte_signed(s), is_equal_to(-5));
+	assert_that(rdp_in_two_byte_signed(s), is_equal_to(0x3f));
+	assert_that(rdp_in_two_byte_signed(s), is_equal_to(-0x3f));
+	assert_that(rdp_in_two_byte_signed(s), is_equal_to(0));
+	assert_that(rdp_in_two_byte_signed(s), is_equal_to(0x123));
+	assert_that(rdp_in_two_byte_signed(s), is_equal_to(-0x123));
+	assert_that(rdp_in_two_byte_signed(s), is_equal_to(0x3fff));
+	assert_that(rdp_in_two_byte_signed(s), is_equal_to(-0x3fff));
+	assert_that(s->p, is_equal_to(s->end));
+
+	free_stream(s);
+}
+
+Ensure(Orders, caches_glyphs_of_revision_2_orders)
+{
+	/* an 8x2 glyph with one byte fields and a negative offset, and a
+	   16x16 glyph with two byte fields that fills a whole cell */
+	uint8 bytes[6 + 4 + 8 + CELL_SIZE] = {
+		'A', 0x42, 0x81, 0x00, 0x08, 0x02,
+		[10] = 'B', 0x80, 0x00, 0x4c, 0x80, 0x10, 0x80, 0x10
+	};
+	STREAM s = make_stream(bytes, sizeof(bytes));
+
+	always_expect(logger);
+	always_expect(cache_get_glyph_cell_size, will_return(CELL_SIZE));
+	expect(ui_create_glyph, will_return(1),
+	       when(width, is_equal_to(8)), when(height, is_equal_to(2)));
+	expect(cache_put_font,
+	       when(font, is_equal_to(FONT)), when(character, is_equal_to('A')),
+	       when(offset, is_equal_to((uint16) (-2))), when(baseline, is_equal_to(0x100)),
+	       when(width, is_equal_to(8)), when(height, is_equal_to(2)),
+	       when(pixmap, is_equal_to(1)));
+	expect(ui_create_glyph, will_return(2),
+	       when(width, is_equal_to(16)), when(height, is_equal_to(16)));
+	expect(cache_put_font,
+	       when(character, is_equal_to('B')), when(offset, is_equal_to(0)),
+	       when(baseline, is_equal_to((uint16) (-12))), when(pixmap, is_equal_to(2)));
+
+	process_fontcache2(s, GLYPHS(2));
+	assert_that(s->p, is_equal_to(s->end));
+
+	free_stream(s);
+}
+
+Ensure(Orders, refuses_glyphs_a_pixel_larger_than_the_cell)
+{
+	/* 17x16 and 16x17 glyphs, followed by enough data for either */
+	uint8 wide[5 + 48] = { 'A', 0x00, 0x00, 0x11, 0x10 };
+	uint8 tall[5 + 36] = { 'A', 0x00, 0x00, 0x10, 0x11 };
+	STREAM s;
+
+	always_expect(logger);
+	always_expect(cache_get_glyph_cell_size, will_return(CELL_SIZE));
+	never_expect(ui_create_glyph);
+	never_expect(cache_put_font);
+
+	s = make_stream(wide, sizeof(wide));
+	process_fontcache2(s, GLYPHS(1));
+	free_stream(s);
+
+	s = make_stream(tall, sizeof(tall));
+	process_fontcache2(s, GLYPHS(1));
+	free_stream(s);
+}
+
+Ensure(Orders, refuses_truncated_revision_2_orders)
+{
+	/* a glyph missing a byte of its data, one missing the second byte of
+	   its height, and a second glyph missing altogether */
+	uint8 data[5 + 3] = { 'A', 0x00, 0x00, 0x08, 0x04 };
+	uint8 header[5] = { 'A', 0x00, 0x00, 0x08, 0x80 };
+	uint8 glyphs[5 + 4] = { 'A', 0x00, 0x00, 0x08, 0x04 };
+	STREAM s;
+
+	always_expect(logger);
+	always_expect(cache_get_glyph_cell_size, will_return(CELL_SIZE));
+	expect(ui_create_glyph, will_return(1));
+	expect(cache_put_font, when(character, is_equal_to('A')));
+
+	s = make_stream(glyphs, sizeof(glyphs));
+	process_fontcache2(s, GLYPHS(2));
+	assert_that(s->p, is_equal_to(s->end));
+	free_stream(s);
+
+	never_expect(ui_create_glyph);
+	never_expect(cache_put_font);
+
+	s = make_stream(data, sizeof(data));
+	process_fontcache2(s, GLYPHS(1));
+	free_stream(s);
+
+	s = make_stream(header, sizeof(header));
+	process_fontcache2(s, GLYPHS(1));
+	free_stream(s);
+}
@@ -6,7 +6,23 @@ int pstcache_enumerate(uint8 id, HASH_KEY * keylist)
   return mock(id, keylist);
 }
 
+void pstcache_set_server(char *server)
+{
+  mock(server);
+}
+
 RD_BOOL pstcache_init(uint8 cache_id)
 {
   return mock(cache_id);
 }
+
+RD_BOOL pstcache_precache(void)
+{
+  return mock();
+}
+
+RD_BOOL pstcache_save_bitmap(uint8 cache_id, uint16 cache_idx, uint8 * key, uint8 width,
+			     uint8 height, uint32 length, uint8 * data)
+{
+  return mock(cache_id, cache_idx, key, width, height, length, data);
+}
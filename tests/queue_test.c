@@ -0,0 +1,97 @@
+#include <cgreen/cgreen.h>
+#include <cgreen/mocks.h>
+#include <sys/select.h>
+#include "../rdesktop.h"
+
+/* Boilerplate */
+Describe(Queue);
+BeforeEach(Queue) {}
+AfterEach(Queue) {}
+
+/* malloc; exit if out of memory */
+void *
+xmalloc(int size)
+{
+	void *mem = malloc(size);
+	if (mem == NULL)
+	{
+		logger(Core, Error, "xmalloc, failed to allocate %d bytes", size);
+		exit(EX_UNAVAILABLE);
+	}
+	return mem;
+}
+
+/* free */
+void
+xfree(void *mem)
+{
+	free(mem);
+}
+
+static RD_BOOL
+fd_is_readable(int fd)
+{
+	fd_set rfds;
+	struct timeval tv = { 0, 0 };
+
+	FD_ZERO(&rfds);
+	FD_SET(fd, &rfds);
+	return select(fd + 1, &rfds, NULL, NULL, &tv) == 1;
+}
+
+Ensure(Queue, pops_items_in_order_until_empty)
+{
+	RD_QUEUE q;
+	int items[3];
+
+	assert_that(queue_init(&q, 4), is_true);
+	assert_that(queue_pop(&q), is_null);
+
+	assert_that(queue_push(&q, &items[0]), is_true);
+	assert_that(queue_push(&q, &items[1]), is_true);
+	assert_that(queue_push(&q, &items[2]), is_true);
+
+	assert_that(queue_pop(&q), is_equal_to(&items[0]));
+	assert_that(queue_pop(&q), is_equal_to(&items[1]));
+	assert_that(queue_pop(&q), is_equal_to(&items[2]));
+	assert_that(queue_pop(&q), is_null);
+
+	queue_destroy(&q);
+}
+
+Ensure(Queue, refuses_items_when_full)
+{
+	RD_QUEUE q;
+	int items[3];
+
+	assert_that(queue_init(&q, 2), is_true);
+
+	assert_that(queue_push(&q, &items[0]), is_true);
+	assert_that(queue_push(&q, &items[1]), is_true);
+	assert_that(queue_push(&q, &items[2]), is_false);
+
+	assert_that(queue_pop(&q), is_equal_to(&items[0]));
+	assert_that(queue_push(&q, &items[2]), is_true);
+	assert_that(queue_pop(&q), is_equal_to(&items[1]));
+	assert_that(queue_pop(&q), is_equal_to(&items[2]));
+
+	queue_destroy(&q);
+}
+
+Ensure(Queue, signals_consumer_when_items_arrive)
+{
+	RD_QUEUE q;
+	int item;
+
+	assert_that(queue_init(&q, 4), is_true);
+	assert_that(fd_is_readable(queue_fd(&q)), is_false);
+
+	queue_push(&q, &item);
+	assert_that(fd_is_readable(queue_fd(&q)), is_true);
+
+	queue_pop(&q);
+	assert_that(queue_pop(&q), is_null);
+	assert_that(fd_is_readable(queue_fd(&q)), is_false);
+
+	queue_destroy(&q);
+}
@@ -11,3 +11,68 @@ void generate_random(uint8 * random)
 {
   mock(random);
 }
+
+int rd_open_file(char *filename)
+{
+  return mock(filename);
+}
+
+void rd_close_file(int fd)
+{
+  mock(fd);
+}
+
+int rd_read_file(int fd, void *ptr, int len)
+{
+  return mock(fd, ptr, len);
+}
+
+int rd_write_file(int fd, void *ptr, int len)
+{
+  return mock(fd, ptr, len);
+}
+
+int rd_lseek_file(int fd, int offset)
+{
+  return mock(fd, offset);
+}
+
+RD_BOOL rd_lock_file(int fd, int start, int len)
+{
+  return mock(fd, start, len);
+}
+
+RD_BOOL rd_lock_file_wait(int fd, int start, int len)
+{
+  return mock(fd, start, len);
+}
+
+void rd_unlock_file(int fd, int start, int len)
+{
+  mock(fd, start, len);
+}
+
+RD_BOOL rd_rename_file(char *oldname, char *newname)
+{
+  return mock(oldname, newname);
+}
+
+void rd_remove_file(char *filename)
+{
+  mock(filename);
+}
+
+void *rd_map_file(int fd, int length)
+{
+  return (void *) mock(fd, length);
+}
+
+void rd_unmap_file(void *map, int length)
+{
+  mock(map, length);
+}
+
+void rd_sync_file(void *map, int length)
+{
+  mock(map, length);
+}
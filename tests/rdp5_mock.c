@@ -5,3 +5,9 @@ void process_ts_fp_updates(STREAM s)
 {
   mock(s);
 }
+
+void
+expand_ts_fp_updates(STREAM s, RDP_EXPANDED *** tail)
+{
+  mock(s, tail);
+}
@@ -7,6 +7,18 @@ rdp_send_input(uint32 time, uint16 message_type, uint16 device_flags, uint16 par
   mock(time, message_type, device_flags, param1, param2);
 }
 
+void
+rdp_begin_input_batch(void)
+{
+  mock();
+}
+
+void
+rdp_end_input_batch(void)
+{
+  mock();
+}
+
 void
 rdp_send_suppress_output_pdu(enum RDP_SUPPRESS_STATUS allowupdates)
 {
@@ -37,3 +49,9 @@ rdp_reset_state()
 {
   mock();
 }
+
+void
+rdp_protocol_error(const char *message, STREAM s)
+{
+  mock(message, s);
+}
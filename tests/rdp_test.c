@@ -23,6 +23,7 @@ uint32 g_rdp5_performanceflags;
 int g_server_depth;
 RD_BOOL g_bitmap_cache;
 RD_BOOL g_bitmap_cache_persist_enable;
+int g_bmpcache_num;
 RD_BOOL g_numlock_sync;
 RD_BOOL g_pending_resize;
 RD_BOOL g_network_error;
@@ -137,3 +138,140 @@ Ensure(RDP, ProcessBitmapCapsCallsUiResizeWindow) {
 
   free(s.data);
 }
+
+Ensure(RDP, ExpandUsesBulkExpandWithoutReceivePipeline) {
+  uint8 data[16];
+  struct stream s, ns;
+  memset(&s, 0, sizeof(struct stream));
+
+  s.data = data;
+  s.p = data + 6;
+  s.end = data + sizeof(data);
+
+  expect(tcp_recv_decoded, will_return(False));
+  expect(bulk_expand,
+	 when(data, is_equal_to(data + 6)),
+	 when(clen, is_equal_to(10)),
+	 will_return(True));
+
+  assert_that(rdp_expand(&ns, &s, 10, RDP_MPPC_COMPRESSED | PACKET_COMPR_TYPE_64K),
+	      is_true);
+}
+
+Ensure(RDP, ExpandLooksUpDataExpandedByDecodeThread) {
+  uint8 data[16], expanded[] = "expanded";
+  uint8 ctype = RDP_MPPC_COMPRESSED | PACKET_COMPR_TYPE_64K;
+  RDP_EXPANDED first, second;
+  struct stream s, ns;
+  memset(&s, 0, sizeof(struct stream));
+  memset(&first, 0, sizeof(RDP_EXPANDED));
+  memset(&second, 0, sizeof(RDP_EXPANDED));
+
+  s.data = data;
+  s.p = data + 6;
+  s.end = data + sizeof(data);
+
+  first.offset = 2;
+  first.clen = 10;
+  first.ctype = ctype;
+  first.ok = True;
+  first.next = &second;
+
+  second.offset = 6;
+  second.clen = 10;
+  second.ctype = ctype;
+  second.ok = True;
+  second.s.data = second.s.p = expanded;
+  second.s.end = expanded + 8;
+
+  expect(tcp_recv_decoded, will_return(True));
+  expect(tcp_recv_expanded, will_return(&first));
+  never_expect(bulk_expand);
+
+  assert_that(rdp_expand(&ns, &s, 10, ctype), is_true);
+  assert_that(ns.p, is_equal_to(expanded));
+  assert_that(ns.end - ns.p, is_equal_to(8));
+}
+
+Ensure(RDP, ExpandFailsIfDecodeThreadFailed) {
+  uint8 data[16];
+  uint8 ctype = RDP_MPPC_COMPRESSED | PACKET_COMPR_TYPE_64K;
+  RDP_EXPANDED e;
+  struct stream s, ns;
+  memset(&s, 0, sizeof(struct stream));
+  memset(&e, 0, sizeof(RDP_EXPANDED));
+
+  s.data = s.p = data;
+  s.end = data + sizeof(data);
+
+  e.clen = 16;
+  e.ctype = ctype;
+  e.ok = False;
+
+  expect(tcp_recv_decoded, will_return(True));
+  expect(tcp_recv_expanded, will_return(&e));
+  never_expect(bulk_expand);
+
+  assert_that(rdp_expand(&ns, &s, 16, ctype), is_false);
+}
+
+Ensure(RDP, ExpandFrameExpandsCompressedDataPdus) {
+  uint8 expanded[] = "expanded";
+  uint8 ctype = RDP_MPPC_COMPRESSED | PACKET_COMPR_TYPE_64K;
+  uint16 channel = MCS_GLOBAL_CHANNEL;
+  RD_BOOL is_fastpath = False;
+  RDP_EXPANDED *list;
+  struct stream s, ns;
+  memset(&s, 0, sizeof(struct stream));
+  memset(&ns, 0, sizeof(struct stream));
+
+  ns.data = ns.p = expanded;
+  ns.end = expanded + 8;
+
+  s_realloc(&s, 64);
+  s_reset(&s);
+
+  out_uint16_le(&s, 0x8000); /* flow PDU */
+  out_uint8s(&s, 6);
+
+  out_uint16_le(&s, 22); /* uncompressed data PDU */
+  out_uint16_le(&s, RDP_PDU_DATA);
+  out_uint8s(&s, 11);
+  out_uint8(&s, 0); /* compressedType */
+  out_uint16_le(&s, 0); /* compressedLength */
+  out_uint8s(&s, 4);
+
+  out_uint16_le(&s, 22); /* compressed data PDU */
+  out_uint16_le(&s, RDP_PDU_DATA);
+  out_uint8s(&s, 11);
+  out_uint8(&s, ctype); /* compressedType */
+  out_uint16_le(&s, 18 + 4); /* compressedLength */
+  out_uint8s(&s, 4);
+  s_mark_end(&s);
+  s.p = s.data;
+
+  expect(sec_parse_frame,
+	 will_set_contents_of_parameter(channel, &channel, sizeof(uint16)),
+	 will_set_contents_of_parameter(is_fastpath, &is_fastpath, sizeof(RD_BOOL)),
+	 will_return(True));
+  expect(bulk_expand,
+	 when(data, is_equal_to(s.data + 48)),
+	 when(clen, is_equal_to(4)),
+	 when(ctype, is_equal_to(ctype)),
+	 will_set_contents_of_parameter(s, &ns, sizeof(struct stream)),
+	 will_return(True));
+
+  list = rdp_expand_frame(&s);
+
+  assert_that(list, is_not_null);
+  assert_that(list->offset, is_equal_to(48));
+  assert_that(list->clen, is_equal_to(4));
+  assert_that(list->ok, is_true);
+  assert_that(list->s.end - list->s.p, is_equal_to(8));
+  assert_that(list->s.p, is_equal_to_contents_of(expanded, 8));
+  assert_that(list->next, is_null);
+
+  free(list->s.data);
+  free(list);
+  free(s.data);
+}
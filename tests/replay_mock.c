@@ -0,0 +1,44 @@
+#include <cgreen/mocks.h>
+#include "../rdesktop.h"
+
+RD_BOOL
+replay_record_open(const char *filename)
+{
+  return mock(filename);
+}
+
+void
+replay_record_close(void)
+{
+  mock();
+}
+
+void
+replay_record_session(void)
+{
+  mock();
+}
+
+void
+replay_record_fp_update(uint8 hdr, uint8 * data, uint16 length)
+{
+  mock(hdr, data, length);
+}
+
+void
+replay_record_fp_end(void)
+{
+  mock();
+}
+
+void
+replay_record_data_pdu(uint8 data_pdu_type, uint8 * data, uint32 length)
+{
+  mock(data_pdu_type, data, length);
+}
+
+int
+replay_run(const char *filename, RD_BOOL paced)
+{
+  return mock(filename, paced);
+}
@@ -36,6 +36,7 @@ Atom g_net_wm_state_atom;
 Atom g_net_wm_desktop_atom;
 Atom g_net_wm_ping_atom;
 RD_BOOL g_ownbackstore;
+RD_BOOL g_swfb;
 RD_BOOL g_rdpsnd;
 RD_BOOL g_owncolmap;
 RD_BOOL g_local_cursor;
@@ -60,6 +61,7 @@ uint32 g_requested_session_width;
 uint32 g_requested_session_height;
 RD_BOOL g_bitmap_cache;
 RD_BOOL g_bitmap_cache_persist_enable;
+int g_bmpcache_num;
 RD_BOOL g_numlock_sync;
 RD_BOOL g_pending_resize;
 RD_BOOL g_network_error;
@@ -31,6 +31,16 @@ void sec_send(STREAM s, uint32 flags)
   mock(s, flags);
 }
 
+STREAM sec_fastpath_init(uint32 flags, int maxlen)
+{
+  return (STREAM) mock(flags, maxlen);
+}
+
+void sec_fastpath_send(STREAM s, uint32 flags, uint8 num_events)
+{
+  mock(s, flags, num_events);
+}
+
 void
 sec_hash_sha1_16(uint8 * out, uint8 * in, uint8 * salt1)
 {
@@ -49,3 +59,9 @@ sec_process_mcs_data(STREAM s)
 {
   mock(s);
 }
+
+RD_BOOL
+sec_parse_frame(STREAM s, RD_BOOL decrypt, uint16 * channel, RD_BOOL * is_fastpath)
+{
+  return (RD_BOOL) mock(s, decrypt, channel, is_fastpath);
+}
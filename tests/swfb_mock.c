@@ -0,0 +1,145 @@
+#include <cgreen/mocks.h>
+#include "../rdesktop.h"
+
+RD_BOOL
+swfb_get_damage(int *x, int *y, int *cx, int *cy)
+{
+  return mock(x, y, cx, cy);
+}
+
+void
+swfb_fill(uint8 opcode, int x, int y, int cx, int cy, uint32 colour)
+{
+  mock(opcode, x, y, cx, cy, colour);
+}
+
+void
+swfb_patblt(uint8 opcode, int x, int y, int cx, int cy, BRUSH * brush, uint32 bgcolour,
+	    uint32 fgcolour)
+{
+  mock(opcode, x, y, cx, cy, brush, bgcolour, fgcolour);
+}
+
+void
+swfb_blit(uint8 opcode, int x, int y, int cx, int cy, SWFB_SURFACE * src, int srcx, int srcy)
+{
+  mock(opcode, x, y, cx, cy, src, srcx, srcy);
+}
+
+void
+swfb_triblt(uint8 rop3, int x, int y, int cx, int cy, SWFB_SURFACE * src, int srcx, int srcy,
+	    BRUSH * brush, uint32 bgcolour, uint32 fgcolour)
+{
+  mock(rop3, x, y, cx, cy, src, srcx, srcy, brush, bgcolour, fgcolour);
+}
+
+void
+swfb_line(uint8 opcode, int startx, int starty, int endx, int endy, uint32 colour)
+{
+  mock(opcode, startx, starty, endx, endy, colour);
+}
+
+void
+swfb_polyline(uint8 opcode, RD_POINT * points, int npoints, uint32 colour)
+{
+  mock(opcode, points, npoints, colour);
+}
+
+void
+swfb_polygon(uint8 opcode, uint8 fillmode, RD_POINT * point, int npoints, BRUSH * brush,
+	     uint32 bgcolour, uint32 fgcolour)
+{
+  mock(opcode, fillmode, point, npoints, brush, bgcolour, fgcolour);
+}
+
+void
+swfb_ellipse(uint8 opcode, uint8 fillmode, int x, int y, int cx, int cy, BRUSH * brush,
+	     uint32 bgcolour, uint32 fgcolour)
+{
+  mock(opcode, fillmode, x, y, cx, cy, brush, bgcolour, fgcolour);
+}
+
+void
+swfb_draw_glyph(uint8 * bits, int scanline, int width, int height, int x, int y,
+		uint32 fgcolour, uint32 bgcolour, RD_BOOL transparent)
+{
+  mock(bits, scanline, width, height, x, y, fgcolour, bgcolour, transparent);
+}
+
+SWFB_SURFACE *
+swfb_create_surface(int width, int height, uint8 * data, RD_BOOL native)
+{
+  return (SWFB_SURFACE *) mock(width, height, data, native);
+}
+
+void
+swfb_destroy_surface(SWFB_SURFACE * surface)
+{
+  mock(surface);
+}
+
+void
+swfb_paint(int x, int y, int cx, int cy, int width, int height, uint8 * data, RD_BOOL native)
+{
+  mock(x, y, cx, cy, width, height, data, native);
+}
+
+RD_HCOLOURMAP
+swfb_create_colourmap(COLOURMAP * colours)
+{
+  return (RD_HCOLOURMAP) mock(colours);
+}
+
+void
+swfb_set_colourmap(RD_HCOLOURMAP map)
+{
+  mock(map);
+}
+
+void
+swfb_desktop_save(uint32 offset, int x, int y, int cx, int cy)
+{
+  mock(offset, x, y, cx, cy);
+}
+
+void
+swfb_desktop_restore(uint32 offset, int x, int y, int cx, int cy)
+{
+  mock(offset, x, y, cx, cy);
+}
+
+void
+swfb_set_clip(int x, int y, int cx, int cy)
+{
+  mock(x, y, cx, cy);
+}
+
+void
+swfb_create(int width, int height)
+{
+  mock(width, height);
+}
+
+void
+swfb_resize(int width, int height)
+{
+  mock(width, height);
+}
+
+void
+swfb_destroy(void)
+{
+  mock();
+}
+
+SWFB_SURFACE *
+swfb_screen(void)
+{
+  return (SWFB_SURFACE *) mock();
+}
+
+uint32
+swfb_checksum(void)
+{
+  return mock();
+}
@@ -0,0 +1,117 @@
+#include <cgreen/cgreen.h>
+#include <cgreen/mocks.h>
+#include "../rdesktop.h"
+
+/* Boilerplate */
+Describe(Swfb);
+BeforeEach(Swfb) {}
+AfterEach(Swfb) { swfb_destroy(); }
+
+int g_server_depth = 32;
+
+/* malloc; exit if out of memory */
+void *
+xmalloc(int size)
+{
+	void *mem = malloc(size);
+	if (mem == NULL)
+	{
+		logger(Core, Error, "xmalloc, failed to allocate %d bytes", size);
+		exit(EX_UNAVAILABLE);
+	}
+	return mem;
+}
+
+/* realloc; exit if out of memory */
+void *
+xrealloc(void *oldmem, size_t size)
+{
+	void *mem = realloc(oldmem, MAX(size, 1));
+	if (mem == NULL)
+	{
+		logger(Core, Error, "xrealloc, failed to allocate %d bytes", (int) size);
+		exit(EX_UNAVAILABLE);
+	}
+	return mem;
+}
+
+/* free */
+void
+xfree(void *mem)
+{
+	free(mem);
+}
+
+/* wider than a few vectors, with a scalar tail */
+#define WIDTH 37
+#define HEIGHT 3
+
+static void
+random_pixels(uint32 * data, int count, unsigned int seed)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		data[i] = (seed >> 8) & 0xffffff;
+	}
+}
+
+/* A ROP3 evaluated one bit at a time, as it is defined */
+static uint32
+rop3_reference(uint8 rop, uint32 p, uint32 s, uint32 d)
+{
+	uint32 result = 0;
+	int bit, n;
+
+	for (bit = 0; bit < 24; bit++)
+	{
+		n = (((p >> bit) & 1) << 2) | (((s >> bit) & 1) << 1) | ((d >> bit) & 1);
+		result |= ((rop >> n) & 1) << bit;
+	}
+
+	return result;
+}
+
+Ensure(Swfb, evaluates_all_rop3_codes_in_spans_like_single_pixels)
+{
+	static uint32 dest[WIDTH * HEIGHT], source[WIDTH * HEIGHT], pattern[WIDTH * HEIGHT],
+		span[WIDTH * HEIGHT];
+	BRUSH brush = { 3, 5, 3, { 0x55, 0x33, 0x0f, 0x81, 0xc3, 0x18, 0x7e, 0xa5 }, NULL };
+	SWFB_SURFACE *src, *screen;
+	int rop, x, i;
+
+	random_pixels(dest, WIDTH * HEIGHT, 1);
+	random_pixels(source, WIDTH * HEIGHT, 2);
+
+	swfb_create(WIDTH, HEIGHT);
+	screen = swfb_screen();
+	src = swfb_create_surface(WIDTH, HEIGHT, (uint8 *) source, True);
+
+	/* the expanded brush, as the ROP3 that is only the pattern */
+	swfb_triblt(0xf0, 0, 0, WIDTH, HEIGHT, src, 0, 0, &brush, 0x123456, 0xfedcba);
+	memcpy(pattern, screen->data, sizeof(pattern));
+
+	for (rop = 0; rop < 256; rop++)
+	{
+		/* whole rows go through the vectorised spans where available */
+		swfb_paint(0, 0, WIDTH, HEIGHT, WIDTH, HEIGHT, (uint8 *) dest, True);
+		swfb_triblt(rop, 0, 0, WIDTH, HEIGHT, src, 0, 0, &brush, 0x123456, 0xfedcba);
+		memcpy(span, screen->data, sizeof(span));
+
+		/* single columns are too narrow for them */
+		swfb_paint(0, 0, WIDTH, HEIGHT, WIDTH, HEIGHT, (uint8 *) dest, True);
+		for (x = 0; x < WIDTH; x++)
+			swfb_triblt(rop, x, 0, 1, HEIGHT, src, x, 0, &brush, 0x123456, 0xfedcba);
+
+		for (i = 0; i < WIDTH * HEIGHT; i++)
+		{
+			assert_that(span[i], is_equal_to(screen->data[i]));
+			assert_that(span[i], is_equal_to(rop3_reference(rop, pattern[i], source[i],
+									 dest[i])));
+		}
+	}
+
+	swfb_destroy_surface(src);
+}
@@ -11,3 +11,15 @@ tcp_run_ui(RD_BOOL run)
 {
   mock(run);
 }
+
+RD_BOOL
+tcp_recv_decoded(void)
+{
+  return (RD_BOOL) mock();
+}
+
+RDP_EXPANDED *
+tcp_recv_expanded(void)
+{
+  return (RDP_EXPANDED *) mock();
+}
@@ -29,6 +29,11 @@ void ui_paint_bitmap(int x, int y, int cx, int cy, int width, int height, uint8
   mock(x,y,cx,cy,width,height,data);
 }
 
+void ui_paint_bitmap_native(int x, int y, int cx, int cy, int width, int height, uint8 * data)
+{
+  mock(x,y,cx,cy,width,height,data);
+}
+
 void ui_begin_update()
 {
   mock();
@@ -118,3 +123,106 @@ ui_seamless_end()
 {
   mock();
 }
+
+RD_HBITMAP
+ui_create_bitmap(int width, int height, uint8 * data)
+{
+  return (RD_HBITMAP) mock(width, height, data);
+}
+
+RD_HBITMAP
+ui_create_bitmap_native(int width, int height, uint8 * data)
+{
+  return (RD_HBITMAP) mock(width, height, data);
+}
+
+RD_HGLYPH
+ui_create_glyph(int width, int height, uint8 * data)
+{
+  return (RD_HGLYPH) mock(width, height, data);
+}
+
+void
+ui_destblt(uint8 opcode, int x, int y, int cx, int cy)
+{
+  mock(opcode, x, y, cx, cy);
+}
+
+void
+ui_patblt(uint8 opcode, int x, int y, int cx, int cy, BRUSH * brush, uint32 bgcolour,
+	  uint32 fgcolour)
+{
+  mock(opcode, x, y, cx, cy, brush, bgcolour, fgcolour);
+}
+
+void
+ui_screenblt(uint8 opcode, int x, int y, int cx, int cy, int srcx, int srcy)
+{
+  mock(opcode, x, y, cx, cy, srcx, srcy);
+}
+
+void
+ui_memblt(uint8 opcode, int x, int y, int cx, int cy, RD_HBITMAP src, int srcx, int srcy)
+{
+  mock(opcode, x, y, cx, cy, src, srcx, srcy);
+}
+
+void
+ui_triblt(uint8 opcode, int x, int y, int cx, int cy, RD_HBITMAP src, int srcx, int srcy,
+	  BRUSH * brush, uint32 bgcolour, uint32 fgcolour)
+{
+  mock(opcode, x, y, cx, cy, src, srcx, srcy, brush, bgcolour, fgcolour);
+}
+
+void
+ui_line(uint8 opcode, int startx, int starty, int endx, int endy, PEN * pen)
+{
+  mock(opcode, startx, starty, endx, endy, pen);
+}
+
+void
+ui_rect(int x, int y, int cx, int cy, uint32 colour)
+{
+  mock(x, y, cx, cy, colour);
+}
+
+void
+ui_polygon(uint8 opcode, uint8 fillmode, RD_POINT * point, int npoints, BRUSH * brush,
+	   uint32 bgcolour, uint32 fgcolour)
+{
+  mock(opcode, fillmode, point, npoints, brush, bgcolour, fgcolour);
+}
+
+void
+ui_polyline(uint8 opcode, RD_POINT * points, int npoints, PEN * pen)
+{
+  mock(opcode, points, npoints, pen);
+}
+
+void
+ui_ellipse(uint8 opcode, uint8 fillmode, int x, int y, int cx, int cy, BRUSH * brush,
+	   uint32 bgcolour, uint32 fgcolour)
+{
+  mock(opcode, fillmode, x, y, cx, cy, brush, bgcolour, fgcolour);
+}
+
+void
+ui_draw_text(uint8 font, uint8 flags, uint8 opcode, int mixmode, int x, int y, int clipx,
+	     int clipy, int clipcx, int clipcy, int boxx, int boxy, int boxcx, int boxcy,
+	     BRUSH * brush, uint32 bgcolour, uint32 fgcolour, uint8 * text, uint8 length)
+{
+  mock(font, flags, opcode, mixmode, x, y, clipx, clipy, clipcx, clipcy, boxx, boxy, boxcx,
+       boxcy, brush, bgcolour, fgcolour, text, length);
+}
+
+void
+ui_desktop_save(uint32 offset, int x, int y, int cx, int cy)
+{
+  mock(offset, x, y, cx, cy);
+}
+
+void
+ui_desktop_restore(uint32 offset, int x, int y, int cx, int cy)
+{
+  mock(offset, x, y, cx, cy);
+}
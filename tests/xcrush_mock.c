@@ -0,0 +1,14 @@
+#include <cgreen/mocks.h>
+#include "../rdesktop.h"
+
+RD_BOOL
+xcrush_expand(STREAM s, uint8 * data, uint32 clen)
+{
+  return mock(s, data, clen);
+}
+
+void
+xcrush_reset(void)
+{
+  mock();
+}
@@ -43,6 +43,7 @@ Atom g_net_wm_state_atom;
 Atom g_net_wm_desktop_atom;
 Atom g_net_wm_ping_atom;
 RD_BOOL g_ownbackstore;
+RD_BOOL g_swfb;
 RD_BOOL g_rdpsnd;
 RD_BOOL g_owncolmap;
 RD_BOOL g_local_cursor;
@@ -311,6 +311,108 @@ typedef struct fileinfo
 }
 FILEINFO;
 
+/* TCP receive statistics */
+typedef struct _TCP_RECV_STATS
+{
+	uint32 frames;		/* frames handed to the ISO layer */
+	uint32 reads;		/* recv() / gnutls_record_recv() calls */
+	uint32 selects;		/* ui_select() calls */
+	uint64 bytes;
+
+	/* receive thread */
+	uint64 read_ns;		/* time spent receiving and TLS decrypting */
+	uint64 decrypt_ns;	/* time spent RC4 decrypting */
+	uint32 stalls;		/* times the receive queue was full */
+	uint64 stall_ns;	/* time waited for the receive queue */
+
+	/* decode thread */
+	uint32 queued;		/* frames taken from the receive queue */
+	uint64 queue_ns;	/* time frames waited in the receive queue */
+	uint64 queue_max_ns;
+	uint64 decode_ns;	/* time spent expanding compressed data */
+	uint32 decode_stalls;	/* times the decode queue was full */
+	uint64 decode_stall_ns;	/* time waited for the decode queue */
+
+	/* main thread */
+	uint32 decoded;		/* frames taken from the decode queue */
+	uint64 decode_queue_ns;	/* time frames waited in the decode queue */
+	uint64 decode_queue_max_ns;
+}
+TCP_RECV_STATS;
+
+/* Bulk compressed data of a received frame, expanded ahead of the main
+   thread by the decode stage of the receive pipeline */
+typedef struct _RDP_EXPANDED
+{
+	uint32 offset;		/* of the compressed data in the frame */
+	uint32 clen;
+	uint8 ctype;
+	RD_BOOL ok;
+	struct stream s;	/* the expanded data, owned by the entry */
+	struct _RDP_EXPANDED *next;
+}
+RDP_EXPANDED;
+
+/* Pixel layout of the UI, see bitmap_set_format(). Colour components
+   are reduced to 8 bits, shifted right by *_shift_r and left by
+   *_shift_l, and or'ed together. */
+typedef struct _PIXEL_FORMAT
+{
+	int Bpp;
+	RD_BOOL big_endian;
+	int red_shift_r, red_shift_l;
+	int green_shift_r, green_shift_l;
+	int blue_shift_r, blue_shift_l;
+}
+PIXEL_FORMAT;
+
+/* Bitmap decompression job, see bitmap_decompress_start() */
+typedef struct _BITMAP_JOB
+{
+	uint8 *output;
+	uint8 *input;
+	int size;
+	int width;
+	int height;
+	int Bpp;
+	RD_BOOL native;		/* decompress into the UI format */
+	RD_BOOL ok;
+	RD_BOOL done;
+}
+BITMAP_JOB;
+
+/* Bounded single producer, single consumer queue */
+typedef struct _RD_QUEUE
+{
+	void **items;
+	uint32 size;
+	uint32 head;		/* next item to pop, written by the consumer */
+	uint32 tail;		/* next free slot, written by the producer */
+	int readable[2];	/* pipe signalled when the queue becomes non-empty */
+	int writable[2];	/* pipe signalled when the queue becomes non-full */
+}
+RD_QUEUE;
+
+/* Bulk decompression statistics */
+typedef struct _MPPC_STATS
+{
+	uint32 packets;		/* compressed packets expanded */
+	uint32 errors;
+	uint64 bytes_in;
+	uint64 bytes_out;
+	uint64 ns;		/* time spent expanding */
+}
+MPPC_STATS;
+
+/* Software framebuffer surface, 0x00RRGGBB pixels */
+typedef struct _SWFB_SURFACE
+{
+	int width;
+	int height;
+	uint32 *data;
+}
+SWFB_SURFACE;
+
 typedef RD_BOOL(*str_handle_lines_t) (const char *line, void *data);
 
 typedef enum
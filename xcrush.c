@@ -0,0 +1,187 @@
+/* -*- c-basic-offset: 8 -*-
+   rdesktop: A Remote Desktop Protocol client.
+   Protocol services - RDP 6.1 bulk decompression (XCRUSH)
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+   RDP 6.1 bulk compression works in two levels, see MS-RDPEGDI
+   RDP61_COMPRESSED_DATA:
+
+     uint8 Level1ComprFlags
+     uint8 Level2ComprFlags
+     level 1 data, optionally compressed with 64K MPPC (level 2)
+
+   Level 1 data is a list of matches into a 2,000,000 byte history
+   followed by the literal bytes between them:
+
+     uint16 MatchCount
+     MatchCount x { uint16 MatchLength, uint16 MatchOutputOffset,
+                    uint32 MatchHistoryOffset }
+     literals
+
+   The level 2 stage uses the regular MPPC history in mppc.c, it is not
+   otherwise used once RDP 6.1 compression has been negotiated.
+*/
+
+#include "rdesktop.h"
+
+static uint8 *g_xcrush_hist = NULL;
+static uint32 g_xcrush_offset = 0;
+
+/* Copy a match, source and destination may overlap in which case the
+   bytes just written are repeated */
+static void
+xcrush_copy(uint8 * out, uint8 * src, uint32 length)
+{
+	if (src + length <= out || src >= out + length)
+	{
+		memcpy(out, src, length);
+		return;
+	}
+
+	while (length--)
+		*(out++) = *(src++);
+}
+
+/* Expand level 1 data from in into the history, s is set up as a view
+   of the output */
+static RD_BOOL
+xcrush_expand_l1(STREAM s, STREAM in, uint8 flags)
+{
+	uint8 *out, *start, *end, *literals;
+	uint16 count, match_length, match_output_offset;
+	uint32 match_history_offset, output_offset, length;
+	int i;
+
+	if (g_xcrush_hist == NULL)
+		g_xcrush_hist = (uint8 *) xmalloc(XCRUSH_HISTORY_SIZE);
+
+	if (flags & RDP61_L1_PACKET_AT_FRONT)
+		g_xcrush_offset = 0;
+
+	start = out = g_xcrush_hist + g_xcrush_offset;
+	end = g_xcrush_hist + XCRUSH_HISTORY_SIZE;
+
+	if (flags & RDP61_L1_COMPRESSED)
+	{
+		if (!s_check_rem(in, 2))
+			goto error;
+		in_uint16_le(in, count);
+
+		if (!s_check_rem(in, count * 8))
+			goto error;
+		literals = in->p + count * 8;
+
+		output_offset = 0;
+		for (i = 0; i < count; i++)
+		{
+			in_uint16_le(in, match_length);
+			in_uint16_le(in, match_output_offset);
+			in_uint32_le(in, match_history_offset);
+
+			/* literals up to the match */
+			if (match_output_offset < output_offset)
+				goto error;
+			length = match_output_offset - output_offset;
+			if (length > in->end - literals || length > end - out)
+				goto error;
+			memcpy(out, literals, length);
+			out += length;
+			literals += length;
+
+			if (match_history_offset >= XCRUSH_HISTORY_SIZE
+			    || match_length > XCRUSH_HISTORY_SIZE - match_history_offset
+			    || match_length > end - out)
+				goto error;
+			xcrush_copy(out, g_xcrush_hist + match_history_offset, match_length);
+			out += match_length;
+
+			output_offset = match_output_offset + match_length;
+		}
+	}
+	else
+	{
+		literals = in->p;
+	}
+
+	/* trailing literals, or all of the data when not compressed */
+	length = in->end - literals;
+	if (length > end - out)
+		goto error;
+	memcpy(out, literals, length);
+	out += length;
+
+	g_xcrush_offset = out - g_xcrush_hist;
+
+	memset(s, 0, sizeof(struct stream));
+	s->data = s->p = start;
+	s->size = out - start;
+	s->end = out;
+	s->rdp_hdr = s->p;
+
+	return True;
+
+      error:
+	logger(Protocol, Error, "xcrush_expand_l1(), invalid level 1 data, flags 0x%x", flags);
+	return False;
+}
+
+/* Expand an RDP 6.1 compressed packet, s is set up as a read-only view
+   of the result in the history and is valid until the next call */
+RD_BOOL
+xcrush_expand(STREAM s, uint8 * data, uint32 clen)
+{
+	struct stream in;
+	uint8 l1flags, l2flags;
+	uint32 roff, rlen;
+
+	if (clen < 2)
+	{
+		logger(Protocol, Error, "xcrush_expand(), packet too short");
+		return False;
+	}
+
+	l1flags = data[0];
+	l2flags = data[1];
+
+	if (l2flags & RDP_MPPC_COMPRESSED)
+	{
+		/* level 2 is always 64K MPPC */
+		if (mppc_expand(data + 2, clen - 2,
+				(l2flags & ~RDP_MPPC_TYPE_MASK) | PACKET_COMPR_TYPE_64K, &roff,
+				&rlen) == -1)
+			return False;
+		if (!mppc_get_stream(&in, roff, rlen))
+			return False;
+	}
+	else
+	{
+		memset(&in, 0, sizeof(in));
+		in.data = in.p = data + 2;
+		in.end = data + clen;
+	}
+
+	return xcrush_expand_l1(s, &in, l1flags);
+}
+
+/* Release the history, a new connection starts from an empty one */
+void
+xcrush_reset(void)
+{
+	xfree(g_xcrush_hist);
+	g_xcrush_hist = NULL;
+	g_xcrush_offset = 0;
+}
@@ -36,6 +36,14 @@
 #ifdef HAVE_XRANDR
 #include <X11/extensions/Xrandr.h>
 #endif
+#ifdef HAVE_XRENDER
+#include <X11/extensions/Xrender.h>
+#endif
+#ifdef HAVE_XSHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#endif
 
 #ifdef __APPLE__
 #include <sys/param.h>
@@ -94,6 +102,15 @@ RD_BOOL g_dynamic_session_resize = True;
 static uint32 g_window_width;
 static uint32 g_window_height;
 
+/* Current size of g_wnd, tracked from ConfigureNotify so that drawing
+   never has to ask the X server */
+static int g_wnd_width;
+static int g_wnd_height;
+
+/* Synchronous requests, logged per second to spot new ones in hot paths */
+static unsigned int g_round_trips;
+static struct timeval g_round_trip_timer;
+
 /* SeamlessRDP support */
 typedef struct _seamless_group
 {
@@ -139,6 +156,18 @@ RD_BOOL g_Unobscured;		/* used for screenblt */
 static GC g_gc = NULL;
 static GC g_create_bitmap_gc = NULL;
 static GC g_create_glyph_gc = NULL;
+
+typedef struct
+{
+	Pixmap pixmap;
+	int width, height, scanline;
+	uint8 *bits;
+#ifdef HAVE_XRENDER
+	unsigned int id;	/* in g_text_glyphset, 0 until first drawn */
+#endif
+}
+xwin_glyph;
+
 static XRectangle g_clip_rectangle;
 static Visual *g_visual;
 /* Color depth of the X11 visual of our window (e.g. 24 for True Color R8G8B visual).
@@ -193,6 +222,69 @@ static int g_red_shift_l, g_blue_shift_l, g_green_shift_l;
 extern RD_BOOL g_ownbackstore;
 static Pixmap g_backstore = 0;
 
+/* With a software backing store, drawing only goes to the backstore.
+   Between ui_begin_update() and ui_end_update() the changed area is
+   collected in g_damage and copied to the windows once at the end. */
+static RD_BOOL g_damage_deferred = False;
+static Region g_damage = NULL;
+static GC g_damage_gc = NULL;
+
+/* With -F drawing orders are rendered into the framebuffer of swfb.c,
+   and what changed in it is put to the windows in the same way */
+extern RD_BOOL g_swfb;
+
+/* Desktop saves not yet read back into the desktop cache */
+#define DESKTOP_SAVES 8
+typedef struct
+{
+	Pixmap pixmap;
+	uint32 offset;
+	int cx, cy;
+}
+xwin_desktop_save;
+
+static xwin_desktop_save g_desktop_saves[DESKTOP_SAVES];
+static int g_desktop_save_next = 0;
+
+#ifdef HAVE_XSHM
+/* Shared memory images for uploading bitmaps to a local X server. An
+   image is busy from XShmPutImage() until the server reports that it
+   is done with it. */
+#define XSHM_IMAGES 16
+
+typedef struct
+{
+	XImage *image;
+	XShmSegmentInfo info;
+	RD_BOOL busy;
+}
+xshm_image;
+
+static RD_BOOL g_shm_available = False;
+static int g_shm_completion;
+static xshm_image g_shm_images[XSHM_IMAGES];
+#endif
+
+#ifdef HAVE_XRENDER
+/* Text is drawn with XRender when the X server has it. Glyphs are kept
+   in a glyph set on the server, a text order is one request naming
+   them, composited through a 1x1 repeating source in the text colour. */
+static RD_BOOL g_text_render = False;
+static GlyphSet g_text_glyphset = 0;
+static unsigned int g_text_glyph_id = 0;
+static Pixmap g_text_src_pixmap = 0;
+static Picture g_text_src = 0;
+static GC g_text_src_gc = NULL;
+static unsigned long g_text_src_pixel;
+static unsigned long g_text_src_alpha;	/* alpha bits of the visual, if any */
+static RD_BOOL g_text_src_valid = False;
+static Picture g_text_dst = 0;
+static Drawable g_text_dst_drawable = 0;
+static RD_BOOL g_text_clip_valid = False;
+static XGlyphElt32 *g_text_elts = NULL;
+static int g_text_elts_size = 0;
+#endif
+
 /* Moving in single app mode */
 static RD_BOOL g_moving_wnd;
 static int g_move_x_offset = 0;
@@ -260,12 +352,101 @@ seamless_XDrawLines(Drawable d, XPoint * points, int npoints, int xoffset, int y
 	points[0].y += yoffset;
 }
 
+/* The backstore changed in the given rectangle, bring the windows up to
+   date now or at the end of the update */
+static void
+xwin_damage(int x, int y, int cx, int cy)
+{
+	XRectangle rect;
+	seamless_window *sw;
+	int x2, y2;
+
+	/* drawing is clipped, and so is what changed */
+	x2 = MIN(x + cx, g_clip_rectangle.x + g_clip_rectangle.width);
+	y2 = MIN(y + cy, g_clip_rectangle.y + g_clip_rectangle.height);
+	x = MAX(x, g_clip_rectangle.x);
+	y = MAX(y, g_clip_rectangle.y);
+	if (x2 <= x || y2 <= y)
+		return;
+
+	rect.x = x;
+	rect.y = y;
+	rect.width = x2 - x;
+	rect.height = y2 - y;
+
+	if (g_damage_deferred)
+	{
+		XUnionRectWithRegion(&rect, g_damage, g_damage);
+		return;
+	}
+
+	XCopyArea(g_display, g_backstore, g_wnd, g_damage_gc, rect.x, rect.y, rect.width,
+		  rect.height, rect.x, rect.y);
+	for (sw = g_seamless_windows; sw; sw = sw->next)
+		XCopyArea(g_display, g_backstore, sw->wnd, g_damage_gc, rect.x, rect.y,
+			  rect.width, rect.height, rect.x - sw->xoffset, rect.y - sw->yoffset);
+}
+
+/* Damage the bounding box of points in CoordModePrevious, enlarged by
+   extra pixels to the right and bottom */
+static void
+xwin_damage_points(XPoint * points, int npoints, int extra)
+{
+	int i, x, y, x1, y1, x2, y2;
+
+	if (npoints < 1)
+		return;
+
+	x = x1 = x2 = points[0].x;
+	y = y1 = y2 = points[0].y;
+	for (i = 1; i < npoints; i++)
+	{
+		x += points[i].x;
+		y += points[i].y;
+		x1 = MIN(x1, x);
+		y1 = MIN(y1, y);
+		x2 = MAX(x2, x);
+		y2 = MAX(y2, y);
+	}
+
+	xwin_damage(x1, y1, x2 - x1 + extra, y2 - y1 + extra);
+}
+
+/* Count a request that waits for a reply from the X server */
+static void
+xwin_round_trip(void)
+{
+	struct timeval now;
+	uint32 ms;
+
+	g_round_trips++;
+
+	gettimeofday(&now, NULL);
+	if (g_round_trip_timer.tv_sec == 0)
+		g_round_trip_timer = now;
+	ms = (now.tv_sec - g_round_trip_timer.tv_sec) * 1000 +
+		(now.tv_usec - g_round_trip_timer.tv_usec) / 1000;
+	if (ms < 1000)
+		return;
+
+	logger(GUI, Debug, "xwin_round_trip(), %u round-trips to the X server in %u ms",
+	       g_round_trips, ms);
+	g_round_trips = 0;
+	g_round_trip_timer = now;
+}
+
 #define FILL_RECTANGLE(x,y,cx,cy)\
 { \
-	XFillRectangle(g_display, g_wnd, g_gc, x, y, cx, cy); \
-        ON_ALL_SEAMLESS_WINDOWS(XFillRectangle, (g_display, sw->wnd, g_gc, x-sw->xoffset, y-sw->yoffset, cx, cy)); \
 	if (g_ownbackstore) \
+	{ \
 		XFillRectangle(g_display, g_backstore, g_gc, x, y, cx, cy); \
+		xwin_damage(x, y, cx, cy); \
+	} \
+	else \
+	{ \
+		XFillRectangle(g_display, g_wnd, g_gc, x, y, cx, cy); \
+		ON_ALL_SEAMLESS_WINDOWS(XFillRectangle, (g_display, sw->wnd, g_gc, x-sw->xoffset, y-sw->yoffset, cx, cy)); \
+	} \
 }
 
 #define FILL_RECTANGLE_BACKSTORE(x,y,cx,cy)\
@@ -275,10 +456,16 @@ seamless_XDrawLines(Drawable d, XPoint * points, int npoints, int xoffset, int y
 
 #define FILL_POLYGON(p,np)\
 { \
-	XFillPolygon(g_display, g_wnd, g_gc, p, np, Complex, CoordModePrevious); \
 	if (g_ownbackstore) \
+	{ \
 		XFillPolygon(g_display, g_backstore, g_gc, p, np, Complex, CoordModePrevious); \
-	ON_ALL_SEAMLESS_WINDOWS(seamless_XFillPolygon, (sw->wnd, p, np, sw->xoffset, sw->yoffset)); \
+		xwin_damage_points(p, np, 1); \
+	} \
+	else \
+	{ \
+		XFillPolygon(g_display, g_wnd, g_gc, p, np, Complex, CoordModePrevious); \
+		ON_ALL_SEAMLESS_WINDOWS(seamless_XFillPolygon, (sw->wnd, p, np, sw->xoffset, sw->yoffset)); \
+	} \
 }
 
 #define DRAW_ELLIPSE(x,y,cx,cy,m)\
@@ -286,16 +473,24 @@ seamless_XDrawLines(Drawable d, XPoint * points, int npoints, int xoffset, int y
 	switch (m) \
 	{ \
 		case 0:	/* Outline */ \
-			XDrawArc(g_display, g_wnd, g_gc, x, y, cx, cy, 0, 360*64); \
-                        ON_ALL_SEAMLESS_WINDOWS(XDrawArc, (g_display, sw->wnd, g_gc, x-sw->xoffset, y-sw->yoffset, cx, cy, 0, 360*64)); \
 			if (g_ownbackstore) \
+			{ \
 				XDrawArc(g_display, g_backstore, g_gc, x, y, cx, cy, 0, 360*64); \
+				xwin_damage(x, y, cx + 1, cy + 1); \
+				break; \
+			} \
+			XDrawArc(g_display, g_wnd, g_gc, x, y, cx, cy, 0, 360*64); \
+                        ON_ALL_SEAMLESS_WINDOWS(XDrawArc, (g_display, sw->wnd, g_gc, x-sw->xoffset, y-sw->yoffset, cx, cy, 0, 360*64)); \
 			break; \
 		case 1: /* Filled */ \
-			XFillArc(g_display, g_wnd, g_gc, x, y, cx, cy, 0, 360*64); \
-			ON_ALL_SEAMLESS_WINDOWS(XFillArc, (g_display, sw->wnd, g_gc, x-sw->xoffset, y-sw->yoffset, cx, cy, 0, 360*64)); \
 			if (g_ownbackstore) \
+			{ \
 				XFillArc(g_display, g_backstore, g_gc, x, y, cx, cy, 0, 360*64); \
+				xwin_damage(x, y, cx + 1, cy + 1); \
+				break; \
+			} \
+			XFillArc(g_display, g_wnd, g_gc, x, y, cx, cy, 0, 360*64); \
+			ON_ALL_SEAMLESS_WINDOWS(XFillArc, (g_display, sw->wnd, g_gc, x-sw->xoffset, y-sw->yoffset, cx, cy, 0, 360*64)); \
 			break; \
 	} \
 }
@@ -481,6 +676,7 @@ sw_handle_restack(seamless_window * sw)
 	unsigned int nchildren, i;
 	seamless_window *sw_below;
 
+	xwin_round_trip();
 	status = XQueryTree(g_display, RootWindowOfScreen(g_screen),
 			    &root, &parent, &children, &nchildren);
 	if (!status || !nchildren)
@@ -1481,7 +1677,7 @@ translate24to32(const uint8 * data, uint8 * out, uint8 * end)
 static uint8 *
 translate_image(int width, int height, uint8 * data)
 {
-	int size;
+	int size, Bpp;
 	uint8 *out;
 	uint8 *end;
 
@@ -1508,6 +1704,16 @@ translate_image(int width, int height, uint8 * data)
 			return data;
 	}
 
+	/* bitmap.c has vectorised translate functions for common visuals,
+	   the ones below are the reference for all the others */
+	Bpp = bitmap_native_Bpp((g_server_depth + 7) / 8);
+	if (Bpp)
+	{
+		out = (uint8 *) xmalloc(width * height * Bpp);
+		bitmap_translate(out, data, width * height, (g_server_depth + 7) / 8);
+		return out;
+	}
+
 	size = width * height * (g_bpp / 8);
 	out = (uint8 *) xmalloc(size);
 	end = out + size;
@@ -1846,8 +2052,38 @@ select_visual(int screen_num)
 	return True;
 }
 
+/* Have bitmap.c decode bitmaps straight into the format of the visual.
+   Images that need no translation at all, colour maps and visuals
+   with more than 8 bits per channel are left to translate_image(). */
+static void
+xwin_set_bitmap_format(void)
+{
+	PIXEL_FORMAT format;
+
+	if (g_owncolmap || g_no_translate_image || (g_bpp != 16 && g_bpp != 24 && g_bpp != 32)
+	    || g_red_shift_r < 0 || g_green_shift_r < 0 || g_blue_shift_r < 0)
+	{
+		bitmap_set_format(NULL);
+		return;
+	}
+
+	format.Bpp = g_bpp / 8;
+	format.big_endian = g_xserver_be;
+	format.red_shift_r = g_red_shift_r;
+	format.red_shift_l = g_red_shift_l;
+	format.green_shift_r = g_green_shift_r;
+	format.green_shift_l = g_green_shift_l;
+	format.blue_shift_r = g_blue_shift_r;
+	format.blue_shift_l = g_blue_shift_l;
+	bitmap_set_format(&format);
+
+	logger(GUI, Debug, "xwin_set_bitmap_format(), decoding bitmaps into %d bpp visual",
+	       g_bpp);
+}
+
 static XErrorHandler g_old_error_handler;
 static RD_BOOL g_error_expected = False;
+static RD_BOOL g_error_seen = False;
 
 /* Check if the X11 window corresponding to a seamless window with
    specified id exists. */
@@ -1877,7 +2113,10 @@ static int
 error_handler(Display * dpy, XErrorEvent * eev)
 {
 	if (g_error_expected)
+	{
+		g_error_seen = True;
 		return 0;
+	}
 
 	return g_old_error_handler(dpy, eev);
 }
@@ -1960,6 +2199,333 @@ RD_BOOL is_wm_active(void)
 }
 
 
+#ifdef HAVE_XSHM
+static void
+xwin_shm_destroy_image(xshm_image * shm)
+{
+	XShmDetach(g_display, &shm->info);
+	XDestroyImage(shm->image);
+	shmdt(shm->info.shmaddr);
+	shm->image = NULL;
+	shm->busy = False;
+}
+
+/* Create a shared image of at least width x height in shm. The X server
+   must attach the segment before it can be removed, which needs a round
+   trip, but images are only created when none of the present ones is
+   big enough. Returns False if shared memory does not work, e.g. with a
+   remote X server. */
+static RD_BOOL
+xwin_shm_create_image(xshm_image * shm, int width, int height)
+{
+	XImage *image;
+
+	image = XShmCreateImage(g_display, g_visual, g_depth, ZPixmap, NULL, &shm->info, width,
+				height);
+	if (image == NULL)
+		return False;
+
+	shm->info.shmid = shmget(IPC_PRIVATE, image->bytes_per_line * image->height,
+				 IPC_CREAT | 0600);
+	if (shm->info.shmid == -1)
+	{
+		XDestroyImage(image);
+		return False;
+	}
+
+	shm->info.shmaddr = image->data = shmat(shm->info.shmid, NULL, 0);
+	if (shm->info.shmaddr == (char *) -1)
+	{
+		shmctl(shm->info.shmid, IPC_RMID, NULL);
+		XDestroyImage(image);
+		return False;
+	}
+	shm->info.readOnly = True;
+
+	g_error_seen = False;
+	g_error_expected = True;
+	XShmAttach(g_display, &shm->info);
+	xwin_round_trip();
+	XSync(g_display, False);
+	g_error_expected = False;
+
+	shmctl(shm->info.shmid, IPC_RMID, NULL);
+	if (g_error_seen)
+	{
+		XDestroyImage(image);
+		shmdt(shm->info.shmaddr);
+		return False;
+	}
+
+	shm->image = image;
+	shm->busy = False;
+	return True;
+}
+
+/* Mark the image of a ShmCompletion event as free again */
+static void
+xwin_shm_completed(XEvent * xevent)
+{
+	XShmCompletionEvent *ev = (XShmCompletionEvent *) xevent;
+	int i;
+
+	for (i = 0; i < XSHM_IMAGES; i++)
+	{
+		if (g_shm_images[i].image != NULL && g_shm_images[i].info.shmseg == ev->shmseg)
+			g_shm_images[i].busy = False;
+	}
+}
+
+/* Find a free image of at least width x height, growing one if needed */
+static xshm_image *
+xwin_shm_get_image(int width, int height)
+{
+	XEvent xevent;
+	xshm_image *shm, *grow;
+	int i, retry;
+
+	for (retry = 0; retry < 2; retry++)
+	{
+		grow = NULL;
+		for (i = 0; i < XSHM_IMAGES; i++)
+		{
+			shm = &g_shm_images[i];
+			if (shm->busy)
+				continue;
+
+			if (shm->image != NULL && shm->image->width >= width
+			    && shm->image->height >= height)
+				return shm;
+
+			if (grow == NULL || shm->image == NULL)
+				grow = shm;
+		}
+
+		if (grow != NULL)
+		{
+			if (grow->image != NULL)
+			{
+				width = MAX(width, grow->image->width);
+				height = MAX(height, grow->image->height);
+				xwin_shm_destroy_image(grow);
+			}
+
+			if (xwin_shm_create_image(grow, width, height))
+				return grow;
+
+			logger(GUI, Warning, "MIT-SHM image creation failed, using XPutImage()");
+			g_shm_available = False;
+			return NULL;
+		}
+
+		/* all busy, collect completions that have arrived meanwhile */
+		while (XCheckTypedEvent(g_display, g_shm_completion, &xevent))
+			xwin_shm_completed(&xevent);
+	}
+
+	return NULL;
+}
+
+/* Upload the top left cx x cy pixels of data, whose lines are stride
+   bytes apart, through a shared image. Returns False if the caller has
+   to use XPutImage() instead. */
+static RD_BOOL
+xwin_shm_put_image(Drawable d, GC gc, int x, int y, int cx, int cy, uint8 * data, int stride)
+{
+	xshm_image *shm;
+	int line, row;
+
+	if (!g_shm_available || cx <= 0 || cy <= 0)
+		return False;
+
+	shm = xwin_shm_get_image(cx, cy);
+	if (shm == NULL)
+		return False;
+
+	line = cx * shm->image->bits_per_pixel / 8;
+	for (row = 0; row < cy; row++)
+		memcpy(shm->image->data + row * shm->image->bytes_per_line, data + row * stride,
+		       line);
+
+	XShmPutImage(g_display, d, gc, shm->image, 0, 0, x, y, cx, cy, True);
+	shm->busy = True;
+	return True;
+}
+
+/* Use MIT-SHM if the X server supports it and shares our memory */
+static void
+xwin_shm_init(void)
+{
+	int major, minor;
+	Bool pixmaps;
+
+	g_shm_available = False;
+	if (!XShmQueryVersion(g_display, &major, &minor, &pixmaps))
+		return;
+
+	/* a remote X server fails to attach the segment */
+	if (!xwin_shm_create_image(&g_shm_images[0], 64, 64))
+	{
+		logger(GUI, Debug, "xwin_shm_init(), MIT-SHM not usable with this display");
+		return;
+	}
+
+	g_shm_completion = XShmGetEventBase(g_display) + ShmCompletion;
+	g_shm_available = True;
+	logger(GUI, Debug, "xwin_shm_init(), using MIT-SHM %d.%d for image uploads", major,
+	       minor);
+}
+
+static void
+xwin_shm_deinit(void)
+{
+	int i;
+
+	for (i = 0; i < XSHM_IMAGES; i++)
+	{
+		if (g_shm_images[i].image != NULL)
+			xwin_shm_destroy_image(&g_shm_images[i]);
+	}
+	g_shm_available = False;
+}
+#endif
+
+#ifdef HAVE_XRENDER
+/* Use XRender for text if the X server has it and the visual is true
+   colour, so that composited pixels are the ones the GC would draw */
+static void
+xwin_text_init(void)
+{
+	XRenderPictFormat *format, *a1;
+	XRenderPictureAttributes attrs;
+	int event_base, error_base;
+
+	g_text_render = False;
+	if (!XRenderQueryExtension(g_display, &event_base, &error_base))
+		return;
+
+	format = XRenderFindVisualFormat(g_display, g_visual);
+	a1 = XRenderFindStandardFormat(g_display, PictStandardA1);
+	if (format == NULL || a1 == NULL || format->type != PictTypeDirect)
+	{
+		logger(GUI, Debug, "xwin_text_init(), XRender not usable with this visual");
+		return;
+	}
+
+	g_text_glyphset = XRenderCreateGlyphSet(g_display, a1);
+
+	g_text_src_pixmap = XCreatePixmap(g_display, RootWindowOfScreen(g_screen), 1, 1, g_depth);
+	g_text_src_gc = XCreateGC(g_display, g_text_src_pixmap, 0, NULL);
+	attrs.repeat = RepeatNormal;
+	g_text_src = XRenderCreatePicture(g_display, g_text_src_pixmap, format, CPRepeat, &attrs);
+	g_text_src_alpha = (unsigned long) format->direct.alphaMask << format->direct.alpha;
+	g_text_src_valid = False;
+
+	g_text_render = True;
+	logger(GUI, Debug, "xwin_text_init(), using XRender glyphs for text");
+}
+
+/* Free the picture of the window or backstore, before it is destroyed */
+static void
+xwin_text_release_dst(void)
+{
+	if (g_text_dst != 0)
+		XRenderFreePicture(g_display, g_text_dst);
+	g_text_dst = 0;
+	g_text_dst_drawable = 0;
+}
+
+static void
+xwin_text_deinit(void)
+{
+	if (!g_text_render)
+		return;
+
+	xwin_text_release_dst();
+	XRenderFreePicture(g_display, g_text_src);
+	XFreeGC(g_display, g_text_src_gc);
+	XFreePixmap(g_display, g_text_src_pixmap);
+	XRenderFreeGlyphSet(g_display, g_text_glyphset);
+	g_text_render = False;
+}
+#endif
+
+/* Put the top left cx x cy pixels of width x height data at x, y of d */
+static void
+xwin_put_image(Drawable d, GC gc, int x, int y, int cx, int cy, int width, int height,
+	       uint8 * data, int bitmap_pad)
+{
+	XImage *image;
+
+	image = XCreateImage(g_display, g_visual, g_depth, ZPixmap, 0,
+			     (char *) data, width, height, bitmap_pad, 0);
+
+#ifdef HAVE_XSHM
+	if (xwin_shm_put_image(d, gc, x, y, cx, cy, data, image->bytes_per_line))
+	{
+		XFree(image);
+		return;
+	}
+#endif
+
+	XPutImage(g_display, d, gc, image, 0, 0, x, y, cx, cy);
+	XFree(image);
+}
+
+/* Put a rectangle of the framebuffer to a window that shows it from
+   xoffset, yoffset on */
+static void
+xwin_swfb_put(Window wnd, int xoffset, int yoffset, int x, int y, int cx, int cy)
+{
+	SWFB_SURFACE *fb = swfb_screen();
+	int x2, y2;
+
+	if (fb == NULL)
+		return;
+
+	x2 = MIN(x + cx, fb->width);
+	y2 = MIN(y + cy, fb->height);
+	x = MAX(x, 0);
+	y = MAX(y, 0);
+	if (x >= x2 || y >= y2)
+		return;
+
+	xwin_put_image(wnd, g_damage_gc, x - xoffset, y - yoffset, x2 - x, y2 - y, fb->width,
+		       y2 - y, (uint8 *) (fb->data + y * fb->width + x), 32);
+}
+
+/* Put what changed in the framebuffer to the windows */
+static void
+xwin_swfb_flush(void)
+{
+	seamless_window *sw;
+	int x, y, cx, cy, x1, y1, x2, y2;
+
+	while (swfb_get_damage(&x, &y, &cx, &cy))
+	{
+		xwin_swfb_put(g_wnd, 0, 0, x, y, cx, cy);
+		for (sw = g_seamless_windows; sw; sw = sw->next)
+		{
+			x1 = MAX(x, sw->xoffset);
+			y1 = MAX(y, sw->yoffset);
+			x2 = MIN(x + cx, sw->xoffset + sw->width);
+			y2 = MIN(y + cy, sw->yoffset + sw->height);
+			if (x1 < x2 && y1 < y2)
+				xwin_swfb_put(sw->wnd, sw->xoffset, sw->yoffset, x1, y1, x2 - x1,
+					      y2 - y1);
+		}
+	}
+}
+
+/* The framebuffer has been drawn to, outside of an update the windows
+   are brought up to date right away */
+static void
+xwin_swfb_drawn(void)
+{
+	if (!g_damage_deferred)
+		xwin_swfb_flush();
+}
+
 /* Initialize the UI. This is done once per process. */
 RD_BOOL
 ui_init(void)
@@ -1988,6 +2554,29 @@ ui_init(void)
 	if (!select_visual(screen_num))
 		return False;
 
+	/* bitmaps are then decoded straight into the framebuffer format,
+	   which can be put to the windows as it is */
+	if (g_swfb && (g_bpp != 32 || g_owncolmap || g_xserver_be != g_host_be
+		       || g_visual->red_mask != 0xff0000 || g_visual->green_mask != 0xff00
+		       || g_visual->blue_mask != 0xff))
+	{
+		logger(GUI, Warning,
+		       "Client side rendering needs a 32 bpp RGB visual, drawing on the X server");
+		g_swfb = False;
+	}
+
+	if (g_swfb)
+		g_ownbackstore = False;
+
+	xwin_set_bitmap_format();
+
+#ifdef HAVE_XSHM
+	xwin_shm_init();
+#endif
+#ifdef HAVE_XRENDER
+	xwin_text_init();
+#endif
+
 	if (g_no_translate_image)
 	{
 		logger(GUI, Debug,
@@ -2016,7 +2605,7 @@ ui_init(void)
 			       g_depth);
 	}
 
-	if ((!g_ownbackstore) && (DoesBackingStore(g_screen) != Always))
+	if ((!g_ownbackstore) && (!g_swfb) && (DoesBackingStore(g_screen) != Always))
 	{
 		logger(GUI, Warning, "External BackingStore not available. Using internal");
 		g_ownbackstore = True;
@@ -2090,6 +2679,16 @@ ui_deinit(void)
 
 	XFreeModifiermap(g_mod_map);
 
+#ifdef HAVE_XSHM
+	xwin_shm_deinit();
+#endif
+#ifdef HAVE_XRENDER
+	xwin_text_deinit();
+#endif
+
+	if (g_swfb)
+		swfb_destroy();
+
 	XFreeGC(g_display, g_gc);
 	XCloseDisplay(g_display);
 	g_display = NULL;
@@ -2105,7 +2704,7 @@ get_window_attribs(XSetWindowAttributes * attribs)
 
 	attribs->background_pixel = BlackPixelOfScreen(g_screen);
 	attribs->border_pixel = WhitePixelOfScreen(g_screen);
-	attribs->backing_store = g_ownbackstore ? NotUseful : Always;
+	attribs->backing_store = (g_ownbackstore || g_swfb) ? NotUseful : Always;
 	if (g_has_wm) {
 		attribs->override_redirect = 0;
 	} else {
@@ -2130,7 +2729,7 @@ get_input_mask(long *input_mask)
 
 	if (g_sendmotion)
 		*input_mask |= PointerMotionMask;
-	if (g_ownbackstore)
+	if (g_ownbackstore || g_swfb)
 		*input_mask |= ExposureMask;
 	if (g_fullscreen || g_grab_keyboard)
 		*input_mask |= EnterWindowMask;
@@ -2217,6 +2816,8 @@ ui_create_window(uint32 width, uint32 height)
 
 	g_wnd = XCreateWindow(g_display, RootWindowOfScreen(g_screen), g_xpos, g_ypos, width,
 			      height, 0, g_depth, InputOutput, g_visual, value_mask, &attribs);
+	g_wnd_width = width;
+	g_wnd_height = height;
 
 	ewmh_set_wm_pid(g_wnd, getpid());
 	set_wm_client_machine(g_display, g_wnd);
@@ -2230,15 +2831,27 @@ ui_create_window(uint32 width, uint32 height)
 	if (g_create_bitmap_gc == NULL)
 		g_create_bitmap_gc = XCreateGC(g_display, g_wnd, 0, NULL);
 
-	if ((g_ownbackstore) && (g_backstore == 0))
+	if (g_damage_gc == NULL)
 	{
-		g_backstore = XCreatePixmap(g_display, g_wnd, width, height, g_depth);
+		g_damage_gc = XCreateGC(g_display, g_wnd, 0, NULL);
+		XSetGraphicsExposures(g_display, g_damage_gc, False);
+	}
+
+	if ((g_ownbackstore) && (g_backstore == 0))
+	{
+		g_backstore = XCreatePixmap(g_display, g_wnd, width, height, g_depth);
 
 		/* clear to prevent rubbish being exposed at startup */
 		XSetForeground(g_display, g_gc, BlackPixelOfScreen(g_screen));
 		XFillRectangle(g_display, g_backstore, g_gc, 0, 0, width, height);
 	}
 
+	/* the framebuffer outlives windows recreated by xwin_toggle_fullscreen() */
+	if (g_swfb && swfb_screen() == NULL)
+		swfb_create(width, height);
+	else if (g_swfb)
+		swfb_resize(width, height);
+
 	XStoreName(g_display, g_wnd, g_title);
 	ewmh_set_wm_name(g_wnd, g_title);
 
@@ -2330,6 +2943,7 @@ ui_resize_window(uint32 width, uint32 height)
 	XSizeHints *sizehints;
 	Pixmap bs;
 
+	xwin_round_trip();
 	XGetWindowAttributes(g_display, g_wnd, &attr);
 
 	if ((attr.width == (int) width && attr.height == (int) height))
@@ -2353,6 +2967,8 @@ ui_resize_window(uint32 width, uint32 height)
 	if (!g_embed_wnd)
 	{
 		XResizeWindow(g_display, g_wnd, width, height);
+		g_wnd_width = width;
+		g_wnd_height = height;
 	}
 
 	/* create new backstore pixmap */
@@ -2362,10 +2978,16 @@ ui_resize_window(uint32 width, uint32 height)
 		XSetForeground(g_display, g_gc, BlackPixelOfScreen(g_screen));
 		XFillRectangle(g_display, bs, g_gc, 0, 0, width, height);
 		XCopyArea(g_display, g_backstore, bs, g_gc, 0, 0, width, height, 0, 0);
+#ifdef HAVE_XRENDER
+		xwin_text_release_dst();
+#endif
 		XFreePixmap(g_display, g_backstore);
 		g_backstore = bs;
 	}
 
+	if (g_swfb)
+		swfb_resize(width, height);
+
 	ui_set_clip(0, 0, width, height);
 }
 
@@ -2378,9 +3000,14 @@ ui_have_window()
 void
 ui_destroy_window(void)
 {
+	int i;
+
 	if (g_IC != NULL)
 		XDestroyIC(g_IC);
 
+#ifdef HAVE_XRENDER
+	xwin_text_release_dst();
+#endif
 	XDestroyWindow(g_display, g_wnd);
 	g_wnd = 0;
 
@@ -2389,6 +3016,20 @@ ui_destroy_window(void)
 		XFreePixmap(g_display, g_backstore);
 		g_backstore = 0;
 	}
+
+	if (g_damage != NULL)
+	{
+		XDestroyRegion(g_damage);
+		g_damage = NULL;
+	}
+	g_damage_deferred = False;
+
+	for (i = 0; i < DESKTOP_SAVES; i++)
+		if (g_desktop_saves[i].pixmap != 0)
+		{
+			XFreePixmap(g_display, g_desktop_saves[i].pixmap);
+			g_desktop_saves[i].pixmap = 0;
+		}
 }
 
 void
@@ -2429,7 +3070,7 @@ xwin_toggle_fullscreen(void)
 		windowed_height = attr.height;
 	}
 
-	if (!g_ownbackstore)
+	if (!g_ownbackstore && !g_swfb)
 	{
 		/* need to save contents of current window */
 		contents = XCreatePixmap(g_display, g_wnd, attr.width, attr.height, g_depth);
@@ -2493,7 +3134,7 @@ xwin_toggle_fullscreen(void)
 
 	XDefineCursor(g_display, g_wnd, g_current_cursor);
 
-	if (!g_ownbackstore)
+	if (!g_ownbackstore && !g_swfb)
 	{
 		/* copy back saved contents into new window */
 		XCopyArea(g_display, contents, g_wnd, g_gc, 0, 0, attr.width, attr.height, 0, 0);
@@ -2504,11 +3145,8 @@ xwin_toggle_fullscreen(void)
 static void
 handle_button_event(XEvent xevent, RD_BOOL down)
 {
-	XWindowAttributes attr;
 	uint16 button, input_type, flags = 0;
 
-	XGetWindowAttributes(g_display, g_wnd, &attr);
-
 	g_last_gesturetime = xevent.xbutton.time;
 	/* Reverse the pointer button mapping, e.g. in the case of
 	   "left-handed mouse mode"; the RDP session expects to
@@ -2531,12 +3169,12 @@ handle_button_event(XEvent xevent, RD_BOOL down)
 	if (xevent.xbutton.y < g_win_button_size)
 	{
 		/*  Check from right to left: */
-		if (xevent.xbutton.x >= attr.width - g_win_button_size)
+		if (xevent.xbutton.x >= g_wnd_width - g_win_button_size)
 		{
 			/* The close button, continue */
 			;
 		}
-		else if (xevent.xbutton.x >= attr.width - g_win_button_size * 2)
+		else if (xevent.xbutton.x >= g_wnd_width - g_win_button_size * 2)
 		{
 			/* The maximize/restore button. Do not send to
 			   server.  It might be a good idea to change the
@@ -2545,7 +3183,7 @@ handle_button_event(XEvent xevent, RD_BOOL down)
 			if (xevent.type == ButtonPress)
 				return;
 		}
-		else if (xevent.xbutton.x >= attr.width - g_win_button_size * 3)
+		else if (xevent.xbutton.x >= g_wnd_width - g_win_button_size * 3)
 		{
 			/* The minimize button. Iconify window. */
 			if (xevent.type == ButtonRelease)
@@ -2618,6 +3256,14 @@ xwin_process_events(void)
 	{
 		XNextEvent(g_display, &xevent);
 
+#ifdef HAVE_XSHM
+		if (g_shm_available && xevent.type == g_shm_completion)
+		{
+			xwin_shm_completed(&xevent);
+			continue;
+		}
+#endif
+
 		if (!g_wnd)
 			/* Ignore events between ui_destroy_window and ui_create_window */
 			continue;
@@ -2825,7 +3471,20 @@ xwin_process_events(void)
 				break;
 
 			case Expose:
-				if (xevent.xexpose.window == g_wnd)
+				if (g_swfb)
+				{
+					if (xevent.xexpose.window == g_wnd)
+						sw = NULL;
+					else if ((sw =
+						  sw_get_window_by_wnd(xevent.xexpose.window)) == NULL)
+						break;
+					xwin_swfb_put(xevent.xexpose.window, sw ? sw->xoffset : 0,
+						      sw ? sw->yoffset : 0,
+						      xevent.xexpose.x + (sw ? sw->xoffset : 0),
+						      xevent.xexpose.y + (sw ? sw->yoffset : 0),
+						      xevent.xexpose.width, xevent.xexpose.height);
+				}
+				else if (xevent.xexpose.window == g_wnd)
 				{
 					XCopyArea(g_display, g_backstore, xevent.xexpose.window,
 						  g_gc,
@@ -2910,6 +3569,7 @@ xwin_process_events(void)
 				if (xevent.xconfigure.window == g_wnd)
 				{
 					XWindowAttributes attr;
+					xwin_round_trip();
 					XGetWindowAttributes(g_display, g_wnd, &attr);
 					g_window_width = attr.width;
 					g_window_height = attr.height;
@@ -2938,6 +3598,12 @@ xwin_process_events(void)
 				}
 				break;
 			case ConfigureNotify:
+				if (xevent.xconfigure.window == g_wnd)
+				{
+					g_wnd_width = xevent.xconfigure.width;
+					g_wnd_height = xevent.xconfigure.height;
+				}
+
 #ifdef HAVE_XRANDR
 				/* Resize on root window size change */
 				if (xevent.xconfigure.window == DefaultRootWindow(g_display))
@@ -2971,6 +3637,7 @@ xwin_process_events(void)
 					}
 
 					XRRUpdateConfiguration(&xevent);
+					xwin_round_trip();
 					XSync(g_display, False);
 
 				}
@@ -3234,12 +3901,18 @@ void
 ui_select(int rdp_socket)
 {
 	int timeout;
+	RD_BOOL events_ok, precache;
 	RD_BOOL rdp_socket_has_data = False;
 
 	while (g_exit_mainloop == False && rdp_socket_has_data == False)
 	{
-		/* Process a limited amount of pending x11 events */
-		if (!xwin_process_events())
+		/* Process a limited amount of pending x11 events, input
+		   events generated are sent together in one PDU */
+		rdp_begin_input_batch();
+		events_ok = xwin_process_events();
+		rdp_end_input_batch();
+
+		if (!events_ok)
 		{
 			/* User quit */
 			g_user_quit = True;
@@ -3261,6 +3934,9 @@ ui_select(int rdp_socket)
 		if (g_seamless_active)
 			sw_check_timers();
 
+		/* load persistent cache bitmaps a few at a time while idle */
+		precache = pstcache_precache();
+
 		/* process_fds() is a little special, it does two
 		   things in one. It will perform a select() on all
 		   filedescriptors; rdpsnd / rdpdr / ctrl and
@@ -3272,13 +3948,13 @@ ui_select(int rdp_socket)
 		   read data from rdp_socket.
 
 		   Use 60 seconds as default timeout for select. If
-		   there is more X11 events on queue or g_pend is set,
-		   use a low timeout.
+		   there is more X11 events on queue, bitmaps left to
+		   precache or g_pend is set, use a low timeout.
 		 */
 
 		timeout = 60000;
 
-		if (XPending(g_display) > 0)
+		if (XPending(g_display) > 0 || precache)
 			timeout = 0;
 		else if (g_pending_resize == True)
 			timeout = 100;
@@ -3293,11 +3969,165 @@ ui_move_pointer(int x, int y)
 	XWarpPointer(g_display, g_wnd, g_wnd, 0, 0, 0, 0, x, y);
 }
 
-RD_HBITMAP
-ui_create_bitmap(int width, int height, uint8 * data)
+/* Small bitmaps, which is what the bitmap caches hold, are packed into
+   atlas pixmaps instead of getting a pixmap each. An atlas is a grid of
+   ATLAS_GRID x ATLAS_GRID cells of one size, 16, 32 or 64 pixels
+   square like the cells of the three caches. */
+#define ATLAS_CLASSES	3
+#define ATLAS_GRID	8
+#define ATLAS_CELL(c)	(16 << (c))
+
+typedef struct _xwin_atlas
 {
-	XImage *image;
-	Pixmap bitmap;
+	Pixmap pixmap;
+	int class;
+	uint64 used;		/* a bit per cell */
+	struct _xwin_atlas *next;
+}
+xwin_atlas;
+
+/* A bitmap, at x, y of an atlas or in a pixmap of its own */
+typedef struct
+{
+	Pixmap pixmap;
+	int x, y;
+	int width, height;
+	xwin_atlas *atlas;
+	int cell;
+}
+xwin_bitmap;
+
+static xwin_atlas *g_atlases[ATLAS_CLASSES];
+
+/* Find a free cell for a bitmap of the given size, False if it is too
+   large for an atlas */
+static RD_BOOL
+xwin_atlas_alloc(xwin_bitmap * bmp, int width, int height)
+{
+	xwin_atlas *atlas;
+	int class, size, cell;
+
+	for (class = 0; class < ATLAS_CLASSES; class++)
+		if (width <= ATLAS_CELL(class) && height <= ATLAS_CELL(class))
+			break;
+	if (class == ATLAS_CLASSES)
+		return False;
+
+	for (atlas = g_atlases[class]; atlas != NULL; atlas = atlas->next)
+		if (atlas->used != ~(uint64) 0)
+			break;
+
+	if (atlas == NULL)
+	{
+		size = ATLAS_CELL(class) * ATLAS_GRID;
+		logger(GUI, Debug, "xwin_atlas_alloc(), new %dx%d atlas for %dx%d cells", size,
+		       size, ATLAS_CELL(class), ATLAS_CELL(class));
+
+		atlas = (xwin_atlas *) xmalloc(sizeof(xwin_atlas));
+		atlas->pixmap = XCreatePixmap(g_display, g_wnd, size, size, g_depth);
+		atlas->class = class;
+		atlas->used = 0;
+		atlas->next = g_atlases[class];
+		g_atlases[class] = atlas;
+	}
+
+	for (cell = 0; atlas->used & ((uint64) 1 << cell); cell++);
+	atlas->used |= (uint64) 1 << cell;
+
+	bmp->pixmap = atlas->pixmap;
+	bmp->x = (cell % ATLAS_GRID) * ATLAS_CELL(class);
+	bmp->y = (cell / ATLAS_GRID) * ATLAS_CELL(class);
+	bmp->atlas = atlas;
+	bmp->cell = cell;
+	return True;
+}
+
+/* Release the cell of a bitmap, and its atlas once that is empty */
+static void
+xwin_atlas_free(xwin_bitmap * bmp)
+{
+	xwin_atlas *atlas = bmp->atlas, **prev;
+
+	atlas->used &= ~((uint64) 1 << bmp->cell);
+	if (atlas->used != 0)
+		return;
+
+	for (prev = &g_atlases[atlas->class]; *prev != atlas; prev = &(*prev)->next);
+	*prev = atlas->next;
+
+	XFreePixmap(g_display, atlas->pixmap);
+	xfree(atlas);
+}
+
+/* Create a bitmap from data in the format of the visual. Bitmaps that
+   are used as tiles need a pixmap of their own. */
+static xwin_bitmap *
+xwin_create_bitmap(int width, int height, uint8 * data, int bitmap_pad, RD_BOOL own_pixmap)
+{
+	xwin_bitmap *bmp;
+
+	bmp = (xwin_bitmap *) xmalloc(sizeof(xwin_bitmap));
+	bmp->width = width;
+	bmp->height = height;
+
+	if (own_pixmap || !xwin_atlas_alloc(bmp, width, height))
+	{
+		bmp->pixmap = XCreatePixmap(g_display, g_wnd, width, height, g_depth);
+		bmp->x = bmp->y = 0;
+		bmp->atlas = NULL;
+	}
+
+	xwin_put_image(bmp->pixmap, g_create_bitmap_gc, bmp->x, bmp->y, width, height, width,
+		       height, data, bitmap_pad);
+	return bmp;
+}
+
+/* Clip a copy from a bitmap to the bitmap, which an atlas doesn't do */
+static RD_BOOL
+xwin_bitmap_clip(xwin_bitmap * bmp, int *x, int *y, int *cx, int *cy, int *srcx, int *srcy)
+{
+	if (*srcx < 0)
+	{
+		*x -= *srcx;
+		*cx += *srcx;
+		*srcx = 0;
+	}
+	if (*srcy < 0)
+	{
+		*y -= *srcy;
+		*cy += *srcy;
+		*srcy = 0;
+	}
+	*cx = MIN(*cx, bmp->width - *srcx);
+	*cy = MIN(*cy, bmp->height - *srcy);
+
+	return *cx > 0 && *cy > 0;
+}
+
+/* Paint cx x cy pixels of an image of width x height to the screen */
+static void
+xwin_paint_image(int x, int y, int cx, int cy, int width, int height, uint8 * data,
+		 int bitmap_pad)
+{
+	if (g_ownbackstore)
+	{
+		xwin_put_image(g_backstore, g_gc, x, y, cx, cy, width, height, data, bitmap_pad);
+		xwin_damage(x, y, cx, cy);
+	}
+	else
+	{
+		xwin_put_image(g_wnd, g_gc, x, y, cx, cy, width, height, data, bitmap_pad);
+		ON_ALL_SEAMLESS_WINDOWS(XCopyArea,
+					(g_display, g_wnd, sw->wnd, g_gc, x, y, cx, cy,
+					 x - sw->xoffset, y - sw->yoffset));
+	}
+}
+
+/* Create a bitmap from data in the format of the server */
+static xwin_bitmap *
+xwin_create_bitmap_translated(int width, int height, uint8 * data, RD_BOOL own_pixmap)
+{
+	xwin_bitmap *bitmap;
 	uint8 *tdata;
 	int bitmap_pad;
 
@@ -3314,25 +4144,47 @@ ui_create_bitmap(int width, int height, uint8 * data)
 	}
 
 	tdata = (g_owncolmap ? data : translate_image(width, height, data));
-	bitmap = XCreatePixmap(g_display, g_wnd, width, height, g_depth);
-	image = XCreateImage(g_display, g_visual, g_depth, ZPixmap, 0,
-			     (char *) tdata, width, height, bitmap_pad, 0);
-
-	XPutImage(g_display, bitmap, g_create_bitmap_gc, image, 0, 0, 0, 0, width, height);
+	bitmap = xwin_create_bitmap(width, height, tdata, bitmap_pad, own_pixmap);
 
-	XFree(image);
 	if (tdata != data)
 		xfree(tdata);
-	return (RD_HBITMAP) bitmap;
+	return bitmap;
+}
+
+RD_HBITMAP
+ui_create_bitmap(int width, int height, uint8 * data)
+{
+	if (g_swfb)
+		return (RD_HBITMAP) swfb_create_surface(width, height, data, False);
+
+	return (RD_HBITMAP) xwin_create_bitmap_translated(width, height, data, False);
+}
+
+/* Create a bitmap from data that bitmap.c has already put into the
+   format of the visual */
+RD_HBITMAP
+ui_create_bitmap_native(int width, int height, uint8 * data)
+{
+	if (g_swfb)
+		return (RD_HBITMAP) swfb_create_surface(width, height, data, True);
+
+	return (RD_HBITMAP) xwin_create_bitmap(width, height, data, g_bpp == 24 ? 32 : g_bpp,
+					       False);
 }
 
 void
 ui_paint_bitmap(int x, int y, int cx, int cy, int width, int height, uint8 * data)
 {
-	XImage *image;
 	uint8 *tdata;
 	int bitmap_pad;
 
+	if (g_swfb)
+	{
+		swfb_paint(x, y, cx, cy, width, height, data, False);
+		xwin_swfb_drawn();
+		return;
+	}
+
 	if (g_server_depth == 8)
 	{
 		bitmap_pad = 8;
@@ -3346,44 +4198,51 @@ ui_paint_bitmap(int x, int y, int cx, int cy, int width, int height, uint8 * dat
 	}
 
 	tdata = (g_owncolmap ? data : translate_image(width, height, data));
-	image = XCreateImage(g_display, g_visual, g_depth, ZPixmap, 0,
-			     (char *) tdata, width, height, bitmap_pad, 0);
+	xwin_paint_image(x, y, cx, cy, width, height, tdata, bitmap_pad);
 
-	if (g_ownbackstore)
-	{
-		XPutImage(g_display, g_backstore, g_gc, image, 0, 0, x, y, cx, cy);
-		XCopyArea(g_display, g_backstore, g_wnd, g_gc, x, y, cx, cy, x, y);
-		ON_ALL_SEAMLESS_WINDOWS(XCopyArea,
-					(g_display, g_backstore, sw->wnd, g_gc, x, y, cx, cy,
-					 x - sw->xoffset, y - sw->yoffset));
-	}
-	else
+	if (tdata != data)
+		xfree(tdata);
+}
+
+/* Paint data that bitmap.c has already put into the format of the
+   visual */
+void
+ui_paint_bitmap_native(int x, int y, int cx, int cy, int width, int height, uint8 * data)
+{
+	if (g_swfb)
 	{
-		XPutImage(g_display, g_wnd, g_gc, image, 0, 0, x, y, cx, cy);
-		ON_ALL_SEAMLESS_WINDOWS(XCopyArea,
-					(g_display, g_wnd, sw->wnd, g_gc, x, y, cx, cy,
-					 x - sw->xoffset, y - sw->yoffset));
+		swfb_paint(x, y, cx, cy, width, height, data, True);
+		xwin_swfb_drawn();
+		return;
 	}
 
-	XFree(image);
-	if (tdata != data)
-		xfree(tdata);
+	xwin_paint_image(x, y, cx, cy, width, height, data, g_bpp == 24 ? 32 : g_bpp);
 }
 
 void
 ui_destroy_bitmap(RD_HBITMAP bmp)
 {
-	XFreePixmap(g_display, (Pixmap) bmp);
+	xwin_bitmap *bitmap = (xwin_bitmap *) bmp;
+
+	if (g_swfb)
+	{
+		swfb_destroy_surface((SWFB_SURFACE *) bmp);
+		return;
+	}
+
+	if (bitmap->atlas != NULL)
+		xwin_atlas_free(bitmap);
+	else
+		XFreePixmap(g_display, bitmap->pixmap);
+	xfree(bitmap);
 }
 
-RD_HGLYPH
-ui_create_glyph(int width, int height, uint8 * data)
+/* Upload a 1 bpp MSB first bitmap to a new pixmap */
+static Pixmap
+xwin_create_stipple(int width, int height, int scanline, uint8 * data)
 {
 	XImage *image;
 	Pixmap bitmap;
-	int scanline;
-
-	scanline = (width + 7) / 8;
 
 	bitmap = XCreatePixmap(g_display, g_wnd, width, height, 1);
 	if (g_create_glyph_gc == 0)
@@ -3398,13 +4257,65 @@ ui_create_glyph(int width, int height, uint8 * data)
 	XPutImage(g_display, bitmap, g_create_glyph_gc, image, 0, 0, 0, 0, width, height);
 
 	XFree(image);
-	return (RD_HGLYPH) bitmap;
+	return bitmap;
+}
+
+/* Glyph bits are kept on the client. The X server gets a copy the first
+   time the glyph is drawn: in the XRender glyph set for text, or as a
+   stipple pixmap for brushes and when there is no XRender. */
+RD_HGLYPH
+ui_create_glyph(int width, int height, uint8 * data)
+{
+	xwin_glyph *glyph;
+	int scanline, i;
+	uint8 last;
+
+	scanline = (width + 7) / 8;
+
+	glyph = (xwin_glyph *) xmalloc(sizeof(xwin_glyph) + scanline * height);
+	glyph->pixmap = 0;
+#ifdef HAVE_XRENDER
+	glyph->id = 0;
+#endif
+	glyph->width = width;
+	glyph->height = height;
+	glyph->scanline = scanline;
+	glyph->bits = (uint8 *) (glyph + 1);
+	memcpy(glyph->bits, data, scanline * height);
+
+	/* clear the padding so that glyphs can be or'ed together */
+	last = 0xff << ((8 - (width & 7)) & 7);
+	for (i = 1; i <= height && scanline > 0; i++)
+		glyph->bits[i * scanline - 1] &= last;
+
+	return (RD_HGLYPH) glyph;
+}
+
+static Pixmap
+xwin_glyph_pixmap(xwin_glyph * glyph)
+{
+	if (glyph->pixmap == 0)
+		glyph->pixmap = xwin_create_stipple(glyph->width, glyph->height, glyph->scanline,
+						    glyph->bits);
+
+	return glyph->pixmap;
 }
 
 void
 ui_destroy_glyph(RD_HGLYPH glyph)
 {
-	XFreePixmap(g_display, (Pixmap) glyph);
+	xwin_glyph *g = (xwin_glyph *) glyph;
+
+	if (g->pixmap != 0)
+		XFreePixmap(g_display, g->pixmap);
+#ifdef HAVE_XRENDER
+	if (g->id != 0)
+	{
+		Glyph id = g->id;
+		XRenderFreeGlyphs(g_display, g_text_glyphset, &id, 1);
+	}
+#endif
+	xfree(g);
 }
 
 #define GET_BIT(ptr, bit) (*(ptr + bit / 8) & (1 << (7 - (bit % 8))))
@@ -3634,6 +4545,8 @@ ui_create_colourmap(COLOURMAP * colours)
 {
 	COLOURENTRY *entry;
 	int i, ncolours = colours->ncolours;
+	if (g_swfb)
+		return swfb_create_colourmap(colours);
 	if (!g_owncolmap)
 	{
 		uint32 *map = (uint32 *) xmalloc(sizeof(*g_colmap) * ncolours);
@@ -3741,7 +4654,11 @@ ui_destroy_colourmap(RD_HCOLOURMAP map)
 void
 ui_set_colourmap(RD_HCOLOURMAP map)
 {
-	if (!g_owncolmap)
+	if (g_swfb)
+	{
+		swfb_set_colourmap(map);
+	}
+	else if (!g_owncolmap)
 	{
 		if (g_colmap)
 			xfree(g_colmap);
@@ -3762,15 +4679,23 @@ ui_set_clip(int x, int y, int cx, int cy)
 	g_clip_rectangle.y = y;
 	g_clip_rectangle.width = cx;
 	g_clip_rectangle.height = cy;
+
+	if (g_swfb)
+	{
+		swfb_set_clip(x, y, cx, cy);
+		return;
+	}
+
 	XSetClipRectangles(g_display, g_gc, 0, 0, &g_clip_rectangle, 1, YXBanded);
+#ifdef HAVE_XRENDER
+	g_text_clip_valid = False;
+#endif
 }
 
 void
 ui_reset_clip(void)
 {
-	XWindowAttributes attr;
-	XGetWindowAttributes(g_display, g_wnd, &attr);
-	ui_set_clip(0, 0, attr.width, attr.height);
+	ui_set_clip(0, 0, g_wnd_width, g_wnd_height);
 }
 
 void
@@ -3783,6 +4708,13 @@ void
 ui_destblt(uint8 opcode,
 	   /* dest */ int x, int y, int cx, int cy)
 {
+	if (g_swfb)
+	{
+		swfb_fill(opcode, x, y, cx, cy, 0);
+		xwin_swfb_drawn();
+		return;
+	}
+
 	SET_FUNCTION(opcode);
 	FILL_RECTANGLE(x, y, cx, cy);
 	RESET_FUNCTION(opcode);
@@ -3797,6 +4729,39 @@ static uint8 hatch_patterns[] = {
 	0x81, 0x42, 0x24, 0x18, 0x18, 0x24, 0x42, 0x81	/* 5 - bsDiagCross */
 };
 
+/* Get the 8x8 stipple for a 1 bpp brush pattern, the pixmap is owned
+   by the brush pixmap cache */
+static Pixmap
+xwin_brush_stipple(uint8 * pattern)
+{
+	void *fill;
+
+	fill = cache_get_brush_pixmap(BRUSH_PIXMAP_STIPPLE, pattern, 8);
+	if (fill == NULL)
+	{
+		fill = ui_create_glyph(8, 8, pattern);
+		cache_put_brush_pixmap(BRUSH_PIXMAP_STIPPLE, pattern, 8, fill);
+	}
+
+	return xwin_glyph_pixmap((xwin_glyph *) fill);
+}
+
+/* Get the 8x8 tile for a colour brush */
+static Pixmap
+xwin_brush_tile(BRUSHDATA * bd)
+{
+	void *fill;
+
+	fill = cache_get_brush_pixmap(BRUSH_PIXMAP_TILE, bd->data, bd->data_size);
+	if (fill == NULL)
+	{
+		fill = xwin_create_bitmap_translated(8, 8, bd->data, True);
+		cache_put_brush_pixmap(BRUSH_PIXMAP_TILE, bd->data, bd->data_size, fill);
+	}
+
+	return ((xwin_bitmap *) fill)->pixmap;
+}
+
 void
 ui_patblt(uint8 opcode,
 	  /* dest */ int x, int y, int cx, int cy,
@@ -3805,6 +4770,13 @@ ui_patblt(uint8 opcode,
 	Pixmap fill;
 	uint8 i, ipattern[8];
 
+	if (g_swfb)
+	{
+		swfb_patblt(opcode, x, y, cx, cy, brush, bgcolour, fgcolour);
+		xwin_swfb_drawn();
+		return;
+	}
+
 	SET_FUNCTION(opcode);
 
 	switch (brush->style)
@@ -3815,8 +4787,7 @@ ui_patblt(uint8 opcode,
 			break;
 
 		case 2:	/* Hatch */
-			fill = (Pixmap) ui_create_glyph(8, 8,
-							hatch_patterns + brush->pattern[0] * 8);
+			fill = xwin_brush_stipple(hatch_patterns + brush->pattern[0] * 8);
 			SET_FOREGROUND(fgcolour);
 			SET_BACKGROUND(bgcolour);
 			XSetFillStyle(g_display, g_gc, FillOpaqueStippled);
@@ -3825,7 +4796,6 @@ ui_patblt(uint8 opcode,
 			FILL_RECTANGLE_BACKSTORE(x, y, cx, cy);
 			XSetFillStyle(g_display, g_gc, FillSolid);
 			XSetTSOrigin(g_display, g_gc, 0, 0);
-			ui_destroy_glyph((RD_HGLYPH) fill);
 			break;
 
 		case 3:	/* Pattern */
@@ -3833,7 +4803,7 @@ ui_patblt(uint8 opcode,
 			{
 				for (i = 0; i != 8; i++)
 					ipattern[7 - i] = brush->pattern[i];
-				fill = (Pixmap) ui_create_glyph(8, 8, ipattern);
+				fill = xwin_brush_stipple(ipattern);
 				SET_FOREGROUND(bgcolour);
 				SET_BACKGROUND(fgcolour);
 				XSetFillStyle(g_display, g_gc, FillOpaqueStippled);
@@ -3842,22 +4812,20 @@ ui_patblt(uint8 opcode,
 				FILL_RECTANGLE_BACKSTORE(x, y, cx, cy);
 				XSetFillStyle(g_display, g_gc, FillSolid);
 				XSetTSOrigin(g_display, g_gc, 0, 0);
-				ui_destroy_glyph((RD_HGLYPH) fill);
 			}
 			else if (brush->bd->colour_code > 1)	/* > 1 bpp */
 			{
-				fill = (Pixmap) ui_create_bitmap(8, 8, brush->bd->data);
+				fill = xwin_brush_tile(brush->bd);
 				XSetFillStyle(g_display, g_gc, FillTiled);
 				XSetTile(g_display, g_gc, fill);
 				XSetTSOrigin(g_display, g_gc, brush->xorigin, brush->yorigin);
 				FILL_RECTANGLE_BACKSTORE(x, y, cx, cy);
 				XSetFillStyle(g_display, g_gc, FillSolid);
 				XSetTSOrigin(g_display, g_gc, 0, 0);
-				ui_destroy_bitmap((RD_HBITMAP) fill);
 			}
 			else
 			{
-				fill = (Pixmap) ui_create_glyph(8, 8, brush->bd->data);
+				fill = xwin_brush_stipple(brush->bd->data);
 				SET_FOREGROUND(bgcolour);
 				SET_BACKGROUND(fgcolour);
 				XSetFillStyle(g_display, g_gc, FillOpaqueStippled);
@@ -3866,7 +4834,6 @@ ui_patblt(uint8 opcode,
 				FILL_RECTANGLE_BACKSTORE(x, y, cx, cy);
 				XSetFillStyle(g_display, g_gc, FillSolid);
 				XSetTSOrigin(g_display, g_gc, 0, 0);
-				ui_destroy_glyph((RD_HGLYPH) fill);
 			}
 			break;
 
@@ -3878,10 +4845,11 @@ ui_patblt(uint8 opcode,
 	RESET_FUNCTION(opcode);
 
 	if (g_ownbackstore)
-		XCopyArea(g_display, g_backstore, g_wnd, g_gc, x, y, cx, cy, x, y);
-	ON_ALL_SEAMLESS_WINDOWS(XCopyArea,
-				(g_display, g_ownbackstore ? g_backstore : g_wnd, sw->wnd, g_gc,
-				 x, y, cx, cy, x - sw->xoffset, y - sw->yoffset));
+		xwin_damage(x, y, cx, cy);
+	else
+		ON_ALL_SEAMLESS_WINDOWS(XCopyArea,
+					(g_display, g_wnd, sw->wnd, g_gc,
+					 x, y, cx, cy, x - sw->xoffset, y - sw->yoffset));
 }
 
 void
@@ -3889,22 +4857,28 @@ ui_screenblt(uint8 opcode,
 	     /* dest */ int x, int y, int cx, int cy,
 	     /* src */ int srcx, int srcy)
 {
+	if (g_swfb)
+	{
+		swfb_blit(opcode, x, y, cx, cy, swfb_screen(), srcx, srcy);
+		xwin_swfb_drawn();
+		return;
+	}
+
 	SET_FUNCTION(opcode);
 	if (g_ownbackstore)
 	{
-		XCopyArea(g_display, g_Unobscured ? g_wnd : g_backstore,
-			  g_wnd, g_gc, srcx, srcy, cx, cy, x, y);
+		/* the window may lag behind the backstore during an update */
 		XCopyArea(g_display, g_backstore, g_backstore, g_gc, srcx, srcy, cx, cy, x, y);
+		xwin_damage(x, y, cx, cy);
 	}
 	else
 	{
 		XCopyArea(g_display, g_wnd, g_wnd, g_gc, srcx, srcy, cx, cy, x, y);
+		ON_ALL_SEAMLESS_WINDOWS(XCopyArea,
+					(g_display, g_wnd, sw->wnd, g_gc, x, y, cx, cy,
+					 x - sw->xoffset, y - sw->yoffset));
 	}
 
-	ON_ALL_SEAMLESS_WINDOWS(XCopyArea,
-				(g_display, g_ownbackstore ? g_backstore : g_wnd,
-				 sw->wnd, g_gc, x, y, cx, cy, x - sw->xoffset, y - sw->yoffset));
-
 	RESET_FUNCTION(opcode);
 }
 
@@ -3913,13 +4887,33 @@ ui_memblt(uint8 opcode,
 	  /* dest */ int x, int y, int cx, int cy,
 	  /* src */ RD_HBITMAP src, int srcx, int srcy)
 {
+	xwin_bitmap *bmp = (xwin_bitmap *) src;
+
+	if (g_swfb)
+	{
+		swfb_blit(opcode, x, y, cx, cy, (SWFB_SURFACE *) src, srcx, srcy);
+		xwin_swfb_drawn();
+		return;
+	}
+
+	if (!xwin_bitmap_clip(bmp, &x, &y, &cx, &cy, &srcx, &srcy))
+		return;
+	srcx += bmp->x;
+	srcy += bmp->y;
+
 	SET_FUNCTION(opcode);
-	XCopyArea(g_display, (Pixmap) src, g_wnd, g_gc, srcx, srcy, cx, cy, x, y);
-	ON_ALL_SEAMLESS_WINDOWS(XCopyArea,
-				(g_display, (Pixmap) src, sw->wnd, g_gc,
-				 srcx, srcy, cx, cy, x - sw->xoffset, y - sw->yoffset));
 	if (g_ownbackstore)
-		XCopyArea(g_display, (Pixmap) src, g_backstore, g_gc, srcx, srcy, cx, cy, x, y);
+	{
+		XCopyArea(g_display, bmp->pixmap, g_backstore, g_gc, srcx, srcy, cx, cy, x, y);
+		xwin_damage(x, y, cx, cy);
+	}
+	else
+	{
+		XCopyArea(g_display, bmp->pixmap, g_wnd, g_gc, srcx, srcy, cx, cy, x, y);
+		ON_ALL_SEAMLESS_WINDOWS(XCopyArea,
+					(g_display, bmp->pixmap, sw->wnd, g_gc,
+					 srcx, srcy, cx, cy, x - sw->xoffset, y - sw->yoffset));
+	}
 	RESET_FUNCTION(opcode);
 }
 
@@ -3929,6 +4923,14 @@ ui_triblt(uint8 opcode,
 	  /* src */ RD_HBITMAP src, int srcx, int srcy,
 	  /* brush */ BRUSH * brush, uint32 bgcolour, uint32 fgcolour)
 {
+	if (g_swfb)
+	{
+		swfb_triblt(opcode, x, y, cx, cy, (SWFB_SURFACE *) src, srcx, srcy, brush,
+			    bgcolour, fgcolour);
+		xwin_swfb_drawn();
+		return;
+	}
+
 	/* This is potentially difficult to do in general. Until someone
 	   comes up with a more efficient way of doing it I am using cases. */
 
@@ -3961,14 +4963,28 @@ ui_line(uint8 opcode,
 	/* dest */ int startx, int starty, int endx, int endy,
 	/* pen */ PEN * pen)
 {
+	if (g_swfb)
+	{
+		swfb_line(opcode, startx, starty, endx, endy, pen->colour);
+		xwin_swfb_drawn();
+		return;
+	}
+
 	SET_FUNCTION(opcode);
 	SET_FOREGROUND(pen->colour);
-	XDrawLine(g_display, g_wnd, g_gc, startx, starty, endx, endy);
-	ON_ALL_SEAMLESS_WINDOWS(XDrawLine, (g_display, sw->wnd, g_gc,
-					    startx - sw->xoffset, starty - sw->yoffset,
-					    endx - sw->xoffset, endy - sw->yoffset));
 	if (g_ownbackstore)
+	{
 		XDrawLine(g_display, g_backstore, g_gc, startx, starty, endx, endy);
+		xwin_damage(MIN(startx, endx), MIN(starty, endy), abs(endx - startx) + 1,
+			    abs(endy - starty) + 1);
+	}
+	else
+	{
+		XDrawLine(g_display, g_wnd, g_gc, startx, starty, endx, endy);
+		ON_ALL_SEAMLESS_WINDOWS(XDrawLine, (g_display, sw->wnd, g_gc,
+						    startx - sw->xoffset, starty - sw->yoffset,
+						    endx - sw->xoffset, endy - sw->yoffset));
+	}
 	RESET_FUNCTION(opcode);
 }
 
@@ -3977,6 +4993,13 @@ ui_rect(
 	       /* dest */ int x, int y, int cx, int cy,
 	       /* brush */ uint32 colour)
 {
+	if (g_swfb)
+	{
+		swfb_fill(ROP2_COPY, x, y, cx, cy, colour);
+		xwin_swfb_drawn();
+		return;
+	}
+
 	SET_FOREGROUND(colour);
 	FILL_RECTANGLE(x, y, cx, cy);
 }
@@ -3990,6 +5013,15 @@ ui_polygon(uint8 opcode,
 	uint8 style, i, ipattern[8];
 	Pixmap fill;
 
+	if (g_swfb)
+	{
+		if (fillmode != ALTERNATE && fillmode != WINDING)
+			logger(GUI, Warning, "Unimplemented fill mode %d", fillmode);
+		swfb_polygon(opcode, fillmode, point, npoints, brush, bgcolour, fgcolour);
+		xwin_swfb_drawn();
+		return;
+	}
+
 	SET_FUNCTION(opcode);
 
 	switch (fillmode)
@@ -4017,8 +5049,7 @@ ui_polygon(uint8 opcode,
 			break;
 
 		case 2:	/* Hatch */
-			fill = (Pixmap) ui_create_glyph(8, 8,
-							hatch_patterns + brush->pattern[0] * 8);
+			fill = xwin_brush_stipple(hatch_patterns + brush->pattern[0] * 8);
 			SET_FOREGROUND(fgcolour);
 			SET_BACKGROUND(bgcolour);
 			XSetFillStyle(g_display, g_gc, FillOpaqueStippled);
@@ -4027,7 +5058,6 @@ ui_polygon(uint8 opcode,
 			FILL_POLYGON((XPoint *) point, npoints);
 			XSetFillStyle(g_display, g_gc, FillSolid);
 			XSetTSOrigin(g_display, g_gc, 0, 0);
-			ui_destroy_glyph((RD_HGLYPH) fill);
 			break;
 
 		case 3:	/* Pattern */
@@ -4035,7 +5065,7 @@ ui_polygon(uint8 opcode,
 			{
 				for (i = 0; i != 8; i++)
 					ipattern[7 - i] = brush->pattern[i];
-				fill = (Pixmap) ui_create_glyph(8, 8, ipattern);
+				fill = xwin_brush_stipple(ipattern);
 				SET_FOREGROUND(bgcolour);
 				SET_BACKGROUND(fgcolour);
 				XSetFillStyle(g_display, g_gc, FillOpaqueStippled);
@@ -4044,22 +5074,20 @@ ui_polygon(uint8 opcode,
 				FILL_POLYGON((XPoint *) point, npoints);
 				XSetFillStyle(g_display, g_gc, FillSolid);
 				XSetTSOrigin(g_display, g_gc, 0, 0);
-				ui_destroy_glyph((RD_HGLYPH) fill);
 			}
 			else if (brush->bd->colour_code > 1)	/* > 1 bpp */
 			{
-				fill = (Pixmap) ui_create_bitmap(8, 8, brush->bd->data);
+				fill = xwin_brush_tile(brush->bd);
 				XSetFillStyle(g_display, g_gc, FillTiled);
 				XSetTile(g_display, g_gc, fill);
 				XSetTSOrigin(g_display, g_gc, brush->xorigin, brush->yorigin);
 				FILL_POLYGON((XPoint *) point, npoints);
 				XSetFillStyle(g_display, g_gc, FillSolid);
 				XSetTSOrigin(g_display, g_gc, 0, 0);
-				ui_destroy_bitmap((RD_HBITMAP) fill);
 			}
 			else
 			{
-				fill = (Pixmap) ui_create_glyph(8, 8, brush->bd->data);
+				fill = xwin_brush_stipple(brush->bd->data);
 				SET_FOREGROUND(bgcolour);
 				SET_BACKGROUND(fgcolour);
 				XSetFillStyle(g_display, g_gc, FillOpaqueStippled);
@@ -4068,7 +5096,6 @@ ui_polygon(uint8 opcode,
 				FILL_POLYGON((XPoint *) point, npoints);
 				XSetFillStyle(g_display, g_gc, FillSolid);
 				XSetTSOrigin(g_display, g_gc, 0, 0);
-				ui_destroy_glyph((RD_HGLYPH) fill);
 			}
 			break;
 
@@ -4084,16 +5111,29 @@ ui_polyline(uint8 opcode,
 	    /* dest */ RD_POINT * points, int npoints,
 	    /* pen */ PEN * pen)
 {
+	if (g_swfb)
+	{
+		swfb_polyline(opcode, points, npoints, pen->colour);
+		xwin_swfb_drawn();
+		return;
+	}
+
 	/* TODO: set join style */
 	SET_FUNCTION(opcode);
 	SET_FOREGROUND(pen->colour);
-	XDrawLines(g_display, g_wnd, g_gc, (XPoint *) points, npoints, CoordModePrevious);
 	if (g_ownbackstore)
+	{
 		XDrawLines(g_display, g_backstore, g_gc, (XPoint *) points, npoints,
 			   CoordModePrevious);
-
-	ON_ALL_SEAMLESS_WINDOWS(seamless_XDrawLines,
-				(sw->wnd, (XPoint *) points, npoints, sw->xoffset, sw->yoffset));
+		xwin_damage_points((XPoint *) points, npoints, 1);
+	}
+	else
+	{
+		XDrawLines(g_display, g_wnd, g_gc, (XPoint *) points, npoints, CoordModePrevious);
+		ON_ALL_SEAMLESS_WINDOWS(seamless_XDrawLines,
+					(sw->wnd, (XPoint *) points, npoints, sw->xoffset,
+					 sw->yoffset));
+	}
 
 	RESET_FUNCTION(opcode);
 }
@@ -4107,6 +5147,13 @@ ui_ellipse(uint8 opcode,
 	uint8 style, i, ipattern[8];
 	Pixmap fill;
 
+	if (g_swfb)
+	{
+		swfb_ellipse(opcode, fillmode, x, y, cx, cy, brush, bgcolour, fgcolour);
+		xwin_swfb_drawn();
+		return;
+	}
+
 	SET_FUNCTION(opcode);
 
 	if (brush)
@@ -4122,8 +5169,7 @@ ui_ellipse(uint8 opcode,
 			break;
 
 		case 2:	/* Hatch */
-			fill = (Pixmap) ui_create_glyph(8, 8,
-							hatch_patterns + brush->pattern[0] * 8);
+			fill = xwin_brush_stipple(hatch_patterns + brush->pattern[0] * 8);
 			SET_FOREGROUND(fgcolour);
 			SET_BACKGROUND(bgcolour);
 			XSetFillStyle(g_display, g_gc, FillOpaqueStippled);
@@ -4132,7 +5178,6 @@ ui_ellipse(uint8 opcode,
 			DRAW_ELLIPSE(x, y, cx, cy, fillmode);
 			XSetFillStyle(g_display, g_gc, FillSolid);
 			XSetTSOrigin(g_display, g_gc, 0, 0);
-			ui_destroy_glyph((RD_HGLYPH) fill);
 			break;
 
 		case 3:	/* Pattern */
@@ -4140,7 +5185,7 @@ ui_ellipse(uint8 opcode,
 			{
 				for (i = 0; i != 8; i++)
 					ipattern[7 - i] = brush->pattern[i];
-				fill = (Pixmap) ui_create_glyph(8, 8, ipattern);
+				fill = xwin_brush_stipple(ipattern);
 				SET_FOREGROUND(bgcolour);
 				SET_BACKGROUND(fgcolour);
 				XSetFillStyle(g_display, g_gc, FillOpaqueStippled);
@@ -4149,22 +5194,20 @@ ui_ellipse(uint8 opcode,
 				DRAW_ELLIPSE(x, y, cx, cy, fillmode);
 				XSetFillStyle(g_display, g_gc, FillSolid);
 				XSetTSOrigin(g_display, g_gc, 0, 0);
-				ui_destroy_glyph((RD_HGLYPH) fill);
 			}
 			else if (brush->bd->colour_code > 1)	/* > 1 bpp */
 			{
-				fill = (Pixmap) ui_create_bitmap(8, 8, brush->bd->data);
+				fill = xwin_brush_tile(brush->bd);
 				XSetFillStyle(g_display, g_gc, FillTiled);
 				XSetTile(g_display, g_gc, fill);
 				XSetTSOrigin(g_display, g_gc, brush->xorigin, brush->yorigin);
 				DRAW_ELLIPSE(x, y, cx, cy, fillmode);
 				XSetFillStyle(g_display, g_gc, FillSolid);
 				XSetTSOrigin(g_display, g_gc, 0, 0);
-				ui_destroy_bitmap((RD_HBITMAP) fill);
 			}
 			else
 			{
-				fill = (Pixmap) ui_create_glyph(8, 8, brush->bd->data);
+				fill = xwin_brush_stipple(brush->bd->data);
 				SET_FOREGROUND(bgcolour);
 				SET_BACKGROUND(fgcolour);
 				XSetFillStyle(g_display, g_gc, FillOpaqueStippled);
@@ -4173,7 +5216,6 @@ ui_ellipse(uint8 opcode,
 				DRAW_ELLIPSE(x, y, cx, cy, fillmode);
 				XSetFillStyle(g_display, g_gc, FillSolid);
 				XSetTSOrigin(g_display, g_gc, 0, 0);
-				ui_destroy_glyph((RD_HGLYPH) fill);
 			}
 			break;
 
@@ -4191,15 +5233,25 @@ ui_draw_glyph(int mixmode,
 	      /* src */ RD_HGLYPH glyph, int srcx, int srcy,
 	      uint32 bgcolour, uint32 fgcolour)
 {
+	xwin_glyph *g = (xwin_glyph *) glyph;
+
 	UNUSED(srcx);
 	UNUSED(srcy);
 
+	if (g_swfb)
+	{
+		swfb_draw_glyph(g->bits, g->scanline, MIN(cx, g->width), MIN(cy, g->height), x, y,
+				fgcolour, bgcolour, mixmode == MIX_TRANSPARENT);
+		xwin_swfb_drawn();
+		return;
+	}
+
 	SET_FOREGROUND(fgcolour);
 	SET_BACKGROUND(bgcolour);
 
 	XSetFillStyle(g_display, g_gc,
 		      (mixmode == MIX_TRANSPARENT) ? FillStippled : FillOpaqueStippled);
-	XSetStipple(g_display, g_gc, (Pixmap) glyph);
+	XSetStipple(g_display, g_gc, xwin_glyph_pixmap(g));
 	XSetTSOrigin(g_display, g_gc, x, y);
 
 	FILL_RECTANGLE_BACKSTORE(x, y, cx, cy);
@@ -4207,6 +5259,266 @@ ui_draw_glyph(int mixmode,
 	XSetFillStyle(g_display, g_gc, FillSolid);
 }
 
+/* Glyphs of the text order being drawn */
+struct xwin_text_glyph
+{
+	xwin_glyph *glyph;
+	int x, y;
+};
+
+static struct xwin_text_glyph *g_text_glyphs = NULL;
+static int g_text_glyphs_size = 0;
+static int g_text_nglyphs = 0;
+static uint8 *g_text_mask = NULL;
+static int g_text_mask_size = 0;
+
+/* Larger text is drawn glyph by glyph rather than composed in memory */
+#define TEXT_MASK_MAX	(256 * 1024)
+
+static void
+xwin_text_add(xwin_glyph * glyph, int x, int y)
+{
+	if (g_text_nglyphs == g_text_glyphs_size)
+	{
+		g_text_glyphs_size = g_text_glyphs_size ? g_text_glyphs_size * 2 : 256;
+		g_text_glyphs = xrealloc(g_text_glyphs,
+					 g_text_glyphs_size * sizeof(struct xwin_text_glyph));
+	}
+
+	g_text_glyphs[g_text_nglyphs].glyph = glyph;
+	g_text_glyphs[g_text_nglyphs].x = x;
+	g_text_glyphs[g_text_nglyphs].y = y;
+	g_text_nglyphs++;
+}
+
+/* Or a glyph into the text mask at bit position x, row y */
+static void
+xwin_text_blit(uint8 * mask, int stride, xwin_glyph * glyph, int x, int y)
+{
+	uint8 *src, *dst, b;
+	int shift, row, i;
+
+	shift = x & 7;
+	for (row = 0; row < glyph->height; row++)
+	{
+		src = glyph->bits + row * glyph->scanline;
+		dst = mask + (y + row) * stride + x / 8;
+		for (i = 0; i < glyph->scanline; i++)
+		{
+			b = src[i];
+			dst[i] |= b >> shift;
+			/* the padding is clear, so this stays within the row */
+			if (shift && (uint8) (b << (8 - shift)))
+				dst[i + 1] |= (uint8) (b << (8 - shift));
+		}
+	}
+}
+
+/* Draw the glyphs collected by xwin_text_add() into the framebuffer,
+   composed into one mask unless that gets large */
+static void
+xwin_text_draw_swfb(uint32 fgcolour)
+{
+	struct xwin_text_glyph *g;
+	int i, x1, y1, x2, y2, width, height, stride;
+
+	x1 = y1 = INT_MAX;
+	x2 = y2 = INT_MIN;
+	for (i = 0; i < g_text_nglyphs; i++)
+	{
+		g = &g_text_glyphs[i];
+		x1 = MIN(x1, g->x);
+		y1 = MIN(y1, g->y);
+		x2 = MAX(x2, g->x + g->glyph->width);
+		y2 = MAX(y2, g->y + g->glyph->height);
+	}
+
+	width = x2 - x1;
+	height = y2 - y1;
+	stride = (width + 7) / 8;
+	if (width <= 0 || height <= 0)
+		return;
+
+	if (stride * height > TEXT_MASK_MAX)
+	{
+		for (i = 0; i < g_text_nglyphs; i++)
+		{
+			g = &g_text_glyphs[i];
+			swfb_draw_glyph(g->glyph->bits, g->glyph->scanline, g->glyph->width,
+					g->glyph->height, g->x, g->y, fgcolour, fgcolour, True);
+		}
+		return;
+	}
+
+	if (stride * height > g_text_mask_size)
+	{
+		g_text_mask_size = stride * height;
+		g_text_mask = xrealloc(g_text_mask, g_text_mask_size);
+	}
+	memset(g_text_mask, 0, stride * height);
+
+	for (i = 0; i < g_text_nglyphs; i++)
+	{
+		g = &g_text_glyphs[i];
+		xwin_text_blit(g_text_mask, stride, g->glyph, g->x - x1, g->y - y1);
+	}
+
+	swfb_draw_glyph(g_text_mask, stride, width, height, x1, y1, fgcolour, fgcolour, True);
+}
+
+#ifdef HAVE_XRENDER
+/* Add a glyph to the glyph set the first time it is drawn. The A1
+   image is padded to 32 bits per row, in the bit and byte order of the
+   X server. */
+static unsigned int *
+xwin_glyph_id(xwin_glyph * glyph)
+{
+	XGlyphInfo info;
+	Glyph id;
+	uint8 *image;
+	int stride, unit, x, y, bit, byte;
+
+	if (glyph->id != 0)
+		return &glyph->id;
+
+	if (++g_text_glyph_id == 0)
+		g_text_glyph_id = 1;
+	glyph->id = id = g_text_glyph_id;
+
+	stride = (glyph->width + 31) / 32 * 4;
+	image = (uint8 *) xmalloc(MAX(stride * glyph->height, 1));
+	memset(image, 0, stride * glyph->height);
+
+	unit = BitmapUnit(g_display);
+	for (y = 0; y < glyph->height; y++)
+	{
+		for (x = 0; x < glyph->width; x++)
+		{
+			if (!(glyph->bits[y * glyph->scanline + x / 8] & (0x80 >> (x & 7))))
+				continue;
+
+			bit = x % unit;
+			if (BitmapBitOrder(g_display) == MSBFirst)
+				bit = unit - 1 - bit;
+			byte = (ImageByteOrder(g_display) == LSBFirst) ? bit / 8 : unit / 8 - 1 - bit / 8;
+			image[y * stride + (x / unit) * (unit / 8) + byte] |= 1 << (bit & 7);
+		}
+	}
+
+	info.width = glyph->width;
+	info.height = glyph->height;
+	info.x = info.y = 0;
+	info.xOff = info.yOff = 0;
+	XRenderAddGlyphs(g_display, g_text_glyphset, &id, &info, 1, (const char *) image,
+			 stride * glyph->height);
+
+	xfree(image);
+	return &glyph->id;
+}
+
+/* Draw the collected glyphs in pixel with a single request, the glyph
+   positions are relative to the previous one */
+static void
+xwin_text_composite(unsigned long pixel)
+{
+	struct xwin_text_glyph *g;
+	XGlyphElt32 *elt;
+	Drawable d;
+	int i, n, x, y;
+
+	d = g_ownbackstore ? g_backstore : g_wnd;
+	if (g_text_dst_drawable != d)
+	{
+		xwin_text_release_dst();
+		g_text_dst = XRenderCreatePicture(g_display, d,
+						  XRenderFindVisualFormat(g_display, g_visual), 0,
+						  NULL);
+		g_text_dst_drawable = d;
+		g_text_clip_valid = False;
+	}
+
+	if (!g_text_clip_valid)
+	{
+		XRenderSetPictureClipRectangles(g_display, g_text_dst, 0, 0, &g_clip_rectangle, 1);
+		g_text_clip_valid = True;
+	}
+
+	if (!g_text_src_valid || g_text_src_pixel != pixel)
+	{
+		XSetForeground(g_display, g_text_src_gc, pixel);
+		XFillRectangle(g_display, g_text_src_pixmap, g_text_src_gc, 0, 0, 1, 1);
+		g_text_src_pixel = pixel;
+		g_text_src_valid = True;
+	}
+
+	if (g_text_nglyphs > g_text_elts_size)
+	{
+		g_text_elts_size = g_text_glyphs_size;
+		g_text_elts = xrealloc(g_text_elts, g_text_elts_size * sizeof(XGlyphElt32));
+	}
+
+	x = y = n = 0;
+	for (i = 0; i < g_text_nglyphs; i++)
+	{
+		g = &g_text_glyphs[i];
+		if (g->glyph->width <= 0 || g->glyph->height <= 0)
+			continue;
+
+		elt = &g_text_elts[n++];
+		elt->glyphset = g_text_glyphset;
+		elt->chars = xwin_glyph_id(g->glyph);
+		elt->nchars = 1;
+		elt->xOff = g->x - x;
+		elt->yOff = g->y - y;
+		x = g->x;
+		y = g->y;
+	}
+
+	if (n > 0)
+		XRenderCompositeText32(g_display, PictOpOver, g_text_src, g_text_dst, NULL, 0, 0,
+				       0, 0, g_text_elts, n);
+}
+#endif
+
+/* Draw the glyphs collected by xwin_text_add() with the current
+   foreground. fgcolour is only used for the framebuffer and XRender,
+   which do not use the GC. */
+static void
+xwin_text_draw(uint32 fgcolour)
+{
+	struct xwin_text_glyph *g;
+	int i;
+
+	if (g_text_nglyphs == 0)
+		return;
+
+	if (g_swfb)
+	{
+		xwin_text_draw_swfb(fgcolour);
+		g_text_nglyphs = 0;
+		return;
+	}
+
+#ifdef HAVE_XRENDER
+	if (g_text_render)
+	{
+		xwin_text_composite(TRANSLATE(fgcolour) | g_text_src_alpha);
+		g_text_nglyphs = 0;
+		return;
+	}
+#endif
+
+	for (i = 0; i < g_text_nglyphs; i++)
+	{
+		g = &g_text_glyphs[i];
+		XSetStipple(g_display, g_gc, xwin_glyph_pixmap(g->glyph));
+		XSetTSOrigin(g_display, g_gc, g->x, g->y);
+		FILL_RECTANGLE_BACKSTORE(g->x, g->y, g->glyph->width, g->glyph->height);
+	}
+
+	g_text_nglyphs = 0;
+}
+
 #define DO_GLYPH(ttext,idx) \
 {\
   glyph = cache_get_font (font, ttext[idx]);\
@@ -4231,11 +5543,7 @@ ui_draw_glyph(int mixmode,
   }\
   if (glyph != NULL)\
   {\
-    x1 = x + glyph->offset;\
-    y1 = y + glyph->baseline;\
-    XSetStipple(g_display, g_gc, (Pixmap) glyph->pixmap);\
-    XSetTSOrigin(g_display, g_gc, x1, y1);\
-    FILL_RECTANGLE_BACKSTORE(x1, y1, glyph->width, glyph->height);\
+    xwin_text_add((xwin_glyph *) glyph->pixmap, x + glyph->offset, y + glyph->baseline);\
     if (flags & TEXT2_IMPLICIT_X)\
       x += glyph->width;\
   }\
@@ -4247,40 +5555,56 @@ ui_draw_text(uint8 font, uint8 flags, uint8 opcode, int mixmode, int x, int y,
 	     int boxx, int boxy, int boxcx, int boxcy, BRUSH * brush,
 	     uint32 bgcolour, uint32 fgcolour, uint8 * text, uint8 length)
 {
-	XWindowAttributes attr;
 	UNUSED(opcode);
 	UNUSED(brush);
 
-	XGetWindowAttributes(g_display, g_wnd, &attr);
-
 	/* TODO: use brush appropriately */
 
 	FONTGLYPH *glyph;
-	int i, j, xyoffset, x1, y1;
+	int i, j, xyoffset;
 	DATABLOB *entry;
+	RD_BOOL stippled = True;
 
-	SET_FOREGROUND(bgcolour);
+#ifdef HAVE_XRENDER
+	/* XRender does not use the GC */
+	stippled = !g_text_render;
+#endif
 
 	/* Sometimes, the boxcx value is something really large, like
 	   32691. This makes XCopyArea fail with Xvnc. The code below
 	   is a quick fix. */
-	if (boxx + boxcx > attr.width)
-		boxcx = attr.width - boxx;
+	if (boxx + boxcx > g_wnd_width)
+		boxcx = g_wnd_width - boxx;
 
-	if (boxcx > 1)
+	if (g_swfb)
 	{
-		FILL_RECTANGLE_BACKSTORE(boxx, boxy, boxcx, boxcy);
+		if (boxcx > 1)
+			swfb_fill(ROP2_COPY, boxx, boxy, boxcx, boxcy, bgcolour);
+		else if (mixmode == MIX_OPAQUE)
+			swfb_fill(ROP2_COPY, clipx, clipy, clipcx, clipcy, bgcolour);
 	}
-	else if (mixmode == MIX_OPAQUE)
+	else
 	{
-		FILL_RECTANGLE_BACKSTORE(clipx, clipy, clipcx, clipcy);
-	}
+		SET_FOREGROUND(bgcolour);
 
-	SET_FOREGROUND(fgcolour);
-	SET_BACKGROUND(bgcolour);
-	XSetFillStyle(g_display, g_gc, FillStippled);
+		if (boxcx > 1)
+		{
+			FILL_RECTANGLE_BACKSTORE(boxx, boxy, boxcx, boxcy);
+		}
+		else if (mixmode == MIX_OPAQUE)
+		{
+			FILL_RECTANGLE_BACKSTORE(clipx, clipy, clipcx, clipcy);
+		}
+
+		if (stippled)
+		{
+			SET_FOREGROUND(fgcolour);
+			SET_BACKGROUND(bgcolour);
+			XSetFillStyle(g_display, g_gc, FillStippled);
+		}
+	}
 
-	/* Paint text, character by character */
+	/* Collect the glyphs, character by character */
 	for (i = 0; i < length;)
 	{
 		switch (text[i])
@@ -4342,101 +5666,200 @@ ui_draw_text(uint8 font, uint8 flags, uint8 opcode, int mixmode, int x, int y,
 		}
 	}
 
-	XSetFillStyle(g_display, g_gc, FillSolid);
+	xwin_text_draw(fgcolour);
+
+	if (g_swfb)
+	{
+		xwin_swfb_drawn();
+		return;
+	}
+
+	if (stippled)
+		XSetFillStyle(g_display, g_gc, FillSolid);
 
 	if (g_ownbackstore)
 	{
 		if (boxcx > 1)
-		{
-			XCopyArea(g_display, g_backstore, g_wnd, g_gc, boxx,
-				  boxy, boxcx, boxcy, boxx, boxy);
-			ON_ALL_SEAMLESS_WINDOWS(XCopyArea,
-						(g_display, g_backstore, sw->wnd, g_gc,
-						 boxx, boxy,
-						 boxcx, boxcy,
-						 boxx - sw->xoffset, boxy - sw->yoffset));
-		}
+			xwin_damage(boxx, boxy, boxcx, boxcy);
 		else
-		{
-			XCopyArea(g_display, g_backstore, g_wnd, g_gc, clipx,
-				  clipy, clipcx, clipcy, clipx, clipy);
-			ON_ALL_SEAMLESS_WINDOWS(XCopyArea,
-						(g_display, g_backstore, sw->wnd, g_gc,
-						 clipx, clipy,
-						 clipcx, clipcy, clipx - sw->xoffset,
-						 clipy - sw->yoffset));
-		}
+			xwin_damage(clipx, clipy, clipcx, clipcy);
 	}
 }
 
-void
-ui_desktop_save(uint32 offset, int x, int y, int cx, int cy)
+/* Read a desktop save back into the desktop cache and free its pixmap */
+static void
+xwin_desktop_fetch(xwin_desktop_save * save)
 {
-	Pixmap pix;
 	XImage *image;
 
-	if (g_ownbackstore)
+	xwin_round_trip();
+	image = XGetImage(g_display, save->pixmap, 0, 0, save->cx, save->cy, AllPlanes, ZPixmap);
+	exit_if_null(image);
+	cache_put_desktop(save->offset, save->cx, save->cy, image->bytes_per_line, g_bpp / 8,
+			  (uint8 *) image->data);
+	XDestroyImage(image);
+
+	XFreePixmap(g_display, save->pixmap);
+	save->pixmap = 0;
+}
+
+/* Fetch the saves overlapping a range of the desktop cache, except for
+   an exact match which is returned */
+static xwin_desktop_save *
+xwin_desktop_find(uint32 offset, int cx, int cy)
+{
+	xwin_desktop_save *save, *match = NULL;
+	uint32 end = offset + cx * cy * (g_bpp / 8);
+	int i;
+
+	for (i = 0; i < DESKTOP_SAVES; i++)
 	{
-		image = XGetImage(g_display, g_backstore, x, y, cx, cy, AllPlanes, ZPixmap);
-		exit_if_null(image);
+		save = &g_desktop_saves[i];
+		if (save->pixmap == 0)
+			continue;
+		if (save->offset == offset && save->cx == cx && save->cy == cy)
+			match = save;
+		else if (save->offset < end
+			 && offset < save->offset + save->cx * save->cy * (g_bpp / 8))
+			xwin_desktop_fetch(save);
 	}
-	else
+
+	return match;
+}
+
+/* Desktop saves are copied to a pixmap instead of read back from the
+   X server, they are usually restored with the same offset and size */
+void
+ui_desktop_save(uint32 offset, int x, int y, int cx, int cy)
+{
+	xwin_desktop_save *save;
+
+	if (g_swfb)
 	{
-		pix = XCreatePixmap(g_display, g_wnd, cx, cy, g_depth);
-		XCopyArea(g_display, g_wnd, pix, g_gc, x, y, cx, cy, 0, 0);
-		image = XGetImage(g_display, pix, 0, 0, cx, cy, AllPlanes, ZPixmap);
-		exit_if_null(image);
-		XFreePixmap(g_display, pix);
+		swfb_desktop_save(offset, x, y, cx, cy);
+		return;
 	}
 
 	offset *= g_bpp / 8;
-	cache_put_desktop(offset, cx, cy, image->bytes_per_line, g_bpp / 8, (uint8 *) image->data);
+	if (cache_get_desktop(offset, cx, cy, g_bpp / 8) == NULL)
+	{
+		logger(GUI, Error, "ui_desktop_save(), offset=%d, size=%dx%d", offset, cx, cy);
+		return;
+	}
 
-	XDestroyImage(image);
+	save = xwin_desktop_find(offset, cx, cy);
+	if (save == NULL)
+	{
+		save = &g_desktop_saves[g_desktop_save_next];
+		g_desktop_save_next = (g_desktop_save_next + 1) % DESKTOP_SAVES;
+		if (save->pixmap != 0)
+			xwin_desktop_fetch(save);
+		save->pixmap = XCreatePixmap(g_display, g_wnd, cx, cy, g_depth);
+		save->offset = offset;
+		save->cx = cx;
+		save->cy = cy;
+	}
+
+	XCopyArea(g_display, g_ownbackstore ? g_backstore : g_wnd, save->pixmap,
+		  g_create_bitmap_gc, x, y, cx, cy, 0, 0);
 }
 
 void
 ui_desktop_restore(uint32 offset, int x, int y, int cx, int cy)
 {
-	XImage *image;
+	xwin_desktop_save *save;
 	uint8 *data;
 
+	if (g_swfb)
+	{
+		swfb_desktop_restore(offset, x, y, cx, cy);
+		xwin_swfb_drawn();
+		return;
+	}
+
 	offset *= g_bpp / 8;
+	save = xwin_desktop_find(offset, cx, cy);
+	if (save != NULL)
+	{
+		if (g_ownbackstore)
+		{
+			XCopyArea(g_display, save->pixmap, g_backstore, g_gc, 0, 0, cx, cy, x, y);
+			xwin_damage(x, y, cx, cy);
+		}
+		else
+		{
+			XCopyArea(g_display, save->pixmap, g_wnd, g_gc, 0, 0, cx, cy, x, y);
+			ON_ALL_SEAMLESS_WINDOWS(XCopyArea,
+						(g_display, g_wnd, sw->wnd, g_gc, x, y, cx, cy,
+						 x - sw->xoffset, y - sw->yoffset));
+		}
+		return;
+	}
+
 	data = cache_get_desktop(offset, cx, cy, g_bpp / 8);
 	if (data == NULL)
 		return;
 
-	image = XCreateImage(g_display, g_visual, g_depth, ZPixmap, 0,
-			     (char *) data, cx, cy, g_bpp, 0);
+	xwin_paint_image(x, y, cx, cy, cx, cy, data, g_bpp);
+}
 
-	if (g_ownbackstore)
-	{
-		XPutImage(g_display, g_backstore, g_gc, image, 0, 0, x, y, cx, cy);
-		XCopyArea(g_display, g_backstore, g_wnd, g_gc, x, y, cx, cy, x, y);
-		ON_ALL_SEAMLESS_WINDOWS(XCopyArea,
-					(g_display, g_backstore, sw->wnd, g_gc,
-					 x, y, cx, cy, x - sw->xoffset, y - sw->yoffset));
-	}
-	else
+/* Copy the damage collected during the update to the windows, using
+   the region as clip mask so that one copy per window does */
+static void
+xwin_flush_damage(void)
+{
+	XRectangle box;
+	seamless_window *sw;
+
+	if (XEmptyRegion(g_damage))
+		return;
+
+	XClipBox(g_damage, &box);
+	XSetRegion(g_display, g_damage_gc, g_damage);
+	XCopyArea(g_display, g_backstore, g_wnd, g_damage_gc, box.x, box.y, box.width,
+		  box.height, box.x, box.y);
+	for (sw = g_seamless_windows; sw; sw = sw->next)
 	{
-		XPutImage(g_display, g_wnd, g_gc, image, 0, 0, x, y, cx, cy);
-		ON_ALL_SEAMLESS_WINDOWS(XCopyArea,
-					(g_display, g_wnd, sw->wnd, g_gc, x, y, cx, cy,
-					 x - sw->xoffset, y - sw->yoffset));
+		XSetClipOrigin(g_display, g_damage_gc, -sw->xoffset, -sw->yoffset);
+		XCopyArea(g_display, g_backstore, sw->wnd, g_damage_gc, box.x, box.y, box.width,
+			  box.height, box.x - sw->xoffset, box.y - sw->yoffset);
 	}
+	XSetClipMask(g_display, g_damage_gc, None);
+	XSetClipOrigin(g_display, g_damage_gc, 0, 0);
 
-	XFree(image);
+	XDestroyRegion(g_damage);
+	g_damage = XCreateRegion();
 }
 
-/* these do nothing here but are used in uiports */
 void
 ui_begin_update(void)
 {
+	if (g_swfb)
+	{
+		g_damage_deferred = True;
+		return;
+	}
+
+	if (!g_ownbackstore || g_backstore == 0)
+		return;
+
+	if (g_damage == NULL)
+		g_damage = XCreateRegion();
+	g_damage_deferred = True;
 }
 
 void
 ui_end_update(void)
 {
+	if (g_damage_deferred)
+	{
+		g_damage_deferred = False;
+		if (g_swfb)
+			xwin_swfb_flush();
+		else
+			xwin_flush_damage();
+	}
+
 	XFlush(g_display);
 }
 
@@ -4867,7 +6290,6 @@ ui_seamless_restack_window(unsigned long id, unsigned long behind, unsigned long
 {
 	seamless_window *sw;
 	XWindowChanges values;
-	unsigned long restack_serial;
 	unsigned int value_mask;
 
 	if (!g_seamless_active)
@@ -4927,9 +6349,9 @@ ui_seamless_restack_window(unsigned long id, unsigned long behind, unsigned long
 		value_mask = CWStackMode;
 	}
 
-	restack_serial = XNextRequest(g_display);
+	/* Don't wait for the ConfigureNotify, it is handled in the event
+	   loop like any other and finds the windows stacked as requested */
 	XReconfigureWMWindow(g_display, sw->wnd, DefaultScreen(g_display), value_mask, &values);
-	sw_wait_configurenotify(sw->wnd, restack_serial);
 
 	sw_restack_window(sw, behind);
 
@@ -5053,9 +6475,13 @@ ui_seamless_ack(unsigned int serial)
 			/* Do a complete redraw of the window as part of the
 			   completion of the move. This is to remove any
 			   artifacts caused by our lack of synchronization. */
-			XCopyArea(g_display, g_backstore,
-				  sw->wnd, g_gc,
-				  sw->xoffset, sw->yoffset, sw->width, sw->height, 0, 0);
+			if (g_swfb)
+				xwin_swfb_put(sw->wnd, sw->xoffset, sw->yoffset, sw->xoffset,
+					      sw->yoffset, sw->width, sw->height);
+			else
+				XCopyArea(g_display, g_backstore,
+					  sw->wnd, g_gc,
+					  sw->xoffset, sw->yoffset, sw->width, sw->height, 0, 0);
 
 			break;
 		}